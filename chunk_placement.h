@@ -0,0 +1,261 @@
+// ============================================================================
+// DISTRIBUTED FILE SYSTEM - CHUNK PLACEMENT
+// ============================================================================
+// File: chunk_placement.h & chunk_placement.cpp
+// Description: Chooses the chunk servers that receive a new chunk's replicas
+// ============================================================================
+
+#ifndef DFS_CHUNK_PLACEMENT_H
+#define DFS_CHUNK_PLACEMENT_H
+
+#include "common.h"
+#include <string>
+#include <vector>
+#include <random>
+#include <unordered_map>
+
+// Each server weighs its free space, discounted by the work queued on it.
+// Replicas are drawn at random in proportion to weight, so new chunks spread
+// over the whole cluster instead of piling onto a few servers. A Fenwick tree
+// over the weights makes each draw and each heartbeat update O(log servers).
+// Not synchronized: MetadataServer guards it with servers_mutex_
+class ChunkPlacement {
+public:
+    ChunkPlacement();
+    
+    // Latest heartbeat from a server; the first one registers it
+    void update(const ChunkServerStatus& status);
+    void remove(const std::string& server_id);
+    
+    // Up to count distinct live servers for new replicas of chunk_bytes, in
+    // different zones where possible, else different racks. Servers in
+    // existing already hold the chunk: they are not chosen and count toward
+    // the spread. Those in avoid are only skipped. The bytes count against
+    // each chosen server until its next heartbeat reports them
+    std::vector<ChunkLocation> choose(uint32_t count, uint64_t chunk_id, uint64_t chunk_bytes,
+                                      time_t now, const std::vector<std::string>& existing = {},
+                                      const std::vector<std::string>& avoid = {});
+    
+    uint64_t weight(const std::string& server_id) const;  // 0 if unknown
+    size_t size() const { return index_.size(); }
+
+private:
+    static const size_t NO_SLOT = (size_t)-1;
+    
+    struct Server {
+        ChunkServerStatus status;
+        uint64_t placed_bytes;             // Chosen since the last heartbeat
+        uint64_t weight;
+    };
+    
+    std::vector<Server> servers_;           // Slots of removed servers are reused
+    std::vector<size_t> free_slots_;
+    std::unordered_map<std::string, size_t> index_;
+    std::vector<uint64_t> tree_;            // Fenwick tree over servers_[i].weight, 1-based
+    uint64_t total_weight_;
+    std::mt19937_64 random_;
+    
+    static uint64_t weigh(const Server& server);
+    static int domain_conflict(const Server& server, const std::vector<const Server*>& chosen);
+    void set_weight(size_t slot, uint64_t weight);
+    size_t sample();
+    void grow();
+};
+
+#endif // DFS_CHUNK_PLACEMENT_H
+
+
+// ============================================================================
+// File: chunk_placement.cpp
+// ============================================================================
+
+#include "chunk_placement.h"
+#include <algorithm>
+
+ChunkPlacement::ChunkPlacement() : tree_(1, 0), total_weight_(0), random_(std::random_device()()) {}
+
+void ChunkPlacement::update(const ChunkServerStatus& status) {
+    size_t slot;
+    auto it = index_.find(status.server_id);
+    if (it != index_.end()) {
+        slot = it->second;
+    } else {
+        if (free_slots_.empty()) {
+            servers_.push_back(Server{ChunkServerStatus(), 0, 0});
+            grow();
+            slot = servers_.size() - 1;
+        } else {
+            slot = free_slots_.back();
+            free_slots_.pop_back();
+        }
+        index_[status.server_id] = slot;
+    }
+    
+    // used_capacity_bytes now covers what was placed before this beat, or soon will
+    Server& server = servers_[slot];
+    server.status = status;
+    server.placed_bytes = 0;
+    set_weight(slot, weigh(server));
+}
+
+void ChunkPlacement::remove(const std::string& server_id) {
+    auto it = index_.find(server_id);
+    if (it == index_.end()) {
+        return;
+    }
+    size_t slot = it->second;
+    set_weight(slot, 0);
+    servers_[slot] = Server{ChunkServerStatus(), 0, 0};
+    free_slots_.push_back(slot);
+    index_.erase(it);
+}
+
+std::vector<ChunkLocation> ChunkPlacement::choose(uint32_t count, uint64_t chunk_id,
+                                                  uint64_t chunk_bytes, time_t now,
+                                                  const std::vector<std::string>& existing,
+                                                  const std::vector<std::string>& avoid) {
+    std::vector<const Server*> chosen;
+    std::vector<size_t> chosen_slots;
+    
+    // Excluded servers sit out this draw with their weight zeroed
+    std::vector<size_t> excluded;
+    auto exclude = [&](const std::string& server_id, bool holds_chunk) {
+        auto it = index_.find(server_id);
+        if (it == index_.end()) {
+            return;
+        }
+        if (holds_chunk) {
+            chosen.push_back(&servers_[it->second]);
+        }
+        if (servers_[it->second].weight > 0) {
+            set_weight(it->second, 0);
+            excluded.push_back(it->second);
+        }
+    };
+    for (const std::string& server_id : existing) {
+        exclude(server_id, true);
+    }
+    for (const std::string& server_id : avoid) {
+        exclude(server_id, false);
+    }
+    
+    while (chosen_slots.size() < count && total_weight_ > 0) {
+        // A few draws per replica looking for an unused failure domain; the
+        // best one seen wins if none is found
+        size_t best = NO_SLOT;
+        int best_conflict = 0;
+        for (int attempt = 0; attempt < DFS_PLACEMENT_ATTEMPTS && total_weight_ > 0; ) {
+            size_t slot = sample();
+            const Server& server = servers_[slot];
+            if (now - server.status.last_heartbeat >= DFS_HEARTBEAT_TIMEOUT_SEC) {
+                set_weight(slot, 0);  // Until it heartbeats again
+                continue;
+            }
+            ++attempt;
+            int conflict = domain_conflict(server, chosen);
+            if (best == NO_SLOT || conflict < best_conflict) {
+                best = slot;
+                best_conflict = conflict;
+            }
+            if (conflict == 0) {
+                break;
+            }
+        }
+        if (best == NO_SLOT) {
+            break;
+        }
+        
+        // Out of the draw for this chunk's remaining replicas
+        set_weight(best, 0);
+        chosen.push_back(&servers_[best]);
+        chosen_slots.push_back(best);
+    }
+    
+    for (size_t slot : excluded) {
+        set_weight(slot, weigh(servers_[slot]));
+    }
+    
+    std::vector<ChunkLocation> replicas;
+    for (size_t slot : chosen_slots) {
+        Server& server = servers_[slot];
+        server.placed_bytes += chunk_bytes;
+        set_weight(slot, weigh(server));
+        replicas.emplace_back(server.status.server_id, server.status.ip_address, server.status.port,
+                              chunk_id);
+    }
+    return replicas;
+}
+
+uint64_t ChunkPlacement::weight(const std::string& server_id) const {
+    auto it = index_.find(server_id);
+    return it != index_.end() ? servers_[it->second].weight : 0;
+}
+
+// Whole free megabytes, scaled down by queued requests and replications: a
+// server with DFS_PLACEMENT_LOAD_SCALE of them draws half its share
+uint64_t ChunkPlacement::weigh(const Server& server) {
+    const ChunkServerStatus& status = server.status;
+    uint64_t committed = status.used_capacity_bytes + server.placed_bytes;
+    if (!status.is_healthy || committed >= status.total_capacity_bytes ||
+        status.total_capacity_bytes - committed < DFS_CHUNK_SIZE_BYTES) {
+        return 0;
+    }
+    uint64_t free_mb = (status.total_capacity_bytes - committed) >> 20;
+    uint64_t load = (uint64_t)status.pending_requests + status.replication_queue_length;
+    return free_mb * DFS_PLACEMENT_LOAD_SCALE / (DFS_PLACEMENT_LOAD_SCALE + load);
+}
+
+// 0 when server shares no zone with a chosen one, 1 for a shared zone, 2 for a shared rack
+int ChunkPlacement::domain_conflict(const Server& server, const std::vector<const Server*>& chosen) {
+    int conflict = 0;
+    for (const Server* other : chosen) {
+        if (other->status.zone == server.status.zone) {
+            conflict = std::max(conflict, other->status.rack == server.status.rack ? 2 : 1);
+        }
+    }
+    return conflict;
+}
+
+void ChunkPlacement::set_weight(size_t slot, uint64_t weight) {
+    uint64_t old = servers_[slot].weight;
+    servers_[slot].weight = weight;
+    total_weight_ += weight - old;  // Unsigned wrap-around nets out
+    for (size_t i = slot + 1; i < tree_.size(); i += i & (~i + 1)) {
+        tree_[i] += weight - old;
+    }
+}
+
+// Slot whose weight interval holds a uniform draw from [0, total_weight_)
+size_t ChunkPlacement::sample() {
+    uint64_t target = std::uniform_int_distribution<uint64_t>(0, total_weight_ - 1)(random_);
+    size_t pos = 0;
+    size_t step = 1;
+    while (step * 2 < tree_.size()) {
+        step *= 2;
+    }
+    for (; step > 0; step /= 2) {
+        if (pos + step < tree_.size() && tree_[pos + step] <= target) {
+            pos += step;
+            target -= tree_[pos];
+        }
+    }
+    return pos;  // Tree index pos + 1 is slot pos
+}
+
+// Double the tree once servers_ outgrows it, rebuilt bottom-up in O(servers)
+void ChunkPlacement::grow() {
+    if (servers_.size() < tree_.size()) {
+        return;
+    }
+    size_t capacity = std::max((size_t)16, (tree_.size() - 1) * 2);
+    tree_.assign(capacity + 1, 0);
+    for (size_t i = 1; i <= capacity; ++i) {
+        if (i <= servers_.size()) {
+            tree_[i] += servers_[i - 1].weight;
+        }
+        size_t parent = i + (i & (~i + 1));
+        if (parent <= capacity) {
+            tree_[parent] += tree_[i];
+        }
+    }
+}
@@ -10,15 +10,24 @@
 #include "common.h"
 #include "network.h"
 #include "thread_pool.h"
+#include "chunk_store.h"
+#include "metrics.h"
 #include <string>
 #include <map>
+#include <unordered_set>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
 #include <memory>
+#include <thread>
 
 class ChunkServer {
 public:
+    // Chunk data goes to `store`; by default a FileChunkStore under storage_path
     explicit ChunkServer(const std::string& server_id, const std::string& ip, uint16_t port,
-                        const std::string& storage_path, uint64_t max_capacity);
+                        const std::string& storage_path, uint64_t max_capacity,
+                        std::unique_ptr<ChunkStore> store = nullptr);
     ~ChunkServer();
     
     // Server lifecycle
@@ -26,6 +35,16 @@ public:
     void stop();
     bool is_running() const { return running_; }
     
+    // Zone and rack reported to the metadata server, which keeps a chunk's
+    // replicas apart by them; set before start()
+    void set_failure_domain(const std::string& zone, const std::string& rack);
+    
+    // Where heartbeats go (127.0.0.1:9000 unless set); set before start()
+    void set_metadata_server(const std::string& ip, uint16_t port);
+    
+    // Workers for non-streamed requests (one per core unless set); set before start()
+    void set_worker_threads(size_t num_threads);
+    
     // Chunk operations (for testing)
     bool write_chunk(uint64_t chunk_id, const std::vector<uint8_t>& data);
     bool read_chunk(uint64_t chunk_id, std::vector<uint8_t>& data);
@@ -35,45 +54,177 @@ public:
     // Health reporting
     ChunkServerStatus get_status() const;
     
+    // Request, lock, checksum and queueing metrics in the text format OP_STATS returns
+    std::string export_metrics() const { return metrics_.export_text(); }
+    
+    // Persist the chunk manifest (chunk_id, version, size, checksum) for fast
+    // restart; commits since the last checkpoint are kept in a journal
+    bool checkpoint_manifest();
+    
+    struct StartupStats {
+        uint64_t manifest_load_ms;      // mmap + parse of the manifest and journal
+        uint64_t ready_ms;              // start() until serving and heartbeating
+        uint64_t full_verify_ms;        // start() until every chunk was re-checksummed
+        uint64_t chunks_indexed;
+        uint64_t chunks_from_manifest;  // Including those found in the commit journal
+        uint64_t chunks_discarded;      // Files with no committed record (torn or unfinished writes)
+        uint64_t chunks_corrupt;
+        bool verification_complete;
+    };
+    StartupStats get_startup_stats() const;
+
 private:
+    // Chunk metadata; the bytes live in store_. Guarded by its own lock:
+    // shared for reads, exclusive for writes
     struct StoredChunk {
         uint64_t chunk_id;
-        std::vector<uint8_t> data;
-        uint32_t version;
+        uint32_t version;                        // 0 until the first write commits
         uint64_t size;
         time_t creation_time;
-        time_t last_access;
-        uint32_t checksum;
+        std::atomic<time_t> last_access;
+        uint32_t checksum;                       // CRC32C over block_checksums
+        std::vector<uint32_t> block_checksums;   // One per DFS_CHECKSUM_BLOCK_BYTES
+        uint64_t dirty_begin;                    // Byte range written since last commit
+        uint64_t dirty_end;
+        bool deleted;
+        bool verified;                           // block_checksums match the stored bytes
+        bool has_expected_checksum;              // checksum came from the manifest
+        bool corrupt;
+        mutable std::shared_mutex lock;
+        std::condition_variable_any committed;   // Dirty range cleared or chunk dropped
+        
+        explicit StoredChunk(uint64_t id)
+            : chunk_id(id), version(0), size(0), creation_time(std::time(nullptr)),
+              last_access(creation_time), checksum(0), dirty_begin(0), dirty_end(0),
+              deleted(false), verified(true), has_expected_checksum(false), corrupt(false) {}
+    };
+    using ChunkRef = std::shared_ptr<StoredChunk>;
+    using SharedTimedLock = TimedLock<std::shared_lock<std::shared_mutex>>;
+    using ExclusiveTimedLock = TimedLock<std::unique_lock<std::shared_mutex>>;
+    
+    // Chunk table split into lock stripes keyed by chunk_id; a stripe lock only
+    // guards membership, so it is never held across data copies or CRC work.
+    // Stripe i holds exactly the chunks of block report slice i
+    static const size_t CHUNK_LOCK_STRIPES = DFS_BLOCK_REPORT_SLICES;
+    struct ChunkStripe {
+        mutable std::shared_mutex mutex;
+        std::map<uint64_t, ChunkRef> chunks;
     };
     
     std::string server_id_;
     std::string ip_;
     uint16_t port_;
+    std::string zone_;
+    std::string rack_;
     std::string storage_path_;
     uint64_t max_capacity_;
-    uint64_t used_capacity_;
-    bool running_;
+    std::atomic<uint64_t> used_capacity_;
+    std::atomic<bool> running_;
+    std::atomic<uint32_t> replications_;   // OP_REPLICATE copies being sent
+    
+    // Declared before the pool and reactor that record into them
+    MetricsRegistry metrics_;
+    RequestMetrics requests_;
+    LatencyHistogram& chunk_read_wait_;    // chunk.lock shared, on the request paths
+    LatencyHistogram& chunk_read_hold_;
+    LatencyHistogram& chunk_write_wait_;   // chunk.lock exclusive
+    LatencyHistogram& chunk_write_hold_;
+    LatencyHistogram& stripe_wait_;        // Stripe lock, looking up or adding a chunk
+    LatencyHistogram& stripe_hold_;
+    LatencyHistogram& checksum_time_;      // Verifying read spans, rehashing committed blocks
+    LatencyHistogram& store_read_time_;
+    LatencyHistogram& downstream_time_;    // Chained writes: waiting for the next replica
+    
+    ChunkStripe stripes_[CHUNK_LOCK_STRIPES];
+    std::unique_ptr<ChunkStore> store_;
     
-    std::map<uint64_t, StoredChunk> chunks_;
-    std::mutex chunks_mutex_;
+    // Startup indexing and background verification
+    std::thread verifier_thread_;
+    mutable std::mutex startup_mutex_;
+    StartupStats startup_stats_;
+    
+    // Commit journal (persistent stores only), opened on the first commit
+    int journal_fd_;
+    std::mutex journal_mutex_;
     
     std::unique_ptr<NetworkSocket> server_socket_;
     std::unique_ptr<ThreadPool> thread_pool_;
+    std::unique_ptr<ElasticThreads> stream_threads_;  // Streamed writes, which wait on downstream replicas
+    std::unique_ptr<ConnectionReactor> reactor_;  // Multiplexes client sockets onto the two above
+    std::unique_ptr<ConnectionPool> peer_pool_;   // Downstream replicas and replication targets
+    std::thread heartbeat_thread_;
     
     // Metadata server connection
     std::string metadata_server_ip_;
     uint16_t metadata_server_port_;
     std::unique_ptr<NetworkSocket> metadata_client_;
     
+    // Heartbeat state: chunk changes not yet reported, and block report progress.
+    // report_mutex_ is taken after any stripe or chunk lock, never before one
+    std::mutex report_mutex_;
+    std::unordered_set<uint64_t> added_chunks_;    // Disjoint from removed_chunks_
+    std::unordered_set<uint64_t> removed_chunks_;
+    uint64_t heartbeat_sequence_;
+    uint32_t next_report_slice_;
+    uint32_t urgent_slices_left_;    // Owed to a full report the metadata server waits for
+    bool report_start_pending_;
+    double report_credit_;           // Steady-state slices due, one full report per interval
+    
     // Internal methods
-    void accept_connections();
-    void handle_client_connection(int client_fd, const std::string& client_ip);
+    void heartbeat_loop();
     void send_heartbeat();
+    void record_chunk_change(uint64_t chunk_id, bool added);
+    void start_block_report_locked();  // Caller holds report_mutex_
+    void append_report_slice(uint32_t slice, std::vector<uint64_t>& chunk_ids, 
+                             std::vector<uint32_t>& versions) const;
+    uint32_t committed_version(uint64_t chunk_id) const;  // 0 if not held
+    void drop_stale_replica(uint64_t chunk_id, uint32_t newest_version);
+    bool delete_chunk_if_older(uint64_t chunk_id, uint32_t newest_version);
+    void remove_chunk_locked(StoredChunk& chunk);  // Caller holds its stripe and chunk.lock exclusively
     bool process_message(const ProtocolFrame& frame, ProtocolFrame& response);
     bool handle_read(const FileReadRequest& req, FileReadResponse& resp);
     bool handle_write(const FileWriteRequest& req, FileWriteResponse& resp);
-    bool handle_replicate(const ProtocolFrame& frame);
+    bool handle_write_stream(NetworkSocket& socket, const FrameHeader& header, ProtocolFrame& response);
+    std::shared_ptr<NetworkSocket> open_to_peer(const std::string& ip, uint16_t port, 
+                                                struct iovec* iov, int iovcnt);
+    std::shared_ptr<NetworkSocket> forward_write(const FrameHeader& header, const WriteRequestHeader& wire,
+                                                 const std::vector<uint8_t>& chain_bytes, 
+                                                 ChunkLocation& next);
+    bool finish_peer_write(std::shared_ptr<NetworkSocket> peer, const ChunkLocation& location,
+                           WriteResponseHeader& result);
+    
+    // Chunk table access (stripe locks are taken internally)
+    ChunkStripe& stripe_for(uint64_t chunk_id);
+    const ChunkStripe& stripe_for(uint64_t chunk_id) const;
+    ChunkRef find_chunk(uint64_t chunk_id) const;
+    ChunkRef find_or_create_chunk(uint64_t chunk_id);
+    bool discard_if_uncommitted(uint64_t chunk_id);
+    bool try_reserve_capacity(uint64_t bytes);
+    
+    // Write path building blocks; callers must hold chunk.lock exclusively
+    bool reserve_write_locked(StoredChunk& chunk, uint32_t offset, size_t length, std::string& error);
+    bool write_range_locked(StoredChunk& chunk, uint32_t offset, const uint8_t* data, size_t length);
+    bool commit_write_locked(StoredChunk& chunk, uint32_t install_version = 0);
+    void abandon_chunk_locked(StoredChunk& chunk);
+    static void mark_dirty(StoredChunk& chunk, uint64_t begin, uint64_t end);
+    bool update_block_checksums(StoredChunk& chunk);
+    static bool verify_blocks(const StoredChunk& chunk, uint64_t span_begin, 
+                              const uint8_t* span, size_t span_length);
+    bool replicate_chunk(uint64_t chunk_id, const std::string& target_ip, uint16_t target_port,
+                         WriteResponseHeader& result);
+    bool handle_replicate(const ProtocolFrame& frame, WriteResponseHeader& result);
     uint64_t get_available_capacity() const;
+    
+    // Startup: index chunks from the manifest, verify lazily/in background
+    std::string manifest_path() const;
+    std::string journal_path() const;
+    size_t load_manifest(std::map<uint64_t, StoredChunk*>& loaded);
+    size_t replay_journal(const std::string& path, std::map<uint64_t, StoredChunk*>& loaded);
+    bool journal_commit(const StoredChunk& chunk);
+    void index_stored_chunks();
+    void verify_all_chunks(std::chrono::steady_clock::time_point started);
+    bool ensure_verified(StoredChunk& chunk);
+    void verify_chunk_locked(StoredChunk& chunk);
 };
 
 #endif // DFS_CHUNK_SERVER_H
@@ -89,138 +240,295 @@ private:
 #include <chrono>
 #include <cstring>
 #include <cmath>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// On-disk chunk manifest: header followed by fixed-size entries, laid out so
+// startup can mmap it and index entries in place
+static const uint32_t MANIFEST_MAGIC = 0x4D534644;  // "DFSM"
+static const uint32_t MANIFEST_VERSION = 1;
+
+struct ManifestHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t entry_count;
+    uint32_t entries_crc;
+    uint32_t reserved;
+};
+
+struct ManifestEntry {
+    uint64_t chunk_id;
+    uint64_t size;
+    uint32_t version;
+    uint32_t checksum;  // CRC32C over the chunk's block checksums
+};
+
+// Commit journal: one record appended (and synced) per commit since the last
+// checkpoint. A torn record at the tail ends replay
+struct JournalRecord {
+    ManifestEntry entry;
+    uint32_t crc;       // CRC32C over entry
+    uint32_t reserved;
+};
 
 ChunkServer::ChunkServer(const std::string& server_id, const std::string& ip, uint16_t port,
-                        const std::string& storage_path, uint64_t max_capacity)
+                        const std::string& storage_path, uint64_t max_capacity,
+                        std::unique_ptr<ChunkStore> store)
     : server_id_(server_id), ip_(ip), port_(port), storage_path_(storage_path),
-      max_capacity_(max_capacity), used_capacity_(0), running_(false),
-      metadata_server_ip_("127.0.0.1"), metadata_server_port_(9000) {
+      max_capacity_(max_capacity), used_capacity_(0), running_(false), replications_(0),
+      requests_(metrics_, "dfs_chunk", {OP_READ, OP_WRITE, OP_DELETE, OP_REPLICATE, OP_STATS}),
+      chunk_read_wait_(metrics_.histogram("dfs_chunk_lock_wait_seconds", "lock=\"chunk\",mode=\"shared\"")),
+      chunk_read_hold_(metrics_.histogram("dfs_chunk_lock_hold_seconds", "lock=\"chunk\",mode=\"shared\"")),
+      chunk_write_wait_(metrics_.histogram("dfs_chunk_lock_wait_seconds", "lock=\"chunk\",mode=\"exclusive\"")),
+      chunk_write_hold_(metrics_.histogram("dfs_chunk_lock_hold_seconds", "lock=\"chunk\",mode=\"exclusive\"")),
+      stripe_wait_(metrics_.histogram("dfs_chunk_lock_wait_seconds", "lock=\"stripe\"")),
+      stripe_hold_(metrics_.histogram("dfs_chunk_lock_hold_seconds", "lock=\"stripe\"")),
+      checksum_time_(metrics_.histogram("dfs_chunk_checksum_seconds")),
+      store_read_time_(metrics_.histogram("dfs_chunk_store_read_seconds")),
+      downstream_time_(metrics_.histogram("dfs_chunk_downstream_seconds")),
+      store_(std::move(store)), startup_stats_(), journal_fd_(-1),
+      metadata_server_ip_("127.0.0.1"), metadata_server_port_(9000), heartbeat_sequence_(0),
+      next_report_slice_(std::hash<std::string>()(server_id) % DFS_BLOCK_REPORT_SLICES),
+      urgent_slices_left_(0), report_start_pending_(false), report_credit_(0) {
+    
+    // Nothing is known about our chunks until the first full report
+    start_block_report_locked();
+    
+    if (!store_) {
+        store_ = std::make_unique<FileChunkStore>(storage_path_);
+    }
     
     server_socket_ = std::make_unique<NetworkSocket>();
     thread_pool_ = std::make_unique<ThreadPool>(std::thread::hardware_concurrency());
+    stream_threads_ = std::make_unique<ElasticThreads>(DFS_MAX_STREAM_THREADS);
+    reactor_ = std::make_unique<ConnectionReactor>(std::max(1u, std::thread::hardware_concurrency() / 4));
+    peer_pool_ = std::make_unique<ConnectionPool>();
+    
+    thread_pool_->set_queue_wait_histogram(&metrics_.histogram("dfs_chunk_queue_wait_seconds"));
+    metrics_.gauge("dfs_chunk_pending_tasks", "", [this] { return (double)thread_pool_->get_pending_tasks(); });
+    metrics_.gauge("dfs_chunk_stream_threads_busy", "", [this] { return (double)stream_threads_->get_busy_threads(); });
+    metrics_.gauge("dfs_chunk_connections", "", [this] { return (double)reactor_->get_connection_count(); });
+    metrics_.gauge("dfs_chunk_used_bytes", "", [this] { return (double)used_capacity_.load(); });
+    metrics_.gauge("dfs_chunk_replications_in_flight", "", [this] { return (double)replications_.load(); });
 }
 
 ChunkServer::~ChunkServer() {
     stop();
+    if (journal_fd_ >= 0) {
+        close(journal_fd_);
+    }
+}
+
+void ChunkServer::set_failure_domain(const std::string& zone, const std::string& rack) {
+    zone_ = zone;
+    rack_ = rack;
+}
+
+void ChunkServer::set_metadata_server(const std::string& ip, uint16_t port) {
+    metadata_server_ip_ = ip;
+    metadata_server_port_ = port;
+}
+
+void ChunkServer::set_worker_threads(size_t num_threads) {
+    thread_pool_ = std::make_unique<ThreadPool>(num_threads);
+    thread_pool_->set_queue_wait_histogram(&metrics_.histogram("dfs_chunk_queue_wait_seconds"));
 }
 
 bool ChunkServer::start() {
+    auto started = std::chrono::steady_clock::now();
+    
+    if (!store_->open()) {
+        std::cerr << "Failed to open " << store_->name() << " chunk store at " 
+                  << storage_path_ << std::endl;
+        return false;
+    }
+    
+    // Index existing chunks from the manifest; data is re-checksummed later
+    index_stored_chunks();
+    
     // Create server socket
     if (!server_socket_->create_server_socket(ip_, port_)) {
         std::cerr << "Failed to create server socket on " << ip_ << ":" << port_ << std::endl;
         return false;
     }
     
-    if (!server_socket_->listen_for_connections(10)) {
+    if (!server_socket_->listen_for_connections(SOMAXCONN)) {
         std::cerr << "Failed to listen on socket" << std::endl;
         return false;
     }
     
+    // Complete frames run on the worker pool. OP_WRITE payloads are streamed
+    // from the socket into the store instead of being buffered, on threads of
+    // their own: a chained write holds its thread until the downstream replica
+    // answers, and two servers forwarding to each other must not wait for a
+    // free worker on the other side
+    reactor_->set_request_handler(
+        [this](uint64_t, const ProtocolFrame& request, ProtocolFrame& response) {
+            uint64_t start_ns = metrics_now_ns();
+            process_message(request, response);
+            requests_.record(request.message_type, metrics_now_ns() - start_ns,
+                             DFS_FRAME_HEADER_SIZE + request.payload_size,
+                             DFS_FRAME_HEADER_SIZE + response.payload_size);
+        });
+    reactor_->set_stream_handler(OP_WRITE, 
+        [this](NetworkSocket& socket, const FrameHeader& header, ProtocolFrame& response) {
+            uint64_t start_ns = metrics_now_ns();
+            bool ok = handle_write_stream(socket, header, response);
+            requests_.record(OP_WRITE, metrics_now_ns() - start_ns,
+                             DFS_FRAME_HEADER_SIZE + header.payload_size,
+                             ok ? DFS_FRAME_HEADER_SIZE + response.payload_size : 0);
+            return ok;
+        });
+    
+    reactor_->set_stream_executor([this](std::function<void()> task) {
+        stream_threads_->enqueue(std::move(task));
+    });
+    
     running_ = true;
-    std::cout << "Chunk Server " << server_id_ << " started on " << ip_ << ":" << port_ << std::endl;
+    if (!reactor_->start(*server_socket_, [this](std::function<void()> task) {
+            thread_pool_->enqueue(std::move(task));
+        })) {
+        std::cerr << "Failed to start connection reactor" << std::endl;
+        running_ = false;
+        return false;
+    }
+    std::cout << "Chunk Server " << server_id_ << " started on " << ip_ << ":" << port_ 
+              << " (" << reactor_->get_num_io_threads() << " I/O threads)" << std::endl;
     
-    // Start accepting connections in thread pool
-    thread_pool_->enqueue([this] { accept_connections(); });
+    // The first heartbeat goes out before verification ends
+    heartbeat_thread_ = std::thread([this] { heartbeat_loop(); });
     
-    // Start heartbeat thread
-    thread_pool_->enqueue([this] {
-        while (running_) {
-            send_heartbeat();
-            std::this_thread::sleep_for(std::chrono::seconds(DFS_HEARTBEAT_INTERVAL_SEC));
-        }
-    });
+    {
+        std::unique_lock<std::mutex> lock(startup_mutex_);
+        startup_stats_.ready_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started).count();
+        std::cout << "Chunk Server " << server_id_ << " ready in " << startup_stats_.ready_ms 
+                  << " ms (" << startup_stats_.chunks_indexed << " chunks, " 
+                  << startup_stats_.chunks_from_manifest << " from manifest, " 
+                  << startup_stats_.chunks_discarded << " discarded)" << std::endl;
+    }
+    
+    verifier_thread_ = std::thread([this, started] { verify_all_chunks(started); });
     
     return true;
 }
 
 void ChunkServer::stop() {
-    running_ = false;
+    bool was_running = running_.exchange(false);
+    if (reactor_) {
+        reactor_->stop();
+    }
     if (server_socket_) {
         server_socket_->close_socket();
     }
     if (thread_pool_) {
         thread_pool_->shutdown();
     }
-}
-
-void ChunkServer::accept_connections() {
-    while (running_) {
-        std::string client_ip;
-        int client_fd = server_socket_->accept_connection(client_ip);
-        
-        if (client_fd < 0) {
-            continue;
-        }
-        
-        // Handle client in thread pool
-        thread_pool_->enqueue([this, client_fd, client_ip] {
-            handle_client_connection(client_fd, client_ip);
-        });
+    if (stream_threads_) {
+        stream_threads_->shutdown();
+    }
+    if (heartbeat_thread_.joinable()) {
+        heartbeat_thread_.join();
+    }
+    if (verifier_thread_.joinable()) {
+        verifier_thread_.join();
+    }
+    if (was_running) {
+        checkpoint_manifest();
     }
 }
 
-void ChunkServer::handle_client_connection(int client_fd, const std::string& client_ip) {
-    NetworkSocket client_socket;
-    // Simulate socket assignment (in real implementation, wrap fd)
-    
-    std::cout << "New client connection from " << client_ip << std::endl;
-    
+void ChunkServer::heartbeat_loop() {
+    auto last_checkpoint = std::chrono::steady_clock::now();
     while (running_) {
-        ProtocolFrame request;
-        // In real implementation:
-        // if (!client_socket.recv_frame(request)) break;
-        
-        ProtocolFrame response;
-        response.magic = DFS_PROTOCOL_MAGIC;
-        response.version = DFS_PROTOCOL_VERSION;
-        
-        // process_message(request, response);
-        // client_socket.send_frame(response);
+        send_heartbeat();
         
-        break;  // Simplified for this example
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_checkpoint >= std::chrono::seconds(DFS_MANIFEST_CHECKPOINT_SEC)) {
+            checkpoint_manifest();
+            last_checkpoint = now;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(DFS_HEARTBEAT_INTERVAL_SEC));
     }
-    
-    close(client_fd);
 }
 
 bool ChunkServer::process_message(const ProtocolFrame& frame, ProtocolFrame& response) {
     response.magic = DFS_PROTOCOL_MAGIC;
     response.version = DFS_PROTOCOL_VERSION;
     response.message_type = OP_ACK;
+    response.resize_payload(0);
     
     switch (frame.message_type) {
         case OP_READ: {
+            ReadRequestHeader wire;
+            if (frame.payload_size < sizeof(ReadRequestHeader)) break;
+            std::memcpy(&wire, frame.payload.data(), sizeof(ReadRequestHeader));
+            
             FileReadRequest req;
-            std::memcpy(&req, frame.payload, sizeof(FileReadRequest));
+            req.chunk_id = wire.chunk_id;
+            req.offset = wire.offset;
+            req.length = wire.length;
+            req.version = wire.version;
             FileReadResponse resp;
+            
+            ReadResponseHeader out = {wire.chunk_id, wire.offset, 0, 1, 0};
             if (handle_read(req, resp)) {
-                std::memcpy(response.payload, &resp, sizeof(FileReadResponse));
-                response.payload_size = sizeof(FileReadResponse);
+                out.length = resp.data.size();
+                out.status = 0;
+            }
+            response.resize_payload(sizeof(ReadResponseHeader) + out.length);
+            std::memcpy(response.payload.data(), &out, sizeof(ReadResponseHeader));
+            if (out.length > 0) {
+                std::memcpy(response.payload.data() + sizeof(ReadResponseHeader), 
+                           resp.data.data(), out.length);
             }
             break;
         }
         
         case OP_WRITE: {
+            // Buffered frames are stored here only; chained writes are forwarded
+            // by handle_write_stream
+            WriteRequestHeader wire;
+            if (frame.payload_size < sizeof(WriteRequestHeader)) break;
+            std::memcpy(&wire, frame.payload.data(), sizeof(WriteRequestHeader));
+            size_t data_offset = sizeof(WriteRequestHeader) + (size_t)wire.chain_bytes;
+            if (frame.payload_size < data_offset || frame.payload_size - data_offset != wire.length) break;
+            
             FileWriteRequest req;
-            std::memcpy(&req, frame.payload, sizeof(FileWriteRequest));
+            req.chunk_id = wire.chunk_id;
+            req.offset = wire.offset;
+            req.version = wire.version;
+            req.data.assign(frame.payload.begin() + data_offset, frame.payload.end());
             FileWriteResponse resp;
-            if (handle_write(req, resp)) {
-                std::memcpy(response.payload, &resp, sizeof(FileWriteResponse));
-                response.payload_size = sizeof(FileWriteResponse);
-            }
+            bool stored = handle_write(req, resp);
+            WriteResponseHeader out = {wire.chunk_id, stored ? 0u : 1u, stored ? 1u : 0u, 
+                                       stored ? resp.version : 0u, 0};
+            response.set_payload(&out, sizeof(out));
             break;
         }
         
         case OP_DELETE: {
             uint64_t chunk_id;
-            std::memcpy(&chunk_id, frame.payload, sizeof(uint64_t));
+            if (frame.payload_size < sizeof(uint64_t)) break;
+            std::memcpy(&chunk_id, frame.payload.data(), sizeof(uint64_t));
             delete_chunk(chunk_id);
             response.message_type = OP_ACK;
             break;
         }
         
         case OP_REPLICATE: {
-            handle_replicate(frame);
+            WriteResponseHeader out = {0, 1, 0, 0, 0};
+            handle_replicate(frame, out);
+            response.set_payload(&out, sizeof(out));
+            break;
+        }
+        
+        case OP_STATS: {
+            std::string text = metrics_.export_text();
+            response.set_payload(text.data(), text.size());
             break;
         }
         
@@ -228,22 +536,57 @@ bool ChunkServer::process_message(const ProtocolFrame& frame, ProtocolFrame& res
             response.message_type = OP_ACK;
     }
     
-    response.checksum = NetworkSocket::calculate_crc32(response.payload, response.payload_size);
+    response.checksum = NetworkSocket::calculate_crc32(response.payload.data(), response.payload_size);
     return true;
 }
 
 bool ChunkServer::handle_read(const FileReadRequest& req, FileReadResponse& resp) {
-    std::unique_lock<std::mutex> lock(chunks_mutex_);
+    ChunkRef ref = find_chunk(req.chunk_id);
+    if (!ref) {
+        resp.success = false;
+        resp.error_message = "Chunk not found";
+        return false;
+    }
+    
+    StoredChunk& chunk = *ref;
+    if (!ensure_verified(chunk)) {
+        resp.success = false;
+        resp.error_message = "Checksum mismatch";
+        return false;
+    }
+    
+    SharedTimedLock lock(chunk.lock, chunk_read_wait_, chunk_read_hold_);
     
-    auto it = chunks_.find(req.chunk_id);
-    if (it == chunks_.end()) {
+    // Blocks under a streaming write have no valid CRC until it commits. A
+    // sender stalled past the network timeout sends the client to another replica
+    uint64_t wait_begin = req.offset - (req.offset % DFS_CHECKSUM_BLOCK_BYTES);
+    uint64_t wait_end = ((uint64_t)req.offset + req.length + DFS_CHECKSUM_BLOCK_BYTES - 1) / 
+        DFS_CHECKSUM_BLOCK_BYTES * DFS_CHECKSUM_BLOCK_BYTES;
+    bool settled = lock.wait_for(chunk.committed, std::chrono::milliseconds(DFS_NETWORK_TIMEOUT_MS), 
+        [&] { return chunk.deleted || wait_end <= chunk.dirty_begin || wait_begin >= chunk.dirty_end; });
+    if (!settled) {
+        resp.success = false;
+        resp.error_message = "Chunk busy";
+        return false;
+    }
+    
+    if (chunk.version == 0 || chunk.deleted) {
         resp.success = false;
         resp.error_message = "Chunk not found";
         return false;
     }
+    if (chunk.corrupt) {
+        resp.success = false;
+        resp.error_message = "Checksum mismatch";
+        return false;
+    }
     
-    StoredChunk& chunk = it->second;
-    uint32_t read_size = std::min(req.length, (uint32_t)chunk.size - req.offset);
+    // This copy missed a write the client has seen; another replica has it
+    if (req.version > chunk.version) {
+        resp.success = false;
+        resp.error_message = "Stale replica";
+        return false;
+    }
     
     if (req.offset >= chunk.size) {
         resp.success = false;
@@ -251,84 +594,507 @@ bool ChunkServer::handle_read(const FileReadRequest& req, FileReadResponse& resp
         return false;
     }
     
-    resp.data.insert(resp.data.end(), 
-                    chunk.data.begin() + req.offset,
-                    chunk.data.begin() + req.offset + read_size);
+    uint32_t read_size = std::min(req.length, (uint32_t)(chunk.size - req.offset));
+    
+    // Read whole checksum blocks so only the blocks being returned are verified
+    uint64_t span_begin = req.offset - (req.offset % DFS_CHECKSUM_BLOCK_BYTES);
+    uint64_t span_end = std::min(chunk.size, 
+        ((uint64_t)req.offset + read_size + DFS_CHECKSUM_BLOCK_BYTES - 1) / 
+        DFS_CHECKSUM_BLOCK_BYTES * DFS_CHECKSUM_BLOCK_BYTES);
+    
+    std::vector<uint8_t> span(span_end - span_begin);
+    uint64_t read_start_ns = metrics_now_ns();
+    if (!store_->read(chunk.chunk_id, span_begin, span.data(), span.size())) {
+        resp.success = false;
+        resp.error_message = "Chunk read failed";
+        return false;
+    }
+    
+    uint64_t verify_start_ns = metrics_now_ns();
+    store_read_time_.record(verify_start_ns - read_start_ns);
+    bool verified = verify_blocks(chunk, span_begin, span.data(), span.size());
+    checksum_time_.record_since(verify_start_ns);
+    if (!verified) {
+        resp.success = false;
+        resp.error_message = "Checksum mismatch";
+        return false;
+    }
+    
+    if (span_begin == req.offset && span.size() == read_size) {
+        resp.data = std::move(span);
+    } else {
+        resp.data.insert(resp.data.end(), 
+                        span.begin() + (req.offset - span_begin),
+                        span.begin() + (req.offset - span_begin) + read_size);
+    }
     resp.success = true;
     chunk.last_access = std::time(nullptr);
     
     return true;
 }
 
-bool ChunkServer::handle_write(const FileWriteRequest& req, FileWriteResponse& resp) {
-    std::unique_lock<std::mutex> lock(chunks_mutex_);
+ChunkServer::ChunkStripe& ChunkServer::stripe_for(uint64_t chunk_id) {
+    return stripes_[block_report_slice(chunk_id)];
+}
+
+const ChunkServer::ChunkStripe& ChunkServer::stripe_for(uint64_t chunk_id) const {
+    return stripes_[block_report_slice(chunk_id)];
+}
+
+ChunkServer::ChunkRef ChunkServer::find_chunk(uint64_t chunk_id) const {
+    const ChunkStripe& stripe = stripe_for(chunk_id);
+    SharedTimedLock lock(stripe.mutex, stripe_wait_, stripe_hold_);
     
-    // Check if we have space
-    if (used_capacity_ + req.data.size() > max_capacity_) {
-        resp.success = false;
-        resp.error_message = "Insufficient storage capacity";
+    auto it = stripe.chunks.find(chunk_id);
+    return (it != stripe.chunks.end()) ? it->second : nullptr;
+}
+
+ChunkServer::ChunkRef ChunkServer::find_or_create_chunk(uint64_t chunk_id) {
+    ChunkRef existing = find_chunk(chunk_id);
+    if (existing) {
+        return existing;
+    }
+    
+    ChunkStripe& stripe = stripe_for(chunk_id);
+    ExclusiveTimedLock lock(stripe.mutex, stripe_wait_, stripe_hold_);
+    
+    // Another writer may have created it between the two lookups
+    auto& slot = stripe.chunks[chunk_id];
+    if (!slot) {
+        slot = std::make_shared<StoredChunk>(chunk_id);
+    }
+    return slot;
+}
+
+// Drop a chunk created for a write that was then rejected or never completed.
+// False if another write committed it first
+bool ChunkServer::discard_if_uncommitted(uint64_t chunk_id) {
+    ChunkStripe& stripe = stripe_for(chunk_id);
+    std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+    
+    auto it = stripe.chunks.find(chunk_id);
+    if (it == stripe.chunks.end()) {
+        return true;
+    }
+    
+    std::unique_lock<std::shared_mutex> chunk_lock(it->second->lock);
+    if (it->second->version != 0) {
+        return false;
+    }
+    it->second->deleted = true;
+    it->second->committed.notify_all();
+    used_capacity_ -= it->second->size;
+    store_->remove(chunk_id);
+    chunk_lock.unlock();
+    stripe.chunks.erase(it);
+    return true;
+}
+
+bool ChunkServer::try_reserve_capacity(uint64_t bytes) {
+    uint64_t used = used_capacity_.load();
+    do {
+        if (used + bytes > max_capacity_) {
+            return false;
+        }
+    } while (!used_capacity_.compare_exchange_weak(used, used + bytes));
+    return true;
+}
+
+bool ChunkServer::reserve_write_locked(StoredChunk& chunk, uint32_t offset, size_t length, 
+                                       std::string& error) {
+    if (chunk.deleted) {
+        error = "Chunk not found";
         return false;
     }
     
-    auto it = chunks_.find(req.chunk_id);
-    if (it == chunks_.end()) {
-        // Create new chunk
-        StoredChunk new_chunk;
-        new_chunk.chunk_id = req.chunk_id;
-        new_chunk.version = 1;
-        new_chunk.creation_time = std::time(nullptr);
-        new_chunk.last_access = new_chunk.creation_time;
-        new_chunk.data = req.data;
-        new_chunk.size = req.data.size();
-        new_chunk.checksum = NetworkSocket::calculate_crc32(req.data.data(), req.data.size());
-        
-        chunks_[req.chunk_id] = new_chunk;
-        used_capacity_ += new_chunk.size;
+    // Partial writes need trustworthy block checksums for the untouched blocks
+    if (!chunk.verified) {
+        verify_chunk_locked(chunk);
+    }
+    if (chunk.corrupt) {
+        error = "Checksum mismatch";
+        return false;
+    }
+    
+    size_t end = (size_t)offset + length;
+    if (end <= chunk.size) {
+        // An empty new chunk still needs its backing object created
+        if (chunk.size == 0 && !store_->resize(chunk.chunk_id, 0)) {
+            error = "Chunk storage failure";
+            return false;
+        }
+        return true;
+    }
+    
+    // Grow the chunk; check if we have space first
+    if (!try_reserve_capacity(end - chunk.size)) {
+        error = "Insufficient storage capacity";
+        return false;
+    }
+    
+    if (!store_->resize(chunk.chunk_id, end)) {
+        used_capacity_ -= end - chunk.size;
+        error = "Chunk storage failure";
+        return false;
+    }
+    
+    // Zero-filled growth counts as written so its blocks get checksummed
+    mark_dirty(chunk, chunk.size, end);
+    chunk.size = end;
+    return true;
+}
+
+bool ChunkServer::write_range_locked(StoredChunk& chunk, uint32_t offset, 
+                                     const uint8_t* data, size_t length) {
+    if (chunk.deleted || (size_t)offset + length > chunk.size) {
+        return false;
+    }
+    
+    mark_dirty(chunk, offset, (uint64_t)offset + length);
+    return store_->write(chunk.chunk_id, offset, data, length);
+}
+
+// Every commit is a new version, reported with the next heartbeat so the
+// metadata server can tell replicas that missed it. install_version (from
+// re-replication) makes a copy take on its source's version. Only writes that
+// arrived intact commit, so replicas at one version hold the same bytes: one
+// past a damaged hop of a chain stays behind and is dropped as stale
+bool ChunkServer::commit_write_locked(StoredChunk& chunk, uint32_t install_version) {
+    if (chunk.deleted) {
+        return false;
+    }
+    
+    chunk.version = std::max(chunk.version + 1, install_version);
+    chunk.last_access = std::time(nullptr);
+    record_chunk_change(chunk.chunk_id, true);
+    uint64_t checksum_start_ns = metrics_now_ns();
+    bool checksummed = update_block_checksums(chunk);
+    checksum_time_.record_since(checksum_start_ns);
+    chunk.committed.notify_all();
+    return store_->sync(chunk.chunk_id) && checksummed && journal_commit(chunk);
+}
+
+// Give up a copy whose bytes no longer match any committed write. It is no
+// longer reported, so the metadata server re-replicates the chunk elsewhere
+void ChunkServer::abandon_chunk_locked(StoredChunk& chunk) {
+    chunk.corrupt = true;
+    chunk.dirty_begin = chunk.dirty_end = 0;
+    chunk.committed.notify_all();
+    record_chunk_change(chunk.chunk_id, false);
+    std::cerr << "Chunk " << chunk.chunk_id << " abandoned after a damaged write" << std::endl;
+}
+
+void ChunkServer::mark_dirty(StoredChunk& chunk, uint64_t begin, uint64_t end) {
+    if (chunk.dirty_begin >= chunk.dirty_end) {
+        chunk.dirty_begin = begin;
+        chunk.dirty_end = end;
     } else {
-        // Update existing chunk
-        StoredChunk& chunk = it->second;
-        size_t new_size = std::max(req.offset + (uint32_t)req.data.size(), (uint32_t)chunk.size);
+        chunk.dirty_begin = std::min(chunk.dirty_begin, begin);
+        chunk.dirty_end = std::max(chunk.dirty_end, end);
+    }
+}
+
+// Rehash only the blocks overlapping the dirty range, then fold the block
+// CRCs into the chunk-level checksum (a few KB instead of the whole chunk)
+bool ChunkServer::update_block_checksums(StoredChunk& chunk) {
+    size_t num_blocks = (chunk.size + DFS_CHECKSUM_BLOCK_BYTES - 1) / DFS_CHECKSUM_BLOCK_BYTES;
+    chunk.block_checksums.resize(num_blocks, 0);
+    
+    bool ok = true;
+    uint64_t dirty_end = std::min(chunk.dirty_end, chunk.size);
+    if (chunk.dirty_begin < dirty_end) {
+        std::vector<uint8_t> block_data(DFS_CHECKSUM_BLOCK_BYTES);
+        size_t first = chunk.dirty_begin / DFS_CHECKSUM_BLOCK_BYTES;
+        size_t last = (dirty_end - 1) / DFS_CHECKSUM_BLOCK_BYTES;
+        for (size_t block = first; block <= last; ++block) {
+            uint64_t begin = (uint64_t)block * DFS_CHECKSUM_BLOCK_BYTES;
+            uint64_t length = std::min((uint64_t)DFS_CHECKSUM_BLOCK_BYTES, chunk.size - begin);
+            if (!store_->read(chunk.chunk_id, begin, block_data.data(), length)) {
+                ok = false;
+                continue;
+            }
+            chunk.block_checksums[block] = NetworkSocket::calculate_crc32(block_data.data(), length);
+        }
+    }
+    chunk.dirty_begin = chunk.dirty_end = 0;
+    
+    chunk.checksum = NetworkSocket::calculate_crc32(
+        (const uint8_t*)chunk.block_checksums.data(), 
+        chunk.block_checksums.size() * sizeof(uint32_t));
+    return ok;
+}
+
+// span must start on a block boundary and end on one (or at the chunk end)
+bool ChunkServer::verify_blocks(const StoredChunk& chunk, uint64_t span_begin, 
+                                const uint8_t* span, size_t span_length) {
+    for (uint64_t pos = 0; pos < span_length; pos += DFS_CHECKSUM_BLOCK_BYTES) {
+        uint64_t begin = span_begin + pos;
+        size_t block = begin / DFS_CHECKSUM_BLOCK_BYTES;
+        uint64_t block_length = std::min((uint64_t)DFS_CHECKSUM_BLOCK_BYTES, span_length - pos);
+        if (block >= chunk.block_checksums.size()) {
+            break;
+        }
         
-        if (used_capacity_ - chunk.size + new_size > max_capacity_) {
-            resp.success = false;
-            resp.error_message = "Insufficient storage capacity";
+        if (NetworkSocket::calculate_crc32(span + pos, block_length) != chunk.block_checksums[block]) {
             return false;
         }
+    }
+    return true;
+}
+
+bool ChunkServer::handle_write(const FileWriteRequest& req, FileWriteResponse& resp) {
+    ChunkRef ref = find_or_create_chunk(req.chunk_id);
+    resp.chunk_id = req.chunk_id;
+    
+    {
+        ExclusiveTimedLock lock(ref->lock, chunk_write_wait_, chunk_write_hold_);
         
-        used_capacity_ -= chunk.size;
-        chunk.data.resize(new_size);
-        std::memcpy(chunk.data.data() + req.offset, req.data.data(), req.data.size());
-        chunk.size = new_size;
-        chunk.version++;
-        chunk.last_access = std::time(nullptr);
-        chunk.checksum = NetworkSocket::calculate_crc32(chunk.data.data(), chunk.size);
-        used_capacity_ += chunk.size;
+        if (reserve_write_locked(*ref, req.offset, req.data.size(), resp.error_message)) {
+            bool written = write_range_locked(*ref, req.offset, req.data.data(), req.data.size());
+            bool committed = commit_write_locked(*ref, req.version);
+            resp.success = written && committed;
+            resp.version = ref->version;
+            if (!resp.success) {
+                resp.error_message = "Chunk storage failure";
+            }
+            return resp.success;
+        }
     }
     
-    resp.chunk_id = req.chunk_id;
-    resp.success = true;
+    discard_if_uncommitted(req.chunk_id);
+    resp.success = false;
+    return false;
+}
+
+bool ChunkServer::handle_write_stream(NetworkSocket& socket, const FrameHeader& header, 
+                                      ProtocolFrame& response) {
+    WriteRequestHeader wire;
+    if (header.payload_size < sizeof(WriteRequestHeader) || 
+        !socket.recv_exact(&wire, sizeof(WriteRequestHeader)) ||
+        wire.chain_bytes > header.payload_size - sizeof(WriteRequestHeader)) {
+        return false;
+    }
+    std::vector<uint8_t> chain_bytes(wire.chain_bytes);
+    if (!chain_bytes.empty() && !socket.recv_exact(chain_bytes.data(), chain_bytes.size())) {
+        return false;
+    }
+    
+    uint32_t crc = NetworkSocket::extend_crc32(0, (const uint8_t*)&wire, sizeof(WriteRequestHeader));
+    crc = NetworkSocket::extend_crc32(crc, chain_bytes.data(), chain_bytes.size());
+    size_t data_size = header.payload_size - sizeof(WriteRequestHeader) - wire.chain_bytes;
+    
+    // The next replica has the frame before any of its data reaches us
+    ChunkLocation next;
+    std::shared_ptr<NetworkSocket> downstream = forward_write(header, wire, chain_bytes, next);
+    
+    // A new chunk is written in place and dropped if the data never arrives
+    // whole. The bytes of a committed chunk change only once the write has
+    // passed its checksum, so until then it is staged in memory
+    std::string error;
+    ChunkRef ref = find_or_create_chunk(wire.chunk_id);
+    bool accepted = (data_size == wire.length);
+    bool creates = false;
+    if (accepted) {
+        ExclusiveTimedLock lock(ref->lock, chunk_write_wait_, chunk_write_hold_);
+        creates = ref->version == 0;
+        accepted = creates ? reserve_write_locked(*ref, wire.offset, data_size, error)
+                           : !ref->deleted && !ref->corrupt;
+    }
+    if (!accepted) {
+        discard_if_uncommitted(wire.chunk_id);
+    }
+    std::vector<uint8_t> staged(accepted && !creates ? data_size : 0);
+    
+    // Each slice goes downstream first, then into the store. Rejected writes
+    // are still drained (and forwarded) so connections stay in sync with the
+    // frame boundaries
+    bool stored = accepted;
+    uint32_t committed_version = 0;
+    bool received = socket.recv_stream(data_size, DFS_STREAM_SLICE_BYTES, crc,
+        [&](const uint8_t* data, size_t length, uint64_t offset) {
+            if (downstream) {
+                struct iovec iov = {const_cast<uint8_t*>(data), length};
+                if (!downstream->send_iov(&iov, 1)) {
+                    downstream.reset();  // Replicas past it are left to re-replication
+                }
+            }
+            if (accepted && creates) {
+                ExclusiveTimedLock lock(ref->lock, chunk_write_wait_, chunk_write_hold_);
+                stored = write_range_locked(*ref, wire.offset + offset, data, length) && stored;
+            } else if (accepted) {
+                std::memcpy(staged.data() + offset, data, length);
+            }
+            return true;
+        });
+    bool intact = received && crc == header.checksum;
+    
+    if (accepted && creates && !intact && discard_if_uncommitted(wire.chunk_id)) {
+        stored = false;
+    } else if (accepted && creates) {
+        ExclusiveTimedLock lock(ref->lock, chunk_write_wait_, chunk_write_hold_);
+        if (intact) {
+            stored = commit_write_locked(*ref, wire.version) && stored;
+            committed_version = ref->version;
+        } else {
+            // Another write committed the chunk while this one's bad bytes went
+            // in place. Rehashing would vouch for them, so the copy is given up
+            abandon_chunk_locked(*ref);
+            stored = false;
+        }
+    } else if (accepted && intact) {
+        ExclusiveTimedLock lock(ref->lock, chunk_write_wait_, chunk_write_hold_);
+        stored = reserve_write_locked(*ref, wire.offset, data_size, error);
+        if (stored) {
+            bool written = write_range_locked(*ref, wire.offset, staged.data(), staged.size());
+            stored = commit_write_locked(*ref, wire.version) && written;
+            committed_version = ref->version;
+        }
+    } else {
+        stored = false;  // A staged write that failed its checksum left the chunk as it was
+    }
+    if (!received) {
+        return false;
+    }
+    
+    bool ok = stored && intact;
+    WriteResponseHeader out = {wire.chunk_id, ok ? 0u : 1u, ok ? 1u : 0u, ok ? committed_version : 0u, 0};
+    if (downstream) {
+        uint64_t wait_start_ns = metrics_now_ns();
+        WriteResponseHeader downstream_result;
+        if (finish_peer_write(downstream, next, downstream_result)) {
+            out.replicas_written += downstream_result.replicas_written;
+            out.version = std::max(out.version, downstream_result.version);
+        }
+        downstream_time_.record_since(wait_start_ns);
+    }
+    
+    response.set_payload(&out, sizeof(out));
+    response.checksum = NetworkSocket::calculate_crc32(response.payload.data(), response.payload_size);
+    return true;
+}
+
+// Connection to a peer with iov already sent on it. A pooled connection the
+// peer has since closed gets one retry on a fresh one
+std::shared_ptr<NetworkSocket> ChunkServer::open_to_peer(const std::string& ip, uint16_t port,
+                                                         struct iovec* iov, int iovcnt) {
+    std::vector<struct iovec> retry(iov, iov + iovcnt);  // send_iov advances the array it is given
+    std::shared_ptr<NetworkSocket> peer = peer_pool_->acquire(ip, port);
+    if (peer && peer->send_iov(iov, iovcnt)) {
+        return peer;
+    }
+    
+    peer = std::make_shared<NetworkSocket>();
+    if (peer->connect_to_server(ip, port) && peer->send_iov(retry.data(), iovcnt)) {
+        return peer;
+    }
+    return nullptr;
+}
+
+// Pass a chained write on to the first reachable replica after this one in
+// its chain: the frame goes out unchanged, so its checksum still holds, and
+// that replica finds its own place in the chain the same way
+std::shared_ptr<NetworkSocket> ChunkServer::forward_write(const FrameHeader& header, 
+                                                          const WriteRequestHeader& wire,
+                                                          const std::vector<uint8_t>& chain_bytes,
+                                                          ChunkLocation& next) {
+    std::vector<ChunkLocation> chain;
+    WireReader in(chain_bytes.data(), chain_bytes.size());
+    if (chain_bytes.empty() || !decode_write_chain(in, chain)) {
+        return nullptr;
+    }
+    
+    size_t self = 0;
+    while (self < chain.size() && chain[self].server_id != server_id_) {
+        ++self;
+    }
+    for (size_t i = self + 1; i < chain.size(); ++i) {
+        struct iovec iov[3];
+        iov[0].iov_base = const_cast<FrameHeader*>(&header);
+        iov[0].iov_len = DFS_FRAME_HEADER_SIZE;
+        iov[1].iov_base = const_cast<WriteRequestHeader*>(&wire);
+        iov[1].iov_len = sizeof(WriteRequestHeader);
+        iov[2].iov_base = const_cast<uint8_t*>(chain_bytes.data());
+        iov[2].iov_len = chain_bytes.size();
+        
+        std::shared_ptr<NetworkSocket> peer = open_to_peer(chain[i].ip_address, chain[i].port, iov, 3);
+        if (peer) {
+            next = chain[i];
+            return peer;
+        }
+    }
+    return nullptr;
+}
+
+// Read the peer's answer to a write sent on peer; the connection goes back to
+// the pool only when its frame completed
+bool ChunkServer::finish_peer_write(std::shared_ptr<NetworkSocket> peer, const ChunkLocation& location,
+                                    WriteResponseHeader& result) {
+    ProtocolFrame reply;
+    if (!peer->recv_frame(reply) || reply.payload_size < sizeof(WriteResponseHeader)) {
+        return false;
+    }
+    peer_pool_->release(location.ip_address, location.port, peer);
+    std::memcpy(&result, reply.payload.data(), sizeof(WriteResponseHeader));
     return true;
 }
 
 bool ChunkServer::delete_chunk(uint64_t chunk_id) {
-    std::unique_lock<std::mutex> lock(chunks_mutex_);
+    ChunkStripe& stripe = stripe_for(chunk_id);
+    std::unique_lock<std::shared_mutex> lock(stripe.mutex);
     
-    auto it = chunks_.find(chunk_id);
-    if (it == chunks_.end()) {
+    auto it = stripe.chunks.find(chunk_id);
+    if (it == stripe.chunks.end()) {
         return false;
     }
     
-    used_capacity_ -= it->second.size;
-    chunks_.erase(it);
+    // In-flight readers finish before the backing data is removed
+    {
+        std::unique_lock<std::shared_mutex> chunk_lock(it->second->lock);
+        remove_chunk_locked(*it->second);
+    }
+    stripe.chunks.erase(it);
+    return true;
+}
+
+// The version check and the removal happen under one hold of the chunk lock,
+// so a write or re-replication that brings the copy up to date first keeps
+// it. Uncommitted copies (an incoming re-replication) are left to their writer
+bool ChunkServer::delete_chunk_if_older(uint64_t chunk_id, uint32_t newest_version) {
+    ChunkStripe& stripe = stripe_for(chunk_id);
+    std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+    
+    auto it = stripe.chunks.find(chunk_id);
+    if (it == stripe.chunks.end()) {
+        return false;
+    }
+    
+    {
+        std::unique_lock<std::shared_mutex> chunk_lock(it->second->lock);
+        if (it->second->version == 0 || it->second->version >= newest_version) {
+            return false;
+        }
+        remove_chunk_locked(*it->second);
+    }
+    stripe.chunks.erase(it);
     return true;
 }
 
+void ChunkServer::remove_chunk_locked(StoredChunk& chunk) {
+    chunk.deleted = true;
+    chunk.committed.notify_all();
+    used_capacity_ -= chunk.size;
+    store_->remove(chunk.chunk_id);
+    if (chunk.version > 0) {
+        record_chunk_change(chunk.chunk_id, false);
+    }
+}
+
 bool ChunkServer::write_chunk(uint64_t chunk_id, const std::vector<uint8_t>& data) {
     FileWriteRequest req;
     req.chunk_id = chunk_id;
     req.offset = 0;
     req.data = data;
-    req.version = 1;
+    req.version = 0;
     
     FileWriteResponse resp;
     return handle_write(req, resp);
@@ -339,6 +1105,7 @@ bool ChunkServer::read_chunk(uint64_t chunk_id, std::vector<uint8_t>& data) {
     req.chunk_id = chunk_id;
     req.offset = 0;
     req.length = DFS_CHUNK_SIZE_BYTES;
+    req.version = 0;
     
     FileReadResponse resp;
     if (handle_read(req, resp)) {
@@ -357,74 +1124,586 @@ ChunkServerStatus ChunkServer::get_status() const {
     status.server_id = server_id_;
     status.ip_address = ip_;
     status.port = port_;
+    status.zone = zone_;
+    status.rack = rack_;
     status.total_capacity_bytes = max_capacity_;
     status.used_capacity_bytes = used_capacity_;
+    status.active_connections = reactor_->get_connection_count();
+    status.pending_requests = thread_pool_->get_pending_tasks();
     status.is_healthy = running_;
     status.last_heartbeat = std::time(nullptr);
     
-    {
-        std::unique_lock<std::mutex> lock(chunks_mutex_);
-        for (const auto& entry : chunks_) {
-            status.healthy_chunks.push_back(entry.first);
+    for (const auto& stripe : stripes_) {
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+        for (const auto& entry : stripe.chunks) {
+            std::shared_lock<std::shared_mutex> chunk_lock(entry.second->lock);
+            if (entry.second->version > 0 && !entry.second->corrupt) {
+                status.healthy_chunks.push_back(entry.first);
+            }
         }
     }
     
     return status;
 }
 
-bool ChunkServer::replicate_chunk(uint64_t chunk_id, const std::string& target_ip, uint16_t target_port) {
-    std::vector<uint8_t> data;
-    if (!read_chunk(chunk_id, data)) {
+
+std::string ChunkServer::manifest_path() const {
+    return storage_path_ + "/chunks.manifest";
+}
+
+std::string ChunkServer::journal_path() const {
+    return storage_path_ + "/chunks.journal";
+}
+
+// Make a commit survive a restart before the next checkpoint. Called after the
+// chunk's data is synced, so a record never vouches for bytes not on disk
+bool ChunkServer::journal_commit(const StoredChunk& chunk) {
+    if (!store_->is_persistent()) {
+        return true;
+    }
+    
+    JournalRecord record;
+    record.entry = {chunk.chunk_id, chunk.size, chunk.version, chunk.checksum};
+    record.crc = NetworkSocket::calculate_crc32((const uint8_t*)&record.entry, sizeof(record.entry));
+    record.reserved = 0;
+    
+    std::lock_guard<std::mutex> lock(journal_mutex_);
+    if (journal_fd_ < 0) {
+        journal_fd_ = ::open(journal_path().c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (journal_fd_ < 0) {
+            return false;
+        }
+    }
+    return ::write(journal_fd_, &record, sizeof(record)) == (ssize_t)sizeof(record) &&
+           fdatasync(journal_fd_) == 0;
+}
+
+// Write the manifest to a temp file, fsync it, then atomically replace the old one
+bool ChunkServer::checkpoint_manifest() {
+    if (!store_->is_persistent()) {
+        return true;
+    }
+    
+    // Commits from here on go to a fresh journal. The old one is dropped once
+    // the manifest covering it is durable (after a failed checkpoint it is
+    // still there, and the current journal is simply kept as well)
+    std::string old_journal = journal_path() + ".old";
+    {
+        std::lock_guard<std::mutex> lock(journal_mutex_);
+        if (::access(old_journal.c_str(), F_OK) != 0) {
+            if (journal_fd_ >= 0) {
+                close(journal_fd_);
+                journal_fd_ = -1;
+            }
+            std::rename(journal_path().c_str(), old_journal.c_str());
+        }
+    }
+    
+    std::vector<ManifestEntry> entries;
+    for (const auto& stripe : stripes_) {
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+        for (const auto& entry : stripe.chunks) {
+            const StoredChunk& chunk = *entry.second;
+            std::shared_lock<std::shared_mutex> chunk_lock(chunk.lock);
+            if (chunk.version == 0 || chunk.deleted || chunk.corrupt) {
+                continue;
+            }
+            // Unverified chunks without a trusted checksum are re-indexed next start
+            if (!chunk.verified && !chunk.has_expected_checksum) {
+                continue;
+            }
+            entries.push_back({chunk.chunk_id, chunk.size, chunk.version, chunk.checksum});
+        }
+    }
+    
+    ManifestHeader header;
+    header.magic = MANIFEST_MAGIC;
+    header.version = MANIFEST_VERSION;
+    header.entry_count = entries.size();
+    header.entries_crc = NetworkSocket::calculate_crc32(
+        (const uint8_t*)entries.data(), entries.size() * sizeof(ManifestEntry));
+    header.reserved = 0;
+    
+    std::string tmp_path = manifest_path() + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
         return false;
     }
     
-    NetworkSocket target_socket;
-    if (!target_socket.connect_to_server(target_ip, target_port)) {
+    bool ok = ::write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header);
+    size_t entry_bytes = entries.size() * sizeof(ManifestEntry);
+    const uint8_t* ptr = (const uint8_t*)entries.data();
+    size_t written = 0;
+    while (ok && written < entry_bytes) {
+        ssize_t n = ::write(fd, ptr + written, entry_bytes - written);
+        if (n < 0 && errno == EINTR) continue;
+        ok = n > 0;
+        if (ok) written += n;
+    }
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    
+    if (!ok || std::rename(tmp_path.c_str(), manifest_path().c_str()) != 0) {
+        unlink(tmp_path.c_str());
         return false;
     }
+    unlink(old_journal.c_str());
+    return true;
+}
+
+// mmap the manifest and create chunk entries straight from it
+size_t ChunkServer::load_manifest(std::map<uint64_t, StoredChunk*>& loaded) {
+    int fd = ::open(manifest_path().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
     
-    ProtocolFrame frame;
-    frame.magic = DFS_PROTOCOL_MAGIC;
-    frame.version = DFS_PROTOCOL_VERSION;
-    frame.message_type = OP_REPLICATE;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ManifestHeader)) {
+        close(fd);
+        return 0;
+    }
+    
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return 0;
+    }
     
-    // Simplified replication (in production, handle large chunks)
-    frame.payload_size = sizeof(uint64_t) + data.size();
-    uint8_t* ptr = frame.payload;
-    std::memcpy(ptr, &chunk_id, sizeof(uint64_t));
-    std::memcpy(ptr + sizeof(uint64_t), data.data(), data.size());
+    // A damaged entry_count must not wrap the size check below
+    const ManifestHeader* header = (const ManifestHeader*)mapped;
+    const ManifestEntry* entries = (const ManifestEntry*)(header + 1);
+    size_t max_entries = ((size_t)st.st_size - sizeof(ManifestHeader)) / sizeof(ManifestEntry);
+    size_t entry_bytes = header->entry_count <= max_entries ? header->entry_count * sizeof(ManifestEntry) : 0;
+    
+    size_t count = 0;
+    if (header->magic == MANIFEST_MAGIC && header->version == MANIFEST_VERSION &&
+        header->entry_count <= max_entries &&
+        sizeof(ManifestHeader) + entry_bytes == (size_t)st.st_size &&
+        NetworkSocket::calculate_crc32((const uint8_t*)entries, entry_bytes) == header->entries_crc) {
+        for (uint64_t i = 0; i < header->entry_count; ++i) {
+            const ManifestEntry& entry = entries[i];
+            auto chunk = std::make_shared<StoredChunk>(entry.chunk_id);
+            chunk->version = entry.version;
+            chunk->size = entry.size;
+            chunk->checksum = entry.checksum;
+            chunk->verified = false;
+            chunk->has_expected_checksum = true;
+            
+            stripe_for(entry.chunk_id).chunks[entry.chunk_id] = chunk;
+            loaded[entry.chunk_id] = chunk.get();
+            ++count;
+        }
+    } else {
+        std::cerr << "Ignoring invalid chunk manifest " << manifest_path() << std::endl;
+    }
+    
+    munmap(mapped, st.st_size);
+    return count;
+}
+
+// Apply journaled commits newer than what is loaded; returns how many were applied
+size_t ChunkServer::replay_journal(const std::string& path, std::map<uint64_t, StoredChunk*>& loaded) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
     
-    frame.checksum = NetworkSocket::calculate_crc32(frame.payload, frame.payload_size);
+    size_t applied = 0;
+    JournalRecord record;
+    while (::read(fd, &record, sizeof(record)) == (ssize_t)sizeof(record)) {
+        const ManifestEntry& entry = record.entry;
+        if (NetworkSocket::calculate_crc32((const uint8_t*)&entry, sizeof(entry)) != record.crc) {
+            break;
+        }
+        
+        auto it = loaded.find(entry.chunk_id);
+        if (it != loaded.end() && it->second->version > entry.version) {
+            continue;
+        }
+        if (it == loaded.end()) {
+            auto chunk = std::make_shared<StoredChunk>(entry.chunk_id);
+            stripe_for(entry.chunk_id).chunks[entry.chunk_id] = chunk;
+            it = loaded.emplace(entry.chunk_id, chunk.get()).first;
+        }
+        StoredChunk& chunk = *it->second;
+        chunk.version = entry.version;
+        chunk.size = entry.size;
+        chunk.checksum = entry.checksum;
+        chunk.verified = false;
+        chunk.has_expected_checksum = true;
+        ++applied;
+    }
     
-    return target_socket.send_frame(frame);
+    close(fd);
+    return applied;
 }
 
+// Reconcile the manifest and journal with what the store actually holds. Only
+// a directory listing is done here; chunk contents are verified later against
+// the recorded checksums. Nothing without a committed record is trusted
+void ChunkServer::index_stored_chunks() {
+    if (!store_->is_persistent()) {
+        return;
+    }
+    
+    auto load_start = std::chrono::steady_clock::now();
+    std::map<uint64_t, StoredChunk*> loaded;
+    load_manifest(loaded);
+    replay_journal(journal_path() + ".old", loaded);
+    replay_journal(journal_path(), loaded);
+    auto load_end = std::chrono::steady_clock::now();
+    
+    std::map<uint64_t, uint64_t> on_disk = store_->list_chunks();
+    
+    // Records whose file is gone, or is shorter than committed. A longer file
+    // had a growing write in flight: it is cut back to the committed size and
+    // verification decides whether the committed bytes survived
+    uint64_t used = 0;
+    for (const auto& entry : loaded) {
+        auto disk = on_disk.find(entry.first);
+        if (disk != on_disk.end() && disk->second > entry.second->size &&
+            store_->resize(entry.first, entry.second->size)) {
+            disk->second = entry.second->size;
+        }
+        if (disk == on_disk.end() || disk->second != entry.second->size) {
+            stripe_for(entry.first).chunks.erase(entry.first);
+            continue;
+        }
+        used += disk->second;
+    }
+    
+    // Files with no committed record are torn or unfinished writes. Peers hold
+    // the committed copies, and the metadata server re-replicates from them
+    size_t discarded = 0;
+    for (const auto& disk : on_disk) {
+        if (!stripe_for(disk.first).chunks.count(disk.first)) {
+            store_->remove(disk.first);
+            ++discarded;
+        }
+    }
+    used_capacity_ = used;
+    
+    std::unique_lock<std::mutex> lock(startup_mutex_);
+    startup_stats_.manifest_load_ms = 
+        std::chrono::duration_cast<std::chrono::milliseconds>(load_end - load_start).count();
+    startup_stats_.chunks_indexed = on_disk.size();
+    startup_stats_.chunks_from_manifest = on_disk.size() - discarded;
+    startup_stats_.chunks_discarded = discarded;
+}
+
+bool ChunkServer::ensure_verified(StoredChunk& chunk) {
+    {
+        std::shared_lock<std::shared_mutex> lock(chunk.lock);
+        if (chunk.verified) {
+            return !chunk.corrupt;
+        }
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(chunk.lock);
+    if (!chunk.verified) {
+        verify_chunk_locked(chunk);
+    }
+    return !chunk.corrupt;
+}
+
+// Rebuild block checksums from the stored bytes and compare with the manifest
+void ChunkServer::verify_chunk_locked(StoredChunk& chunk) {
+    uint32_t expected = chunk.checksum;
+    chunk.dirty_begin = 0;
+    chunk.dirty_end = chunk.size;
+    bool readable = update_block_checksums(chunk);
+    
+    chunk.corrupt = !readable || (chunk.has_expected_checksum && chunk.checksum != expected);
+    chunk.verified = true;
+    
+    if (chunk.corrupt) {
+        if (chunk.version > 0) {
+            record_chunk_change(chunk.chunk_id, false);
+        }
+        std::unique_lock<std::mutex> lock(startup_mutex_);
+        startup_stats_.chunks_corrupt++;
+        std::cerr << "Chunk " << chunk.chunk_id << " failed verification" << std::endl;
+    }
+}
+
+void ChunkServer::verify_all_chunks(std::chrono::steady_clock::time_point started) {
+    std::vector<ChunkRef> pending;
+    for (const auto& stripe : stripes_) {
+        std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+        for (const auto& entry : stripe.chunks) {
+            pending.push_back(entry.second);
+        }
+    }
+    
+    for (const auto& chunk : pending) {
+        if (!running_) {
+            return;
+        }
+        ensure_verified(*chunk);
+    }
+    
+    std::unique_lock<std::mutex> lock(startup_mutex_);
+    startup_stats_.full_verify_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started).count();
+    startup_stats_.verification_complete = true;
+}
+
+ChunkServer::StartupStats ChunkServer::get_startup_stats() const {
+    std::unique_lock<std::mutex> lock(startup_mutex_);
+    return startup_stats_;
+}
+
+// Stream a committed chunk to target as an OP_WRITE, one slice in memory at
+// a time. The frame checksum is folded from the stored block checksums before
+// any data is read, and each slice is checked against them on the way out
+bool ChunkServer::replicate_chunk(uint64_t chunk_id, const std::string& target_ip, uint16_t target_port) {
+    WriteResponseHeader result;
+    return replicate_chunk(chunk_id, target_ip, target_port, result);
+}
+
+bool ChunkServer::replicate_chunk(uint64_t chunk_id, const std::string& target_ip, uint16_t target_port,
+                                  WriteResponseHeader& result) {
+    static_assert(DFS_STREAM_SLICE_BYTES % DFS_CHECKSUM_BLOCK_BYTES == 0, 
+                  "replication slices must cover whole checksum blocks");
+    ChunkRef ref = find_chunk(chunk_id);
+    if (!ref || !ensure_verified(*ref)) {
+        return false;
+    }
+    
+    WriteRequestHeader wire = {chunk_id, 0, 0, 0, 0};
+    std::vector<uint32_t> block_checksums;
+    {
+        std::shared_lock<std::shared_mutex> lock(ref->lock);
+        if (ref->deleted || ref->version == 0 || ref->dirty_begin < ref->dirty_end) {
+            return false;
+        }
+        wire.length = ref->size;
+        wire.version = ref->version;
+        block_checksums = ref->block_checksums;
+    }
+    
+    uint32_t data_crc = 0;
+    for (size_t block = 0; block < block_checksums.size(); ++block) {
+        uint64_t begin = (uint64_t)block * DFS_CHECKSUM_BLOCK_BYTES;
+        uint64_t length = std::min((uint64_t)DFS_CHECKSUM_BLOCK_BYTES, wire.length - begin);
+        data_crc = NetworkSocket::combine_crc32(data_crc, block_checksums[block], length);
+    }
+    FrameHeader header = make_frame_header(OP_WRITE, sizeof(WriteRequestHeader) + wire.length);
+    header.checksum = NetworkSocket::combine_crc32(
+        NetworkSocket::calculate_crc32((const uint8_t*)&wire, sizeof(WriteRequestHeader)), 
+        data_crc, wire.length);
+    
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = DFS_FRAME_HEADER_SIZE;
+    iov[1].iov_base = &wire;
+    iov[1].iov_len = sizeof(WriteRequestHeader);
+    std::shared_ptr<NetworkSocket> target = open_to_peer(target_ip, target_port, iov, 2);
+    if (!target) {
+        return false;
+    }
+    
+    // Bailing out mid-frame drops the connection, and the target discards the
+    // partial chunk
+    std::vector<uint8_t> slice(std::min((uint64_t)DFS_STREAM_SLICE_BYTES, (uint64_t)wire.length));
+    for (uint64_t offset = 0; offset < wire.length; offset += slice.size()) {
+        size_t length = std::min((uint64_t)slice.size(), wire.length - offset);
+        {
+            std::shared_lock<std::shared_mutex> lock(ref->lock);
+            if (ref->deleted || !store_->read(chunk_id, offset, slice.data(), length)) {
+                return false;
+            }
+        }
+        
+        // A write that raced in since the checksums were copied fails here too
+        for (uint64_t pos = 0; pos < length; pos += DFS_CHECKSUM_BLOCK_BYTES) {
+            size_t block = (offset + pos) / DFS_CHECKSUM_BLOCK_BYTES;
+            size_t block_length = std::min((uint64_t)DFS_CHECKSUM_BLOCK_BYTES, length - pos);
+            if (block >= block_checksums.size() ||
+                NetworkSocket::calculate_crc32(slice.data() + pos, block_length) != block_checksums[block]) {
+                return false;
+            }
+        }
+        
+        struct iovec data_iov = {slice.data(), length};
+        if (!target->send_iov(&data_iov, 1)) {
+            return false;
+        }
+    }
+    
+    ChunkLocation location;
+    location.ip_address = target_ip;
+    location.port = target_port;
+    return finish_peer_write(target, location, result) && result.status == 0;
+}
+
+bool ChunkServer::handle_replicate(const ProtocolFrame& frame, WriteResponseHeader& result) {
+    WireReader in(frame.payload.data(), frame.payload.size());
+    std::string target_ip;
+    uint16_t target_port = 0;
+    if (!in.get_u64(result.chunk_id) || !in.get_string(target_ip) || !in.get_u16(target_port)) {
+        return false;
+    }
+    
+    ++replications_;
+    WriteResponseHeader target_result = {result.chunk_id, 1, 0, 0, 0};
+    bool ok = replicate_chunk(result.chunk_id, target_ip, target_port, target_result);
+    --replications_;
+    result.status = ok ? 0 : 1;
+    result.replicas_written = ok ? 1 : 0;
+    result.version = ok ? target_result.version : 0;
+    return ok;
+}
+
+// Heartbeats carry load, capacity and chunk changes since the previous one; the
+// full chunk list trickles out as block report slices (all of it once per
+// DFS_BLOCK_REPORT_INTERVAL_SEC, or within a few heartbeats when asked for)
 void ChunkServer::send_heartbeat() {
     if (!metadata_client_ || !metadata_client_->is_connected()) {
         metadata_client_ = std::make_unique<NetworkSocket>();
         if (!metadata_client_->connect_to_server(metadata_server_ip_, metadata_server_port_)) {
-            return;
+            return;  // Changes keep accumulating until the metadata server is back
         }
     }
     
-    ChunkServerStatus status = get_status();
+    HeartbeatMessage msg;
+    msg.server_id = server_id_;
+    msg.ip_address = ip_;
+    msg.port = port_;
+    msg.zone = zone_;
+    msg.rack = rack_;
+    msg.timestamp = std::time(nullptr);
+    msg.total_capacity = max_capacity_;
+    msg.used_capacity = used_capacity_;
+    msg.replication_queue_length = replications_;
+    msg.active_connections = reactor_->get_connection_count();
+    msg.pending_requests = thread_pool_->get_pending_tasks();
     
-    ProtocolFrame frame;
-    frame.magic = DFS_PROTOCOL_MAGIC;
-    frame.version = DFS_PROTOCOL_VERSION;
-    frame.message_type = OP_HEARTBEAT;
+    // Changes are drained before the slices are captured: one racing with the
+    // capture is then repeated by the next heartbeat rather than lost
+    std::vector<uint64_t> added;
+    {
+        std::unique_lock<std::mutex> lock(report_mutex_);
+        msg.sequence = ++heartbeat_sequence_;
+        added.assign(added_chunks_.begin(), added_chunks_.end());
+        msg.removed_chunks.assign(removed_chunks_.begin(), removed_chunks_.end());
+        added_chunks_.clear();
+        removed_chunks_.clear();
+        
+        msg.report_start = report_start_pending_;
+        report_start_pending_ = false;
+        uint32_t slices = 0;
+        if (urgent_slices_left_ > 0) {
+            slices = std::min(urgent_slices_left_, DFS_BLOCK_REPORT_URGENT_SLICES);
+            urgent_slices_left_ -= slices;
+        } else {
+            report_credit_ += (double)DFS_BLOCK_REPORT_SLICES * DFS_HEARTBEAT_INTERVAL_SEC / 
+                              DFS_BLOCK_REPORT_INTERVAL_SEC;
+            slices = (uint32_t)report_credit_;
+            report_credit_ -= slices;
+        }
+        for (uint32_t i = 0; i < slices; ++i) {
+            msg.report_slices.push_back(next_report_slice_);
+            next_report_slice_ = (next_report_slice_ + 1) % DFS_BLOCK_REPORT_SLICES;
+        }
+    }
+    for (uint64_t chunk_id : added) {
+        uint32_t version = committed_version(chunk_id);
+        if (version > 0) {
+            msg.added_chunks.push_back(chunk_id);
+            msg.added_versions.push_back(version);
+        }
+    }
+    for (uint32_t slice : msg.report_slices) {
+        append_report_slice(slice, msg.report_chunks, msg.report_versions);
+    }
     
-    HeartbeatMessage msg;
-    msg.server_id = status.server_id;
-    msg.timestamp = status.last_heartbeat;
-    msg.healthy_chunks = status.healthy_chunks;
-    msg.total_capacity = status.total_capacity_bytes;
-    msg.used_capacity = status.used_capacity_bytes;
-    msg.replication_queue_length = status.replication_queue_length;
-    
-    frame.payload_size = sizeof(HeartbeatMessage);
-    std::memcpy(frame.payload, &msg, frame.payload_size);
-    frame.checksum = NetworkSocket::calculate_crc32(frame.payload, frame.payload_size);
-    
-    metadata_client_->send_frame(frame);
+    ProtocolFrame frame(OP_HEARTBEAT);
+    WireWriter out(frame.payload);
+    encode_heartbeat(out, msg);
+    frame.payload_size = frame.payload.size();
+    frame.checksum = NetworkSocket::calculate_crc32(frame.payload.data(), frame.payload_size);
+    
+    ProtocolFrame response;
+    if (!metadata_client_->send_frame(frame) || !metadata_client_->recv_frame(response) ||
+        response.payload_size < sizeof(MetadataResponseHeader) + 1) {
+        // The changes may not have arrived; a full report replaces them, and the
+        // next heartbeat reconnects
+        metadata_client_->close_socket();
+        std::unique_lock<std::mutex> lock(report_mutex_);
+        start_block_report_locked();
+        return;
+    }
+    
+    if (response.payload[sizeof(MetadataResponseHeader)] & HEARTBEAT_WANT_BLOCK_REPORT) {
+        std::unique_lock<std::mutex> lock(report_mutex_);
+        start_block_report_locked();
+    }
+    
+    WireReader in(response.payload.data() + sizeof(MetadataResponseHeader) + 1,
+                  response.payload_size - sizeof(MetadataResponseHeader) - 1);
+    uint32_t stale = 0;
+    in.get_u32(stale);
+    for (uint32_t i = 0; i < stale && in.ok(); ++i) {
+        uint64_t chunk_id = 0;
+        uint32_t newest_version = 0;
+        if (in.get_u64(chunk_id) && in.get_u32(newest_version)) {
+            drop_stale_replica(chunk_id, newest_version);
+        }
+    }
+}
+
+uint32_t ChunkServer::committed_version(uint64_t chunk_id) const {
+    ChunkRef ref = find_chunk(chunk_id);
+    if (!ref) {
+        return 0;
+    }
+    std::shared_lock<std::shared_mutex> lock(ref->lock);
+    return (ref->deleted || ref->corrupt) ? 0 : ref->version;
+}
+
+// The metadata server saw a newer version of this chunk elsewhere and this copy
+// never caught up. A write that has brought it up to date since keeps it
+void ChunkServer::drop_stale_replica(uint64_t chunk_id, uint32_t newest_version) {
+    if (delete_chunk_if_older(chunk_id, newest_version)) {
+        std::cerr << "Dropped stale replica of chunk " << chunk_id << " (version " 
+                  << newest_version << " exists)" << std::endl;
+    }
+}
+
+void ChunkServer::record_chunk_change(uint64_t chunk_id, bool added) {
+    std::unique_lock<std::mutex> lock(report_mutex_);
+    if (added) {
+        removed_chunks_.erase(chunk_id);
+        added_chunks_.insert(chunk_id);
+    } else {
+        added_chunks_.erase(chunk_id);
+        removed_chunks_.insert(chunk_id);
+    }
+    
+    // Still unreported after a long outage: a full report is cheaper to send
+    if (added_chunks_.size() + removed_chunks_.size() > DFS_HEARTBEAT_MAX_DELTAS) {
+        added_chunks_.clear();
+        removed_chunks_.clear();
+        start_block_report_locked();
+    }
+}
+
+void ChunkServer::start_block_report_locked() {
+    urgent_slices_left_ = DFS_BLOCK_REPORT_SLICES;
+    report_start_pending_ = true;
+}
+
+void ChunkServer::append_report_slice(uint32_t slice, std::vector<uint64_t>& chunk_ids, 
+                                      std::vector<uint32_t>& versions) const {
+    const ChunkStripe& stripe = stripes_[slice];
+    std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+    for (const auto& entry : stripe.chunks) {
+        std::shared_lock<std::shared_mutex> chunk_lock(entry.second->lock);
+        if (entry.second->version > 0 && !entry.second->corrupt && !entry.second->deleted) {
+            chunk_ids.push_back(entry.first);
+            versions.push_back(entry.second->version);
+        }
+    }
 }
@@ -0,0 +1,434 @@
+// ============================================================================
+// DISTRIBUTED FILE SYSTEM - CHUNK STORAGE ENGINES
+// ============================================================================
+// File: chunk_store.h & chunk_store.cpp
+// Description: Pluggable backing store for chunk data on a chunk server
+// ============================================================================
+
+#ifndef DFS_CHUNK_STORE_H
+#define DFS_CHUNK_STORE_H
+
+#include "common.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+// Byte storage for chunks. ChunkServer serializes writers per chunk, so
+// implementations only need to be safe across different chunk ids and
+// for concurrent reads of one chunk.
+class ChunkStore {
+public:
+    virtual ~ChunkStore() = default;
+    
+    // Prepare the backing storage (e.g. create the directory)
+    virtual bool open() = 0;
+    
+    virtual bool write(uint64_t chunk_id, uint64_t offset, const uint8_t* data, size_t length) = 0;
+    virtual bool read(uint64_t chunk_id, uint64_t offset, uint8_t* dest, size_t length) = 0;
+    
+    // Set the chunk size; growth reads back as zeros
+    virtual bool resize(uint64_t chunk_id, uint64_t size) = 0;
+    
+    // Make previous writes to the chunk durable
+    virtual bool sync(uint64_t chunk_id) = 0;
+    
+    virtual bool remove(uint64_t chunk_id) = 0;
+    
+    // Chunk ids and sizes currently present in the store
+    virtual std::map<uint64_t, uint64_t> list_chunks() = 0;
+    
+    virtual const char* name() const = 0;
+    
+    // Whether chunks survive a restart (and a manifest is worth keeping)
+    virtual bool is_persistent() const = 0;
+};
+
+// Volatile store that keeps every chunk in RAM (testing and benchmarks)
+class MemoryChunkStore : public ChunkStore {
+public:
+    bool open() override { return true; }
+    bool write(uint64_t chunk_id, uint64_t offset, const uint8_t* data, size_t length) override;
+    bool read(uint64_t chunk_id, uint64_t offset, uint8_t* dest, size_t length) override;
+    bool resize(uint64_t chunk_id, uint64_t size) override;
+    bool sync(uint64_t) override { return true; }
+    bool remove(uint64_t chunk_id) override;
+    std::map<uint64_t, uint64_t> list_chunks() override;
+    const char* name() const override { return "memory"; }
+    bool is_persistent() const override { return false; }
+
+private:
+    std::map<uint64_t, std::vector<uint8_t>> chunks_;
+    std::shared_mutex chunks_mutex_;  // Guards membership only
+    
+    std::vector<uint8_t>* find(uint64_t chunk_id);
+};
+
+// One file per chunk under the storage directory: pwrite + fdatasync for
+// writes, pread (or O_DIRECT / mmap for large sequential scans) for reads.
+// At most max_open_files descriptors stay cached, least recently used closed first
+class FileChunkStore : public ChunkStore {
+public:
+    enum ReadMode { READ_PREAD, READ_DIRECT, READ_MMAP };
+    
+    explicit FileChunkStore(const std::string& directory, bool sync_writes = true,
+                            size_t max_open_files = DFS_MAX_OPEN_CHUNK_FILES);
+    ~FileChunkStore() override;
+    
+    bool open() override;
+    bool write(uint64_t chunk_id, uint64_t offset, const uint8_t* data, size_t length) override;
+    bool read(uint64_t chunk_id, uint64_t offset, uint8_t* dest, size_t length) override;
+    bool resize(uint64_t chunk_id, uint64_t size) override;
+    bool sync(uint64_t chunk_id) override;
+    bool remove(uint64_t chunk_id) override;
+    std::map<uint64_t, uint64_t> list_chunks() override;
+    const char* name() const override { return "file"; }
+    bool is_persistent() const override { return true; }
+    
+    // Reads of at least `threshold` bytes use `mode`; smaller ones use pread
+    void set_large_read_mode(ReadMode mode, size_t threshold);
+    
+    std::string chunk_path(uint64_t chunk_id) const;
+
+private:
+    std::string directory_;
+    bool sync_writes_;
+    ReadMode large_read_mode_;
+    size_t large_read_threshold_;
+    
+    // A descriptor closes when the cache has evicted it and the last
+    // operation using it has finished
+    struct OpenChunkFile {
+        int fd;
+        explicit OpenChunkFile(int descriptor) : fd(descriptor) {}
+        ~OpenChunkFile();
+    };
+    using FileRef = std::shared_ptr<const OpenChunkFile>;
+    struct CachedFile {
+        FileRef file;
+        std::list<uint64_t>::iterator lru_position;
+    };
+    
+    size_t max_open_files_;
+    std::unordered_map<uint64_t, CachedFile> files_;
+    std::list<uint64_t> lru_;  // Most recently used first
+    std::mutex files_mutex_;
+    
+    FileRef get_file(uint64_t chunk_id, bool create);
+    bool read_direct(uint64_t chunk_id, uint64_t offset, uint8_t* dest, size_t length);
+    bool read_mmap(int fd, uint64_t offset, uint8_t* dest, size_t length);
+};
+
+#endif // DFS_CHUNK_STORE_H
+
+
+// ============================================================================
+// File: chunk_store.cpp
+// ============================================================================
+
+#include "chunk_store.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// ---------------------------------------------------------------------------
+// MemoryChunkStore
+// ---------------------------------------------------------------------------
+
+std::vector<uint8_t>* MemoryChunkStore::find(uint64_t chunk_id) {
+    std::shared_lock<std::shared_mutex> lock(chunks_mutex_);
+    auto it = chunks_.find(chunk_id);
+    return (it != chunks_.end()) ? &it->second : nullptr;
+}
+
+bool MemoryChunkStore::write(uint64_t chunk_id, uint64_t offset, const uint8_t* data,
+                             size_t length) {
+    std::vector<uint8_t>* bytes = find(chunk_id);
+    if (!bytes || offset + length > bytes->size()) {
+        return false;
+    }
+    
+    std::memcpy(bytes->data() + offset, data, length);
+    return true;
+}
+
+bool MemoryChunkStore::read(uint64_t chunk_id, uint64_t offset, uint8_t* dest, size_t length) {
+    std::vector<uint8_t>* bytes = find(chunk_id);
+    if (!bytes || offset + length > bytes->size()) {
+        return false;
+    }
+    
+    std::memcpy(dest, bytes->data() + offset, length);
+    return true;
+}
+
+bool MemoryChunkStore::resize(uint64_t chunk_id, uint64_t size) {
+    std::vector<uint8_t>* bytes = find(chunk_id);
+    if (!bytes) {
+        std::unique_lock<std::shared_mutex> lock(chunks_mutex_);
+        bytes = &chunks_[chunk_id];
+    }
+    
+    bytes->resize(size);
+    return true;
+}
+
+bool MemoryChunkStore::remove(uint64_t chunk_id) {
+    std::unique_lock<std::shared_mutex> lock(chunks_mutex_);
+    return chunks_.erase(chunk_id) > 0;
+}
+
+std::map<uint64_t, uint64_t> MemoryChunkStore::list_chunks() {
+    std::shared_lock<std::shared_mutex> lock(chunks_mutex_);
+    
+    std::map<uint64_t, uint64_t> result;
+    for (const auto& entry : chunks_) {
+        result[entry.first] = entry.second.size();
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// FileChunkStore
+// ---------------------------------------------------------------------------
+
+static const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+FileChunkStore::FileChunkStore(const std::string& directory, bool sync_writes, 
+                               size_t max_open_files)
+    : directory_(directory), sync_writes_(sync_writes),
+      large_read_mode_(READ_PREAD), large_read_threshold_(DFS_CHUNK_SIZE_BYTES),
+      max_open_files_(std::max((size_t)1, max_open_files)) {}
+
+FileChunkStore::~FileChunkStore() = default;
+
+FileChunkStore::OpenChunkFile::~OpenChunkFile() {
+    close(fd);
+}
+
+bool FileChunkStore::open() {
+    if (mkdir(directory_.c_str(), 0755) < 0 && errno != EEXIST) {
+        return false;
+    }
+    
+    struct stat st;
+    return stat(directory_.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+std::string FileChunkStore::chunk_path(uint64_t chunk_id) const {
+    return directory_ + "/chunk_" + std::to_string(chunk_id) + ".dat";
+}
+
+void FileChunkStore::set_large_read_mode(ReadMode mode, size_t threshold) {
+    large_read_mode_ = mode;
+    large_read_threshold_ = threshold;
+}
+
+FileChunkStore::FileRef FileChunkStore::get_file(uint64_t chunk_id, bool create) {
+    {
+        std::lock_guard<std::mutex> lock(files_mutex_);
+        auto it = files_.find(chunk_id);
+        if (it != files_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second.lru_position);
+            return it->second.file;
+        }
+    }
+    
+    // open() runs unlocked; a racing opener of the same chunk keeps the first
+    int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0);
+    int fd = ::open(chunk_path(chunk_id).c_str(), flags, 0644);
+    if (fd < 0) {
+        return nullptr;
+    }
+    FileRef opened = std::make_shared<const OpenChunkFile>(fd);
+    
+    std::vector<FileRef> evicted;  // Closed after the lock is dropped
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    auto inserted = files_.emplace(chunk_id, CachedFile{opened, lru_.end()});
+    if (!inserted.second) {
+        lru_.splice(lru_.begin(), lru_, inserted.first->second.lru_position);
+        return inserted.first->second.file;
+    }
+    lru_.push_front(chunk_id);
+    inserted.first->second.lru_position = lru_.begin();
+    
+    while (files_.size() > max_open_files_) {
+        auto oldest = files_.find(lru_.back());
+        evicted.push_back(std::move(oldest->second.file));
+        files_.erase(oldest);
+        lru_.pop_back();
+    }
+    return opened;
+}
+
+bool FileChunkStore::write(uint64_t chunk_id, uint64_t offset, const uint8_t* data,
+                           size_t length) {
+    FileRef file = get_file(chunk_id, true);
+    if (!file) {
+        return false;
+    }
+    
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = pwrite(file->fd, data + written, length - written, offset + written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+bool FileChunkStore::read(uint64_t chunk_id, uint64_t offset, uint8_t* dest, size_t length) {
+    if (length >= large_read_threshold_ && large_read_mode_ == READ_DIRECT) {
+        return read_direct(chunk_id, offset, dest, length);
+    }
+    
+    FileRef file = get_file(chunk_id, false);
+    if (!file) {
+        return false;
+    }
+    
+    if (length >= large_read_threshold_ && large_read_mode_ == READ_MMAP) {
+        return read_mmap(file->fd, offset, dest, length);
+    }
+    
+    size_t total = 0;
+    while (total < length) {
+        ssize_t n = pread(file->fd, dest + total, length - total, offset + total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) {
+            return false;  // Past end of file
+        }
+        total += n;
+    }
+    return true;
+}
+
+// Bypass the page cache: read the enclosing aligned range into an aligned buffer
+bool FileChunkStore::read_direct(uint64_t chunk_id, uint64_t offset, uint8_t* dest,
+                                 size_t length) {
+    int fd = ::open(chunk_path(chunk_id).c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    
+    uint64_t aligned_begin = offset & ~(uint64_t)(DIRECT_IO_ALIGNMENT - 1);
+    uint64_t aligned_end = (offset + length + DIRECT_IO_ALIGNMENT - 1) &
+                           ~(uint64_t)(DIRECT_IO_ALIGNMENT - 1);
+    size_t span = aligned_end - aligned_begin;
+    
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, span) != 0) {
+        close(fd);
+        return false;
+    }
+    
+    size_t total = 0;
+    bool ok = true;
+    while (total < span) {
+        ssize_t n = pread(fd, (uint8_t*)buffer + total, span - total, aligned_begin + total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        if (n == 0) break;  // EOF inside the last aligned block
+        total += n;
+    }
+    
+    ok = ok && total >= (offset - aligned_begin) + length;
+    if (ok) {
+        std::memcpy(dest, (uint8_t*)buffer + (offset - aligned_begin), length);
+    }
+    
+    free(buffer);
+    close(fd);
+    return ok;
+}
+
+bool FileChunkStore::read_mmap(int fd, uint64_t offset, uint8_t* dest, size_t length) {
+    static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t map_begin = offset & ~(page_size - 1);
+    size_t map_length = (offset - map_begin) + length;
+    
+    void* mapped = mmap(nullptr, map_length, PROT_READ, MAP_SHARED, fd, map_begin);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    
+    madvise(mapped, map_length, MADV_SEQUENTIAL);
+    std::memcpy(dest, (uint8_t*)mapped + (offset - map_begin), length);
+    munmap(mapped, map_length);
+    return true;
+}
+
+bool FileChunkStore::resize(uint64_t chunk_id, uint64_t size) {
+    FileRef file = get_file(chunk_id, true);
+    return file && ftruncate(file->fd, size) == 0;
+}
+
+bool FileChunkStore::sync(uint64_t chunk_id) {
+    if (!sync_writes_) {
+        return true;
+    }
+    
+    FileRef file = get_file(chunk_id, false);
+    return file && fdatasync(file->fd) == 0;
+}
+
+bool FileChunkStore::remove(uint64_t chunk_id) {
+    FileRef cached;  // Closed here, unless an operation still holds it
+    {
+        std::lock_guard<std::mutex> lock(files_mutex_);
+        auto it = files_.find(chunk_id);
+        if (it != files_.end()) {
+            cached = std::move(it->second.file);
+            lru_.erase(it->second.lru_position);
+            files_.erase(it);
+        }
+    }
+    
+    return unlink(chunk_path(chunk_id).c_str()) == 0;
+}
+
+std::map<uint64_t, uint64_t> FileChunkStore::list_chunks() {
+    std::map<uint64_t, uint64_t> result;
+    
+    DIR* dir = opendir(directory_.c_str());
+    if (!dir) {
+        return result;
+    }
+    
+    while (struct dirent* entry = readdir(dir)) {
+        unsigned long long chunk_id = 0;
+        char suffix[8] = {0};
+        if (std::sscanf(entry->d_name, "chunk_%llu.%4s", &chunk_id, suffix) != 2 ||
+            std::strcmp(suffix, "dat") != 0) {
+            continue;
+        }
+        
+        struct stat st;
+        std::string path = directory_ + "/" + entry->d_name;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            result[chunk_id] = st.st_size;
+        }
+    }
+    
+    closedir(dir);
+    return result;
+}
@@ -10,10 +10,293 @@
 
 #include "common.h"
 #include "network.h"
+#include "thread_pool.h"
+#include "metrics.h"
 #include <string>
 #include <memory>
 #include <map>
+#include <unordered_map>
+#include <array>
 #include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <list>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+// Bounded LRU cache of chunk data blocks, keyed by (chunk_id, version, block).
+// Misses are filled by a caller-supplied fetcher outside the lock; concurrent
+// readers of a block being fetched wait for it instead of fetching again.
+class BlockCache {
+public:
+    struct Key {
+        uint64_t chunk_id;
+        uint32_t version;
+        uint32_t block;  // Index of the DFS_CLIENT_CACHE_BLOCK_BYTES block within the chunk
+        
+        bool operator<(const Key& other) const {
+            if (chunk_id != other.chunk_id) return chunk_id < other.chunk_id;
+            if (version != other.version) return version < other.version;
+            return block < other.block;
+        }
+    };
+    
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t prefetches;        // Blocks fetched by read-ahead
+        uint64_t prefetch_hits;     // ... that were later read
+        uint64_t prefetch_wasted;   // ... evicted or invalidated without being read
+        uint64_t evictions;
+        uint64_t cached_bytes;
+    };
+    
+    // Fill data with the whole block; false on failure
+    using Fetcher = std::function<bool(std::vector<uint8_t>& data)>;
+    
+    explicit BlockCache(size_t capacity_bytes);
+    
+    // Copy [offset, offset + length) of the block into dest, fetching it on a miss
+    bool read(const Key& key, uint32_t offset, uint32_t length, uint8_t* dest, const Fetcher& fetch);
+    
+    // Fetch a block ahead of use; no-op if it is cached or already being fetched
+    void prefetch(const Key& key, const Fetcher& fetch);
+    bool contains(const Key& key) const;
+    
+    // Drop every cached block of chunk_id overlapping [offset, offset + length)
+    void invalidate(uint64_t chunk_id, uint64_t offset, uint64_t length);
+    
+    Stats get_stats() const;
+
+private:
+    enum BlockState { BLOCK_LOADING, BLOCK_READY, BLOCK_FAILED };
+    
+    struct Block {
+        std::vector<uint8_t> data;  // Immutable once BLOCK_READY
+        BlockState state;
+        bool prefetched;
+        bool used;
+        std::list<Key>::iterator lru_position;
+    };
+    using BlockRef = std::shared_ptr<Block>;
+    
+    size_t capacity_bytes_;
+    size_t used_bytes_;
+    std::map<Key, BlockRef> blocks_;
+    std::list<Key> lru_;  // Most recently used first
+    Stats stats_;
+    
+    mutable std::mutex mutex_;
+    std::condition_variable loaded_;
+    
+    BlockRef reserve_locked(const Key& key, bool prefetched);
+    void complete(const Key& key, const BlockRef& block, bool ok);
+    void erase_locked(std::map<Key, BlockRef>::iterator it);
+    void evict_locked();
+};
+
+// Client-side view of chunk server latency and load, fed by this client's own
+// requests. Reads rank replicas by expected wait, EWMA latency x (in-flight + 1),
+// using power-of-two-choices for the first pick so clients do not herd onto
+// one server. A server that fails sits out a backoff window.
+class ReplicaSelector {
+public:
+    struct ServerStats {
+        std::string address;  // "ip:port"
+        double ewma_latency_us;
+        uint32_t in_flight;
+        uint64_t requests;
+        uint64_t failures;
+        uint64_t hedged;      // Requests that were a hedge for a slow replica
+    };
+    
+    ReplicaSelector();
+    
+    // Indices into replicas, best first; backed-off servers come last
+    std::vector<size_t> rank(const std::vector<ChunkLocation>& replicas);
+    
+    // Bracket every request to a server. latency_us is sampled only when
+    // sample is set (block-sized reads, so request sizes stay comparable).
+    void begin(const ChunkLocation& replica, bool hedge = false);
+    void end(const ChunkLocation& replica, bool ok, uint64_t latency_us, bool sample);
+    
+    // Delay after which a read is hedged to a second replica: the p95 of recent
+    // sampled reads, or 0 until enough have been seen
+    uint64_t hedge_delay_us() const;
+    
+    std::vector<ServerStats> get_stats() const;
+
+private:
+    struct Server {
+        double ewma_latency_us;
+        uint32_t in_flight;
+        uint64_t requests;
+        uint64_t failures;
+        uint64_t hedged;
+        uint32_t consecutive_failures;
+        std::chrono::steady_clock::time_point retry_after;
+    };
+    
+    std::map<std::string, Server> servers_;
+    std::vector<uint32_t> samples_;  // Ring of recent read latencies
+    size_t samples_seen_;
+    uint64_t hedge_delay_us_;        // Recomputed every few samples
+    std::minstd_rand rng_;
+    mutable std::mutex mutex_;
+    
+    Server& server_locked(const ChunkLocation& replica);
+    static double cost(const Server& server);
+};
+
+// Metadata lookups cached on the client, including "no such path" answers.
+// Each shard has its own reader/writer lock, so hits take only a shared lock
+// and lookups of different paths rarely meet. An entry lives until its server
+// lease runs out or the server pushes an invalidation for it.
+//
+// Answers race with invalidations, so inserts are conditional: take
+// generation() before sending a lookup, and the answer is dropped if the path
+// has been invalidated (or the cache cleared) since.
+class MetadataCache {
+public:
+    using Snapshot = std::shared_ptr<const FileMetadata>;  // Null for a path that does not exist
+    
+    struct Stats {
+        uint64_t hits;
+        uint64_t negative_hits;   // Hits on a cached "does not exist"
+        uint64_t misses;
+        uint64_t invalidations;
+        size_t entries;
+    };
+    
+    explicit MetadataCache(size_t max_entries);
+    
+    // True if path has a live entry; snapshot is then null for a negative entry
+    bool lookup(const std::string& path, Snapshot& snapshot);
+    uint64_t generation() const { return generation_.load(std::memory_order_acquire); }
+    void insert(const std::string& path, Snapshot snapshot, std::chrono::milliseconds lease, 
+                uint64_t generation);
+    void invalidate(const std::string& path);
+    void clear();
+    
+    Stats get_stats() const;
+
+private:
+    static const size_t NUM_SHARDS = 32;
+    
+    struct Entry {
+        Snapshot snapshot;
+        std::chrono::steady_clock::time_point expires;  // Past for an invalidated path
+        uint64_t invalidated_at;                        // Generation of the last invalidation
+    };
+    
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        uint64_t floor;  // Answers from before this generation are refused (clear, eviction)
+        
+        Shard() : floor(0) {}
+    };
+    
+    std::array<Shard, NUM_SHARDS> shards_;
+    size_t max_entries_per_shard_;
+    std::atomic<uint64_t> generation_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> negative_hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> invalidations_;
+    
+    Shard& shard_for(const std::string& path);
+};
+
+// Connections to the metadata server, shared by every thread of a client. Each
+// request is tagged with a request_id, so any number can be in flight on one
+// connection; a reader thread per connection hands each response to its caller
+// as it arrives, in whatever order the server finishes them, and passes
+// server pushes (request_id 0) to on_push. on_reset runs whenever a connection
+// is lost, since pushes may have been missed.
+class MetadataChannel {
+public:
+    using PushHandler = std::function<void(const ProtocolFrame& frame)>;
+    using ResetHandler = std::function<void()>;
+    
+    MetadataChannel(const std::string& server_ip, uint16_t port, size_t num_connections, 
+                    PushHandler on_push, ResetHandler on_reset);
+    ~MetadataChannel();
+    
+    // Send request and wait for its response. False if the connection failed or
+    // the server did not answer within DFS_NETWORK_TIMEOUT_MS.
+    bool call(ProtocolFrame& request, ProtocolFrame& response);
+    
+    bool reconnect();  // Drop every connection and open the first again
+    bool is_connected() const;
+
+private:
+    // A caller waiting for one response; lives on the caller's stack
+    struct Pending {
+        ProtocolFrame* response;
+        bool done;
+        bool ok;
+        std::condition_variable completed;
+    };
+    
+    struct Connection {
+        NetworkSocket socket;
+        std::thread reader;
+        std::mutex mutex;  // Guards pending, next_request_id and broken
+        std::unordered_map<uint32_t, Pending*> pending;
+        uint32_t next_request_id;
+        bool broken;
+        std::mutex send_mutex;
+        
+        Connection() : next_request_id(1), broken(false) {}
+    };
+    
+    // Connections are opened lazily and replaced once broken
+    struct Slot {
+        std::mutex mutex;
+        std::shared_ptr<Connection> connection;
+    };
+    
+    std::string server_ip_;
+    uint16_t port_;
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::atomic<size_t> next_slot_;
+    PushHandler on_push_;
+    ResetHandler on_reset_;
+    
+    std::shared_ptr<Connection> connection_for(Slot& slot);
+    void read_loop(Connection& connection);
+    static void close_connection(Slot& slot);
+};
+
+// open() flags
+const int DFS_OPEN_WRITE = 0x01;
+const int DFS_OPEN_WRITE_BEHIND = 0x10;  // Buffer and coalesce writes; errors surface at fsync()/close()
+
+// One file range of a vectored call; writev() only reads from buffer
+struct FileRange {
+    uint64_t offset;
+    void* buffer;
+    size_t length;
+};
+
+// One operation of a metadata batch: OP_METADATA_QUERY, OP_FILE_CREATE,
+// OP_FILE_DELETE or OP_MKDIR
+struct MetadataOp {
+    uint16_t type;
+    std::string path;
+    uint32_t permissions;  // OP_FILE_CREATE only
+};
+
+struct MetadataResult {
+    uint32_t status;                               // MetadataStatus
+    uint64_t file_id;                              // OP_FILE_CREATE
+    std::shared_ptr<const FileMetadata> metadata;  // OP_METADATA_QUERY, when found
+};
 
 class DistributedFileSystem {
 public:
@@ -25,456 +308,1969 @@ public:
     int delete_file(const std::string& path);
     int mkdir(const std::string& path);
     
+    // Batched metadata operations, one round trip per DFS_METADATA_BATCH_MAX_OPS.
+    // The server applies a batch in order, so a later op sees the earlier ones.
+    // Each op is atomic on its own, the batch is not: other clients' changes can
+    // land between ops, and one op failing leaves the rest applied. Queries the
+    // cache can answer are not sent. Ops whose batch failed (not sent, no reply,
+    // or not logged) come back as META_ERROR, though the server may have applied them.
+    std::vector<MetadataResult> batch_metadata(const std::vector<MetadataOp>& ops);
+    size_t create_files(const std::vector<std::string>& paths, uint32_t permissions = 0644);  // Number created
+    
     // File I/O operations
     int open(const std::string& path, int flags);
     size_t read(int fd, void* buffer, size_t size);
     size_t write(int fd, const void* data, size_t size);
+    int fsync(int fd);  // Wait for buffered and async writes; -1 if any write failed
     int close(int fd);
     
+    // Positional I/O; neither uses nor moves the file position, so threads can
+    // share an fd. The vectored calls issue every range's chunk requests in one
+    // round and return the total bytes transferred (each range up to its first
+    // failed byte).
+    size_t pread(int fd, void* buffer, size_t size, uint64_t offset);
+    size_t pwrite(int fd, const void* data, size_t size, uint64_t offset);
+    size_t readv(int fd, const std::vector<FileRange>& ranges);
+    size_t writev(int fd, const std::vector<FileRange>& ranges);
+    
+    // Asynchronous I/O. The file position advances when the call is issued, so
+    // back-to-back calls cover consecutive ranges while their chunk requests run
+    // concurrently. The buffer must stay valid until completion. Callbacks run on
+    // the client's I/O pool (or inline if the call fails up front) and must not
+    // block on this client.
+    using IoCallback = std::function<void(size_t bytes)>;
+    std::future<size_t> read_async(int fd, void* buffer, size_t size);
+    std::future<size_t> write_async(int fd, const void* data, size_t size);
+    void read_async(int fd, void* buffer, size_t size, IoCallback on_complete);
+    void write_async(int fd, const void* data, size_t size, IoCallback on_complete);
+    
     // File info
     bool get_file_info(const std::string& path, FileMetadata& metadata);
     
+    // Data cache counters (hits, misses, read-ahead usefulness)
+    BlockCache::Stats get_cache_stats() const { return block_cache_->get_stats(); }
+    
+    // Per-chunk-server latency, load and hedging counters
+    std::vector<ReplicaSelector::ServerStats> get_replica_stats() const { 
+        return replica_selector_->get_stats(); 
+    }
+    
+    // Metadata cache counters (positive and negative hits, pushed invalidations)
+    MetadataCache::Stats get_metadata_cache_stats() const { return metadata_cache_->get_stats(); }
+    
+    // Latency and bytes of metadata calls, chunk requests and whole reads and
+    // writes, in the Prometheus text format
+    std::string export_metrics() const { return metrics_.export_text(); }
+    
+    // A server's metrics (OP_STATS), fetched over a connection of its own
+    static bool fetch_server_stats(const std::string& ip, uint16_t port, std::string& text);
+    
     // Connection management
     bool reconnect_to_metadata_server();
-    bool is_connected() const { return metadata_client_ && metadata_client_->is_connected(); }
+    bool is_connected() const;
 
 private:
+    // Write-behind buffer of one open file, shared with its in-flight flush tasks
+    struct WriteBehind {
+        uint64_t buffer_offset;        // File offset of buffer[0]
+        std::vector<uint8_t> buffer;   // Contiguous, never crosses a chunk boundary
+        size_t inflight_bytes;
+        bool failed;                   // Sticky until close()
+        std::map<size_t, uint32_t> chunk_versions;  // Chunk index -> version flushes produced
+        std::mutex mutex;
+        std::condition_variable drained;
+        
+        WriteBehind() : buffer_offset(0), inflight_bytes(0), failed(false) {}
+    };
+    
     struct OpenFileHandle {
         std::string path;
         uint64_t file_id;
         uint64_t current_offset;
-        std::vector<ChunkHandle> chunks;
+        uint64_t file_size;
+        std::vector<ChunkHandle> chunks;  // In file order, DFS_CHUNK_SIZE_BYTES each
         bool writable;
         time_t open_time;
+        
+        // Sequential-read detection for read-ahead
+        uint64_t last_read_end;
+        uint32_t readahead_blocks;
+        
+        std::shared_ptr<WriteBehind> write_behind;  // Null unless opened with DFS_OPEN_WRITE_BEHIND
+    };
+    
+    // fd table entry. mutex guards handle and is held only to claim or settle a
+    // range; chunk I/O runs without it (write-behind backpressure and drains are
+    // the exception, and they stall only this fd).
+    struct OpenFile {
+        std::mutex mutex;
+        OpenFileHandle handle;
+        
+        // Unbuffered write requests claimed but not yet settled, so fsync() and
+        // close() can wait for write_async() and friends
+        size_t writes_in_flight;
+        bool write_failed;                    // One came up short; sticky until close()
+        std::condition_variable writes_settled;
+        
+        OpenFile() : writes_in_flight(0), write_failed(false) {}
     };
     
     std::string metadata_server_ip_;
     uint16_t metadata_port_;
-    std::unique_ptr<NetworkSocket> metadata_client_;
+    
+    // Declared before io_pool_, which records into them
+    MetricsRegistry metrics_;
+    RequestMetrics metadata_requests_;
+    RequestMetrics chunk_requests_;   // Per chunk, across failover and hedging
+    LatencyHistogram& read_time_;     // Each read range, issue to completion
+    LatencyHistogram& write_time_;
+    
+    std::unique_ptr<MetadataCache> metadata_cache_;
+    std::unique_ptr<MetadataChannel> metadata_channel_;  // After the cache: its readers update it
     std::unique_ptr<ConnectionPool> chunk_pool_;
+    std::unique_ptr<BlockCache> block_cache_;
+    std::unique_ptr<ReplicaSelector> replica_selector_;
+    std::unique_ptr<ThreadPool> io_pool_;  // Per-chunk requests and read-ahead; declared last so
+                                           // in-flight tasks finish before the cache goes away
     
-    std::map<int, OpenFileHandle> open_files_;
+    std::map<int, std::shared_ptr<OpenFile>> open_files_;
     int next_file_handle_;
-    std::mutex files_mutex_;
+    std::shared_mutex files_mutex_;  // Guards the fd table only, never held across I/O
     
-    // Metadata cache
-    struct CachedMetadata {
-        FileMetadata metadata;
-        time_t cached_time;
-    };
-    std::map<std::string, CachedMetadata> metadata_cache_;
-    std::mutex cache_mutex_;
+    std::shared_ptr<OpenFile> find_file(int fd);
     
     // Internal helpers
-    bool query_metadata(const std::string& path, FileMetadata& metadata);
+    bool query_metadata(const std::string& path, MetadataCache::Snapshot& metadata);
+    bool call_metadata_server(ProtocolFrame& request, ProtocolFrame& response, 
+                              MetadataResponseHeader& header);
+    void on_metadata_push(const ProtocolFrame& frame);
     std::vector<ChunkLocation> select_replicas(const std::vector<ChunkHandle>& chunks);
     ChunkLocation select_nearest_replica(const std::vector<ChunkLocation>& replicas);
-    bool read_chunk(uint64_t chunk_id, uint32_t offset, uint32_t length, 
-                   std::vector<uint8_t>& data);
-    bool write_chunk(uint64_t chunk_id, uint32_t offset, const std::vector<uint8_t>& data);
-    void invalidate_cache_entry(const std::string& path);
+    bool read_chunk(const ChunkHandle& chunk, uint32_t offset, uint32_t length, uint8_t* dest);
+    bool read_chunk_from(const ChunkLocation& replica, const ChunkHandle& chunk, 
+                         uint32_t offset, uint32_t length, uint8_t* dest);
+    bool read_chunk_hedged(const ChunkHandle& chunk, const ChunkLocation& primary, 
+                           const ChunkLocation& backup, uint32_t offset, uint32_t length, 
+                           uint8_t* dest, uint64_t hedge_delay_us);
+    static bool send_read_request(NetworkSocket& socket, const ChunkHandle& chunk, 
+                                  uint32_t offset, uint32_t length);
+    // poolable is set when the socket is left at a frame boundary
+    static bool recv_read_response(NetworkSocket& socket, uint32_t length, uint8_t* dest, 
+                                   bool& poolable);
+    // version gets the chunk version the write produced
+    bool write_chunk(const ChunkHandle& chunk, uint32_t offset, const uint8_t* data, size_t length,
+                     uint32_t& version);
+    // Replicas that stored the data; the head forwards it down chunk.replicas
+    uint32_t write_chunk_to(const ChunkLocation& replica, const ChunkHandle& chunk, uint32_t offset,
+                            const uint8_t* data, size_t length, uint32_t& version);
+    
+    // Piece of a file range that falls inside one chunk
+    struct ChunkSpan {
+        size_t chunk_index;
+        uint32_t chunk_offset;
+        uint32_t length;
+        size_t buffer_offset;  // Position within the caller's buffer
+    };
+    static std::vector<ChunkSpan> map_chunk_spans(const OpenFileHandle& handle, 
+                                                  uint64_t offset, size_t size);
+    
+    // Block cache plumbing for reads
+    bool read_span_cached(const OpenFileHandle& handle, const ChunkSpan& span, uint8_t* dest);
+    BlockCache::Fetcher block_fetcher(const ChunkHandle& chunk, uint32_t block, uint32_t length);
+    static uint32_t block_length(const OpenFileHandle& handle, size_t chunk_index, uint32_t block);
+    void schedule_readahead(const OpenFileHandle& handle, uint64_t offset, uint32_t num_blocks);
+    
+    // Write-behind: buffer_write_behind() coalesces, flush_write_behind() hands the
+    // buffer to io_pool_ (blocking while too much is in flight)
+    size_t buffer_write_behind(OpenFileHandle& handle, uint64_t offset, const uint8_t* data, 
+                               size_t size);
+    void flush_write_behind(OpenFileHandle& handle);
+    bool drain_write_behind(OpenFileHandle& handle);  // Flush and wait; false if a write failed
+    bool settle_writes(OpenFile& file, std::unique_lock<std::mutex>& lock);
+    
+    // One read or write in flight, shared by its per-span tasks
+    struct IoRequest {
+        std::shared_ptr<OpenFile> file;
+        bool is_write;
+        uint64_t offset;           // File position the request was issued at
+        bool advances_position;    // False for positional calls
+        size_t requested;          // Bytes covered by spans
+        uint8_t* dest;             // Reads
+        const uint8_t* src;        // Writes
+        uint32_t readahead_blocks;
+        uint64_t issued_ns;
+        
+        // Snapshot of the chunks the range touches, rebased so that window.chunks[0]
+        // is the first of them; only chunks and file_size are meaningful
+        OpenFileHandle window;
+        std::vector<ChunkSpan> spans;
+        std::vector<char> succeeded;
+        std::atomic<size_t> remaining;
+        IoCallback on_complete;
+    };
+    
+    // FileRange offset that means "at the file position, and advance it"
+    static const uint64_t AT_CURRENT_OFFSET = UINT64_MAX;
+    
+    // Claim every range under the file's lock, then start them all; on_complete
+    // gets the total. Blocking calls go through transfer(), which waits.
+    void submit(int fd, bool is_write, const std::vector<FileRange>& ranges, IoCallback on_complete,
+                bool run_first_inline);
+    size_t transfer(int fd, bool is_write, const std::vector<FileRange>& ranges);
+    std::shared_ptr<IoRequest> claim_read(const std::shared_ptr<OpenFile>& file, 
+                                          const FileRange& range);
+    std::shared_ptr<IoRequest> claim_write(const std::shared_ptr<OpenFile>& file, 
+                                           const FileRange& range, size_t& buffered);
+    std::shared_ptr<IoRequest> make_request(const std::shared_ptr<OpenFile>& file, uint64_t offset, 
+                                            size_t size);
+    
+    // Run every span on io_pool_ (optionally the first on the calling thread); the
+    // last span to finish settles the file position and fires on_complete
+    void start_transfer(const std::shared_ptr<IoRequest>& request, bool run_first_inline);
+    bool transfer_span(IoRequest& request, const ChunkSpan& span);
+    void finish_span(const std::shared_ptr<IoRequest>& request, size_t index, bool ok);
+    void complete_transfer(IoRequest& request);
 };
 
-#endif // DFS_CLIENT_LIB_H
+#endif // DFS_CLIENT_LIB_H
+
+
+// ============================================================================
+// File: client_lib.cpp
+// ============================================================================
+
+#include "client_lib.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+#include <cerrno>
+#include <poll.h>
+
+// Spans at least this large skip the block cache (bulk reads would only churn it)
+static const uint32_t CACHE_BYPASS_BYTES = 8 * DFS_CLIENT_CACHE_BLOCK_BYTES;
+
+// Block Cache Implementation
+BlockCache::BlockCache(size_t capacity_bytes)
+    : capacity_bytes_(capacity_bytes), used_bytes_(0), stats_() {}
+
+bool BlockCache::read(const Key& key, uint32_t offset, uint32_t length, uint8_t* dest, 
+                      const Fetcher& fetch) {
+    while (true) {
+        BlockRef block;
+        bool owner = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = blocks_.find(key);
+            if (it == blocks_.end()) {
+                stats_.misses++;
+                block = reserve_locked(key, false);
+                owner = true;
+            } else {
+                block = it->second;
+                loaded_.wait(lock, [&block] { return block->state != BLOCK_LOADING; });
+                auto current = blocks_.find(key);
+                if (block->state != BLOCK_READY || current == blocks_.end() || current->second != block) {
+                    continue;  // Fetch failed or the block was invalidated meanwhile
+                }
+                
+                stats_.hits++;
+                if (block->prefetched && !block->used) {
+                    stats_.prefetch_hits++;
+                }
+                block->used = true;
+                lru_.splice(lru_.begin(), lru_, block->lru_position);
+            }
+        }
+        
+        if (owner) {
+            bool ok = fetch(block->data);
+            complete(key, block, ok);
+            if (!ok) {
+                return false;
+            }
+        }
+        
+        // READY data never changes, so it can be copied without the lock
+        if ((uint64_t)offset + length > block->data.size()) {
+            return false;
+        }
+        std::memcpy(dest, block->data.data() + offset, length);
+        return true;
+    }
+}
+
+void BlockCache::prefetch(const Key& key, const Fetcher& fetch) {
+    BlockRef block;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (blocks_.count(key)) {
+            return;
+        }
+        block = reserve_locked(key, true);
+        stats_.prefetches++;
+    }
+    
+    complete(key, block, fetch(block->data));
+}
+
+bool BlockCache::contains(const Key& key) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return blocks_.count(key) != 0;
+}
+
+// Insert a LOADING placeholder; its bytes are charged up front
+BlockCache::BlockRef BlockCache::reserve_locked(const Key& key, bool prefetched) {
+    used_bytes_ += DFS_CLIENT_CACHE_BLOCK_BYTES;
+    evict_locked();
+    
+    auto block = std::make_shared<Block>();
+    block->state = BLOCK_LOADING;
+    block->prefetched = prefetched;
+    block->used = !prefetched;
+    lru_.push_front(key);
+    block->lru_position = lru_.begin();
+    blocks_[key] = block;
+    return block;
+}
+
+void BlockCache::complete(const Key& key, const BlockRef& block, bool ok) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        block->state = ok ? BLOCK_READY : BLOCK_FAILED;
+        
+        auto it = blocks_.find(key);
+        if (!ok && it != blocks_.end() && it->second == block) {
+            erase_locked(it);
+        }
+    }
+    loaded_.notify_all();
+}
+
+void BlockCache::erase_locked(std::map<Key, BlockRef>::iterator it) {
+    const BlockRef& block = it->second;
+    if (block->prefetched && !block->used && block->state == BLOCK_READY) {
+        stats_.prefetch_wasted++;
+    }
+    lru_.erase(block->lru_position);
+    used_bytes_ -= DFS_CLIENT_CACHE_BLOCK_BYTES;
+    blocks_.erase(it);
+}
+
+// Evict least recently used READY blocks until the reservation fits
+void BlockCache::evict_locked() {
+    auto victim = lru_.end();
+    while (used_bytes_ > capacity_bytes_ && victim != lru_.begin()) {
+        --victim;
+        auto it = blocks_.find(*victim);
+        if (it->second->state == BLOCK_LOADING) {
+            continue;
+        }
+        
+        auto next = victim;
+        ++next;
+        erase_locked(it);
+        stats_.evictions++;
+        victim = next;
+    }
+}
+
+void BlockCache::invalidate(uint64_t chunk_id, uint64_t offset, uint64_t length) {
+    uint64_t first = offset / DFS_CLIENT_CACHE_BLOCK_BYTES;
+    uint64_t last = (offset + std::max(length, (uint64_t)1) - 1) / DFS_CLIENT_CACHE_BLOCK_BYTES;
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = blocks_.lower_bound(Key{chunk_id, 0, 0});
+    while (it != blocks_.end() && it->first.chunk_id == chunk_id) {
+        auto next = std::next(it);
+        if (it->first.block >= first && it->first.block <= last) {
+            erase_locked(it);  // A fetch still in flight completes into a detached block
+        }
+        it = next;
+    }
+}
+
+BlockCache::Stats BlockCache::get_stats() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.cached_bytes = used_bytes_;
+    return stats;
+}
+
+static const double LATENCY_EWMA_ALPHA = 0.2;
+static const size_t LATENCY_SAMPLES = 256;
+static const size_t HEDGE_MIN_SAMPLES = 32;
+static const int MAX_BACKOFF_MS = 5000;
+
+ReplicaSelector::ReplicaSelector() 
+    : samples_(LATENCY_SAMPLES, 0), samples_seen_(0), hedge_delay_us_(0), 
+      rng_(std::random_device()()) {}
+
+ReplicaSelector::Server& ReplicaSelector::server_locked(const ChunkLocation& replica) {
+    std::string address = replica.ip_address + ":" + std::to_string(replica.port);
+    auto it = servers_.find(address);
+    if (it == servers_.end()) {
+        // Unseen servers start at zero cost so they get probed early
+        Server server = {};
+        it = servers_.emplace(address, server).first;
+    }
+    return it->second;
+}
+
+double ReplicaSelector::cost(const Server& server) {
+    return server.ewma_latency_us * (server.in_flight + 1) + server.in_flight;
+}
+
+std::vector<size_t> ReplicaSelector::rank(const std::vector<ChunkLocation>& replicas) {
+    std::vector<size_t> order(replicas.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    if (order.size() < 2) {
+        return order;
+    }
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    std::vector<double> costs(replicas.size());
+    std::vector<char> healthy(replicas.size());
+    for (size_t i = 0; i < replicas.size(); ++i) {
+        const Server& server = server_locked(replicas[i]);
+        costs[i] = cost(server);
+        healthy[i] = server.retry_after <= now;
+    }
+    
+    // Healthy before backed-off, then cheapest first
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (healthy[a] != healthy[b]) {
+            return healthy[a] > healthy[b];
+        }
+        return costs[a] < costs[b];
+    });
+    
+    // Power of two choices among the healthy ones: the better of two random
+    // picks goes first, so equal-cost replicas share the load
+    size_t num_healthy = std::count(healthy.begin(), healthy.end(), 1);
+    if (num_healthy >= 2) {
+        size_t a = rng_() % num_healthy;
+        size_t b = (a + 1 + rng_() % (num_healthy - 1)) % num_healthy;
+        size_t pick = costs[order[a]] <= costs[order[b]] ? a : b;
+        std::rotate(order.begin(), order.begin() + pick, order.begin() + pick + 1);
+    }
+    return order;
+}
+
+void ReplicaSelector::begin(const ChunkLocation& replica, bool hedge) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Server& server = server_locked(replica);
+    server.in_flight++;
+    server.requests++;
+    if (hedge) {
+        server.hedged++;
+    }
+}
+
+void ReplicaSelector::end(const ChunkLocation& replica, bool ok, uint64_t latency_us, bool sample) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Server& server = server_locked(replica);
+    server.in_flight--;
+    
+    if (!ok) {
+        server.failures++;
+        server.consecutive_failures++;
+        int backoff_ms = std::min(MAX_BACKOFF_MS, 
+                                  DFS_RETRY_BACKOFF_MS << std::min(server.consecutive_failures - 1, 6u));
+        server.retry_after = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff_ms);
+        return;
+    }
+    server.consecutive_failures = 0;
+    if (!sample) {
+        return;
+    }
+    
+    server.ewma_latency_us = server.ewma_latency_us == 0 ? latency_us : 
+        LATENCY_EWMA_ALPHA * latency_us + (1 - LATENCY_EWMA_ALPHA) * server.ewma_latency_us;
+    
+    samples_[samples_seen_ % LATENCY_SAMPLES] = latency_us;
+    samples_seen_++;
+    if (samples_seen_ >= HEDGE_MIN_SAMPLES && samples_seen_ % 16 == 0) {
+        std::vector<uint32_t> recent(samples_.begin(), 
+                                     samples_.begin() + std::min(samples_seen_, LATENCY_SAMPLES));
+        auto p95 = recent.begin() + recent.size() * 95 / 100;
+        std::nth_element(recent.begin(), p95, recent.end());
+        hedge_delay_us_ = std::max((uint32_t)1, *p95);
+    }
+}
+
+uint64_t ReplicaSelector::hedge_delay_us() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return hedge_delay_us_;
+}
+
+std::vector<ReplicaSelector::ServerStats> ReplicaSelector::get_stats() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<ServerStats> stats;
+    for (const auto& entry : servers_) {
+        const Server& server = entry.second;
+        stats.push_back({entry.first, server.ewma_latency_us, server.in_flight, 
+                         server.requests, server.failures, server.hedged});
+    }
+    return stats;
+}
+
+// Metadata Cache Implementation
+MetadataCache::MetadataCache(size_t max_entries)
+    : max_entries_per_shard_(std::max<size_t>(1, max_entries / NUM_SHARDS)), generation_(0),
+      hits_(0), negative_hits_(0), misses_(0), invalidations_(0) {}
+
+MetadataCache::Shard& MetadataCache::shard_for(const std::string& path) {
+    return shards_[std::hash<std::string>()(path) % NUM_SHARDS];
+}
+
+bool MetadataCache::lookup(const std::string& path, Snapshot& snapshot) {
+    Shard& shard = shard_for(path);
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.entries.find(path);
+        // An expired entry is left for the next insert to replace
+        if (it != shard.entries.end() && it->second.expires > std::chrono::steady_clock::now()) {
+            snapshot = it->second.snapshot;
+            (snapshot ? hits_ : negative_hits_).fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void MetadataCache::insert(const std::string& path, Snapshot snapshot, std::chrono::milliseconds lease,
+                           uint64_t generation) {
+    auto now = std::chrono::steady_clock::now();
+    Shard& shard = shard_for(path);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (generation < shard.floor) {
+        return;
+    }
+    
+    auto it = shard.entries.find(path);
+    if (it != shard.entries.end()) {
+        if (generation < it->second.invalidated_at) {
+            return;  // The answer predates a change to path
+        }
+        it->second.snapshot = std::move(snapshot);
+        it->second.expires = now + lease;
+        return;
+    }
+    
+    if (shard.entries.size() >= max_entries_per_shard_) {
+        // Full: drop whatever has expired, otherwise any one entry. A dropped
+        // invalidation record can no longer refuse stale answers, so raise floor.
+        for (auto victim = shard.entries.begin(); victim != shard.entries.end();) {
+            if (victim->second.expires <= now) {
+                shard.floor = std::max(shard.floor, victim->second.invalidated_at);
+                victim = shard.entries.erase(victim);
+            } else {
+                ++victim;
+            }
+        }
+        if (shard.entries.size() >= max_entries_per_shard_) {
+            shard.floor = std::max(shard.floor, shard.entries.begin()->second.invalidated_at);
+            shard.entries.erase(shard.entries.begin());
+        }
+        if (generation < shard.floor) {
+            return;
+        }
+    }
+    
+    shard.entries[path] = {std::move(snapshot), now + lease, 0};
+}
+
+// Keeps an expired record behind, so answers already in flight for path are refused
+void MetadataCache::invalidate(const std::string& path) {
+    uint64_t generation = generation_.fetch_add(1, std::memory_order_acq_rel) + 1;
+    auto now = std::chrono::steady_clock::now();
+    Shard& shard = shard_for(path);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    
+    auto it = shard.entries.find(path);
+    if (it == shard.entries.end()) {
+        if (shard.entries.size() >= max_entries_per_shard_) {
+            shard.floor = generation;  // No room for the record
+            return;
+        }
+        shard.entries[path] = {nullptr, std::chrono::steady_clock::time_point(), generation};
+        return;
+    }
+    
+    if (it->second.expires > now) {
+        invalidations_.fetch_add(1, std::memory_order_relaxed);
+    }
+    it->second = {nullptr, std::chrono::steady_clock::time_point(), generation};
+}
+
+void MetadataCache::clear() {
+    uint64_t generation = generation_.fetch_add(1, std::memory_order_acq_rel) + 1;
+    for (Shard& shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        shard.entries.clear();
+        shard.floor = generation;
+    }
+}
+
+MetadataCache::Stats MetadataCache::get_stats() const {
+    Stats stats;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.negative_hits = negative_hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.invalidations = invalidations_.load(std::memory_order_relaxed);
+    stats.entries = 0;
+    auto now = std::chrono::steady_clock::now();
+    for (const Shard& shard : shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto& entry : shard.entries) {
+            stats.entries += entry.second.expires > now;
+        }
+    }
+    return stats;
+}
+
+// Metadata Channel Implementation
+MetadataChannel::MetadataChannel(const std::string& server_ip, uint16_t port, size_t num_connections,
+                                 PushHandler on_push, ResetHandler on_reset)
+    : server_ip_(server_ip), port_(port), next_slot_(0), 
+      on_push_(std::move(on_push)), on_reset_(std::move(on_reset)) {
+    for (size_t i = 0; i < std::max((size_t)1, num_connections); ++i) {
+        slots_.push_back(std::make_unique<Slot>());
+    }
+}
+
+MetadataChannel::~MetadataChannel() {
+    for (auto& slot : slots_) {
+        close_connection(*slot);
+    }
+}
+
+// Shut the slot's connection down and wait for its reader, which fails every
+// caller still waiting on it
+void MetadataChannel::close_connection(Slot& slot) {
+    std::shared_ptr<Connection> connection;
+    {
+        std::unique_lock<std::mutex> lock(slot.mutex);
+        connection.swap(slot.connection);
+    }
+    if (!connection) {
+        return;
+    }
+    
+    ::shutdown(connection->socket.get_socket_fd(), SHUT_RDWR);
+    if (connection->reader.joinable()) {
+        connection->reader.join();
+    }
+}
+
+std::shared_ptr<MetadataChannel::Connection> MetadataChannel::connection_for(Slot& slot) {
+    std::unique_lock<std::mutex> lock(slot.mutex);
+    if (slot.connection) {
+        std::unique_lock<std::mutex> state_lock(slot.connection->mutex);
+        if (!slot.connection->broken) {
+            return slot.connection;
+        }
+    }
+    
+    // The old reader has failed its callers and is exiting
+    if (slot.connection && slot.connection->reader.joinable()) {
+        slot.connection->reader.join();
+    }
+    slot.connection.reset();
+    
+    auto connection = std::make_shared<Connection>();
+    if (!connection->socket.connect_to_server(server_ip_, port_)) {
+        std::cerr << "Failed to connect to metadata server" << std::endl;
+        return nullptr;
+    }
+    connection->reader = std::thread(&MetadataChannel::read_loop, this, std::ref(*connection));
+    slot.connection = connection;
+    return connection;
+}
+
+void MetadataChannel::read_loop(Connection& connection) {
+    int fd = connection.socket.get_socket_fd();
+    while (true) {
+        // Wait without the receive timeout, which only bounds a frame in progress
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = ::poll(&pfd, 1, -1);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        
+        ProtocolFrame frame;
+        if (ready < 0 || !connection.socket.recv_frame(frame)) {
+            break;
+        }
+        
+        if (frame.request_id == 0) {
+            on_push_(frame);
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(connection.mutex);
+        auto it = connection.pending.find(frame.request_id);
+        if (it == connection.pending.end()) {
+            continue;  // Its caller timed out
+        }
+        Pending* pending = it->second;
+        connection.pending.erase(it);
+        *pending->response = std::move(frame);
+        pending->done = true;
+        pending->ok = true;
+        pending->completed.notify_one();
+    }
+    
+    {
+        std::unique_lock<std::mutex> lock(connection.mutex);
+        connection.broken = true;
+        for (auto& entry : connection.pending) {
+            entry.second->done = true;
+            entry.second->ok = false;
+            entry.second->completed.notify_one();
+        }
+        connection.pending.clear();
+    }
+    on_reset_();
+}
+
+bool MetadataChannel::call(ProtocolFrame& request, ProtocolFrame& response) {
+    Slot& slot = *slots_[next_slot_.fetch_add(1, std::memory_order_relaxed) % slots_.size()];
+    std::shared_ptr<Connection> connection = connection_for(slot);
+    if (!connection) {
+        return false;
+    }
+    
+    Pending pending;
+    pending.response = &response;
+    pending.done = false;
+    pending.ok = false;
+    request.checksum = NetworkSocket::calculate_crc32(request.payload.data(), request.payload_size);
+    {
+        std::unique_lock<std::mutex> lock(connection->mutex);
+        if (connection->broken) {
+            return false;
+        }
+        do {
+            request.request_id = connection->next_request_id++;
+        } while (request.request_id == 0 || connection->pending.count(request.request_id));
+        connection->pending[request.request_id] = &pending;
+    }
+    
+    bool sent;
+    {
+        std::unique_lock<std::mutex> lock(connection->send_mutex);
+        sent = connection->socket.send_frame(request);
+    }
+    if (!sent) {
+        // The reader sees the shutdown and fails every caller, this one included
+        ::shutdown(connection->socket.get_socket_fd(), SHUT_RDWR);
+    }
+    
+    std::unique_lock<std::mutex> lock(connection->mutex);
+    if (!pending.completed.wait_for(lock, std::chrono::milliseconds(DFS_NETWORK_TIMEOUT_MS), 
+                                    [&pending] { return pending.done; })) {
+        connection->pending.erase(request.request_id);
+        return false;
+    }
+    return pending.ok;
+}
+
+bool MetadataChannel::reconnect() {
+    for (auto& slot : slots_) {
+        close_connection(*slot);
+    }
+    return connection_for(*slots_[0]) != nullptr;
+}
+
+bool MetadataChannel::is_connected() const {
+    for (const auto& slot : slots_) {
+        std::unique_lock<std::mutex> lock(slot->mutex);
+        if (slot->connection) {
+            std::unique_lock<std::mutex> state_lock(slot->connection->mutex);
+            if (!slot->connection->broken) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+DistributedFileSystem::DistributedFileSystem(const std::string& metadata_server_ip, 
+                                           uint16_t metadata_port)
+    : metadata_server_ip_(metadata_server_ip), metadata_port_(metadata_port), 
+      metadata_requests_(metrics_, "dfs_client_metadata", 
+                         {OP_METADATA_QUERY, OP_FILE_CREATE, OP_FILE_DELETE, OP_MKDIR, OP_BATCH_METADATA}),
+      chunk_requests_(metrics_, "dfs_client_chunk", {OP_READ, OP_WRITE}),
+      read_time_(metrics_.histogram("dfs_client_io_seconds", "op=\"read\"")),
+      write_time_(metrics_.histogram("dfs_client_io_seconds", "op=\"write\"")),
+      next_file_handle_(1) {
+    
+    metadata_cache_ = std::make_unique<MetadataCache>(DFS_CLIENT_METADATA_CACHE_ENTRIES);
+    metadata_channel_ = std::make_unique<MetadataChannel>(
+        metadata_server_ip, metadata_port, DFS_CLIENT_METADATA_CONNECTIONS,
+        [this](const ProtocolFrame& frame) { on_metadata_push(frame); },
+        [this] { metadata_cache_->clear(); });  // Pushes may have been lost
+    chunk_pool_ = std::make_unique<ConnectionPool>(20);
+    block_cache_ = std::make_unique<BlockCache>((size_t)DFS_CLIENT_CACHE_SIZE_MB * 1024 * 1024);
+    replica_selector_ = std::make_unique<ReplicaSelector>();
+    io_pool_ = std::make_unique<ThreadPool>(DFS_CLIENT_IO_PARALLELISM);
+    io_pool_->set_queue_wait_histogram(&metrics_.histogram("dfs_client_queue_wait_seconds"));
+}
+
+DistributedFileSystem::~DistributedFileSystem() {
+    // close() takes files_mutex_ itself and flushes write-behind buffers
+    std::vector<int> open_fds;
+    {
+        std::shared_lock<std::shared_mutex> lock(files_mutex_);
+        for (const auto& entry : open_files_) {
+            open_fds.push_back(entry.first);
+        }
+    }
+    for (int fd : open_fds) {
+        close(fd);
+    }
+    
+    // Let in-flight async transfers finish while the rest of the client still exists
+    io_pool_->shutdown();
+}
+
+bool DistributedFileSystem::reconnect_to_metadata_server() {
+    // Dropping the old connections clears the cache (see on_metadata_push)
+    return metadata_channel_->reconnect();
+}
+
+bool DistributedFileSystem::is_connected() const {
+    return metadata_channel_->is_connected();
+}
+
+bool DistributedFileSystem::fetch_server_stats(const std::string& ip, uint16_t port, std::string& text) {
+    NetworkSocket socket;
+    ProtocolFrame request(OP_STATS);
+    ProtocolFrame response;
+    if (!socket.connect_to_server(ip, port) || !socket.send_frame(request) || 
+        !socket.recv_frame(response) || response.message_type != OP_ACK) {
+        return false;
+    }
+    text.assign(response.payload.begin(), response.payload.end());
+    return true;
+}
+
+// Runs on a metadata channel reader thread, in order with that connection's responses
+void DistributedFileSystem::on_metadata_push(const ProtocolFrame& frame) {
+    if (frame.message_type != OP_METADATA_INVALIDATE) {
+        return;
+    }
+    
+    WireReader in(frame.payload.data(), frame.payload_size);
+    uint32_t count = 0;
+    in.get_u32(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string path;
+        if (!in.get_string(path)) {
+            metadata_cache_->clear();  // Cannot tell what else changed
+            return;
+        }
+        metadata_cache_->invalidate(path);
+    }
+}
+
+static std::chrono::milliseconds lease_of(const MetadataResponseHeader& header) {
+    if (header.lease_ms == 0) {
+        return std::chrono::seconds(DFS_METADATA_CACHE_TTL_SEC);
+    }
+    return std::chrono::milliseconds(header.lease_ms);
+}
+
+// Send request on the shared metadata channel and wait for its response. On
+// success the response payload starts with header.
+bool DistributedFileSystem::call_metadata_server(ProtocolFrame& request, ProtocolFrame& response, 
+                                                 MetadataResponseHeader& header) {
+    uint64_t start_ns = metrics_now_ns();
+    bool answered = metadata_channel_->call(request, response);
+    metadata_requests_.record(request.message_type, metrics_now_ns() - start_ns,
+                              answered ? DFS_FRAME_HEADER_SIZE + response.payload_size : 0,
+                              DFS_FRAME_HEADER_SIZE + request.payload_size);
+    if (!answered) {
+        return false;
+    }
+    
+    if (response.message_type != OP_ACK || response.payload_size < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, response.payload.data(), sizeof(header));
+    return true;
+}
+
+int DistributedFileSystem::create_file(const std::string& path, uint32_t permissions) {
+    // Send file creation request to metadata server
+    ProtocolFrame frame(OP_FILE_CREATE);
+    frame.resize_payload(path.size() + 8); // path + permissions
+    
+    uint8_t* payload_ptr = frame.payload.data();
+    std::memcpy(payload_ptr, path.c_str(), path.size());
+    payload_ptr += path.size();
+    std::memcpy(payload_ptr, &permissions, 4);
+    
+    ProtocolFrame response;
+    MetadataResponseHeader header;
+    if (!call_metadata_server(frame, response, header)) {
+        return -1;
+    }
+    
+    // Parse response to get file_id
+    uint64_t file_id = 0;
+    if (response.payload_size >= sizeof(header) + sizeof(file_id)) {
+        std::memcpy(&file_id, response.payload.data() + sizeof(header), sizeof(file_id));
+    }
+    
+    metadata_cache_->invalidate(path);
+    return header.status == META_OK ? 0 : -1;
+}
+
+int DistributedFileSystem::delete_file(const std::string& path) {
+    ProtocolFrame frame(OP_FILE_DELETE);
+    frame.set_payload(path.data(), path.size());
+    
+    ProtocolFrame response;
+    MetadataResponseHeader header;
+    if (!call_metadata_server(frame, response, header)) {
+        return -1;
+    }
+    
+    metadata_cache_->invalidate(path);
+    return header.status == META_OK ? 0 : -1;
+}
+
+int DistributedFileSystem::mkdir(const std::string& path) {
+    ProtocolFrame frame(OP_MKDIR);
+    frame.set_payload(path.data(), path.size());
+    
+    ProtocolFrame response;
+    MetadataResponseHeader header;
+    if (!call_metadata_server(frame, response, header)) {
+        return -1;
+    }
+    
+    metadata_cache_->invalidate(path);
+    return header.status == META_OK ? 0 : -1;
+}
+
+std::vector<MetadataResult> DistributedFileSystem::batch_metadata(const std::vector<MetadataOp>& ops) {
+    std::vector<MetadataResult> results(ops.size(), MetadataResult{META_ERROR, 0, nullptr});
+    
+    // Answer what we can from the cache; the rest goes to the server in op order
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        MetadataCache::Snapshot snapshot;
+        if (ops[i].type == OP_METADATA_QUERY && metadata_cache_->lookup(ops[i].path, snapshot)) {
+            results[i].status = snapshot ? META_OK : META_NOT_FOUND;
+            results[i].metadata = std::move(snapshot);
+        } else {
+            pending.push_back(i);
+        }
+    }
+    
+    for (size_t begin = 0; begin < pending.size(); begin += DFS_METADATA_BATCH_MAX_OPS) {
+        size_t end = std::min(pending.size(), begin + DFS_METADATA_BATCH_MAX_OPS);
+        
+        ProtocolFrame frame(OP_BATCH_METADATA);
+        WireWriter out(frame.payload);
+        out.put_u32(static_cast<uint32_t>(end - begin));
+        for (size_t k = begin; k < end; ++k) {
+            const MetadataOp& op = ops[pending[k]];
+            out.put_u16(op.type);
+            out.put_string(op.path);
+            out.put_u32(op.permissions);
+        }
+        frame.payload_size = frame.payload.size();
+        
+        uint64_t generation = metadata_cache_->generation();
+        ProtocolFrame response;
+        MetadataResponseHeader header;
+        if (!call_metadata_server(frame, response, header) || header.status != META_OK) {
+            break;
+        }
+        
+        WireReader in(response.payload.data() + sizeof(header), response.payload_size - sizeof(header));
+        uint32_t count = 0;
+        if (!in.get_u32(count) || count != end - begin) {
+            break;
+        }
+        
+        for (size_t k = begin; k < end; ++k) {
+            const MetadataOp& op = ops[pending[k]];
+            MetadataResult result = {META_ERROR, 0, nullptr};
+            if (!in.get_u32(result.status)) {
+                break;
+            }
+            
+            if (op.type == OP_METADATA_QUERY) {
+                if (result.status == META_OK) {
+                    auto decoded = std::make_shared<FileMetadata>();
+                    if (!decode_file_metadata(in, *decoded)) {
+                        break;
+                    }
+                    result.metadata = std::move(decoded);
+                }
+                if (result.status == META_OK || result.status == META_NOT_FOUND) {
+                    metadata_cache_->insert(op.path, result.metadata, lease_of(header), generation);
+                }
+            } else {
+                if (op.type == OP_FILE_CREATE && !in.get_u64(result.file_id)) {
+                    break;
+                }
+                metadata_cache_->invalidate(op.path);
+            }
+            results[pending[k]] = std::move(result);
+        }
+    }
+    
+    return results;
+}
+
+size_t DistributedFileSystem::create_files(const std::vector<std::string>& paths, uint32_t permissions) {
+    std::vector<MetadataOp> ops;
+    ops.reserve(paths.size());
+    for (const std::string& path : paths) {
+        ops.push_back({OP_FILE_CREATE, path, permissions});
+    }
+    
+    size_t created = 0;
+    for (const MetadataResult& result : batch_metadata(ops)) {
+        created += result.status == META_OK;
+    }
+    return created;
+}
+
+// Resolve path through the cache. Returns false if the path does not exist or
+// the server could not be asked; metadata is an immutable shared snapshot.
+bool DistributedFileSystem::query_metadata(const std::string& path, MetadataCache::Snapshot& metadata) {
+    // Check cache first
+    if (metadata_cache_->lookup(path, metadata)) {
+        return metadata != nullptr;
+    }
+    
+    // Query from metadata server
+    ProtocolFrame frame(OP_METADATA_QUERY);
+    frame.set_payload(path.data(), path.size());
+    
+    // Taken before sending, so an invalidation that overtakes the answer wins
+    uint64_t generation = metadata_cache_->generation();
+    ProtocolFrame response;
+    MetadataResponseHeader header;
+    if (!call_metadata_server(frame, response, header)) {
+        return false;
+    }
+    
+    MetadataCache::Snapshot result;
+    if (header.status == META_OK) {
+        auto decoded = std::make_shared<FileMetadata>();
+        WireReader in(response.payload.data() + sizeof(header), response.payload_size - sizeof(header));
+        if (!decode_file_metadata(in, *decoded)) {
+            return false;
+        }
+        result = std::move(decoded);
+    } else if (header.status != META_NOT_FOUND) {
+        return false;
+    }
+    
+    metadata_cache_->insert(path, result, lease_of(header), generation);
+    
+    metadata = std::move(result);
+    return metadata != nullptr;
+}
+
+bool DistributedFileSystem::get_file_info(const std::string& path, FileMetadata& metadata) {
+    MetadataCache::Snapshot snapshot;
+    if (!query_metadata(path, snapshot)) {
+        return false;
+    }
+    metadata = *snapshot;
+    return true;
+}
+
+int DistributedFileSystem::open(const std::string& path, int flags) {
+    MetadataCache::Snapshot metadata;
+    if (!query_metadata(path, metadata)) {
+        return -1;
+    }
+    
+    auto file = std::make_shared<OpenFile>();
+    OpenFileHandle& handle = file->handle;
+    handle.path = path;
+    handle.file_id = metadata->file_id;
+    handle.current_offset = 0;
+    handle.file_size = metadata->file_size;
+    handle.chunks = metadata->chunks;
+    handle.writable = (flags & DFS_OPEN_WRITE) != 0;  // Simplified flag check
+    handle.open_time = std::time(nullptr);
+    handle.last_read_end = 0;
+    handle.readahead_blocks = 0;
+    if (handle.writable && (flags & DFS_OPEN_WRITE_BEHIND)) {
+        handle.write_behind = std::make_shared<WriteBehind>();
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(files_mutex_);
+    int fd = next_file_handle_++;
+    open_files_[fd] = file;
+    return fd;
+}
+
+std::shared_ptr<DistributedFileSystem::OpenFile> DistributedFileSystem::find_file(int fd) {
+    std::shared_lock<std::shared_mutex> lock(files_mutex_);
+    auto it = open_files_.find(fd);
+    return it == open_files_.end() ? nullptr : it->second;
+}
 
+// Completion that fulfils a future; the promise lives until both sides are done with it
+static DistributedFileSystem::IoCallback fulfil(std::future<size_t>& result) {
+    auto done = std::make_shared<std::promise<size_t>>();
+    result = done->get_future();
+    return [done](size_t bytes) { done->set_value(bytes); };
+}
 
-// ============================================================================
-// File: client_lib.cpp
-// ============================================================================
+size_t DistributedFileSystem::read(int fd, void* buffer, size_t size) {
+    return transfer(fd, false, {{AT_CURRENT_OFFSET, buffer, size}});
+}
 
-#include "client_lib.h"
-#include <iostream>
-#include <cstring>
+size_t DistributedFileSystem::write(int fd, const void* data, size_t size) {
+    return transfer(fd, true, {{AT_CURRENT_OFFSET, const_cast<void*>(data), size}});
+}
 
-DistributedFileSystem::DistributedFileSystem(const std::string& metadata_server_ip, 
-                                           uint16_t metadata_port)
-    : metadata_server_ip_(metadata_server_ip), metadata_port_(metadata_port), 
-      next_file_handle_(1) {
-    
-    metadata_client_ = std::make_unique<NetworkSocket>();
-    chunk_pool_ = std::make_unique<ConnectionPool>(20);
+size_t DistributedFileSystem::pread(int fd, void* buffer, size_t size, uint64_t offset) {
+    return transfer(fd, false, {{offset, buffer, size}});
 }
 
-DistributedFileSystem::~DistributedFileSystem() {
-    std::unique_lock<std::mutex> lock(files_mutex_);
-    for (auto& entry : open_files_) {
-        close(entry.first);
-    }
+size_t DistributedFileSystem::pwrite(int fd, const void* data, size_t size, uint64_t offset) {
+    return transfer(fd, true, {{offset, const_cast<void*>(data), size}});
 }
 
-bool DistributedFileSystem::reconnect_to_metadata_server() {
-    if (metadata_client_) {
-        metadata_client_->close_socket();
-    }
-    
-    metadata_client_ = std::make_unique<NetworkSocket>();
-    if (metadata_client_->connect_to_server(metadata_server_ip_, metadata_port_)) {
-        return true;
-    }
-    
-    std::cerr << "Failed to reconnect to metadata server" << std::endl;
-    return false;
+size_t DistributedFileSystem::readv(int fd, const std::vector<FileRange>& ranges) {
+    return transfer(fd, false, ranges);
 }
 
-int DistributedFileSystem::create_file(const std::string& path, uint32_t permissions) {
-    if (!metadata_client_ || !metadata_client_->is_connected()) {
-        if (!reconnect_to_metadata_server()) {
-            return -1;
+size_t DistributedFileSystem::writev(int fd, const std::vector<FileRange>& ranges) {
+    return transfer(fd, true, ranges);
+}
+
+std::future<size_t> DistributedFileSystem::read_async(int fd, void* buffer, size_t size) {
+    std::future<size_t> result;
+    submit(fd, false, {{AT_CURRENT_OFFSET, buffer, size}}, fulfil(result), false);
+    return result;
+}
+
+std::future<size_t> DistributedFileSystem::write_async(int fd, const void* data, size_t size) {
+    std::future<size_t> result;
+    submit(fd, true, {{AT_CURRENT_OFFSET, const_cast<void*>(data), size}}, fulfil(result), false);
+    return result;
+}
+
+void DistributedFileSystem::read_async(int fd, void* buffer, size_t size, IoCallback on_complete) {
+    submit(fd, false, {{AT_CURRENT_OFFSET, buffer, size}}, std::move(on_complete), false);
+}
+
+void DistributedFileSystem::write_async(int fd, const void* data, size_t size,
+                                        IoCallback on_complete) {
+    submit(fd, true, {{AT_CURRENT_OFFSET, const_cast<void*>(data), size}}, std::move(on_complete),
+           false);
+}
+
+size_t DistributedFileSystem::transfer(int fd, bool is_write, const std::vector<FileRange>& ranges) {
+    std::future<size_t> result;
+    submit(fd, is_write, ranges, fulfil(result), true);
+    return result.get();
+}
+
+void DistributedFileSystem::submit(int fd, bool is_write, const std::vector<FileRange>& ranges,
+                                   IoCallback on_complete, bool run_first_inline) {
+    std::vector<std::shared_ptr<IoRequest>> requests;
+    size_t buffered = 0;  // Bytes absorbed by write-behind, already complete
+    std::shared_ptr<OpenFile> file = find_file(fd);
+    if (file) {
+        std::unique_lock<std::mutex> lock(file->mutex);
+        for (const FileRange& range : ranges) {
+            if (!range.buffer || range.length == 0) {
+                continue;
+            }
+            std::shared_ptr<IoRequest> request = is_write ? claim_write(file, range, buffered)
+                                                          : claim_read(file, range);
+            if (request) {
+                requests.push_back(request);
+            }
         }
     }
     
-    // Send file creation request to metadata server
-    ProtocolFrame frame;
-    frame.magic = DFS_PROTOCOL_MAGIC;
-    frame.version = DFS_PROTOCOL_VERSION;
-    frame.message_type = OP_FILE_CREATE;
-    frame.payload_size = path.size() + 8; // path + permissions
-    
-    uint8_t* payload_ptr = frame.payload;
-    std::memcpy(payload_ptr, path.c_str(), path.size());
-    payload_ptr += path.size();
-    std::memcpy(payload_ptr, &permissions, 4);
-    
-    frame.checksum = NetworkSocket::calculate_crc32(frame.payload, frame.payload_size);
-    
-    if (!metadata_client_->send_frame(frame)) {
-        return -1;
+    if (requests.empty()) {
+        on_complete(buffered);
+        return;
     }
     
-    // Wait for acknowledgment
-    ProtocolFrame response;
-    if (!metadata_client_->recv_frame(response)) {
-        return -1;
+    if (requests.size() == 1 && buffered == 0) {
+        requests[0]->on_complete = std::move(on_complete);
+    } else {
+        // Several ranges: add up their results and complete once, after the last
+        struct Batch {
+            std::atomic<size_t> remaining;
+            std::atomic<size_t> bytes;
+            IoCallback on_complete;
+        };
+        auto batch = std::make_shared<Batch>();
+        batch->remaining.store(requests.size(), std::memory_order_relaxed);
+        batch->bytes.store(buffered, std::memory_order_relaxed);
+        batch->on_complete = std::move(on_complete);
+        for (auto& request : requests) {
+            request->on_complete = [batch](size_t bytes) {
+                batch->bytes.fetch_add(bytes, std::memory_order_relaxed);
+                if (batch->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    batch->on_complete(batch->bytes.load(std::memory_order_relaxed));
+                }
+            };
+        }
     }
     
-    if (response.message_type != OP_ACK) {
-        return -1;
+    // Everything is queued before the caller starts on its own span
+    for (size_t i = 0; i < requests.size(); ++i) {
+        start_transfer(requests[i], run_first_inline && i + 1 == requests.size());
     }
-    
-    // Parse response to get file_id
-    uint64_t file_id = 0;
-    std::memcpy(&file_id, response.payload, 8);
-    
-    invalidate_cache_entry(path);
-    return 0;
 }
 
-int DistributedFileSystem::delete_file(const std::string& path) {
-    if (!metadata_client_ || !metadata_client_->is_connected()) {
-        if (!reconnect_to_metadata_server()) {
-            return -1;
-        }
+// Caller holds file->mutex
+std::shared_ptr<DistributedFileSystem::IoRequest>
+DistributedFileSystem::claim_read(const std::shared_ptr<OpenFile>& file, const FileRange& range) {
+    OpenFileHandle& handle = file->handle;
+    bool advances = range.offset == AT_CURRENT_OFFSET;
+    uint64_t offset = advances ? handle.current_offset : range.offset;
+    
+    // Reads must see this handle's own buffered writes
+    if (handle.write_behind && !drain_write_behind(handle)) {
+        return nullptr;
     }
-    
-    ProtocolFrame frame;
-    frame.magic = DFS_PROTOCOL_MAGIC;
-    frame.version = DFS_PROTOCOL_VERSION;
-    frame.message_type = OP_FILE_DELETE;
-    frame.payload_size = path.size();
-    
-    std::memcpy(frame.payload, path.c_str(), path.size());
-    frame.checksum = NetworkSocket::calculate_crc32(frame.payload, frame.payload_size);
-    
-    if (!metadata_client_->send_frame(frame)) {
-        return -1;
+    if (offset >= handle.file_size) {
+        return nullptr;
     }
-    
-    ProtocolFrame response;
-    if (!metadata_client_->recv_frame(response)) {
-        return -1;
+    size_t size = std::min(range.length, (size_t)(handle.file_size - offset));
+    
+    // Read-ahead window doubles while reads stay sequential and resets on a seek.
+    // Positional reads leave it alone.
+    if (advances) {
+        if (offset == handle.last_read_end) {
+            handle.readahead_blocks = std::min((uint32_t)DFS_CLIENT_READAHEAD_MAX_BLOCKS,
+                                               std::max(1u, handle.readahead_blocks * 2));
+        } else {
+            handle.readahead_blocks = 0;
+        }
     }
     
-    invalidate_cache_entry(path);
-    return response.message_type == OP_ACK ? 0 : -1;
+    std::shared_ptr<IoRequest> request = make_request(file, offset, size);
+    request->dest = static_cast<uint8_t*>(range.buffer);
+    request->advances_position = advances;
+    if (advances) {
+        request->readahead_blocks = handle.readahead_blocks;
+        handle.current_offset += request->requested;
+        handle.last_read_end = handle.current_offset;
+    }
+    return request;
 }
 
-int DistributedFileSystem::mkdir(const std::string& path) {
-    if (!metadata_client_ || !metadata_client_->is_connected()) {
-        if (!reconnect_to_metadata_server()) {
-            return -1;
+// Caller holds file->mutex
+std::shared_ptr<DistributedFileSystem::IoRequest>
+DistributedFileSystem::claim_write(const std::shared_ptr<OpenFile>& file, const FileRange& range,
+                                   size_t& buffered) {
+    OpenFileHandle& handle = file->handle;
+    if (!handle.writable) {
+        return nullptr;
+    }
+    bool advances = range.offset == AT_CURRENT_OFFSET;
+    uint64_t offset = advances ? handle.current_offset : range.offset;
+    const uint8_t* src = static_cast<const uint8_t*>(range.buffer);
+    
+    if (handle.write_behind) {
+        size_t accepted = buffer_write_behind(handle, offset, src, range.length);
+        if (advances) {
+            handle.current_offset += accepted;
         }
+        buffered += accepted;
+        return nullptr;
     }
     
-    ProtocolFrame frame;
-    frame.magic = DFS_PROTOCOL_MAGIC;
-    frame.version = DFS_PROTOCOL_VERSION;
-    frame.message_type = OP_MKDIR;
-    frame.payload_size = path.size();
-    
-    std::memcpy(frame.payload, path.c_str(), path.size());
-    frame.checksum = NetworkSocket::calculate_crc32(frame.payload, frame.payload_size);
-    
-    if (!metadata_client_->send_frame(frame)) {
-        return -1;
+    // Only chunks already allocated to the file can be written; the rest is a short write
+    std::shared_ptr<IoRequest> request = make_request(file, offset, range.length);
+    request->is_write = true;
+    request->src = src;
+    request->advances_position = advances;
+    if (advances) {
+        handle.current_offset += request->requested;
     }
-    
-    ProtocolFrame response;
-    if (!metadata_client_->recv_frame(response)) {
+    ++file->writes_in_flight;
+    return request;
+}
+
+int DistributedFileSystem::fsync(int fd) {
+    std::shared_ptr<OpenFile> file = find_file(fd);
+    if (!file) {
         return -1;
     }
     
-    invalidate_cache_entry(path);
-    return response.message_type == OP_ACK ? 0 : -1;
+    // A settled write is already durable on the chunk servers; ones still in
+    // flight (write_async() and the like) are waited for
+    std::unique_lock<std::mutex> lock(file->mutex);
+    return settle_writes(*file, lock) ? 0 : -1;
 }
 
-bool DistributedFileSystem::query_metadata(const std::string& path, FileMetadata& metadata) {
-    // Check cache first
+int DistributedFileSystem::close(int fd) {
+    std::shared_ptr<OpenFile> file;
     {
-        std::unique_lock<std::mutex> lock(cache_mutex_);
-        auto it = metadata_cache_.find(path);
-        if (it != metadata_cache_.end()) {
-            time_t current_time = std::time(nullptr);
-            if (current_time - it->second.cached_time < DFS_METADATA_CACHE_TTL_SEC) {
-                metadata = it->second.metadata;
-                return true;
-            } else {
-                metadata_cache_.erase(it);
-            }
+        std::unique_lock<std::shared_mutex> lock(files_mutex_);
+        auto it = open_files_.find(fd);
+        if (it == open_files_.end()) {
+            return -1;
         }
+        file = it->second;
+        open_files_.erase(it);
     }
     
-    // Query from metadata server
-    if (!metadata_client_ || !metadata_client_->is_connected()) {
-        if (!reconnect_to_metadata_server()) {
-            return false;
+    // Writes still in flight are waited for so their failures are reported;
+    // reads already issued keep the entry alive and settle into it harmlessly
+    std::unique_lock<std::mutex> lock(file->mutex);
+    return settle_writes(*file, lock) ? 0 : -1;
+}
+
+// Caller holds file.mutex through lock; false if any write since open failed
+bool DistributedFileSystem::settle_writes(OpenFile& file, std::unique_lock<std::mutex>& lock) {
+    file.writes_settled.wait(lock, [&file] { return file.writes_in_flight == 0; });
+    bool drained = !file.handle.write_behind || drain_write_behind(file.handle);
+    return drained && !file.write_failed;
+}
+
+size_t DistributedFileSystem::buffer_write_behind(OpenFileHandle& handle, uint64_t offset, 
+                                                  const uint8_t* data, size_t size) {
+    WriteBehind& wb = *handle.write_behind;
+    {
+        std::unique_lock<std::mutex> lock(wb.mutex);
+        if (wb.failed) {
+            return 0;
         }
     }
     
-    ProtocolFrame frame;
-    frame.magic = DFS_PROTOCOL_MAGIC;
-    frame.version = DFS_PROTOCOL_VERSION;
-    frame.message_type = OP_METADATA_QUERY;
-    frame.payload_size = path.size();
+    // A seek ends the current run. Earlier flushes may overlap the new range,
+    // so let them land first to keep writes ordered.
+    if (!wb.buffer.empty() && offset != wb.buffer_offset + wb.buffer.size()) {
+        drain_write_behind(handle);
+    }
     
-    std::memcpy(frame.payload, path.c_str(), path.size());
-    frame.checksum = NetworkSocket::calculate_crc32(frame.payload, frame.payload_size);
+    uint64_t allocated_end = (uint64_t)handle.chunks.size() * DFS_CHUNK_SIZE_BYTES;
+    size_t accepted = 0;
+    while (accepted < size) {
+        uint64_t position = offset + accepted;
+        if (position >= allocated_end) {
+            break;  // Short write, as in the synchronous path
+        }
+        
+        if (wb.buffer.empty()) {
+            wb.buffer_offset = position;
+            wb.buffer.reserve(DFS_CLIENT_WRITE_BEHIND_BYTES);
+        }
+        
+        uint64_t chunk_end = (position / DFS_CHUNK_SIZE_BYTES + 1) * DFS_CHUNK_SIZE_BYTES;
+        size_t room = std::min((uint64_t)(DFS_CLIENT_WRITE_BEHIND_BYTES - wb.buffer.size()), 
+                               chunk_end - position);
+        size_t length = std::min(size - accepted, room);
+        wb.buffer.insert(wb.buffer.end(), data + accepted, data + accepted + length);
+        accepted += length;
+        
+        if (wb.buffer.size() == DFS_CLIENT_WRITE_BEHIND_BYTES || 
+            wb.buffer_offset + wb.buffer.size() == chunk_end) {
+            flush_write_behind(handle);
+        }
+    }
     
-    if (!metadata_client_->send_frame(frame)) {
-        return false;
+    handle.file_size = std::max(handle.file_size, offset + accepted);
+    return accepted;
+}
+
+void DistributedFileSystem::flush_write_behind(OpenFileHandle& handle) {
+    WriteBehind& wb = *handle.write_behind;
+    if (wb.buffer.empty()) {
+        return;
     }
     
-    ProtocolFrame response;
-    if (!metadata_client_->recv_frame(response)) {
-        return false;
+    struct PendingWrite {
+        size_t chunk_index;
+        ChunkHandle chunk;
+        uint32_t chunk_offset;
+        std::vector<uint8_t> data;
+    };
+    auto pending = std::make_shared<PendingWrite>();
+    pending->chunk_index = wb.buffer_offset / DFS_CHUNK_SIZE_BYTES;
+    pending->chunk = handle.chunks[pending->chunk_index];
+    pending->chunk_offset = wb.buffer_offset % DFS_CHUNK_SIZE_BYTES;
+    pending->data.swap(wb.buffer);
+    size_t length = pending->data.size();
+    
+    // Backpressure: bound the bytes a writer can have outstanding
+    {
+        std::unique_lock<std::mutex> lock(wb.mutex);
+        wb.drained.wait(lock, [&wb, length] {
+            return wb.inflight_bytes == 0 || 
+                   wb.inflight_bytes + length <= DFS_CLIENT_WRITE_BEHIND_INFLIGHT_BYTES;
+        });
+        wb.inflight_bytes += length;
     }
     
-    // Parse response (simplified)
-    if (response.payload_size >= sizeof(FileMetadata)) {
-        std::memcpy(&metadata, response.payload, sizeof(FileMetadata));
+    std::shared_ptr<WriteBehind> state = handle.write_behind;
+    io_pool_->enqueue([this, state, pending] {
+        const ChunkHandle& chunk = pending->chunk;
+        size_t length = pending->data.size();
+        uint32_t version = 0;
+        bool ok = write_chunk(chunk, pending->chunk_offset, pending->data.data(), length, version);
+        block_cache_->invalidate(chunk.chunk_id, pending->chunk_offset, length);
         
-        // Cache the result
         {
-            std::unique_lock<std::mutex> lock(cache_mutex_);
-            metadata_cache_[path] = {metadata, std::time(nullptr)};
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->inflight_bytes -= length;
+            state->failed = state->failed || !ok;
+            if (ok) {
+                uint32_t& newest = state->chunk_versions[pending->chunk_index];
+                newest = std::max(newest, version);
+            }
         }
-        
-        return true;
-    }
-    
-    return false;
+        state->drained.notify_all();
+    });
 }
 
-bool DistributedFileSystem::get_file_info(const std::string& path, FileMetadata& metadata) {
-    return query_metadata(path, metadata);
+bool DistributedFileSystem::drain_write_behind(OpenFileHandle& handle) {
+    flush_write_behind(handle);
+    
+    WriteBehind& wb = *handle.write_behind;
+    std::unique_lock<std::mutex> lock(wb.mutex);
+    wb.drained.wait(lock, [&wb] { return wb.inflight_bytes == 0; });
+    for (const auto& written : wb.chunk_versions) {
+        ChunkHandle& chunk = handle.chunks[written.first];
+        chunk.version = std::max(chunk.version, written.second);
+    }
+    wb.chunk_versions.clear();
+    return !wb.failed;
 }
 
-int DistributedFileSystem::open(const std::string& path, int flags) {
-    FileMetadata metadata;
-    if (!query_metadata(path, metadata)) {
-        return -1;
+std::vector<DistributedFileSystem::ChunkSpan> 
+DistributedFileSystem::map_chunk_spans(const OpenFileHandle& handle, uint64_t offset, size_t size) {
+    std::vector<ChunkSpan> spans;
+    size_t buffer_offset = 0;
+    
+    while (buffer_offset < size) {
+        uint64_t position = offset + buffer_offset;
+        size_t chunk_index = position / DFS_CHUNK_SIZE_BYTES;
+        if (chunk_index >= handle.chunks.size()) {
+            break;
+        }
+        
+        ChunkSpan span;
+        span.chunk_index = chunk_index;
+        span.chunk_offset = position % DFS_CHUNK_SIZE_BYTES;
+        span.length = std::min((uint64_t)(size - buffer_offset), 
+                               (uint64_t)(DFS_CHUNK_SIZE_BYTES - span.chunk_offset));
+        span.buffer_offset = buffer_offset;
+        spans.push_back(span);
+        
+        buffer_offset += span.length;
     }
     
-    std::unique_lock<std::mutex> lock(files_mutex_);
-    int fd = next_file_handle_++;
-    
-    OpenFileHandle handle;
-    handle.path = path;
-    handle.file_id = metadata.file_id;
-    handle.current_offset = 0;
-    handle.chunks = metadata.chunks;
-    handle.writable = (flags & 0x01) != 0;  // Simplified flag check
-    handle.open_time = std::time(nullptr);
-    
-    open_files_[fd] = handle;
-    return fd;
+    return spans;
 }
 
-size_t DistributedFileSystem::read(int fd, void* buffer, size_t size) {
-    if (!buffer || size == 0) {
-        return 0;
+std::shared_ptr<DistributedFileSystem::IoRequest> 
+DistributedFileSystem::make_request(const std::shared_ptr<OpenFile>& file, uint64_t offset, 
+                                    size_t size) {
+    const OpenFileHandle& handle = file->handle;
+    auto request = std::make_shared<IoRequest>();
+    request->file = file;
+    request->is_write = false;
+    request->offset = offset;
+    request->advances_position = true;
+    request->dest = nullptr;
+    request->src = nullptr;
+    request->readahead_blocks = 0;
+    request->issued_ns = metrics_now_ns();
+    
+    // Copy only the touched chunk handles, so spans run without the file's lock
+    size_t first_chunk = offset / DFS_CHUNK_SIZE_BYTES;
+    uint64_t base = (uint64_t)first_chunk * DFS_CHUNK_SIZE_BYTES;
+    if (first_chunk < handle.chunks.size()) {
+        size_t last_chunk = std::min((size_t)((offset + size - 1) / DFS_CHUNK_SIZE_BYTES),
+                                     handle.chunks.size() - 1);
+        request->window.chunks.assign(handle.chunks.begin() + first_chunk, 
+                                      handle.chunks.begin() + last_chunk + 1);
     }
+    request->window.file_size = handle.file_size > base ? handle.file_size - base : 0;
+    request->spans = map_chunk_spans(request->window, offset - base, size);
     
-    std::unique_lock<std::mutex> lock(files_mutex_);
-    auto it = open_files_.find(fd);
-    if (it == open_files_.end()) {
-        return 0;
+    request->requested = 0;
+    for (const ChunkSpan& span : request->spans) {
+        request->requested += span.length;
     }
-    
-    OpenFileHandle& handle = it->second;
-    std::vector<uint8_t> data;
-    
-    // Simplified: read from first chunk
-    if (handle.chunks.empty()) {
-        return 0;
+    request->succeeded.assign(request->spans.size(), 0);
+    request->remaining.store(request->spans.size(), std::memory_order_relaxed);
+    return request;
+}
+
+void DistributedFileSystem::start_transfer(const std::shared_ptr<IoRequest>& request, 
+                                           bool run_first_inline) {
+    if (request->spans.empty()) {
+        complete_transfer(*request);
+        return;
     }
     
-    uint64_t chunk_id = handle.chunks[0].chunk_id;
-    if (!read_chunk(chunk_id, handle.current_offset, size, data)) {
-        return 0;
+    size_t first_pooled = run_first_inline ? 1 : 0;
+    std::vector<Task> tasks;
+    tasks.reserve(request->spans.size() - first_pooled);
+    for (size_t i = first_pooled; i < request->spans.size(); ++i) {
+        tasks.emplace_back([this, request, i] {
+            finish_span(request, i, transfer_span(*request, request->spans[i]));
+        });
+    }
+    if (!tasks.empty()) {
+        io_pool_->enqueue_bulk(std::move(tasks));
     }
     
-    std::memcpy(buffer, data.data(), std::min(data.size(), size));
-    handle.current_offset += data.size();
-    
-    return data.size();
+    if (run_first_inline) {
+        finish_span(request, 0, transfer_span(*request, request->spans[0]));
+    }
 }
 
-size_t DistributedFileSystem::write(int fd, const void* data, size_t size) {
-    if (!data || size == 0) {
-        return 0;
+bool DistributedFileSystem::transfer_span(IoRequest& request, const ChunkSpan& span) {
+    const ChunkHandle& chunk = request.window.chunks[span.chunk_index];
+    if (request.is_write) {
+        uint32_t version = 0;
+        bool ok = write_chunk(chunk, span.chunk_offset, request.src + span.buffer_offset, span.length,
+                              version);
+        block_cache_->invalidate(chunk.chunk_id, span.chunk_offset, span.length);
+        
+        // Later reads ask for this version, which replicas that missed the write refuse
+        if (ok) {
+            std::unique_lock<std::mutex> lock(request.file->mutex);
+            size_t chunk_index = request.offset / DFS_CHUNK_SIZE_BYTES + span.chunk_index;
+            std::vector<ChunkHandle>& chunks = request.file->handle.chunks;
+            if (chunk_index < chunks.size() && chunks[chunk_index].chunk_id == chunk.chunk_id) {
+                chunks[chunk_index].version = std::max(chunks[chunk_index].version, version);
+            }
+        }
+        return ok;
     }
     
-    std::unique_lock<std::mutex> lock(files_mutex_);
-    auto it = open_files_.find(fd);
-    if (it == open_files_.end()) {
-        return 0;
+    // Small spans go through the block cache; large ones stream straight into the buffer
+    if (span.length >= CACHE_BYPASS_BYTES) {
+        return read_chunk(chunk, span.chunk_offset, span.length, request.dest + span.buffer_offset);
     }
+    return read_span_cached(request.window, span, request.dest + span.buffer_offset);
+}
+
+void DistributedFileSystem::finish_span(const std::shared_ptr<IoRequest>& request, size_t index, 
+                                        bool ok) {
+    request->succeeded[index] = ok;
     
-    OpenFileHandle& handle = it->second;
-    if (!handle.writable) {
-        return 0;
+    // acq_rel makes every span's result visible to whichever task finishes last
+    if (request->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        complete_transfer(*request);
     }
-    
-    // Simplified: write to first chunk
-    if (handle.chunks.empty()) {
-        return 0;
+}
+
+void DistributedFileSystem::complete_transfer(IoRequest& request) {
+    size_t completed = 0;
+    for (size_t i = 0; i < request.spans.size() && request.succeeded[i]; ++i) {
+        completed += request.spans[i].length;
     }
     
-    uint64_t chunk_id = handle.chunks[0].chunk_id;
-    std::vector<uint8_t> write_data((uint8_t*)data, (uint8_t*)data + size);
+    {
+        std::unique_lock<std::mutex> lock(request.file->mutex);
+        OpenFileHandle& handle = request.file->handle;
+        uint64_t claimed_end = request.offset + request.requested;
+        uint64_t end = request.offset + completed;
+        
+        // A short transfer leaves the position just past its last good byte,
+        // unless a later call has already moved it
+        if (request.advances_position && completed < request.requested && 
+            handle.current_offset == claimed_end) {
+            handle.current_offset = end;
+            if (!request.is_write) {
+                handle.last_read_end = end;
+            }
+        }
+        
+        if (request.is_write) {
+            handle.file_size = std::max(handle.file_size, end);
+            request.file->write_failed = request.file->write_failed || completed < request.requested;
+            if (--request.file->writes_in_flight == 0) {
+                request.file->writes_settled.notify_all();
+            }
+        } else if (request.readahead_blocks > 0 && completed == request.requested) {
+            schedule_readahead(handle, claimed_end, request.readahead_blocks);
+        }
+    }
     
-    if (!write_chunk(chunk_id, handle.current_offset, write_data)) {
+    (request.is_write ? write_time_ : read_time_).record_since(request.issued_ns);
+    request.on_complete(completed);
+}
+
+
+// Bytes of a cache block that exist in the file (the last block may be short)
+uint32_t DistributedFileSystem::block_length(const OpenFileHandle& handle, size_t chunk_index, 
+                                             uint32_t block) {
+    uint64_t block_start = (uint64_t)chunk_index * DFS_CHUNK_SIZE_BYTES + 
+                           (uint64_t)block * DFS_CLIENT_CACHE_BLOCK_BYTES;
+    if (block_start >= handle.file_size) {
         return 0;
     }
-    
-    handle.current_offset += size;
-    return size;
+    return std::min((uint64_t)DFS_CLIENT_CACHE_BLOCK_BYTES, handle.file_size - block_start);
 }
 
-int DistributedFileSystem::close(int fd) {
-    std::unique_lock<std::mutex> lock(files_mutex_);
-    auto it = open_files_.find(fd);
-    if (it == open_files_.end()) {
-        return -1;
+BlockCache::Fetcher DistributedFileSystem::block_fetcher(const ChunkHandle& chunk, uint32_t block,
+                                                         uint32_t length) {
+    return [this, &chunk, block, length](std::vector<uint8_t>& data) {
+        data.resize(length);
+        return read_chunk(chunk, block * DFS_CLIENT_CACHE_BLOCK_BYTES, length, data.data());
+    };
+}
+
+bool DistributedFileSystem::read_span_cached(const OpenFileHandle& handle, const ChunkSpan& span,
+                                             uint8_t* dest) {
+    const ChunkHandle& chunk = handle.chunks[span.chunk_index];
+    uint32_t done = 0;
+    
+    while (done < span.length) {
+        uint32_t position = span.chunk_offset + done;
+        uint32_t block = position / DFS_CLIENT_CACHE_BLOCK_BYTES;
+        uint32_t block_offset = position % DFS_CLIENT_CACHE_BLOCK_BYTES;
+        uint32_t length = std::min(span.length - done, DFS_CLIENT_CACHE_BLOCK_BYTES - block_offset);
+        
+        BlockCache::Key key = {chunk.chunk_id, chunk.version, block};
+        if (!block_cache_->read(key, block_offset, length, dest + done,
+                                block_fetcher(chunk, block, block_length(handle, span.chunk_index, block)))) {
+            return false;
+        }
+        done += length;
     }
     
-    open_files_.erase(it);
-    return 0;
+    return true;
 }
 
-bool DistributedFileSystem::read_chunk(uint64_t chunk_id, uint32_t offset, 
-                                      uint32_t length, std::vector<uint8_t>& data) {
-    // Simplified: connect to first replica and read
-    FileMetadata dummy;
-    if (dummy.chunks.empty()) {
-        return false;
+// Fetch the blocks following offset in the background, one pool task per block
+void DistributedFileSystem::schedule_readahead(const OpenFileHandle& handle, uint64_t offset, 
+                                               uint32_t num_blocks) {
+    uint64_t first = offset / DFS_CLIENT_CACHE_BLOCK_BYTES;
+    for (uint64_t b = first; b < first + num_blocks; ++b) {
+        uint64_t position = b * DFS_CLIENT_CACHE_BLOCK_BYTES;
+        size_t chunk_index = position / DFS_CHUNK_SIZE_BYTES;
+        if (position >= handle.file_size || chunk_index >= handle.chunks.size()) {
+            break;
+        }
+        
+        // The task owns a copy of the chunk handle; the open file may be closed meanwhile
+        auto chunk = std::make_shared<ChunkHandle>(handle.chunks[chunk_index]);
+        uint32_t block = (position % DFS_CHUNK_SIZE_BYTES) / DFS_CLIENT_CACHE_BLOCK_BYTES;
+        uint32_t length = block_length(handle, chunk_index, block);
+        BlockCache::Key key = {chunk->chunk_id, chunk->version, block};
+        if (block_cache_->contains(key)) {
+            continue;
+        }
+        
+        io_pool_->enqueue([this, chunk, key, length] {
+            block_cache_->prefetch(key, block_fetcher(*chunk, key.block, length));
+        });
+    }
+}
+
+// Try the chunk's replicas in turn, starting at a different one per chunk so a
+// striped read fans out across servers
+static uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+bool DistributedFileSystem::read_chunk(const ChunkHandle& chunk, uint32_t offset, 
+                                      uint32_t length, uint8_t* dest) {
+    uint64_t start_ns = metrics_now_ns();
+    std::vector<size_t> order = replica_selector_->rank(chunk.replicas);
+    size_t next = 0;
+    bool ok = false;
+    
+    // Block-sized reads race a second replica once the first runs past the p95
+    uint64_t hedge_delay_us = replica_selector_->hedge_delay_us();
+    if (order.size() >= 2 && hedge_delay_us > 0 && length <= DFS_CLIENT_CACHE_BLOCK_BYTES) {
+        ok = read_chunk_hedged(chunk, chunk.replicas[order[0]], chunk.replicas[order[1]], 
+                               offset, length, dest, hedge_delay_us);
+        next = 2;
     }
     
-    auto& chunk = dummy.chunks[0];
-    if (chunk.replicas.empty()) {
-        return false;
+    // Plain failover down the ranking
+    for (; !ok && next < order.size(); ++next) {
+        ok = read_chunk_from(chunk.replicas[order[next]], chunk, offset, length, dest);
     }
     
-    auto& replica = chunk.replicas[0];
+    chunk_requests_.record(OP_READ, metrics_now_ns() - start_ns,
+                           ok ? DFS_FRAME_HEADER_SIZE + sizeof(ReadResponseHeader) + length : 0,
+                           DFS_FRAME_HEADER_SIZE + sizeof(ReadRequestHeader));
+    return ok;
+}
+
+bool DistributedFileSystem::read_chunk_from(const ChunkLocation& replica, const ChunkHandle& chunk,
+                                           uint32_t offset, uint32_t length, uint8_t* dest) {
+    auto start = std::chrono::steady_clock::now();
+    replica_selector_->begin(replica);
+    
+    bool poolable = false;
     auto socket = chunk_pool_->acquire(replica.ip_address, replica.port);
-    if (!socket) {
-        return false;
+    bool ok = socket && send_read_request(*socket, chunk, offset, length) &&
+              recv_read_response(*socket, length, dest, poolable);
+    
+    replica_selector_->end(replica, ok, elapsed_us(start), length <= DFS_CLIENT_CACHE_BLOCK_BYTES);
+    if (poolable) {
+        chunk_pool_->release(replica.ip_address, replica.port, socket);
     }
+    return ok;
+}
+
+// Ask primary; if it has not answered within hedge_delay_us (or fails first), ask
+// backup too and take whichever answers. Both responses are read on this thread
+// into dest, one after the other, so no staging buffer is needed.
+bool DistributedFileSystem::read_chunk_hedged(const ChunkHandle& chunk, const ChunkLocation& primary,
+                                             const ChunkLocation& backup, uint32_t offset, 
+                                             uint32_t length, uint8_t* dest, uint64_t hedge_delay_us) {
+    struct Attempt {
+        const ChunkLocation* replica;
+        std::shared_ptr<NetworkSocket> socket;
+        std::chrono::steady_clock::time_point start;
+        bool pending;  // Request sent, response not consumed yet
+    };
+    Attempt attempts[2];
+    attempts[0].replica = &primary;
+    attempts[1].replica = &backup;
+    size_t issued = 0;
+    
+    auto issue = [&]() {
+        Attempt& attempt = attempts[issued];
+        attempt.start = std::chrono::steady_clock::now();
+        replica_selector_->begin(*attempt.replica, issued == 1);
+        attempt.socket = chunk_pool_->acquire(attempt.replica->ip_address, attempt.replica->port);
+        attempt.pending = attempt.socket && send_read_request(*attempt.socket, chunk, offset, length);
+        if (!attempt.pending) {
+            replica_selector_->end(*attempt.replica, false, 0, false);
+        }
+        issued++;
+    };
     
-    ProtocolFrame frame;
-    frame.magic = DFS_PROTOCOL_MAGIC;
-    frame.version = DFS_PROTOCOL_VERSION;
-    frame.message_type = OP_READ;
+    issue();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(hedge_delay_us);
+    while (true) {
+        if (!attempts[0].pending && (issued < 2 || !attempts[1].pending)) {
+            if (issued == 2) {
+                return false;
+            }
+            issue();  // Primary failed before the hedge delay; do not wait for it
+            deadline = std::chrono::steady_clock::now() + 
+                       std::chrono::milliseconds(DFS_NETWORK_TIMEOUT_MS);
+            continue;
+        }
+        
+        struct pollfd fds[2];
+        Attempt* polled[2];
+        nfds_t nfds = 0;
+        for (size_t i = 0; i < issued; ++i) {
+            if (attempts[i].pending) {
+                fds[nfds].fd = attempts[i].socket->get_socket_fd();
+                fds[nfds].events = POLLIN;
+                fds[nfds].revents = 0;
+                polled[nfds++] = &attempts[i];
+            }
+        }
+        
+        auto remaining = std::max(std::chrono::steady_clock::duration::zero(), 
+                                  deadline - std::chrono::steady_clock::now());
+        struct timespec timeout;
+        timeout.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(remaining).count();
+        timeout.tv_nsec = (remaining - std::chrono::seconds(timeout.tv_sec)).count();
+        int ready = ppoll(fds, nfds, &timeout, nullptr);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        
+        if (ready <= 0) {
+            if (ready == 0 && issued == 1) {
+                issue();  // Primary is slow: hedge
+                deadline = std::chrono::steady_clock::now() + 
+                           std::chrono::milliseconds(DFS_NETWORK_TIMEOUT_MS);
+                continue;
+            }
+            for (size_t i = 0; i < nfds; ++i) {
+                replica_selector_->end(*polled[i]->replica, false, 0, false);
+            }
+            return false;
+        }
+        
+        for (size_t i = 0; i < nfds; ++i) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            Attempt& attempt = *polled[i];
+            bool poolable = false;
+            bool ok = recv_read_response(*attempt.socket, length, dest, poolable);
+            attempt.pending = false;
+            replica_selector_->end(*attempt.replica, ok, elapsed_us(attempt.start), true);
+            if (poolable) {
+                chunk_pool_->release(attempt.replica->ip_address, attempt.replica->port, 
+                                     attempt.socket);
+            }
+            if (!ok) {
+                continue;
+            }
+            
+            // The loser still owes a response, so its socket is dropped, not pooled.
+            // A slow primary's wait so far still informs its latency estimate.
+            for (size_t j = 0; j < issued; ++j) {
+                if (attempts[j].pending) {
+                    replica_selector_->end(*attempts[j].replica, true, elapsed_us(attempts[j].start), 
+                                           j == 0);
+                }
+            }
+            return true;
+        }
+    }
+}
+
+bool DistributedFileSystem::send_read_request(NetworkSocket& socket, const ChunkHandle& chunk,
+                                              uint32_t offset, uint32_t length) {
+    ProtocolFrame frame(OP_READ);
     
-    FileReadRequest read_req;
-    read_req.chunk_id = chunk_id;
+    ReadRequestHeader read_req;
+    read_req.chunk_id = chunk.chunk_id;
     read_req.offset = offset;
     read_req.length = length;
     read_req.version = chunk.version;
+    read_req.reserved = 0;
     
-    frame.payload_size = sizeof(FileReadRequest);
-    std::memcpy(frame.payload, &read_req, frame.payload_size);
-    frame.checksum = NetworkSocket::calculate_crc32(frame.payload, frame.payload_size);
-    
-    if (!socket->send_frame(frame)) {
+    frame.set_payload(&read_req, sizeof(ReadRequestHeader));
+    frame.checksum = NetworkSocket::calculate_crc32(frame.payload.data(), frame.payload_size);
+    return socket.send_frame(frame);
+}
+
+bool DistributedFileSystem::recv_read_response(NetworkSocket& socket, uint32_t length, uint8_t* dest,
+                                               bool& poolable) {
+    poolable = false;
+    
+    FrameHeader header;
+    ReadResponseHeader read_resp;
+    if (!socket.recv_frame_header(header) || header.payload_size < sizeof(ReadResponseHeader) ||
+        !socket.recv_exact(&read_resp, sizeof(ReadResponseHeader))) {
         return false;
     }
     
-    ProtocolFrame response;
-    if (!socket->recv_frame(response)) {
+    size_t data_length = header.payload_size - sizeof(ReadResponseHeader);
+    if (read_resp.status != 0 && data_length == 0) {
+        poolable = true;
         return false;
     }
-    
-    FileReadResponse* read_resp = (FileReadResponse*)response.payload;
-    if (read_resp->success) {
-        data = read_resp->data;
-        return true;
+    if (read_resp.status != 0 || data_length != length) {
+        return false;  // Unread payload left on the socket, so it is not pooled
     }
     
-    return false;
-}
-
-bool DistributedFileSystem::write_chunk(uint64_t chunk_id, uint32_t offset,
-                                       const std::vector<uint8_t>& data) {
-    // Simplified: connect to first replica and write
-    FileMetadata dummy;
-    if (dummy.chunks.empty()) {
+    // Data lands in the caller's buffer; the frame CRC is checked over it in place
+    if (!socket.recv_exact(dest, length)) {
+        return false;
+    }
+    uint32_t crc = NetworkSocket::extend_crc32(
+        NetworkSocket::calculate_crc32((const uint8_t*)&read_resp, sizeof(ReadResponseHeader)),
+        dest, length);
+    if (crc != header.checksum) {
         return false;
     }
     
-    auto& chunk = dummy.chunks[0];
+    poolable = true;
+    return true;
+}
+
+bool DistributedFileSystem::write_chunk(const ChunkHandle& chunk, uint32_t offset,
+                                       const uint8_t* data, size_t length, uint32_t& version) {
     if (chunk.replicas.empty()) {
         return false;
     }
     
-    auto& replica = chunk.replicas[0];
+    // Writes enter at the head of the replica list and are pipelined down the
+    // rest of it by the chunk servers; tracking them still keeps in-flight
+    // counts and backoff honest. DFS_MINIMUM_REPLICAS of them must store the
+    // data. One that missed it stays at an older version: it refuses reads
+    // asking for the new one, and once its heartbeats show it still behind,
+    // the metadata server has it deleted and re-replicates the chunk
+    const ChunkLocation& replica = chunk.replicas[0];
+    uint32_t required = std::min((uint32_t)chunk.replicas.size(), (uint32_t)DFS_MINIMUM_REPLICAS);
+    auto start = std::chrono::steady_clock::now();
+    replica_selector_->begin(replica);
+    uint32_t written = write_chunk_to(replica, chunk, offset, data, length, version);
+    uint64_t latency_us = elapsed_us(start);
+    replica_selector_->end(replica, written > 0, latency_us, false);
+    chunk_requests_.record(OP_WRITE, latency_us * 1000,
+                           written > 0 ? DFS_FRAME_HEADER_SIZE + sizeof(WriteResponseHeader) : 0,
+                           DFS_FRAME_HEADER_SIZE + sizeof(WriteRequestHeader) + length);
+    return written >= required;
+}
+
+uint32_t DistributedFileSystem::write_chunk_to(const ChunkLocation& replica, const ChunkHandle& chunk,
+                                              uint32_t offset, const uint8_t* data, size_t length,
+                                              uint32_t& version) {
     auto socket = chunk_pool_->acquire(replica.ip_address, replica.port);
     if (!socket) {
-        return false;
+        return 0;
     }
     
-    ProtocolFrame frame;
-    frame.magic = DFS_PROTOCOL_MAGIC;
-    frame.version = DFS_PROTOCOL_VERSION;
-    frame.message_type = OP_WRITE;
+    FrameHeader header = make_frame_header(OP_WRITE);
     
-    FileWriteRequest write_req;
-    write_req.chunk_id = chunk_id;
-    write_req.offset = offset;
-    write_req.data = data;
-    write_req.version = chunk.version;
-    
-    frame.payload_size = sizeof(FileWriteRequest) + data.size();
-    std::memcpy(frame.payload, &write_req, sizeof(FileWriteRequest));
-    std::memcpy(frame.payload + sizeof(FileWriteRequest), data.data(), data.size());
-    frame.checksum = NetworkSocket::calculate_crc32(frame.payload, frame.payload_size);
+    std::vector<uint8_t> chain;
+    WireWriter chain_out(chain);
+    encode_write_chain(chain_out, chunk.replicas);
     
-    if (!socket->send_frame(frame)) {
-        return false;
+    WriteRequestHeader write_req;
+    write_req.chunk_id = chunk.chunk_id;
+    write_req.offset = offset;
+    write_req.length = length;
+    write_req.version = 0;
+    write_req.chain_bytes = chain.size();
+    
+    // Request header, chain and caller's data go out as three iovecs, no staging copy
+    struct iovec payload_iov[3];
+    payload_iov[0].iov_base = &write_req;
+    payload_iov[0].iov_len = sizeof(WriteRequestHeader);
+    payload_iov[1].iov_base = chain.data();
+    payload_iov[1].iov_len = chain.size();
+    payload_iov[2].iov_base = const_cast<uint8_t*>(data);
+    payload_iov[2].iov_len = length;
+    
+    header.payload_size = sizeof(WriteRequestHeader) + chain.size() + length;
+    uint32_t crc = NetworkSocket::calculate_crc32((const uint8_t*)&write_req, sizeof(WriteRequestHeader));
+    crc = NetworkSocket::extend_crc32(crc, chain.data(), chain.size());
+    header.checksum = NetworkSocket::extend_crc32(crc, data, length);
+    
+    if (!socket->send_frame(header, payload_iov, 3)) {
+        return 0;
     }
     
     ProtocolFrame response;
     if (!socket->recv_frame(response)) {
-        return false;
+        return 0;
     }
+    chunk_pool_->release(replica.ip_address, replica.port, socket);
     
-    FileWriteResponse* write_resp = (FileWriteResponse*)response.payload;
-    return write_resp->success;
-}
-
-void DistributedFileSystem::invalidate_cache_entry(const std::string& path) {
-    std::unique_lock<std::mutex> lock(cache_mutex_);
-    metadata_cache_.erase(path);
+    if (response.payload_size < sizeof(WriteResponseHeader)) {
+        return 0;
+    }
+    
+    WriteResponseHeader result;
+    std::memcpy(&result, response.payload.data(), sizeof(WriteResponseHeader));
+    version = result.version;
+    return result.replicas_written;
 }
 
 // Example: ChunkLocation select_nearest_replica helper
@@ -483,8 +2279,7 @@ ChunkLocation DistributedFileSystem::select_nearest_replica(const std::vector<Ch
         return ChunkLocation();
     }
     
-    // Simplified: return first replica (in production, use latency-based selection)
-    return replicas[0];
+    return replicas[replica_selector_->rank(replicas)[0]];
 }
 
 std::vector<ChunkLocation> DistributedFileSystem::select_replicas(const std::vector<ChunkHandle>& chunks) {
@@ -9,6 +9,7 @@
 #define DFS_COMMON_H
 
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <ctime>
@@ -23,18 +24,48 @@ const int DFS_REPLICATION_FACTOR = 3;
 const int DFS_MINIMUM_REPLICAS = 2;
 const int DFS_HEARTBEAT_INTERVAL_SEC = 3;
 const int DFS_HEARTBEAT_TIMEOUT_SEC = 60;
+const uint32_t DFS_BLOCK_REPORT_SLICES = 64;  // Full chunk lists go out one slice at a time...
+const int DFS_BLOCK_REPORT_INTERVAL_SEC = 3600;  // ...spread over this long in steady state...
+const uint32_t DFS_BLOCK_REPORT_URGENT_SLICES = 8;  // ...or this many per heartbeat when the MDS asks
+const uint32_t DFS_HEARTBEAT_MAX_DELTAS = 65536;  // Pending changes beyond this fall back to a report
+const uint32_t DFS_PLACEMENT_LOAD_SCALE = 16;  // Queued requests that halve a server's share of new chunks
+const int DFS_PLACEMENT_ATTEMPTS = 8;  // Draws per replica looking for a zone/rack not yet used
+const int DFS_MANIFEST_CHECKPOINT_SEC = 60;
+const int DFS_MAX_OPEN_CHUNK_FILES = 1024;  // Descriptors a chunk server keeps cached
 const int DFS_REPLICATION_TIMEOUT_SEC = 600;
-const int DFS_RECOVERY_PARALLELISM = 5;
-const int DFS_METADATA_CACHE_TTL_SEC = 300;
+const int DFS_STALE_REPLICA_GRACE_SEC = 10;  // A replica still behind a chunk's newest version this long is dropped
+const int DFS_RECOVERY_PARALLELISM = 5;  // Re-replication copies in flight across the cluster...
+const uint32_t DFS_RECOVERY_STREAMS_PER_SERVER = 2;  // ...at most this many per source or target...
+const uint64_t DFS_RECOVERY_BYTES_PER_SEC = 256ull * 1024 * 1024;  // ...within this budget
+const int DFS_METADATA_CACHE_TTL_SEC = 300;  // Fallback when a lookup carries no lease
+const int DFS_METADATA_LEASE_SEC = 3600;  // Lookup leases; changes are pushed as invalidations
+const uint32_t DFS_METADATA_BATCH_MAX_OPS = 1024;  // Operations per OP_BATCH_METADATA frame
+const int DFS_METADATA_SNAPSHOT_SEC = 600;  // Namespace snapshots bound log replay at restart...
+const uint64_t DFS_METADATA_SNAPSHOT_LOG_BYTES = 256ull * 1024 * 1024;  // ...as does this much log
 const int DFS_CLIENT_CACHE_SIZE_MB = 100;
+const int DFS_CLIENT_IO_PARALLELISM = 8;  // Concurrent per-chunk requests per client
+const int DFS_CLIENT_READAHEAD_MAX_BLOCKS = 16;
+const int DFS_CLIENT_METADATA_CACHE_ENTRIES = 65536;  // Paths, including negative entries
 const int DFS_MAX_CONCURRENT_CLIENTS = 1000;
+const uint32_t DFS_MAX_PIPELINED_REQUESTS = 64;  // Requests a server runs at once for one connection
+const size_t DFS_MAX_STREAM_THREADS = 256;  // Streamed chunk writes a server runs at once; more are refused
+const int DFS_CLIENT_METADATA_CONNECTIONS = 2;  // Multiplexed, shared by all of a client's threads
 const int DFS_NETWORK_TIMEOUT_MS = 5000;
+const int DFS_POOL_IDLE_TIMEOUT_SEC = 30;  // Pooled connections unused this long are closed
+const uint32_t DFS_POOL_MAX_DIALS = 4;  // Connects in progress to one server; others wait for them
 const int DFS_RETRY_ATTEMPTS = 3;
 const int DFS_RETRY_BACKOFF_MS = 100;
 
 const uint32_t DFS_CHUNK_SIZE_BYTES = DFS_CHUNK_SIZE_MB * 1024 * 1024;
 const uint32_t DFS_PROTOCOL_MAGIC = 0xDEADBEEF;
-const uint16_t DFS_PROTOCOL_VERSION = 1;
+const uint16_t DFS_PROTOCOL_VERSION = 3;  // v2: CRC32C frame checksums; v3: request_id
+const uint32_t DFS_FRAME_HEADER_SIZE = 20;
+const uint32_t DFS_MAX_FRAME_PAYLOAD_BYTES = DFS_CHUNK_SIZE_BYTES + 4096;  // Default receive limit
+const uint32_t DFS_STREAM_SLICE_BYTES = 1024 * 1024;  // Slice size for streamed payloads
+const uint32_t DFS_CHECKSUM_BLOCK_BYTES = 64 * 1024;  // Granularity of stored chunk checksums
+const uint32_t DFS_CLIENT_CACHE_BLOCK_BYTES = 1024 * 1024;  // Client data cache granularity
+const uint32_t DFS_CLIENT_WRITE_BEHIND_BYTES = 8 * 1024 * 1024;  // Coalesced write-behind request
+const uint32_t DFS_CLIENT_WRITE_BEHIND_INFLIGHT_BYTES = 64 * 1024 * 1024;  // Per open file
 
 // ============================================================================
 // MESSAGE TYPES
@@ -50,6 +81,9 @@ enum MessageType : uint16_t {
     OP_FILE_CREATE = 0x07,
     OP_FILE_DELETE = 0x08,
     OP_MKDIR = 0x09,
+    OP_METADATA_INVALIDATE = 0x0A,  // Server -> client push: cached paths that changed
+    OP_BATCH_METADATA = 0x0B,       // Many queries/creates/deletes/mkdirs in one frame
+    OP_STATS = 0x0C,                // Server metrics as text (see metrics.h)
     OP_ACK = 0xFF
 };
 
@@ -104,38 +138,103 @@ struct ChunkServerStatus {
     std::string server_id;
     std::string ip_address;
     uint16_t port;
+    std::string zone;                    // Failure domains: replicas of a chunk avoid sharing
+    std::string rack;                    // a zone where they can, else a rack
     uint64_t total_capacity_bytes;
     uint64_t used_capacity_bytes;
     std::vector<uint64_t> healthy_chunks;
     uint32_t replication_queue_length;
+    uint32_t active_connections;
+    uint32_t pending_requests;           // Queued on the server's worker pool
     time_t last_heartbeat;
     bool is_healthy;
     
     ChunkServerStatus() 
         : port(0), total_capacity_bytes(0), used_capacity_bytes(0), 
-          replication_queue_length(0), is_healthy(true) {
+          replication_queue_length(0), active_connections(0), pending_requests(0), is_healthy(true) {
         last_heartbeat = std::time(nullptr);
     }
 };
 
-// Heartbeat message structure
+// Heartbeat: capacity and load plus the chunk changes since the previous one.
+// The full chunk list is not resent each time; it goes out as a block report,
+// a few slices (block_report_slice) per heartbeat
 struct HeartbeatMessage {
     std::string server_id;
+    std::string ip_address;
+    uint16_t port;
+    std::string zone;
+    std::string rack;
     uint64_t timestamp;
-    std::vector<uint64_t> healthy_chunks;
+    uint64_t sequence;                    // 1, 2, ... per server start; a gap means lost deltas
     uint64_t total_capacity;
     uint64_t used_capacity;
     uint32_t replication_queue_length;
+    uint32_t active_connections;
+    uint32_t pending_requests;
+    std::vector<uint64_t> added_chunks;   // Committed since the previous heartbeat...
+    std::vector<uint32_t> added_versions; // ...and the version each is at now
+    std::vector<uint64_t> removed_chunks; // Deleted or found corrupt
+    bool report_start;                    // First heartbeat of a full block report
+    std::vector<uint32_t> report_slices;  // Block report slices carried here...
+    std::vector<uint64_t> report_chunks;  // ...every healthy chunk that falls in them...
+    std::vector<uint32_t> report_versions; // ...and its version
+    
+    HeartbeatMessage() 
+        : port(0), timestamp(0), sequence(0), total_capacity(0), used_capacity(0),
+          replication_queue_length(0), active_connections(0), pending_requests(0),
+          report_start(false) {}
 };
 
-// Protocol frame structure (network layer)
-struct ProtocolFrame {
+// Block report slice of a chunk; Fibonacci hashing spreads sequential ids
+inline uint32_t block_report_slice(uint64_t chunk_id) {
+    static_assert((DFS_BLOCK_REPORT_SLICES & (DFS_BLOCK_REPORT_SLICES - 1)) == 0, 
+                  "DFS_BLOCK_REPORT_SLICES must be a power of two");
+    return DFS_BLOCK_REPORT_SLICES == 1 ? 0 : 
+        (uint32_t)((chunk_id * 0x9E3779B97F4A7C15ull) >> (64 - __builtin_ctz(DFS_BLOCK_REPORT_SLICES)));
+}
+
+// Protocol frame header (network layer, fixed 20 bytes on the wire)
+struct FrameHeader {
     uint32_t magic;              // 0xDEADBEEF
     uint16_t version;             // Protocol version
     uint16_t message_type;         // MessageType enum
     uint32_t payload_size;         // Data size
     uint32_t checksum;             // CRC32
-    uint8_t payload[DFS_CHUNK_SIZE_BYTES];  // Variable length data
+    uint32_t request_id;           // Echoed in the response; 0 for server pushes
+};
+
+static_assert(sizeof(FrameHeader) == DFS_FRAME_HEADER_SIZE, "FrameHeader must be 20 bytes");
+
+inline FrameHeader make_frame_header(uint16_t message_type, uint32_t payload_size = 0) {
+    FrameHeader header;
+    header.magic = DFS_PROTOCOL_MAGIC;
+    header.version = DFS_PROTOCOL_VERSION;
+    header.message_type = message_type;
+    header.payload_size = payload_size;
+    header.checksum = 0;
+    header.request_id = 0;
+    return header;
+}
+
+// Protocol frame: wire header followed by a separately owned payload
+struct ProtocolFrame : FrameHeader {
+    std::vector<uint8_t> payload;  // Exactly payload_size bytes
+    
+    ProtocolFrame() : ProtocolFrame(OP_ACK) {}
+    explicit ProtocolFrame(uint16_t type) : FrameHeader(make_frame_header(type)) {}
+    
+    // Replace the payload and keep payload_size in sync
+    void set_payload(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        payload.assign(bytes, bytes + size);
+        payload_size = static_cast<uint32_t>(size);
+    }
+    
+    void resize_payload(size_t size) {
+        payload.resize(size);
+        payload_size = static_cast<uint32_t>(size);
+    }
 };
 
 // Request/Response structures
@@ -160,13 +259,51 @@ struct FileWriteRequest {
     uint64_t chunk_id;
     uint32_t offset;
     std::vector<uint8_t> data;
-    uint32_t version;
+    uint32_t version;            // As WriteRequestHeader::version
     std::string client_id;
 };
 
+// Fixed wire prefix of an OP_WRITE payload. chain_bytes of encoded replica
+// chain (encode_write_chain) follow it, then the data bytes
+struct WriteRequestHeader {
+    uint64_t chunk_id;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t version;            // 0 from clients; re-replication installs the source's version
+    uint32_t chain_bytes;        // 0: store locally only
+};
+
+// OP_WRITE response payload
+struct WriteResponseHeader {
+    uint64_t chunk_id;
+    uint32_t status;             // 0 when this replica stored the data
+    uint32_t replicas_written;   // This replica and those downstream of it that stored the data
+    uint32_t version;            // Newest version committed by them
+    uint32_t reserved;
+};
+
+// Fixed wire form of an OP_READ request
+struct ReadRequestHeader {
+    uint64_t chunk_id;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t version;            // Refused by a replica whose copy is older
+    uint32_t reserved;
+};
+
+// Prefix of an OP_READ response payload; length data bytes follow it directly
+struct ReadResponseHeader {
+    uint64_t chunk_id;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t status;             // 0 on success, data is omitted otherwise
+    uint32_t reserved;
+};
+
 struct FileWriteResponse {
     uint64_t chunk_id;
     bool success;
+    uint32_t version;            // The chunk's version after the write
     std::string error_message;
 };
 
@@ -184,4 +321,267 @@ struct MetadataQueryResponse {
     std::string error_message;
 };
 
+// ============================================================================
+// METADATA WIRE FORMAT
+// ============================================================================
+
+// Result codes carried by metadata server responses
+enum MetadataStatus : uint32_t {
+    META_OK = 0,
+    META_NOT_FOUND = 1,
+    META_EXISTS = 2,
+    META_ERROR = 3,
+    META_NOT_EMPTY = 4
+};
+
+// Prefix of every metadata server response payload
+struct MetadataResponseHeader {
+    uint32_t status;             // MetadataStatus
+    uint32_t lease_ms;           // Lookups: how long the client may cache the answer
+};
+
+// OP_BATCH_METADATA request: u32 count, then per operation u16 message type
+// (OP_METADATA_QUERY, OP_FILE_CREATE, OP_FILE_DELETE or OP_MKDIR), path string
+// and u32 permissions. The response header's status covers the batch as a whole;
+// it is followed by u32 count and, per operation in order, u32 MetadataStatus
+// plus the encoded FileMetadata (query found) or u64 file_id (create).
+// Operations are applied in order, each one atomically, but the batch is not a
+// transaction: other clients can interleave between its operations, a failed
+// operation does not undo or stop the ones around it, and a META_ERROR batch
+// status may follow operations that were already applied.
+
+// OP_WRITE replica chain: u32 count, then per replica string server_id, string
+// ip_address and u16 port. A chunk server that finds its own id in the chain
+// forwards the frame, unchanged, to the first reachable replica after it,
+// slice by slice as it arrives, so every replica receives at once.
+//
+// OP_REPLICATE request: u64 chunk_id, string target ip_address, u16 target port.
+// The receiving chunk server streams its copy to the target as an OP_WRITE and
+// answers with the target's WriteResponseHeader.
+//
+// OP_STATS request: empty. Either server answers with its metrics in the
+// Prometheus text format (MetricsRegistry::export_text) as the whole payload.
+//
+// OP_HEARTBEAT request: the encoded HeartbeatMessage (encode_heartbeat). The
+// response header is followed by u8 flags: HEARTBEAT_WANT_BLOCK_REPORT when the
+// metadata server lost track of the sender's chunks and needs a full report.
+// Then u32 count and, per stale replica the sender should delete, u64 chunk_id
+// and u32 version: the chunk's newest version, which the replica is behind.
+const uint8_t HEARTBEAT_WANT_BLOCK_REPORT = 0x01;
+
+// Little-endian append-only encoder for variable-length metadata messages
+class WireWriter {
+public:
+    explicit WireWriter(std::vector<uint8_t>& out) : out_(out) {}
+    
+    void put_u8(uint8_t value) { out_.push_back(value); }
+    void put_u16(uint16_t value) { put_bytes(&value, sizeof(value)); }
+    void put_u32(uint32_t value) { put_bytes(&value, sizeof(value)); }
+    void put_u64(uint64_t value) { put_bytes(&value, sizeof(value)); }
+    void put_string(const std::string& value) {
+        put_u32(static_cast<uint32_t>(value.size()));
+        put_bytes(value.data(), value.size());
+    }
+    void put_bytes(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out_.insert(out_.end(), bytes, bytes + size);
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+};
+
+// Bounds-checked decoder; once a read runs past the end every later read fails
+class WireReader {
+public:
+    WireReader(const uint8_t* data, size_t size) : data_(data), size_(size), offset_(0), ok_(true) {}
+    
+    bool get_u8(uint8_t& value) { return get_bytes(&value, sizeof(value)); }
+    bool get_u16(uint16_t& value) { return get_bytes(&value, sizeof(value)); }
+    bool get_u32(uint32_t& value) { return get_bytes(&value, sizeof(value)); }
+    bool get_u64(uint64_t& value) { return get_bytes(&value, sizeof(value)); }
+    bool get_string(std::string& value) {
+        uint32_t length = 0;
+        if (!get_u32(length) || !has(length)) {
+            return ok_ = false;
+        }
+        value.assign(reinterpret_cast<const char*>(data_ + offset_), length);
+        offset_ += length;
+        return true;
+    }
+    bool get_bytes(void* dest, size_t size) {
+        if (!has(size)) {
+            return ok_ = false;
+        }
+        std::memcpy(dest, data_ + offset_, size);
+        offset_ += size;
+        return true;
+    }
+    
+    bool ok() const { return ok_; }
+    size_t remaining() const { return size_ - offset_; }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t offset_;
+    bool ok_;
+    
+    bool has(size_t size) const { return ok_ && size <= size_ - offset_; }
+};
+
+inline void encode_chunk_handle(WireWriter& out, const ChunkHandle& chunk) {
+    out.put_u64(chunk.chunk_id);
+    out.put_u32(chunk.version);
+    out.put_u64(chunk.creation_time);
+    out.put_u64(chunk.size);
+    out.put_u32(static_cast<uint32_t>(chunk.replicas.size()));
+    for (const ChunkLocation& replica : chunk.replicas) {
+        out.put_string(replica.server_id);
+        out.put_string(replica.ip_address);
+        out.put_u16(replica.port);
+        out.put_u64(replica.generation_number);
+    }
+}
+
+inline bool decode_chunk_handle(WireReader& in, ChunkHandle& chunk) {
+    uint32_t num_replicas = 0;
+    if (!in.get_u64(chunk.chunk_id) || !in.get_u32(chunk.version) || 
+        !in.get_u64(chunk.creation_time) || !in.get_u64(chunk.size) || !in.get_u32(num_replicas)) {
+        return false;
+    }
+    
+    chunk.replicas.clear();
+    for (uint32_t i = 0; i < num_replicas && in.ok(); ++i) {
+        ChunkLocation replica;
+        in.get_string(replica.server_id);
+        in.get_string(replica.ip_address);
+        in.get_u16(replica.port);
+        in.get_u64(replica.generation_number);
+        chunk.replicas.push_back(replica);
+    }
+    return in.ok();
+}
+
+inline void encode_file_metadata(WireWriter& out, const FileMetadata& metadata) {
+    out.put_string(metadata.path);
+    out.put_u64(metadata.file_id);
+    out.put_u32(metadata.permissions);
+    out.put_u64(metadata.creation_time);
+    out.put_u64(metadata.modification_time);
+    out.put_u64(metadata.file_size);
+    out.put_u32(metadata.replication_factor);
+    out.put_string(metadata.owner);
+    out.put_u8(metadata.is_directory ? 1 : 0);
+    out.put_u32(static_cast<uint32_t>(metadata.chunks.size()));
+    for (const ChunkHandle& chunk : metadata.chunks) {
+        encode_chunk_handle(out, chunk);
+    }
+}
+
+inline bool decode_file_metadata(WireReader& in, FileMetadata& metadata) {
+    uint8_t is_directory = 0;
+    uint32_t num_chunks = 0;
+    if (!in.get_string(metadata.path) || !in.get_u64(metadata.file_id) || 
+        !in.get_u32(metadata.permissions) || !in.get_u64(metadata.creation_time) ||
+        !in.get_u64(metadata.modification_time) || !in.get_u64(metadata.file_size) ||
+        !in.get_u32(metadata.replication_factor) || !in.get_string(metadata.owner) ||
+        !in.get_u8(is_directory) || !in.get_u32(num_chunks)) {
+        return false;
+    }
+    metadata.is_directory = is_directory != 0;
+    
+    metadata.chunks.clear();
+    for (uint32_t i = 0; i < num_chunks; ++i) {
+        ChunkHandle chunk;
+        if (!decode_chunk_handle(in, chunk)) {
+            return false;
+        }
+        metadata.chunks.push_back(chunk);
+    }
+    return true;
+}
+
+inline void encode_write_chain(WireWriter& out, const std::vector<ChunkLocation>& chain) {
+    out.put_u32(static_cast<uint32_t>(chain.size()));
+    for (const ChunkLocation& replica : chain) {
+        out.put_string(replica.server_id);
+        out.put_string(replica.ip_address);
+        out.put_u16(replica.port);
+    }
+}
+
+inline bool decode_write_chain(WireReader& in, std::vector<ChunkLocation>& chain) {
+    uint32_t count = 0;
+    if (!in.get_u32(count) || count > in.remaining()) {
+        return false;
+    }
+    chain.resize(count);
+    for (ChunkLocation& replica : chain) {
+        in.get_string(replica.server_id);
+        in.get_string(replica.ip_address);
+        in.get_u16(replica.port);
+    }
+    return in.ok();
+}
+
+inline void encode_heartbeat(WireWriter& out, const HeartbeatMessage& msg) {
+    out.put_string(msg.server_id);
+    out.put_string(msg.ip_address);
+    out.put_u16(msg.port);
+    out.put_string(msg.zone);
+    out.put_string(msg.rack);
+    out.put_u64(msg.timestamp);
+    out.put_u64(msg.sequence);
+    out.put_u64(msg.total_capacity);
+    out.put_u64(msg.used_capacity);
+    out.put_u32(msg.replication_queue_length);
+    out.put_u32(msg.active_connections);
+    out.put_u32(msg.pending_requests);
+    out.put_u8(msg.report_start ? 1 : 0);
+    for (const std::vector<uint64_t>* ids : {&msg.added_chunks, &msg.removed_chunks, &msg.report_chunks}) {
+        out.put_u32(static_cast<uint32_t>(ids->size()));
+        out.put_bytes(ids->data(), ids->size() * sizeof(uint64_t));
+    }
+    for (const std::vector<uint32_t>* values : {&msg.report_slices, &msg.added_versions, &msg.report_versions}) {
+        out.put_u32(static_cast<uint32_t>(values->size()));
+        out.put_bytes(values->data(), values->size() * sizeof(uint32_t));
+    }
+}
+
+inline bool decode_heartbeat(WireReader& in, HeartbeatMessage& msg) {
+    uint8_t report_start = 0;
+    if (!in.get_string(msg.server_id) || !in.get_string(msg.ip_address) || !in.get_u16(msg.port) ||
+        !in.get_string(msg.zone) || !in.get_string(msg.rack) || !in.get_u64(msg.timestamp) || !in.get_u64(msg.sequence) || 
+        !in.get_u64(msg.total_capacity) || !in.get_u64(msg.used_capacity) ||
+        !in.get_u32(msg.replication_queue_length) || !in.get_u32(msg.active_connections) || 
+        !in.get_u32(msg.pending_requests) || !in.get_u8(report_start)) {
+        return false;
+    }
+    msg.report_start = report_start != 0;
+    
+    // Counts are checked against the bytes left before anything is allocated
+    uint32_t count = 0;
+    for (std::vector<uint64_t>* ids : {&msg.added_chunks, &msg.removed_chunks, &msg.report_chunks}) {
+        if (!in.get_u32(count) || count > in.remaining() / sizeof(uint64_t)) {
+            return false;
+        }
+        ids->resize(count);
+        if (count > 0) {
+            in.get_bytes(ids->data(), count * sizeof(uint64_t));
+        }
+    }
+    for (std::vector<uint32_t>* values : {&msg.report_slices, &msg.added_versions, &msg.report_versions}) {
+        if (!in.get_u32(count) || count > in.remaining() / sizeof(uint32_t)) {
+            return false;
+        }
+        values->resize(count);
+        if (count > 0) {
+            in.get_bytes(values->data(), count * sizeof(uint32_t));
+        }
+    }
+    return in.ok() && msg.added_versions.size() == msg.added_chunks.size() &&
+           msg.report_versions.size() == msg.report_chunks.size();
+}
+
 #endif // DFS_COMMON_H
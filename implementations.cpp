@@ -10,14 +10,27 @@
 #include "common.h"
 #include "network.h"
 #include "thread_pool.h"
+#include "namespace_tree.h"
+#include "metadata_log.h"
+#include "chunk_placement.h"
+#include "replication_scheduler.h"
+#include "metrics.h"
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
 #include <mutex>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 class MetadataServer {
 public:
-    explicit MetadataServer(const std::string& ip, uint16_t port);
+    // Namespace changes are logged under storage_path and replayed by start();
+    // with no storage_path the namespace lives in memory only
+    explicit MetadataServer(const std::string& ip, uint16_t port, const std::string& storage_path = "");
     ~MetadataServer();
     
     // Server lifecycle
@@ -34,40 +47,992 @@ public:
     // Chunk management
     bool allocate_chunks(uint64_t file_id, uint32_t num_chunks);
     std::vector<ChunkHandle> get_file_chunks(uint64_t file_id);
+    std::vector<std::string> get_chunk_holders(uint64_t chunk_id);  // Servers with its newest version
     
-    // Chunk server heartbeat handling
-    void process_heartbeat(const HeartbeatMessage& msg);
+    // A replica whose chunk_id and version pair goes into stale_replicas
+    // is behind the chunk's newest version, and the sender should delete it.
+    // Returns true when the sender should start a full block report because
+    // changes it sent were lost.
+    bool process_heartbeat(const HeartbeatMessage& msg, 
+                           std::vector<std::pair<uint64_t, uint32_t>>& stale_replicas);
     
+    // Snapshot the namespace and drop the log it covers, so a restart replays less
+    bool checkpoint();
+    
+    // Request, lock, log and recovery metrics in the text format OP_STATS returns
+    std::string export_metrics() const { return metrics_.export_text(); }
+
 private:
-    struct FileEntry {
-        FileMetadata metadata;
-        std::vector<ChunkHandle> chunks;
-    };
+    using TimedMutexLock = TimedLock<std::unique_lock<std::mutex>>;
     
     std::string ip_;
     uint16_t port_;
-    bool running_;
+    std::string storage_path_;
+    std::atomic<bool> running_;
+    
+    // Declared before the pools and reactor that record into them
+    MetricsRegistry metrics_;
+    RequestMetrics requests_;
+    LatencyHistogram& servers_wait_;       // servers_mutex_
+    LatencyHistogram& servers_hold_;
+    LatencyHistogram& reports_wait_;       // reports_mutex_
+    LatencyHistogram& reports_hold_;
+    LatencyHistogram& log_sync_time_;      // Replies waiting for their changes to be durable
+    Counter& copies_done_;
+    Counter& copies_failed_;
     
-    std::map<std::string, FileEntry> file_system_;
+    NamespaceTree file_system_;            // Compact records, locked per directory; assigns file ids
     std::map<std::string, ChunkServerStatus> chunk_servers_;
+    std::atomic<uint64_t> next_chunk_id_;
     
-    std::mutex fs_mutex_;
+    ChunkPlacement placement_;             // Guarded by servers_mutex_
     std::mutex servers_mutex_;
     
+    // Where chunks are, as chunk servers report them: kept current by heartbeat
+    // deltas and refreshed one block report slice at a time
+    struct ChunkReport {
+        uint64_t last_sequence = 0;
+        bool want_block_report = true;
+        std::unordered_map<uint64_t, uint32_t> slices[DFS_BLOCK_REPORT_SLICES];  // Chunk -> version, by slice
+        std::unordered_set<uint64_t> stale;                    // Held, but behind: not holders
+        std::vector<std::pair<uint64_t, uint32_t>> drops;      // Stale replicas to delete, next reply
+    };
+    std::unordered_map<std::string, ChunkReport> chunk_reports_;
+    std::unordered_map<uint64_t, std::vector<std::string>> chunk_holders_;  // With the newest version
+    std::unordered_map<uint64_t, uint32_t> chunk_versions_;                 // Newest version reported
+    
+    // Every replica gets DFS_STALE_REPLICA_GRACE_SEC to report a chunk's newest
+    // version (commits reach the replicas of a chain in the same write); the
+    // check then drops the ones still behind
+    std::deque<std::pair<std::chrono::steady_clock::time_point, uint64_t>> version_checks_;
+    std::mutex reports_mutex_;
+    
+    // Chunks left short of replicas by a dead server or a lost copy; the copies
+    // run on recovery_pool_ as OP_REPLICATE requests to a surviving holder
+    ReplicationScheduler recovery_;        // Guarded by reports_mutex_
+    std::unique_ptr<ThreadPool> recovery_pool_;
+    std::thread recovery_thread_;
+    
+    // Lookup leases: which client connections may be caching each path (or its
+    // absence), so that a change can be pushed to them as OP_METADATA_INVALIDATE
+    struct Lease {
+        uint64_t connection_id;
+        std::chrono::steady_clock::time_point expires;
+    };
+    std::unordered_map<std::string, std::vector<Lease>> leases_;
+    std::mutex leases_mutex_;
+    
     std::unique_ptr<NetworkSocket> server_socket_;
     std::unique_ptr<ThreadPool> thread_pool_;
+    std::unique_ptr<ConnectionReactor> reactor_;  // Client sockets -> process_message on thread_pool_
+    
+    // Every namespace change is appended by file_system_'s observer, under the
+    // lock that orders it; replies wait for publish() to make it durable
+    std::unique_ptr<MetadataLog> log_;
+    std::mutex checkpoint_mutex_;
+    std::thread checkpoint_thread_;
     
     // Internal methods
-    void accept_connections();
-    void handle_client_connection(int client_fd, const std::string& client_ip);
-    bool process_message(const ProtocolFrame& frame, ProtocolFrame& response);
+    bool process_message(uint64_t connection_id, const ProtocolFrame& frame, ProtocolFrame& response);
     std::vector<ChunkLocation> select_chunk_replicas(uint64_t chunk_id);
     uint64_t allocate_chunk_id();
+    void add_chunk_holder(uint64_t chunk_id, const std::string& server_id);     // Caller holds reports_mutex_
+    void remove_chunk_holder(uint64_t chunk_id, const std::string& server_id);  // Caller holds reports_mutex_
+    // Caller holds reports_mutex_ for these three
+    void note_replica(ChunkReport& report, const std::string& server_id, uint64_t chunk_id, uint32_t version);
+    void forget_replica(ChunkReport& report, const std::string& server_id, uint64_t chunk_id);
+    void check_replica_versions(std::chrono::steady_clock::time_point now);
+    void grant_lease(const std::string& path, uint64_t connection_id);
+    void revoke_leases(const std::vector<std::string>& paths);
+    bool process_batch(uint64_t connection_id, const ProtocolFrame& frame, WireWriter& out);
+    bool recover();
+    void checkpoint_loop();
+    void recovery_loop();
+    void expire_servers(time_t now);
+    void start_recovery();
+    void copy_chunk(const ReplicationScheduler::Task& task, const ChunkLocation& source,
+                    const ChunkLocation& target);
+    
+    // Namespace operations; callers publish() the paths they changed afterwards
+    MetadataStatus create_entry(const std::string& path, uint32_t permissions, bool is_directory,
+                                uint64_t& file_id);
+    MetadataStatus delete_entry(const std::string& path);
+    MetadataStatus publish(const std::vector<std::string>& paths);
 };
 
 #endif // DFS_METADATA_SERVER_H
 
 
+// ============================================================================
+// File: metadata_server.cpp
+// ============================================================================
+
+#include "metadata_server.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <cerrno>
+#include <sys/stat.h>
+
+MetadataServer::MetadataServer(const std::string& ip, uint16_t port, const std::string& storage_path)
+    : ip_(ip), port_(port), storage_path_(storage_path), running_(false),
+      requests_(metrics_, "dfs_meta", {OP_HEARTBEAT, OP_METADATA_QUERY, OP_FILE_CREATE, OP_FILE_DELETE,
+                                       OP_MKDIR, OP_BATCH_METADATA, OP_STATS}),
+      servers_wait_(metrics_.histogram("dfs_meta_lock_wait_seconds", "lock=\"servers\"")),
+      servers_hold_(metrics_.histogram("dfs_meta_lock_hold_seconds", "lock=\"servers\"")),
+      reports_wait_(metrics_.histogram("dfs_meta_lock_wait_seconds", "lock=\"reports\"")),
+      reports_hold_(metrics_.histogram("dfs_meta_lock_hold_seconds", "lock=\"reports\"")),
+      log_sync_time_(metrics_.histogram("dfs_meta_log_sync_seconds")),
+      copies_done_(metrics_.counter("dfs_meta_recovery_copies_total", "result=\"ok\"")),
+      copies_failed_(metrics_.counter("dfs_meta_recovery_copies_total", "result=\"failed\"")),
+      next_chunk_id_(1),
+      recovery_(DFS_RECOVERY_PARALLELISM, DFS_RECOVERY_BYTES_PER_SEC, DFS_CHUNK_SIZE_BYTES) {
+    server_socket_ = std::make_unique<NetworkSocket>();
+    thread_pool_ = std::make_unique<ThreadPool>(std::thread::hardware_concurrency());
+    recovery_pool_ = std::make_unique<ThreadPool>(DFS_RECOVERY_PARALLELISM);
+    reactor_ = std::make_unique<ConnectionReactor>(std::max(1u, std::thread::hardware_concurrency() / 4));
+    
+    thread_pool_->set_queue_wait_histogram(&metrics_.histogram("dfs_meta_queue_wait_seconds"));
+    metrics_.gauge("dfs_meta_pending_tasks", "", [this] { return (double)thread_pool_->get_pending_tasks(); });
+    metrics_.gauge("dfs_meta_connections", "", [this] { return (double)reactor_->get_connection_count(); });
+    metrics_.gauge("dfs_meta_recovery_queued", "", [this] {
+        std::unique_lock<std::mutex> lock(reports_mutex_);
+        return (double)recovery_.queued();
+    });
+    metrics_.gauge("dfs_meta_recovery_in_flight", "", [this] {
+        std::unique_lock<std::mutex> lock(reports_mutex_);
+        return (double)recovery_.in_flight();
+    });
+}
+
+MetadataServer::~MetadataServer() {
+    stop();
+}
+
+bool MetadataServer::start() {
+    if (!storage_path_.empty() && !recover()) {
+        return false;
+    }
+    
+    if (!server_socket_->create_server_socket(ip_, port_)) {
+        std::cerr << "Failed to create server socket on " << ip_ << ":" << port_ << std::endl;
+        return false;
+    }
+    
+    if (!server_socket_->listen_for_connections(SOMAXCONN)) {
+        std::cerr << "Failed to listen on socket" << std::endl;
+        return false;
+    }
+    
+    reactor_->set_request_handler(
+        [this](uint64_t connection_id, const ProtocolFrame& request, ProtocolFrame& response) {
+            uint64_t start_ns = metrics_now_ns();
+            process_message(connection_id, request, response);
+            requests_.record(request.message_type, metrics_now_ns() - start_ns,
+                             DFS_FRAME_HEADER_SIZE + request.payload_size,
+                             DFS_FRAME_HEADER_SIZE + response.payload_size);
+        });
+    
+    running_ = true;
+    if (!reactor_->start(*server_socket_, [this](std::function<void()> task) {
+            thread_pool_->enqueue(std::move(task));
+        })) {
+        std::cerr << "Failed to start connection reactor" << std::endl;
+        running_ = false;
+        return false;
+    }
+    
+    if (log_) {
+        checkpoint_thread_ = std::thread([this] { checkpoint_loop(); });
+    }
+    recovery_thread_ = std::thread([this] { recovery_loop(); });
+    
+    std::cout << "Metadata Server started on " << ip_ << ":" << port_ << std::endl;
+    return true;
+}
+
+void MetadataServer::stop() {
+    bool was_running = running_.exchange(false);
+    if (reactor_) {
+        reactor_->stop();
+    }
+    if (server_socket_) {
+        server_socket_->close_socket();
+    }
+    if (thread_pool_) {
+        thread_pool_->shutdown();
+    }
+    if (checkpoint_thread_.joinable()) {
+        checkpoint_thread_.join();
+    }
+    if (recovery_thread_.joinable()) {
+        recovery_thread_.join();
+    }
+    if (recovery_pool_) {
+        recovery_pool_->shutdown();
+    }
+    if (was_running && log_) {
+        checkpoint();
+    }
+}
+
+// Load the latest snapshot, replay the log after it, then log from here on
+bool MetadataServer::recover() {
+    auto started = std::chrono::steady_clock::now();
+    if (::mkdir(storage_path_.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create metadata storage " << storage_path_ << std::endl;
+        return false;
+    }
+    
+    MetadataSnapshot::Info info = {1, 1, 1, 0};
+    MetadataSnapshot::load(storage_path_ + "/metadata.snapshot", file_system_, info);
+    
+    // Chunk ids are not reused, even those of files deleted since
+    uint64_t next_chunk_id = info.next_chunk_id;
+    uint64_t replayed = 0;
+    log_ = std::make_unique<MetadataLog>(storage_path_);
+    bool opened = log_->open(info.log_sequence, [&](const NamespaceChange& change) {
+        file_system_.apply(change);
+        for (const ChunkHandle& chunk : change.entry.chunks) {
+            next_chunk_id = std::max(next_chunk_id, chunk.chunk_id + 1);
+        }
+        ++replayed;
+    });
+    if (!opened) {
+        log_.reset();
+        return false;
+    }
+    next_chunk_id_ = std::max(next_chunk_id_.load(), next_chunk_id);
+    file_system_.set_observer([this](const NamespaceChange& change) { log_->append(change); });
+    
+    std::cout << "Metadata Server recovered " << file_system_.size() << " entries (" << info.entries 
+              << " from snapshot, " << replayed << " log records) in " 
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - started).count() << " ms" << std::endl;
+    return true;
+}
+
+// The log is cut first, so the snapshot covers every change before the cut, and
+// changes made while it is written are replayed over it (see NamespaceTree::apply)
+bool MetadataServer::checkpoint() {
+    if (!log_) {
+        return true;
+    }
+    
+    std::unique_lock<std::mutex> lock(checkpoint_mutex_);
+    MetadataSnapshot::Info info;
+    info.log_sequence = log_->rotate();
+    if (info.log_sequence == 0) {
+        return false;
+    }
+    info.next_file_id = file_system_.next_file_id();
+    info.next_chunk_id = next_chunk_id_.load();
+    if (!MetadataSnapshot::write(storage_path_ + "/metadata.snapshot", file_system_, info)) {
+        std::cerr << "Failed to write metadata snapshot in " << storage_path_ << std::endl;
+        return false;
+    }
+    log_->discard_before(info.log_sequence);
+    return true;
+}
+
+void MetadataServer::checkpoint_loop() {
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    while (running_) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_checkpoint >= std::chrono::seconds(DFS_METADATA_SNAPSHOT_SEC) ||
+            log_->bytes_since_rotate() >= DFS_METADATA_SNAPSHOT_LOG_BYTES) {
+            checkpoint();
+            last_checkpoint = now;
+        }
+    }
+}
+
+// Replica counts mean little until every chunk server has reported what it
+// holds, so nothing is copied for a heartbeat timeout after start
+void MetadataServer::recovery_loop() {
+    auto started = std::chrono::steady_clock::now();
+    while (running_) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (std::chrono::steady_clock::now() - started < std::chrono::seconds(DFS_HEARTBEAT_TIMEOUT_SEC)) {
+            continue;
+        }
+        expire_servers(std::time(nullptr));
+        {
+            TimedMutexLock lock(reports_mutex_, reports_wait_, reports_hold_);
+            check_replica_versions(std::chrono::steady_clock::now());
+        }
+        start_recovery();
+    }
+}
+
+// A server silent for DFS_HEARTBEAT_TIMEOUT_SEC is taken for dead: it leaves
+// placement and its replicas stop counting, which queues them for recovery.
+// Should it come back, it has no report here and is asked for a full one
+void MetadataServer::expire_servers(time_t now) {
+    std::vector<std::string> dead;
+    {
+        TimedMutexLock lock(servers_mutex_, servers_wait_, servers_hold_);
+        for (auto& entry : chunk_servers_) {
+            ChunkServerStatus& status = entry.second;
+            if (status.is_healthy && now - status.last_heartbeat >= DFS_HEARTBEAT_TIMEOUT_SEC) {
+                status.is_healthy = false;
+                placement_.remove(entry.first);
+                dead.push_back(entry.first);
+            }
+        }
+    }
+    
+    TimedMutexLock lock(reports_mutex_, reports_wait_, reports_hold_);
+    for (const std::string& server_id : dead) {
+        auto it = chunk_reports_.find(server_id);
+        if (it == chunk_reports_.end()) {
+            continue;
+        }
+        size_t held = 0;
+        for (const auto& slice : it->second.slices) {
+            for (const auto& chunk : slice) {
+                if (!it->second.stale.count(chunk.first)) {
+                    remove_chunk_holder(chunk.first, server_id);
+                }
+            }
+            held += slice.size();
+        }
+        chunk_reports_.erase(it);
+        std::cerr << "Chunk server " << server_id << " missed heartbeats for " 
+                  << DFS_HEARTBEAT_TIMEOUT_SEC << " s; its " << held << " chunks are re-replicated" 
+                  << std::endl;
+    }
+}
+
+// Hand the scheduler's next copies to recovery_pool_. Targets are drawn like
+// new replicas, away from the chunk's holders and from servers that already
+// serve DFS_RECOVERY_STREAMS_PER_SERVER copies
+void MetadataServer::start_recovery() {
+    std::vector<ReplicationScheduler::Task> tasks;
+    std::vector<std::vector<std::string>> holders;
+    std::unordered_map<std::string, uint32_t> streams;
+    {
+        TimedMutexLock lock(reports_mutex_, reports_wait_, reports_hold_);
+        tasks = recovery_.start(ReplicationScheduler::Clock::now(), chunk_holders_);
+        for (const ReplicationScheduler::Task& task : tasks) {
+            auto it = chunk_holders_.find(task.chunk_id);
+            holders.push_back(it != chunk_holders_.end() ? it->second : std::vector<std::string>());
+        }
+        streams = recovery_.streams();
+    }
+    if (tasks.empty()) {
+        return;
+    }
+    std::vector<std::string> busy;
+    for (const auto& entry : streams) {
+        if (entry.second >= DFS_RECOVERY_STREAMS_PER_SERVER) {
+            busy.push_back(entry.first);
+        }
+    }
+    
+    std::vector<ChunkLocation> sources(tasks.size());
+    std::vector<ChunkLocation> targets(tasks.size());
+    {
+        TimedMutexLock lock(servers_mutex_, servers_wait_, servers_hold_);
+        time_t now = std::time(nullptr);
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            auto source = chunk_servers_.find(tasks[i].source);
+            std::vector<ChunkLocation> target = placement_.choose(1, tasks[i].chunk_id, 
+                                                                  DFS_CHUNK_SIZE_BYTES, now, holders[i], busy);
+            if (source == chunk_servers_.end() || target.empty()) {
+                continue;
+            }
+            sources[i] = ChunkLocation(source->second.server_id, source->second.ip_address, 
+                                       source->second.port, tasks[i].chunk_id);
+            targets[i] = target[0];
+            if (++streams[target[0].server_id] == DFS_RECOVERY_STREAMS_PER_SERVER) {
+                busy.push_back(target[0].server_id);
+            }
+        }
+    }
+    
+    TimedMutexLock lock(reports_mutex_, reports_wait_, reports_hold_);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        if (targets[i].server_id.empty()) {
+            recovery_.finish(tasks[i].chunk_id, false, ReplicationScheduler::Clock::now());
+            continue;
+        }
+        recovery_.assign(tasks[i].chunk_id, targets[i].server_id);
+        tasks[i].target = targets[i].server_id;
+        recovery_pool_->enqueue([this, task = tasks[i], source = sources[i], target = targets[i]] {
+            copy_chunk(task, source, target);
+        });
+    }
+}
+
+// The source streams its copy to the target and answers once the target has
+// it. The target counts as a holder from then on (at the version it took on),
+// without waiting for its next heartbeat to report the chunk
+void MetadataServer::copy_chunk(const ReplicationScheduler::Task& task, const ChunkLocation& source,
+                                const ChunkLocation& target) {
+    ProtocolFrame request(OP_REPLICATE);
+    WireWriter out(request.payload);
+    out.put_u64(task.chunk_id);
+    out.put_string(target.ip_address);
+    out.put_u16(target.port);
+    request.payload_size = request.payload.size();
+    request.checksum = NetworkSocket::calculate_crc32(request.payload.data(), request.payload_size);
+    
+    bool copied = false;
+    NetworkSocket socket;
+    ProtocolFrame reply;
+    WriteResponseHeader result = {task.chunk_id, 1, 0, 0, 0};
+    if (socket.connect_to_server(source.ip_address, source.port) &&
+        socket.set_timeout(DFS_REPLICATION_TIMEOUT_SEC * 1000) &&
+        socket.send_frame(request) && socket.recv_frame(reply) &&
+        reply.payload_size >= sizeof(WriteResponseHeader)) {
+        std::memcpy(&result, reply.payload.data(), sizeof(WriteResponseHeader));
+        copied = result.status == 0 && result.chunk_id == task.chunk_id;
+    }
+    (copied ? copies_done_ : copies_failed_).add();
+    if (!copied) {
+        std::cerr << "Re-replication of chunk " << task.chunk_id << " from " << task.source 
+                  << " to " << task.target << " failed" << std::endl;
+    }
+    
+    TimedMutexLock lock(reports_mutex_, reports_wait_, reports_hold_);
+    auto report = chunk_reports_.find(target.server_id);
+    if (copied && report != chunk_reports_.end()) {
+        note_replica(report->second, target.server_id, task.chunk_id, result.version);
+    }
+    recovery_.finish(task.chunk_id, copied, ReplicationScheduler::Clock::now());
+}
+
+bool MetadataServer::create_file(const std::string& path, uint32_t permissions, uint64_t& file_id) {
+    if (create_entry(path, permissions, false, file_id) != META_OK) {
+        return false;
+    }
+    
+    return publish({path}) == META_OK;  // Cached "does not exist" answers are now wrong
+}
+
+bool MetadataServer::delete_file(const std::string& path) {
+    if (delete_entry(path) != META_OK) {
+        return false;
+    }
+    
+    return publish({path}) == META_OK;
+}
+
+bool MetadataServer::mkdir(const std::string& path) {
+    uint64_t file_id;
+    if (create_entry(path, 0755, true, file_id) != META_OK) {
+        return false;
+    }
+    
+    return publish({path}) == META_OK;
+}
+
+// Chunk versions are the newest reported, so a client reading with them is
+// refused by replicas that missed a write
+bool MetadataServer::get_file_metadata(const std::string& path, FileMetadata& metadata) {
+    if (!file_system_.get(path, metadata)) {
+        return false;
+    }
+    if (!metadata.chunks.empty()) {
+        TimedMutexLock lock(reports_mutex_, reports_wait_, reports_hold_);
+        for (ChunkHandle& chunk : metadata.chunks) {
+            auto it = chunk_versions_.find(chunk.chunk_id);
+            if (it != chunk_versions_.end()) {
+                chunk.version = std::max(chunk.version, it->second);
+            }
+        }
+    }
+    return true;
+}
+
+MetadataStatus MetadataServer::create_entry(const std::string& path, uint32_t permissions, 
+                                            bool is_directory, uint64_t& file_id) {
+    FileMetadata metadata;
+    metadata.permissions = permissions;
+    metadata.is_directory = is_directory;
+    MetadataStatus status = file_system_.insert(path, metadata);
+    file_id = status == META_OK ? metadata.file_id : 0;
+    return status;
+}
+
+MetadataStatus MetadataServer::delete_entry(const std::string& path) {
+    return file_system_.erase(path);
+}
+
+// After changing paths: wait until the changes are logged (one fdatasync shared
+// with concurrent callers), then invalidate cached copies. META_ERROR if the log
+// failed; the changes stay applied in memory.
+MetadataStatus MetadataServer::publish(const std::vector<std::string>& paths) {
+    uint64_t sync_start_ns = metrics_now_ns();
+    bool durable = !log_ || log_->sync();
+    log_sync_time_.record_since(sync_start_ns);
+    revoke_leases(paths);
+    return durable ? META_OK : META_ERROR;
+}
+
+bool MetadataServer::allocate_chunks(uint64_t file_id, uint32_t num_chunks) {
+    std::string path;
+    if (!file_system_.find_path(file_id, path)) {
+        return false;
+    }
+    
+    // Replicas are picked outside the namespace locks
+    std::vector<ChunkHandle> chunks(num_chunks);
+    for (ChunkHandle& chunk : chunks) {
+        chunk.chunk_id = allocate_chunk_id();
+        chunk.replicas = select_chunk_replicas(chunk.chunk_id);
+        chunk.creation_time = std::time(nullptr);
+    }
+    
+    if (!file_system_.append_chunks(path, file_id, chunks, std::time(nullptr))) {
+        return false;
+    }
+    
+    return publish({path}) == META_OK;  // Clients hold the old chunk list
+}
+
+std::vector<ChunkHandle> MetadataServer::get_file_chunks(uint64_t file_id) {
+    std::string path;
+    FileMetadata metadata;
+    if (!file_system_.find_path(file_id, path) || !file_system_.get(path, metadata) ||
+        metadata.file_id != file_id) {
+        return {};
+    }
+    return metadata.chunks;
+}
+
+std::vector<std::string> MetadataServer::get_chunk_holders(uint64_t chunk_id) {
+    TimedMutexLock lock(reports_mutex_, reports_wait_, reports_hold_);
+    auto it = chunk_holders_.find(chunk_id);
+    return it != chunk_holders_.end() ? it->second : std::vector<std::string>();
+}
+
+bool MetadataServer::process_heartbeat(const HeartbeatMessage& msg, 
+                                       std::vector<std::pair<uint64_t, uint32_t>>& stale_replicas) {
+    {
+        TimedMutexLock lock(servers_mutex_, servers_wait_, servers_hold_);
+        ChunkServerStatus& status = chunk_servers_[msg.server_id];
+        status.server_id = msg.server_id;
+        status.ip_address = msg.ip_address;
+        status.port = msg.port;
+        status.zone = msg.zone;
+        status.rack = msg.rack;
+        status.total_capacity_bytes = msg.total_capacity;
+        status.used_capacity_bytes = msg.used_capacity;
+        status.replication_queue_length = msg.replication_queue_length;
+        status.active_connections = msg.active_connections;
+        status.pending_requests = msg.pending_requests;
+        status.last_heartbeat = std::time(nullptr);
+        status.is_healthy = true;
+        placement_.update(status);
+    }
+    
+    TimedMutexLock lock(reports_mutex_, reports_wait_, reports_hold_);
+    ChunkReport& report = chunk_reports_[msg.server_id];
+    
+    // A sequence gap (or a server we have no report from) means lost changes.
+    // What we hold stays in use until a report replaces it slice by slice
+    if (msg.report_start) {
+        report.want_block_report = false;
+    } else if (msg.sequence != report.last_sequence + 1) {
+        report.want_block_report = true;
+    }
+    report.last_sequence = msg.sequence;
+    
+    // Deltas first: the reported slices were captured after they were drained
+    for (size_t i = 0; i < msg.added_chunks.size(); ++i) {
+        note_replica(report, msg.server_id, msg.added_chunks[i], msg.added_versions[i]);
+    }
+    for (uint64_t chunk_id : msg.removed_chunks) {
+        if (report.slices[block_report_slice(chunk_id)].erase(chunk_id) > 0) {
+            forget_replica(report, msg.server_id, chunk_id);
+        }
+    }
+    
+    // Each reported slice replaces what we held for it; only the difference
+    // touches the holder index
+    std::unordered_map<uint32_t, std::unordered_map<uint64_t, uint32_t>> fresh;
+    for (uint32_t slice : msg.report_slices) {
+        if (slice < DFS_BLOCK_REPORT_SLICES) {
+            fresh[slice];
+        }
+    }
+    for (size_t i = 0; i < msg.report_chunks.size(); ++i) {
+        auto it = fresh.find(block_report_slice(msg.report_chunks[i]));
+        if (it != fresh.end()) {
+            it->second[msg.report_chunks[i]] = msg.report_versions[i];
+        }
+    }
+    for (auto& entry : fresh) {
+        std::unordered_map<uint64_t, uint32_t>& held = report.slices[entry.first];
+        for (auto it = held.begin(); it != held.end();) {
+            if (entry.second.count(it->first) == 0) {
+                forget_replica(report, msg.server_id, it->first);
+                it = held.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (const auto& chunk : entry.second) {
+            note_replica(report, msg.server_id, chunk.first, chunk.second);
+        }
+    }
+    
+    stale_replicas.swap(report.drops);
+    report.drops.clear();
+    return report.want_block_report;
+}
+
+// A server reports holding version of chunk_id. Whoever has its newest
+// version is a holder; a replica behind it is given the grace period to
+// catch up, and one already found stale is told again to delete its copy
+void MetadataServer::note_replica(ChunkReport& report, const std::string& server_id, 
+                                  uint64_t chunk_id, uint32_t version) {
+    auto held = report.slices[block_report_slice(chunk_id)].emplace(chunk_id, version);
+    bool known = !held.second;
+    held.first->second = version;
+    
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(DFS_STALE_REPLICA_GRACE_SEC);
+    uint32_t& newest = chunk_versions_[chunk_id];
+    if (version > newest) {
+        if (newest > 0) {
+            version_checks_.emplace_back(deadline, chunk_id);  // The other holders may be behind now
+        }
+        newest = version;
+    }
+    
+    if (report.stale.count(chunk_id)) {
+        if (version < newest) {
+            report.drops.emplace_back(chunk_id, newest);
+            return;
+        }
+        report.stale.erase(chunk_id);  // Caught up after all
+        known = false;
+    }
+    if (!known) {
+        add_chunk_holder(chunk_id, server_id);
+    }
+    if (version < newest) {
+        version_checks_.emplace_back(deadline, chunk_id);
+    }
+}
+
+// The server no longer reports chunk_id (already erased from its slices)
+void MetadataServer::forget_replica(ChunkReport& report, const std::string& server_id, uint64_t chunk_id) {
+    if (report.stale.erase(chunk_id) == 0) {
+        remove_chunk_holder(chunk_id, server_id);
+    }
+}
+
+// Holders still behind a chunk's newest version once its grace period is over
+// missed a write: they stop counting as replicas, which queues the chunk for
+// re-replication, and are told to delete their copy. A chunk whose newest
+// version is held nowhere any more keeps the copies it has
+void MetadataServer::check_replica_versions(std::chrono::steady_clock::time_point now) {
+    while (!version_checks_.empty() && version_checks_.front().first <= now) {
+        uint64_t chunk_id = version_checks_.front().second;
+        version_checks_.pop_front();
+        auto holders = chunk_holders_.find(chunk_id);
+        if (holders == chunk_holders_.end()) {
+            continue;
+        }
+        uint32_t newest = chunk_versions_[chunk_id];
+        
+        std::vector<std::string> behind;
+        bool current = false;
+        for (const std::string& server_id : holders->second) {
+            auto report = chunk_reports_.find(server_id);
+            if (report == chunk_reports_.end()) {
+                continue;
+            }
+            const auto& slice = report->second.slices[block_report_slice(chunk_id)];
+            auto held = slice.find(chunk_id);
+            if (held != slice.end() && held->second < newest) {
+                behind.push_back(server_id);
+            } else if (held != slice.end()) {
+                current = true;
+            }
+        }
+        if (!current) {
+            continue;
+        }
+        
+        for (const std::string& server_id : behind) {
+            ChunkReport& report = chunk_reports_[server_id];
+            report.stale.insert(chunk_id);
+            report.drops.emplace_back(chunk_id, newest);
+            remove_chunk_holder(chunk_id, server_id);
+            std::cerr << "Replica of chunk " << chunk_id << " on " << server_id 
+                      << " missed version " << newest << "; re-replicating" << std::endl;
+        }
+    }
+}
+
+void MetadataServer::add_chunk_holder(uint64_t chunk_id, const std::string& server_id) {
+    std::vector<std::string>& holders = chunk_holders_[chunk_id];
+    holders.push_back(server_id);
+    recovery_.replica_added(chunk_id, holders.size());
+}
+
+void MetadataServer::remove_chunk_holder(uint64_t chunk_id, const std::string& server_id) {
+    auto it = chunk_holders_.find(chunk_id);
+    if (it == chunk_holders_.end()) {
+        return;
+    }
+    std::vector<std::string>& holders = it->second;
+    holders.erase(std::remove(holders.begin(), holders.end(), server_id), holders.end());
+    recovery_.replica_lost(chunk_id, holders.size());
+    if (holders.empty()) {
+        chunk_holders_.erase(it);
+        std::cerr << "Chunk " << chunk_id << " has no live replica left" << std::endl;
+    }
+}
+
+// Live chunk servers up to the replication factor, drawn by free space and
+// load and spread over zones and racks
+std::vector<ChunkLocation> MetadataServer::select_chunk_replicas(uint64_t chunk_id) {
+    TimedMutexLock lock(servers_mutex_, servers_wait_, servers_hold_);
+    return placement_.choose(DFS_REPLICATION_FACTOR, chunk_id, DFS_CHUNK_SIZE_BYTES, std::time(nullptr));
+}
+
+uint64_t MetadataServer::allocate_chunk_id() {
+    return next_chunk_id_++;
+}
+
+// Record that connection_id may cache its answer for path until the lease ends
+void MetadataServer::grant_lease(const std::string& path, uint64_t connection_id) {
+    auto now = std::chrono::steady_clock::now();
+    auto expires = now + std::chrono::seconds(DFS_METADATA_LEASE_SEC);
+    
+    std::unique_lock<std::mutex> lock(leases_mutex_);
+    std::vector<Lease>& holders = leases_[path];
+    for (Lease& lease : holders) {
+        if (lease.connection_id == connection_id) {
+            lease.expires = expires;
+            return;
+        }
+    }
+    
+    holders.erase(std::remove_if(holders.begin(), holders.end(), 
+                                 [now](const Lease& lease) { return lease.expires <= now; }),
+                  holders.end());
+    holders.push_back({connection_id, expires});
+}
+
+// Push OP_METADATA_INVALIDATE to every live lease holder of paths, one frame per
+// holder. Called after the change is visible, so a holder that re-queries sees
+// the new state.
+void MetadataServer::revoke_leases(const std::vector<std::string>& paths) {
+    std::map<uint64_t, std::vector<const std::string*>> by_connection;
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(leases_mutex_);
+        for (const std::string& path : paths) {
+            auto it = leases_.find(path);
+            if (it == leases_.end()) {
+                continue;
+            }
+            for (const Lease& lease : it->second) {
+                if (lease.expires > now) {
+                    by_connection[lease.connection_id].push_back(&path);
+                }
+            }
+            leases_.erase(it);
+        }
+    }
+    
+    for (const auto& holder : by_connection) {
+        ProtocolFrame frame(OP_METADATA_INVALIDATE);
+        WireWriter out(frame.payload);
+        out.put_u32(static_cast<uint32_t>(holder.second.size()));
+        for (const std::string* path : holder.second) {
+            out.put_string(*path);
+        }
+        frame.payload_size = frame.payload.size();
+        frame.checksum = NetworkSocket::calculate_crc32(frame.payload.data(), frame.payload_size);
+        reactor_->push(holder.first, frame);
+    }
+}
+
+// Apply an OP_BATCH_METADATA request in order, each operation atomically,
+// appending per-operation results to out. No lock spans the batch, so it is
+// not atomic as a whole. False if the request is malformed or its changes
+// could not be logged (the operations stay applied).
+bool MetadataServer::process_batch(uint64_t connection_id, const ProtocolFrame& frame, WireWriter& out) {
+    struct Op {
+        uint16_t type;
+        std::string path;
+        uint32_t permissions;
+    };
+    
+    WireReader in(frame.payload.data(), frame.payload_size);
+    uint32_t count = 0;
+    if (!in.get_u32(count) || count > DFS_METADATA_BATCH_MAX_OPS) {
+        return false;
+    }
+    std::vector<Op> ops(count);
+    for (Op& op : ops) {
+        in.get_u16(op.type);
+        in.get_string(op.path);
+        in.get_u32(op.permissions);
+    }
+    if (!in.ok()) {
+        return false;
+    }
+    
+    // Leases first, as for single lookups
+    for (const Op& op : ops) {
+        if (op.type == OP_METADATA_QUERY) {
+            grant_lease(op.path, connection_id);
+        }
+    }
+    
+    std::vector<std::string> changed;
+    out.put_u32(count);
+    for (const Op& op : ops) {
+        MetadataStatus status = META_ERROR;
+        FileMetadata metadata;
+        uint64_t file_id = 0;
+        switch (op.type) {
+            case OP_METADATA_QUERY:
+                status = get_file_metadata(op.path, metadata) ? META_OK : META_NOT_FOUND;
+                break;
+            case OP_FILE_CREATE:
+                status = create_entry(op.path, op.permissions, false, file_id);
+                break;
+            case OP_FILE_DELETE:
+                status = delete_entry(op.path);
+                break;
+            case OP_MKDIR:
+                status = create_entry(op.path, 0755, true, file_id);
+                break;
+            default:
+                break;
+        }
+        
+        out.put_u32(status);
+        if (op.type == OP_METADATA_QUERY && status == META_OK) {
+            encode_file_metadata(out, metadata);
+        } else if (op.type == OP_FILE_CREATE) {
+            out.put_u64(file_id);
+        }
+        if (op.type != OP_METADATA_QUERY && status == META_OK) {
+            changed.push_back(op.path);
+        }
+    }
+    
+    return changed.empty() || publish(changed) == META_OK;
+}
+
+bool MetadataServer::process_message(uint64_t connection_id, const ProtocolFrame& frame, 
+                                     ProtocolFrame& response) {
+    response.magic = DFS_PROTOCOL_MAGIC;
+    response.version = DFS_PROTOCOL_VERSION;
+    response.message_type = OP_ACK;
+    response.resize_payload(0);
+    
+    // Metrics go out as bare text, without a MetadataResponseHeader
+    if (frame.message_type == OP_STATS) {
+        std::string text = metrics_.export_text();
+        response.set_payload(text.data(), text.size());
+        response.checksum = NetworkSocket::calculate_crc32(response.payload.data(), response.payload_size);
+        return true;
+    }
+    
+    // The header is filled in once the operation's outcome is known
+    MetadataResponseHeader header = {META_ERROR, 0};
+    WireWriter out(response.payload);
+    out.put_bytes(&header, sizeof(header));
+    
+    switch (frame.message_type) {
+        case OP_METADATA_QUERY: {
+            std::string path(frame.payload.begin(), frame.payload.end());
+            
+            // Lease first: a change racing with this lookup is then pushed to us
+            grant_lease(path, connection_id);
+            header.lease_ms = DFS_METADATA_LEASE_SEC * 1000;
+            
+            FileMetadata metadata;
+            if (get_file_metadata(path, metadata)) {
+                header.status = META_OK;
+                encode_file_metadata(out, metadata);
+            } else {
+                header.status = META_NOT_FOUND;  // Negative answers are leased too
+            }
+            break;
+        }
+        
+        case OP_FILE_CREATE: {
+            // Path followed by 8 bytes: permissions and 4 reserved
+            if (frame.payload_size < 8) break;
+            std::string path(frame.payload.begin(), frame.payload.end() - 8);
+            uint32_t permissions;
+            std::memcpy(&permissions, frame.payload.data() + path.size(), sizeof(permissions));
+            
+            uint64_t file_id = 0;
+            header.status = create_entry(path, permissions, false, file_id);
+            out.put_u64(file_id);
+            if (header.status == META_OK) {
+                header.status = publish({path});
+            }
+            break;
+        }
+        
+        case OP_FILE_DELETE: {
+            std::string path(frame.payload.begin(), frame.payload.end());
+            header.status = delete_entry(path);
+            if (header.status == META_OK) {
+                header.status = publish({path});
+            }
+            break;
+        }
+        
+        case OP_MKDIR: {
+            std::string path(frame.payload.begin(), frame.payload.end());
+            uint64_t file_id;
+            header.status = create_entry(path, 0755, true, file_id);
+            if (header.status == META_OK) {
+                header.status = publish({path});
+            }
+            break;
+        }
+        
+        case OP_BATCH_METADATA:
+            header.status = process_batch(connection_id, frame, out) ? META_OK : META_ERROR;
+            header.lease_ms = DFS_METADATA_LEASE_SEC * 1000;
+            break;
+        
+        case OP_HEARTBEAT: {
+            WireReader in(frame.payload.data(), frame.payload.size());
+            HeartbeatMessage msg;
+            if (!decode_heartbeat(in, msg) || msg.server_id.empty()) break;
+            std::vector<std::pair<uint64_t, uint32_t>> stale;
+            bool want_report = process_heartbeat(msg, stale);
+            out.put_u8(want_report ? HEARTBEAT_WANT_BLOCK_REPORT : 0);
+            out.put_u32(static_cast<uint32_t>(stale.size()));
+            for (const auto& replica : stale) {
+                out.put_u64(replica.first);
+                out.put_u32(replica.second);
+            }
+            header.status = META_OK;
+            break;
+        }
+        
+        default:
+            break;
+    }
+    
+    std::memcpy(response.payload.data(), &header, sizeof(header));
+    response.payload_size = response.payload.size();
+    response.checksum = NetworkSocket::calculate_crc32(response.payload.data(), response.payload_size);
+    return header.status == META_OK;
+}
+
+
 // ============================================================================
 // File: main_chunk_server.cpp - Example Chunk Server Initialization
 // ============================================================================
@@ -92,13 +1057,18 @@ int main(int argc, char* argv[]) {
     uint16_t port = 9001;
     std::string storage_path = "/tmp/dfs_storage_cs1";
     uint64_t max_capacity = 1024 * 1024 * 1024;  // 1 GB
+    std::string zone;
+    std::string rack;
     
     // Parse command line arguments if provided
     if (argc >= 2) server_id = argv[1];
     if (argc >= 3) ip = argv[2];
     if (argc >= 4) port = std::atoi(argv[3]);
+    if (argc >= 5) zone = argv[4];
+    if (argc >= 6) rack = argv[5];
     
     g_chunk_server = new ChunkServer(server_id, ip, port, storage_path, max_capacity);
+    g_chunk_server->set_failure_domain(zone, rack);
     
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
@@ -200,49 +1170,1906 @@ int main() {
 
 
 // ============================================================================
-// File: CMakeLists.txt - Build Configuration
+// File: main_microbench.cpp - Component Microbenchmarks
 // ============================================================================
 
-cmake_minimum_required(VERSION 3.10)
-project(DistributedFileSystem CXX)
+#include "chunk_server.h"
+#include "namespace_tree.h"
+#include "metadata_log.h"
+#include "chunk_placement.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <cstring>
+#include <random>
+#include <queue>
+#include <set>
+#include <condition_variable>
+#include <malloc.h>
+#include <unistd.h>
 
-set(CMAKE_CXX_STANDARD 17)
-set(CMAKE_CXX_STANDARD_REQUIRED ON)
-set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -O3 -Wall -Wextra")
+using BenchClock = std::chrono::steady_clock;
 
-# Find required packages
-find_package(Threads REQUIRED)
-find_package(SQLite3 REQUIRED)
+static double seconds_since(BenchClock::time_point start) {
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
 
-# Header files
-set(HEADERS
-    common.h
-    thread_pool.h
-    network.h
-    client_lib.h
-    chunk_server.h
-)
+// Stream frames over loopback TCP and report sender-side bytes/sec.
+// copy path = legacy header+payload copy into one vector; sg path = send_frame (sendmsg)
+static double bench_send_path(bool scatter_gather, uint32_t payload_bytes, int iterations, 
+                              uint16_t port) {
+    NetworkSocket server;
+    if (!server.create_server_socket("127.0.0.1", port) || !server.listen_for_connections(1)) {
+        std::cerr << "microbench: cannot listen on port " << port << std::endl;
+        return 0.0;
+    }
+    
+    std::thread drain([&server] {
+        std::string peer_ip;
+        int fd = server.accept_connection(peer_ip);
+        if (fd < 0) return;
+        std::vector<uint8_t> sink(1 << 20);
+        while (recv(fd, sink.data(), sink.size(), 0) > 0) {}
+        close(fd);
+    });
+    
+    NetworkSocket client;
+    if (!client.connect_to_server("127.0.0.1", port)) {
+        server.close_socket();
+        drain.join();
+        return 0.0;
+    }
+    
+    ProtocolFrame frame(OP_WRITE);
+    frame.resize_payload(payload_bytes);
+    std::memset(frame.payload.data(), 0xAB, payload_bytes);
+    frame.checksum = 0;
+    
+    auto start = BenchClock::now();
+    for (int i = 0; i < iterations; ++i) {
+        if (scatter_gather) {
+            client.send_frame(frame);
+        } else {
+            std::vector<uint8_t> buffer(DFS_FRAME_HEADER_SIZE + payload_bytes);
+            const FrameHeader& header = frame;
+            std::memcpy(buffer.data(), &header, DFS_FRAME_HEADER_SIZE);
+            std::memcpy(buffer.data() + DFS_FRAME_HEADER_SIZE, frame.payload.data(), payload_bytes);
+            client.send_data(buffer);
+        }
+    }
+    double elapsed = seconds_since(start);
+    
+    client.close_socket();
+    drain.join();
+    server.close_socket();
+    
+    return (double)(DFS_FRAME_HEADER_SIZE + payload_bytes) * iterations / elapsed;
+}
 
-# Source files
-set(SOURCES
-    thread_pool.h
-    network.h
-    client_lib.h
-    chunk_server.h
-)
+static int run_net_bench(int argc, char* argv[]) {
+    uint32_t payload_kb = (argc >= 3) ? std::atoi(argv[2]) : 4096;
+    int iterations = (argc >= 4) ? std::atoi(argv[3]) : 64;
+    uint16_t port = (argc >= 5) ? std::atoi(argv[4]) : 9100;
+    
+    double copy_bps = bench_send_path(false, payload_kb * 1024, iterations, port);
+    double sg_bps = bench_send_path(true, payload_kb * 1024, iterations, port + 1);
+    
+    std::cout << "net payload_kb=" << payload_kb << " iterations=" << iterations << std::endl;
+    std::cout << "  copy_send   " << (copy_bps / 1e6) << " MB/s" << std::endl;
+    std::cout << "  sendmsg_iov " << (sg_bps / 1e6) << " MB/s" << std::endl;
+    return 0;
+}
 
-# Include directories
-include_directories(${CMAKE_CURRENT_SOURCE_DIR})
+// Compare CRC32C engines on one buffer and report GB/s for each
+static int run_crc_bench(int argc, char* argv[]) {
+    size_t buffer_mb = (argc >= 3) ? std::atoi(argv[2]) : 64;
+    int iterations = (argc >= 4) ? std::atoi(argv[3]) : 8;
+    
+    std::vector<uint8_t> buffer(buffer_mb * 1024 * 1024);
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = (uint8_t)(i * 2654435761u >> 24);
+    }
+    
+    const NetworkSocket::CrcImplementation impls[] = {
+        NetworkSocket::CRC_TABLE, NetworkSocket::CRC_SLICE_BY_8, NetworkSocket::CRC_HARDWARE
+    };
+    
+    std::cout << "crc buffer_mb=" << buffer_mb << " iterations=" << iterations 
+              << " active=" << NetworkSocket::crc_implementation_name(
+                     NetworkSocket::active_crc_implementation()) << std::endl;
+    
+    uint32_t reference = NetworkSocket::extend_crc32(0, buffer.data(), buffer.size(), 
+                                                     NetworkSocket::CRC_TABLE);
+    for (auto impl : impls) {
+        if (!NetworkSocket::crc_implementation_available(impl)) {
+            std::cout << "  " << NetworkSocket::crc_implementation_name(impl) 
+                      << " unavailable" << std::endl;
+            continue;
+        }
+        
+        uint32_t crc = 0;
+        auto start = BenchClock::now();
+        for (int i = 0; i < iterations; ++i) {
+            crc = NetworkSocket::extend_crc32(0, buffer.data(), buffer.size(), impl);
+        }
+        double elapsed = seconds_since(start);
+        
+        std::cout << "  " << NetworkSocket::crc_implementation_name(impl) << " "
+                  << ((double)buffer.size() * iterations / elapsed / 1e9) << " GB/s"
+                  << (crc == reference ? "" : " MISMATCH") << std::endl;
+    }
+    return 0;
+}
 
-# Chunk Server executable
-add_executable(chunk_server
-    main_chunk_server.cpp
-    ${SOURCES}
-)
-target_link_libraries(chunk_server
-    Threads::Threads
-    ${SQLITE3_LIBRARIES}
-)
+// Chunk table contention: mixed reads (half on one hot chunk) and writes
+// against a single ChunkServer, reported as ops/sec per thread count
+static int run_chunk_lock_bench(int argc, char* argv[]) {
+    int max_threads = (argc >= 3) ? std::atoi(argv[2]) : 16;
+    double step_seconds = (argc >= 4) ? std::atof(argv[3]) : 1.0;
+    size_t chunk_kb = (argc >= 5) ? std::atoi(argv[4]) : 64;
+    const uint64_t num_chunks = 256;
+    
+    ChunkServer server("BENCH", "127.0.0.1", 0, "/tmp/dfs_bench", 1ull << 40,
+                       std::make_unique<MemoryChunkStore>());
+    std::vector<uint8_t> chunk_data(chunk_kb * 1024, 0x5A);
+    for (uint64_t id = 0; id < num_chunks; ++id) {
+        server.write_chunk(id, chunk_data);
+    }
+    
+    std::cout << "chunks chunk_kb=" << chunk_kb << " chunks=" << num_chunks << std::endl;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        std::atomic<bool> stop(false);
+        std::atomic<uint64_t> ops(0);
+        std::vector<std::thread> workers;
+        
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::mt19937_64 rng(t + 1);
+                std::vector<uint8_t> out;
+                uint64_t local_ops = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    uint64_t r = rng();
+                    uint64_t id = (r & 1) ? 0 : (r >> 8) % num_chunks;
+                    if ((r >> 4) % 10 == 0) {
+                        server.write_chunk(id == 0 ? 1 : id, chunk_data);
+                    } else {
+                        server.read_chunk(id, out);
+                    }
+                    ++local_ops;
+                }
+                ops += local_ops;
+            });
+        }
+        
+        std::this_thread::sleep_for(std::chrono::duration<double>(step_seconds));
+        stop = true;
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        
+        std::cout << "  threads=" << threads << " " << (ops.load() / step_seconds) 
+                  << " ops/s" << std::endl;
+    }
+    return 0;
+}
+
+// The pre-work-stealing pool (one std::function queue behind one mutex), kept
+// as the baseline for the pool bench
+class LegacyThreadPool {
+public:
+    explicit LegacyThreadPool(size_t num_threads) : stop_(false) {
+        for (size_t i = 0; i < num_threads; ++i) {
+            threads_.emplace_back([this] {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        cv_.wait(lock, [this] { return !tasks_.empty() || stop_; });
+                        if (stop_ && tasks_.empty()) return;
+                        task = std::move(tasks_.front());
+                        tasks_.pop();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+    
+    ~LegacyThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& thread : threads_) thread.join();
+    }
+    
+    void enqueue(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            tasks_.emplace(std::move(task));
+        }
+        cv_.notify_one();
+    }
+
+private:
+    std::vector<std::thread> threads_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_;
+};
+
+static void wait_for_count(const std::atomic<uint64_t>& done, uint64_t target) {
+    while (done.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+    }
+}
+
+static void submit_batch(ThreadPool& pool, std::atomic<uint64_t>& done, size_t count) {
+    std::vector<Task> batch;
+    batch.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        batch.emplace_back([&done] { done.fetch_add(1, std::memory_order_release); });
+    }
+    pool.enqueue_bulk(std::move(batch));
+}
+
+static void submit_batch(LegacyThreadPool& pool, std::atomic<uint64_t>& done, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        pool.enqueue([&done] { done.fetch_add(1, std::memory_order_release); });
+    }
+}
+
+// Binary task tree: every task schedules its children from inside the pool
+template <typename Pool>
+static void spawn_tree(Pool& pool, std::atomic<uint64_t>& done, int depth) {
+    if (depth > 0) {
+        pool.enqueue([&pool, &done, depth] { spawn_tree(pool, done, depth - 1); });
+        pool.enqueue([&pool, &done, depth] { spawn_tree(pool, done, depth - 1); });
+    }
+    done.fetch_add(1, std::memory_order_release);
+}
+
+// Tasks/sec for one submission pattern: "single" (one enqueue per task from an
+// outside thread), "bulk" (batches of 64) or "spawn" (tasks scheduling tasks)
+template <typename Pool>
+static double bench_pool(Pool& pool, const std::string& mode, uint64_t num_tasks) {
+    std::atomic<uint64_t> done(0);
+    uint64_t target = num_tasks;
+    auto start = BenchClock::now();
+    
+    if (mode == "single") {
+        for (uint64_t i = 0; i < num_tasks; ++i) {
+            pool.enqueue([&done] { done.fetch_add(1, std::memory_order_release); });
+        }
+    } else if (mode == "bulk") {
+        for (uint64_t i = 0; i < num_tasks; i += 64) {
+            submit_batch(pool, done, std::min<uint64_t>(64, num_tasks - i));
+        }
+    } else {
+        // Deepest full tree that fits in num_tasks
+        int depth = 0;
+        while ((2ull << (depth + 1)) - 1 <= num_tasks) ++depth;
+        target = (2ull << depth) - 1;
+        pool.enqueue([&pool, &done, depth] { spawn_tree(pool, done, depth); });
+    }
+    
+    wait_for_count(done, target);
+    return target / seconds_since(start);
+}
+
+static int run_pool_bench(int argc, char* argv[]) {
+    int max_threads = (argc >= 3) ? std::atoi(argv[2]) : 64;
+    uint64_t num_tasks = (argc >= 4) ? std::atoll(argv[3]) : 1000000;
+    
+    std::cout << "pool tasks=" << num_tasks << " (tasks/s, legacy -> work-stealing)" << std::endl;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        std::cout << "  threads=" << threads;
+        for (const char* mode : {"single", "bulk", "spawn"}) {
+            double legacy_tps, stealing_tps;
+            {
+                LegacyThreadPool pool(threads);
+                legacy_tps = bench_pool(pool, mode, num_tasks);
+            }
+            {
+                ThreadPool pool(threads);
+                stealing_tps = bench_pool(pool, mode, num_tasks);
+            }
+            std::cout << " " << mode << "=" << (uint64_t)legacy_tps << "->" << (uint64_t)stealing_tps;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+// The flat path -> entry map behind one mutex, storing full FileMetadata and
+// ChunkHandles, that the metadata server used before NamespaceTree; kept as the
+// baseline for the ns and footprint benches
+class LegacyNamespace {
+public:
+    bool get(const std::string& path, FileMetadata& metadata) const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = entries_.find(path);
+        if (it == entries_.end()) return false;
+        metadata = it->second.metadata;
+        metadata.chunks = it->second.chunks;
+        return true;
+    }
+    
+    MetadataStatus insert(const std::string& path, FileMetadata& metadata) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (entries_.count(path)) return META_EXISTS;
+        metadata.file_id = next_file_id_++;
+        Entry& entry = entries_[path];
+        entry.metadata = metadata;
+        entry.metadata.chunks.clear();
+        entry.chunks = metadata.chunks;
+        return META_OK;
+    }
+    
+    MetadataStatus erase(const std::string& path) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return entries_.erase(path) ? META_OK : META_NOT_FOUND;
+    }
+
+private:
+    struct Entry {
+        FileMetadata metadata;
+        std::vector<ChunkHandle> chunks;
+    };
+    
+    std::map<std::string, Entry> entries_;
+    mutable std::mutex mutex_;
+    uint64_t next_file_id_ = 1;
+};
+
+// 64 top-level volumes of 1024 directories each, files spread evenly
+static std::string bench_path(uint64_t i) {
+    return "/vol" + std::to_string(i % 64) + "/dir" + std::to_string((i / 64) % 1024) + 
+           "/file" + std::to_string(i);
+}
+
+// Inserts/sec while filling the namespace with entries files
+template <typename Namespace>
+static double bench_namespace_fill(Namespace& ns, uint64_t entries) {
+    auto start = BenchClock::now();
+    for (uint64_t i = 0; i < entries; ++i) {
+        FileMetadata metadata;
+        metadata.path = bench_path(i);
+        ns.insert(metadata.path, metadata);
+    }
+    return entries / seconds_since(start);
+}
+
+// Ops/sec for threads doing 90% lookups of existing files and 10% create+delete
+// of new ones next to them
+template <typename Namespace>
+static double bench_namespace_ops(Namespace& ns, uint64_t entries, int threads, double step_seconds) {
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> ops(0);
+    std::vector<std::thread> workers;
+    
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            FileMetadata metadata;
+            uint64_t local_ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                uint64_t r = rng();
+                std::string path = bench_path(r % entries);
+                if ((r >> 40) % 10 == 0) {
+                    path += ".t" + std::to_string(t);
+                    FileMetadata created;
+                    ns.insert(path, created);
+                    ns.erase(path);
+                    local_ops += 2;
+                } else {
+                    ns.get(path, metadata);
+                    ++local_ops;
+                }
+            }
+            ops += local_ops;
+        });
+    }
+    
+    std::this_thread::sleep_for(std::chrono::duration<double>(step_seconds));
+    stop = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return ops.load() / step_seconds;
+}
+
+template <typename Namespace>
+static std::vector<double> bench_namespace(uint64_t entries, int max_threads, double step_seconds) {
+    Namespace ns;
+    std::vector<double> results = {bench_namespace_fill(ns, entries)};
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        results.push_back(bench_namespace_ops(ns, entries, threads, step_seconds));
+    }
+    return results;
+}
+
+// Metadata namespace ops/sec at a given size, flat map vs tree. One namespace is
+// alive at a time, so 10M entries fits where two would not.
+static int run_namespace_bench(int argc, char* argv[]) {
+    uint64_t entries = (argc >= 3) ? std::atoll(argv[2]) : 1000000;
+    int max_threads = (argc >= 4) ? std::atoi(argv[3]) : 16;
+    double step_seconds = (argc >= 5) ? std::atof(argv[4]) : 1.0;
+    
+    std::vector<double> legacy = bench_namespace<LegacyNamespace>(entries, max_threads, step_seconds);
+    std::vector<double> tree = bench_namespace<NamespaceTree>(entries, max_threads, step_seconds);
+    
+    std::cout << "ns entries=" << entries << " (ops/s, flat map -> tree)" << std::endl;
+    std::cout << "  insert " << (uint64_t)legacy[0] << "->" << (uint64_t)tree[0] << std::endl;
+    for (size_t i = 1, threads = 1; i < tree.size(); ++i, threads *= 2) {
+        std::cout << "  threads=" << threads << " mixed " << (uint64_t)legacy[i] << "->" 
+                  << (uint64_t)tree[i] << std::endl;
+    }
+    return 0;
+}
+
+static size_t heap_bytes_in_use() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;  // Small blocks plus mmapped ones (arena pages)
+}
+
+// Heap bytes per file for a namespace of files with chunks_per_file chunks of
+// DFS_REPLICATION_FACTOR replicas each, spread over 100 chunk servers
+template <typename Namespace>
+static double bench_footprint(uint64_t files, uint32_t chunks_per_file) {
+    size_t before = heap_bytes_in_use();
+    auto ns = std::make_unique<Namespace>();
+    uint64_t chunk_id = 1;
+    for (uint64_t i = 0; i < files; ++i) {
+        FileMetadata metadata;
+        metadata.path = bench_path(i);
+        metadata.file_size = (uint64_t)chunks_per_file * DFS_CHUNK_SIZE_BYTES;
+        metadata.chunks.resize(chunks_per_file);
+        for (ChunkHandle& chunk : metadata.chunks) {
+            chunk.chunk_id = chunk_id++;
+            chunk.creation_time = metadata.creation_time;
+            chunk.size = DFS_CHUNK_SIZE_BYTES;
+            for (int r = 0; r < DFS_REPLICATION_FACTOR; ++r) {
+                uint64_t server = (chunk.chunk_id + r * 37) % 100;
+                chunk.replicas.emplace_back("CS_" + std::to_string(100 + server), 
+                                            "10.0.1." + std::to_string(server), 9001, 0);
+            }
+        }
+        ns->insert(metadata.path, metadata);
+    }
+    return (double)(heap_bytes_in_use() - before) / files;
+}
+
+// A NamespaceTree logged to a MetadataLog in directory, as the metadata server runs it
+struct LoggedNamespace {
+    NamespaceTree tree;
+    MetadataLog log;
+    
+    explicit LoggedNamespace(const std::string& directory) : log(directory) {
+        log.open(1, [this](const NamespaceChange& change) { tree.apply(change); });
+        tree.set_observer([this](const NamespaceChange& change) { log.append(change); });
+    }
+};
+
+// Durable creates/sec, each thread waiting until its create is synced. Unless
+// grouped, creates are serialized so every one pays its own fdatasync.
+static double bench_wal_creates(LoggedNamespace& ns, int threads, double step_seconds, bool grouped,
+                                uint64_t& creates_per_flush) {
+    static std::atomic<uint64_t> next_file(0);
+    std::mutex serial;
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> ops(0);
+    uint64_t flushes_before = ns.log.flushes();
+    std::vector<std::thread> workers;
+    
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            uint64_t local_ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::unique_lock<std::mutex> lock(serial, std::defer_lock);
+                if (!grouped) {
+                    lock.lock();
+                }
+                FileMetadata metadata;
+                ns.tree.insert(bench_path(next_file++), metadata);
+                ns.log.sync();
+                ++local_ops;
+            }
+            ops += local_ops;
+        });
+    }
+    
+    std::this_thread::sleep_for(std::chrono::duration<double>(step_seconds));
+    stop = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    creates_per_flush = ops.load() / std::max<uint64_t>(1, ns.log.flushes() - flushes_before);
+    return ops.load() / step_seconds;
+}
+
+// Durable metadata creates/sec with and without group commit, then restart time
+// for a namespace of entries files that also saw as many temporary files come
+// and go: replaying its whole log vs loading a snapshot
+static int run_wal_bench(int argc, char* argv[]) {
+    int max_threads = (argc >= 3) ? std::atoi(argv[2]) : 32;
+    double step_seconds = (argc >= 4) ? std::atof(argv[3]) : 1.0;
+    uint64_t entries = (argc >= 5) ? std::atoll(argv[4]) : 1000000;
+    char directory_template[] = "/tmp/dfs_wal_bench.XXXXXX";
+    std::string directory = (argc >= 6) ? argv[5] : "";
+    if (directory.empty()) {
+        if (!mkdtemp(directory_template)) {
+            std::cerr << "Failed to create a bench directory" << std::endl;
+            return 1;
+        }
+        directory = directory_template;
+    }
+    
+    std::cout << "wal dir=" << directory << " (durable creates/s, fdatasync each -> group commit)" 
+              << std::endl;
+    {
+        LoggedNamespace ns(directory);
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            uint64_t serial_batch, grouped_batch;
+            double serial = bench_wal_creates(ns, threads, step_seconds, false, serial_batch);
+            double grouped = bench_wal_creates(ns, threads, step_seconds, true, grouped_batch);
+            std::cout << "  threads=" << threads << " " << (uint64_t)serial << "->" << (uint64_t)grouped 
+                      << " (" << grouped_batch << " creates per fdatasync)" << std::endl;
+        }
+        ns.log.rotate();
+        ns.log.discard_before(UINT64_MAX);
+    }
+    
+    std::string snapshot_path = directory + "/metadata.snapshot";
+    {
+        LoggedNamespace ns(directory);
+        for (uint64_t i = 0; i < entries; ++i) {
+            FileMetadata metadata, temporary;
+            ns.tree.insert(bench_path(i), metadata);
+            ns.tree.insert(bench_path(i) + ".tmp", temporary);
+            ns.tree.erase(bench_path(i) + ".tmp");
+        }
+        ns.log.sync();
+    }
+    
+    // Trees are timed up to ready, not through their teardown
+    auto start = BenchClock::now();
+    double replay_ms;
+    {
+        LoggedNamespace ns(directory);
+        replay_ms = seconds_since(start) * 1000;
+        
+        MetadataSnapshot::Info info = {ns.log.rotate(), ns.tree.next_file_id(), 1, 0};
+        MetadataSnapshot::write(snapshot_path, ns.tree, info);
+        ns.log.discard_before(info.log_sequence);
+    }
+    
+    double load_ms;
+    {
+        start = BenchClock::now();
+        NamespaceTree tree;
+        MetadataSnapshot::Info info;
+        MetadataSnapshot::load(snapshot_path, tree, info);
+        load_ms = seconds_since(start) * 1000;
+    }
+    std::cout << "  restart entries=" << entries << " " << (uint64_t)replay_ms << "->" 
+              << (uint64_t)load_ms << " ms (log replay -> snapshot load)" << std::endl;
+    
+    MetadataLog(directory).discard_before(UINT64_MAX);
+    unlink(snapshot_path.c_str());
+    if (argc < 6) {
+        rmdir(directory.c_str());
+    }
+    return 0;
+}
+
+static int run_footprint_bench(int argc, char* argv[]) {
+    uint64_t files = (argc >= 3) ? std::atoll(argv[2]) : 1000000;
+    uint32_t chunks_per_file = (argc >= 4) ? std::atoi(argv[3]) : 4;
+    
+    double legacy = bench_footprint<LegacyNamespace>(files, chunks_per_file);
+    double tree = bench_footprint<NamespaceTree>(files, chunks_per_file);
+    
+    std::cout << "footprint files=" << files << " chunks_per_file=" << chunks_per_file 
+              << " (heap bytes/file, flat map -> tree)" << std::endl;
+    std::cout << "  " << (uint64_t)legacy << "->" << (uint64_t)tree << " (" << (legacy / tree) 
+              << "x)" << std::endl;
+    return 0;
+}
+
+// Place chunks on a simulated cluster (mixed capacities and fill, 8 zones of
+// racks of 20 servers, heartbeats every few thousand chunks) and report the
+// cost per chunk, the fill spread before and after and how often a chunk's
+// replicas landed in distinct zones. legacy = first live servers in id order
+struct PlacementResult {
+    double ns_per_chunk;
+    double initial_spread;   // Highest minus lowest used fraction, before...
+    double fill_spread;      // ...and after
+    double distinct_zones;   // Fraction of chunks whose replicas share no zone
+    uint64_t overfilled;     // Replicas placed on a server with no room
+};
+
+static double fill_spread(const std::vector<ChunkServerStatus>& cluster) {
+    double lowest = 1.0;
+    double highest = 0.0;
+    for (const ChunkServerStatus& status : cluster) {
+        double fill = (double)status.used_capacity_bytes / status.total_capacity_bytes;
+        lowest = std::min(lowest, fill);
+        highest = std::max(highest, fill);
+    }
+    return highest - lowest;
+}
+
+static PlacementResult bench_placement(bool legacy, size_t num_servers, uint64_t num_chunks) {
+    std::mt19937_64 random(42);
+    std::vector<ChunkServerStatus> cluster(num_servers);
+    for (size_t i = 0; i < num_servers; ++i) {
+        ChunkServerStatus& status = cluster[i];
+        char id[32];
+        std::snprintf(id, sizeof(id), "cs%05zu", i);
+        status.server_id = id;
+        status.ip_address = "10.0.0.1";
+        status.port = 9001;
+        status.zone = "z" + std::to_string(i % 8);
+        status.rack = "r" + std::to_string(i / 8 / 20);
+        status.total_capacity_bytes = (2 + random() % 7) * (1ull << 40);  // 2-8 TB
+        status.used_capacity_bytes = status.total_capacity_bytes / 100 * (random() % 60);
+        status.pending_requests = random() % 32;
+    }
+    std::map<std::string, size_t> by_id;
+    for (size_t i = 0; i < num_servers; ++i) {
+        by_id[cluster[i].server_id] = i;
+    }
+    
+    double initial_spread = fill_spread(cluster);
+    ChunkPlacement placement;
+    for (const ChunkServerStatus& status : cluster) {
+        placement.update(status);
+    }
+    
+    const uint64_t HEARTBEAT_EVERY = 4096;
+    uint64_t distinct = 0;
+    uint64_t overfilled = 0;
+    double elapsed = 0;
+    for (uint64_t chunk = 1; chunk <= num_chunks; ++chunk) {
+        auto start = BenchClock::now();
+        std::vector<ChunkLocation> replicas;
+        if (legacy) {
+            for (const auto& entry : by_id) {
+                const ChunkServerStatus& status = cluster[entry.second];
+                replicas.emplace_back(status.server_id, status.ip_address, status.port, chunk);
+                if (replicas.size() == (size_t)DFS_REPLICATION_FACTOR) {
+                    break;
+                }
+            }
+        } else {
+            replicas = placement.choose(DFS_REPLICATION_FACTOR, chunk, DFS_CHUNK_SIZE_BYTES, 
+                                        std::time(nullptr));
+        }
+        elapsed += seconds_since(start);
+        
+        std::set<std::string> zones;
+        for (const ChunkLocation& replica : replicas) {
+            ChunkServerStatus& status = cluster[by_id[replica.server_id]];
+            if (status.used_capacity_bytes + DFS_CHUNK_SIZE_BYTES > status.total_capacity_bytes) {
+                overfilled++;
+            }
+            status.used_capacity_bytes += DFS_CHUNK_SIZE_BYTES;
+            zones.insert(status.zone);
+        }
+        distinct += zones.size() == replicas.size();
+        
+        if (chunk % HEARTBEAT_EVERY == 0) {
+            for (ChunkServerStatus& status : cluster) {
+                status.last_heartbeat = std::time(nullptr);
+                placement.update(status);
+            }
+        }
+    }
+    
+    return {elapsed * 1e9 / num_chunks, initial_spread, fill_spread(cluster), 
+            (double)distinct / num_chunks, overfilled};
+}
+
+static int run_placement_bench(int argc, char* argv[]) {
+    size_t servers = (argc >= 3) ? std::atoll(argv[2]) : 2000;
+    uint64_t chunks = (argc >= 4) ? std::atoll(argv[3]) : 1000000;
+    
+    std::cout << "placement servers=" << servers << " chunks=" << chunks << std::endl;
+    for (bool legacy : {true, false}) {
+        PlacementResult result = bench_placement(legacy, servers, chunks);
+        std::cout << "  " << (legacy ? "legacy " : "engine ") << (uint64_t)result.ns_per_chunk 
+                  << " ns/chunk, fill spread " << result.initial_spread * 100 << "% -> " 
+                  << result.fill_spread * 100 << "%, distinct zones " << result.distinct_zones * 100 
+                  << "%, overfilled " << result.overfilled << std::endl;
+    }
+    
+    // Cost per allocation as the cluster grows
+    for (size_t n = 100; n <= servers * 10; n *= 10) {
+        std::cout << "  " << n << " servers: " 
+                  << (uint64_t)bench_placement(false, n, 100000).ns_per_chunk << " ns/chunk" << std::endl;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const std::map<std::string, std::function<int(int, char**)>> benches = {
+        {"net", run_net_bench},
+        {"crc", run_crc_bench},
+        {"chunks", run_chunk_lock_bench},
+        {"pool", run_pool_bench},
+        {"ns", run_namespace_bench},
+        {"footprint", run_footprint_bench},
+        {"wal", run_wal_bench},
+        {"placement", run_placement_bench},
+    };
+    
+    std::string name = (argc >= 2) ? argv[1] : "";
+    auto it = benches.find(name);
+    if (it == benches.end()) {
+        std::cerr << "Usage: " << argv[0] << " <bench> [args...]" << std::endl;
+        std::cerr << "  net [payload_kb] [iterations] [port]" << std::endl;
+        std::cerr << "  crc [buffer_mb] [iterations]" << std::endl;
+        std::cerr << "  chunks [max_threads] [seconds_per_step] [chunk_kb]" << std::endl;
+        std::cerr << "  pool [max_threads] [tasks]" << std::endl;
+        std::cerr << "  ns [entries] [max_threads] [seconds_per_step]" << std::endl;
+        std::cerr << "  footprint [files] [chunks_per_file]" << std::endl;
+        std::cerr << "  wal [max_threads] [seconds_per_step] [entries] [dir]" << std::endl;
+        std::cerr << "  placement [servers] [chunks]" << std::endl;
+        return 1;
+    }
+    
+    return it->second(argc, argv);
+}
+
+
+// ============================================================================
+// File: main_bench.cpp - Cluster Benchmarks
+// ============================================================================
+
+#include "chunk_server.h"
+#include "metadata_server.h"
+#include "client_lib.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <algorithm>
+#include <cctype>
+#include <csignal>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+// Brings up a metadata server and N chunk servers on loopback, drives them
+// through the client library (or raw frames, for heartbeats) and prints one
+// JSON object per result line on stdout. Server logs and progress go to stderr.
+
+struct BenchOptions {
+    uint32_t servers = 4;
+    bool processes = false;           // Chunk servers in child processes rather than threads
+    std::string storage_dir;          // FileChunkStore per server under it; empty = memory
+    uint16_t port = 9400;             // Metadata server; chunk servers take the ports after it
+    std::vector<std::string> workloads;
+    std::vector<size_t> io_sizes = {4096, 65536, 1 << 20};
+    uint32_t threads = 4;
+    uint64_t file_mb = 256;           // Data file the I/O workloads and recovery share
+    double seconds = 5.0;             // Per workload and I/O size...
+    uint64_t ops = 0;                 // ...or stop after this many operations
+    uint32_t meta_files = 20000;
+    uint32_t hb_servers = 10;         // Synthetic servers...
+    uint32_t hb_chunks = 100000;      // ...each reporting this many chunks...
+    uint32_t hb_rounds = 20;          // ...then sending this many delta heartbeats...
+    uint32_t hb_deltas = 100;         // ...of this many added chunks
+};
+
+static const char* const BENCH_WORKLOADS[] = {
+    "seq_write", "rand_write", "seq_read", "rand_read",
+    "meta_create", "meta_stat", "heartbeat", "recovery"
+};
+
+static const char* const DATA_FILE = "/bench_data";
+static const char* const META_DIR = "/bench_meta";
+
+// Results only; main() points stdout, where the servers log, at stderr
+static FILE* g_results = stdout;
+
+// One result line
+struct BenchResult {
+    std::string workload;
+    uint64_t io_bytes = 0;
+    uint32_t threads = 0;
+    uint64_t ops = 0;
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+    double seconds = 0.0;
+    HistogramSnapshot latency;
+    std::vector<std::pair<std::string, double>> extra;
+};
+
+static void print_result(const BenchOptions& options, const BenchResult& result) {
+    auto number = [](double value) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.3f", value);
+        return std::string(text);
+    };
+    auto micros = [&](uint64_t ns) { return number(ns / 1e3); };
+    double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+    
+    std::ostringstream line;
+    line << "{\"workload\":\"" << result.workload << "\",\"servers\":" << options.servers
+         << ",\"mode\":\"" << (options.processes ? "processes" : "threads") << "\""
+         << ",\"threads\":" << result.threads << ",\"io_bytes\":" << result.io_bytes
+         << ",\"ops\":" << result.ops << ",\"errors\":" << result.errors
+         << ",\"seconds\":" << number(result.seconds)
+         << ",\"ops_per_sec\":" << number(result.ops / seconds)
+         << ",\"mb_per_sec\":" << number(result.bytes / seconds / (1 << 20))
+         << ",\"p50_us\":" << micros(result.latency.percentile(0.5))
+         << ",\"p99_us\":" << micros(result.latency.percentile(0.99))
+         << ",\"p999_us\":" << micros(result.latency.percentile(0.999))
+         << ",\"max_us\":" << micros(result.latency.max_ns);
+    for (const auto& field : result.extra) {
+        line << ",\"" << field.first << "\":" << number(field.second);
+    }
+    line << "}\n";
+    std::fputs(line.str().c_str(), g_results);
+    std::fflush(g_results);
+}
+
+static double seconds_between(uint64_t start_ns, uint64_t end_ns) {
+    return (end_ns - start_ns) / 1e9;
+}
+
+// Value of one series in Prometheus text, e.g. name{op="heartbeat"}; 0 if absent
+static double metric_value(const std::string& text, const std::string& series) {
+    size_t at = 0;
+    while ((at = text.find(series + " ", at)) != std::string::npos) {
+        if (at == 0 || text[at - 1] == '\n') {
+            return std::atof(text.c_str() + at + series.size() + 1);
+        }
+        at += series.size();
+    }
+    return 0.0;
+}
+
+// ----------------------------------------------------------------------------
+// Cluster
+// ----------------------------------------------------------------------------
+
+class BenchCluster {
+public:
+    explicit BenchCluster(const BenchOptions& options) : options_(options) {}
+    ~BenchCluster() { stop(); }
+    
+    // Returns once the metadata server has heard from every chunk server
+    bool start();
+    void stop();
+    
+    // Stops a chunk server without telling anyone (SIGKILL in process mode)
+    void kill_server(size_t index);
+    
+    MetadataServer& metadata() { return *metadata_; }
+    uint16_t metadata_port() const { return options_.port; }
+    static std::string server_id(size_t index) { return "bench_cs_" + std::to_string(index); }
+
+private:
+    std::unique_ptr<ChunkServer> make_server(size_t index) const;
+    
+    BenchOptions options_;
+    std::unique_ptr<MetadataServer> metadata_;
+    std::vector<std::unique_ptr<ChunkServer>> servers_;
+    std::vector<pid_t> children_;
+};
+
+std::unique_ptr<ChunkServer> BenchCluster::make_server(size_t index) const {
+    std::unique_ptr<ChunkStore> store;
+    std::string path = options_.storage_dir + "/" + server_id(index);
+    if (options_.storage_dir.empty()) {
+        store = std::make_unique<MemoryChunkStore>();
+        path = "/tmp/dfs_bench_unused";
+    }
+    auto server = std::make_unique<ChunkServer>(server_id(index), "127.0.0.1",
+                                                options_.port + 1 + index, path,
+                                                1ull << 40, std::move(store));
+    // A zone each, so placement never has to fall back to sharing one
+    server->set_failure_domain("zone" + std::to_string(index), "rack0");
+    server->set_metadata_server("127.0.0.1", options_.port);
+    return server;
+}
+
+bool BenchCluster::start() {
+    // Children are forked before this process starts any thread
+    if (options_.processes) {
+        for (size_t i = 0; i < options_.servers; ++i) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                std::cerr << "dfs_bench: fork failed" << std::endl;
+                return false;
+            }
+            if (pid == 0) {
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                std::unique_ptr<ChunkServer> server = make_server(i);
+                if (!server->start()) {
+                    _exit(1);
+                }
+                while (server->is_running()) {
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                }
+                _exit(0);
+            }
+            children_.push_back(pid);
+        }
+    }
+    
+    metadata_ = std::make_unique<MetadataServer>("127.0.0.1", options_.port);
+    if (!metadata_->start()) {
+        std::cerr << "dfs_bench: metadata server failed to start on port " << options_.port << std::endl;
+        return false;
+    }
+    
+    if (!options_.processes) {
+        for (size_t i = 0; i < options_.servers; ++i) {
+            servers_.push_back(make_server(i));
+            if (!servers_.back()->start()) {
+                std::cerr << "dfs_bench: " << server_id(i) << " failed to start" << std::endl;
+                return false;
+            }
+        }
+    }
+    
+    // Each server heartbeats as it starts; children retry until the metadata
+    // server listens, one heartbeat interval later
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(3 * DFS_HEARTBEAT_INTERVAL_SEC);
+    while (metric_value(metadata_->export_metrics(),
+                        "dfs_meta_request_seconds_count{op=\"heartbeat\"}") < options_.servers) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            std::cerr << "dfs_bench: chunk servers did not register" << std::endl;
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return true;
+}
+
+void BenchCluster::stop() {
+    for (pid_t pid : children_) {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+    children_.clear();
+    for (auto& server : servers_) {
+        if (server) server->stop();
+    }
+    servers_.clear();
+    if (metadata_) {
+        metadata_->stop();
+        metadata_.reset();
+    }
+}
+
+void BenchCluster::kill_server(size_t index) {
+    if (options_.processes) {
+        kill(children_[index], SIGKILL);
+        waitpid(children_[index], nullptr, 0);
+        children_[index] = -1;
+    } else {
+        servers_[index]->stop();
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Workloads
+// ----------------------------------------------------------------------------
+
+// Runs body(thread, op) on every thread until options.ops operations or
+// options.seconds have passed; body returns the bytes moved, or -1 on error
+static BenchResult run_threads(const BenchOptions& options, const std::string& workload,
+                               uint64_t io_bytes, uint64_t max_ops,
+                               const std::function<int64_t(uint32_t, uint64_t)>& body) {
+    LatencyHistogram latency;
+    std::atomic<uint64_t> next_op(0);
+    std::atomic<uint64_t> errors(0);
+    std::atomic<uint64_t> bytes(0);
+    uint64_t duration_ns = (uint64_t)(options.seconds * 1e9);
+    
+    uint64_t start_ns = metrics_now_ns();
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < options.threads; ++t) {
+        threads.emplace_back([&, t] {
+            uint64_t op;
+            while ((op = next_op.fetch_add(1)) < max_ops) {
+                uint64_t op_start = metrics_now_ns();
+                if (op_start - start_ns > duration_ns) break;
+                int64_t moved = body(t, op);
+                latency.record_since(op_start);
+                if (moved < 0) {
+                    errors.fetch_add(1);
+                } else {
+                    bytes.fetch_add(moved);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    BenchResult result;
+    result.workload = workload;
+    result.io_bytes = io_bytes;
+    result.threads = options.threads;
+    result.seconds = seconds_between(start_ns, metrics_now_ns());
+    result.latency = latency.snapshot();
+    result.ops = result.latency.count;
+    result.errors = errors;
+    result.bytes = bytes;
+    return result;
+}
+
+// The data file: created with its chunks allocated up front (clients cannot
+// allocate), written once before anything reads it
+class DataFile {
+public:
+    DataFile(BenchCluster& cluster, uint64_t size_bytes)
+        : cluster_(cluster), size_(size_bytes),
+          client_("127.0.0.1", cluster.metadata_port()) {}
+    
+    bool open();
+    bool fill();  // Write the whole file sequentially, so reads find data
+    
+    DistributedFileSystem& client() { return client_; }
+    int fd() const { return fd_; }
+    uint64_t size() const { return size_; }
+    uint64_t file_id() const { return file_id_; }
+
+private:
+    BenchCluster& cluster_;
+    uint64_t size_;
+    DistributedFileSystem client_;
+    uint64_t file_id_ = 0;
+    int fd_ = -1;
+    bool filled_ = false;
+};
+
+bool DataFile::open() {
+    if (fd_ >= 0) return true;
+    
+    FileMetadata metadata;
+    if (client_.create_file(DATA_FILE) != 0 ||
+        !cluster_.metadata().get_file_metadata(DATA_FILE, metadata)) {
+        return false;
+    }
+    file_id_ = metadata.file_id;
+    uint32_t chunks = (uint32_t)((size_ + DFS_CHUNK_SIZE_BYTES - 1) / DFS_CHUNK_SIZE_BYTES);
+    if (!cluster_.metadata().allocate_chunks(file_id_, chunks)) {
+        return false;
+    }
+    fd_ = client_.open(DATA_FILE, DFS_OPEN_WRITE);
+    return fd_ >= 0;
+}
+
+bool DataFile::fill() {
+    if (filled_) return true;
+    
+    std::vector<uint8_t> block(4 << 20, 0x5A);
+    for (uint64_t offset = 0; offset < size_; offset += block.size()) {
+        size_t length = (size_t)std::min<uint64_t>(block.size(), size_ - offset);
+        if (client_.pwrite(fd_, block.data(), length, offset) != length) {
+            return false;
+        }
+    }
+    filled_ = true;
+    return true;
+}
+
+static BenchResult run_io(const BenchOptions& options, DataFile& file, bool write, bool random,
+                          size_t io_bytes) {
+    uint64_t blocks = file.size() / io_bytes;
+    uint64_t per_thread = std::max<uint64_t>(1, blocks / options.threads);
+    std::vector<std::vector<uint8_t>> buffers(options.threads, std::vector<uint8_t>(io_bytes, 0xA5));
+    std::vector<std::mt19937_64> rngs;
+    for (uint32_t t = 0; t < options.threads; ++t) {
+        rngs.emplace_back(0x9E3779B9u + t);
+    }
+    std::vector<uint64_t> positions(options.threads, 0);
+    
+    // Sequential: each thread walks its own slice of the file, wrapping around
+    auto body = [&](uint32_t t, uint64_t) -> int64_t {
+        uint64_t block;
+        if (random) {
+            block = rngs[t]() % blocks;
+        } else {
+            block = (t * per_thread + positions[t]++ % per_thread) % blocks;
+        }
+        uint64_t offset = block * io_bytes;
+        size_t moved = write ? file.client().pwrite(file.fd(), buffers[t].data(), io_bytes, offset)
+                             : file.client().pread(file.fd(), buffers[t].data(), io_bytes, offset);
+        return moved == io_bytes ? (int64_t)moved : -1;
+    };
+    
+    std::string name = std::string(random ? "rand_" : "seq_") + (write ? "write" : "read");
+    return run_threads(options, name, io_bytes, options.ops ? options.ops : UINT64_MAX, body);
+}
+
+static std::string meta_path(uint64_t index) {
+    return std::string(META_DIR) + "/f" + std::to_string(index);
+}
+
+// Creates or stats meta_files files, each thread through a client of its own so
+// stats miss the cache and every call is a round trip
+static BenchResult run_meta(const BenchOptions& options, BenchCluster& cluster, bool create) {
+    std::vector<std::unique_ptr<DistributedFileSystem>> clients;
+    for (uint32_t t = 0; t < options.threads; ++t) {
+        clients.push_back(std::make_unique<DistributedFileSystem>("127.0.0.1",
+                                                                  cluster.metadata_port()));
+    }
+    
+    auto body = [&](uint32_t t, uint64_t op) -> int64_t {
+        if (create) {
+            return clients[t]->create_file(meta_path(op)) == 0 ? 0 : -1;
+        }
+        FileMetadata metadata;
+        return clients[t]->get_file_info(meta_path(op), metadata) ? 0 : -1;
+    };
+    
+    uint64_t files = options.ops ? std::min<uint64_t>(options.ops, options.meta_files)
+                                 : options.meta_files;
+    return run_threads(options, create ? "meta_create" : "meta_stat", 0, files, body);
+}
+
+// Synthetic servers send a full block report of hb_chunks chunks each, then
+// hb_rounds delta heartbeats, straight over OP_HEARTBEAT. They go to a metadata
+// server of their own on the port after the chunk servers': left registered
+// with the cluster's, they would expire a heartbeat timeout later and stall it
+// walking every chunk they reported, in the middle of a later workload.
+static std::vector<BenchResult> run_heartbeat(const BenchOptions& options) {
+    const uint64_t FIRST_CHUNK = 1ull << 48;
+    const uint16_t port = options.port + options.servers + 1;
+    
+    MetadataServer metadata("127.0.0.1", port);
+    if (!metadata.start()) {
+        std::cerr << "dfs_bench: heartbeat metadata server failed to start on port " << port << std::endl;
+        return {};
+    }
+    
+    LatencyHistogram full_latency;
+    LatencyHistogram delta_latency;
+    std::atomic<uint64_t> errors(0);
+    std::atomic<uint64_t> full_bytes(0);
+    std::atomic<uint64_t> delta_bytes(0);
+    std::atomic<uint64_t> full_end_ns(0);
+    
+    auto beat = [&](NetworkSocket& socket, const HeartbeatMessage& msg, LatencyHistogram& latency,
+                    std::atomic<uint64_t>& bytes) {
+        ProtocolFrame frame(OP_HEARTBEAT);
+        WireWriter out(frame.payload);
+        encode_heartbeat(out, msg);
+        frame.payload_size = frame.payload.size();
+        frame.checksum = NetworkSocket::calculate_crc32(frame.payload.data(), frame.payload_size);
+        
+        ProtocolFrame response;
+        uint64_t start = metrics_now_ns();
+        if (!socket.send_frame(frame) || !socket.recv_frame(response) ||
+            response.payload_size < sizeof(MetadataResponseHeader) + 1) {
+            errors.fetch_add(1);
+            return;
+        }
+        latency.record_since(start);
+        bytes.fetch_add(frame.payload_size);
+    };
+    
+    // Worker t drives synthetic servers t, t + threads, ...
+    uint64_t start_ns = metrics_now_ns();
+    std::atomic<uint32_t> reported(0);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < options.threads; ++t) {
+        threads.emplace_back([&, t] {
+            std::vector<std::unique_ptr<NetworkSocket>> sockets;
+            std::vector<HeartbeatMessage> servers;
+            std::vector<uint64_t> next_chunk;
+            for (uint32_t s = t; s < options.hb_servers; s += options.threads) {
+                sockets.push_back(std::make_unique<NetworkSocket>());
+                if (!sockets.back()->connect_to_server("127.0.0.1", port)) {
+                    errors.fetch_add(1);
+                }
+                HeartbeatMessage msg;
+                msg.server_id = "bench_hb_" + std::to_string(s);
+                msg.ip_address = "127.0.0.1";
+                msg.port = 1;
+                msg.zone = "bench_hb";
+                msg.rack = "rack" + std::to_string(s);
+                msg.timestamp = std::time(nullptr);
+                msg.total_capacity = 1ull << 40;
+                msg.used_capacity = msg.total_capacity;
+                msg.sequence = 1;
+                msg.report_start = true;
+                for (uint32_t slice = 0; slice < DFS_BLOCK_REPORT_SLICES; ++slice) {
+                    msg.report_slices.push_back(slice);
+                }
+                uint64_t first = FIRST_CHUNK + (uint64_t)s * (options.hb_chunks +
+                                                              options.hb_rounds * options.hb_deltas);
+                for (uint64_t c = 0; c < options.hb_chunks; ++c) {
+                    msg.report_chunks.push_back(first + c);
+                }
+                msg.report_versions.assign(msg.report_chunks.size(), 1);
+                beat(*sockets.back(), msg, full_latency, full_bytes);
+                
+                msg.report_start = false;
+                msg.report_slices.clear();
+                msg.report_chunks.clear();
+                msg.report_versions.clear();
+                servers.push_back(std::move(msg));
+                next_chunk.push_back(first + options.hb_chunks);
+            }
+            if (reported.fetch_add(1) + 1 == options.threads) {
+                full_end_ns = metrics_now_ns();
+            }
+            
+            for (uint32_t round = 0; round < options.hb_rounds; ++round) {
+                for (size_t i = 0; i < servers.size(); ++i) {
+                    HeartbeatMessage& msg = servers[i];
+                    msg.sequence++;
+                    msg.timestamp = std::time(nullptr);
+                    msg.added_chunks.clear();
+                    for (uint32_t c = 0; c < options.hb_deltas; ++c) {
+                        msg.added_chunks.push_back(next_chunk[i]++);
+                    }
+                    msg.added_versions.assign(msg.added_chunks.size(), 1);
+                    beat(*sockets[i], msg, delta_latency, delta_bytes);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    uint64_t end_ns = metrics_now_ns();
+    metadata.stop();
+    
+    std::vector<BenchResult> results(2);
+    for (int i = 0; i < 2; ++i) {
+        BenchResult& result = results[i];
+        result.workload = i == 0 ? "heartbeat_full" : "heartbeat_delta";
+        result.threads = options.threads;
+        result.latency = (i == 0 ? full_latency : delta_latency).snapshot();
+        result.ops = result.latency.count;
+        result.bytes = i == 0 ? full_bytes : delta_bytes;
+        result.seconds = i == 0 ? seconds_between(start_ns, full_end_ns)
+                                : seconds_between(full_end_ns, end_ns);
+        result.errors = errors;  // Shared: a failure in either phase shows in both
+        result.io_bytes = result.ops ? result.bytes / result.ops : 0;
+        result.extra.push_back({"chunks_per_server",
+                                (double)(i == 0 ? options.hb_chunks : options.hb_deltas)});
+    }
+    return results;
+}
+
+// Kills the first chunk server and waits for its chunks of the data file to be
+// back at full replication. Detection alone takes DFS_HEARTBEAT_TIMEOUT_SEC.
+// Latency is per chunk, from detection until it regained a replica.
+static BenchResult run_recovery(BenchCluster& cluster, DataFile& file) {
+    const std::string victim = BenchCluster::server_id(0);
+    auto holds = [](const std::vector<std::string>& holders, const std::string& id) {
+        return std::find(holders.begin(), holders.end(), id) != holders.end();
+    };
+    
+    std::vector<uint64_t> lost;
+    for (const ChunkHandle& chunk : cluster.metadata().get_file_chunks(file.file_id())) {
+        if (holds(cluster.metadata().get_chunk_holders(chunk.chunk_id), victim)) {
+            lost.push_back(chunk.chunk_id);
+        }
+    }
+    
+    BenchResult result;
+    result.workload = "recovery";
+    result.threads = DFS_RECOVERY_PARALLELISM;
+    result.io_bytes = DFS_CHUNK_SIZE_BYTES;
+    
+    std::cerr << "dfs_bench: killing " << victim << " (" << lost.size() << " chunks); "
+              << "it is declared dead after " << DFS_HEARTBEAT_TIMEOUT_SEC << " s" << std::endl;
+    uint64_t killed_ns = metrics_now_ns();
+    cluster.kill_server(0);
+    
+    LatencyHistogram latency;
+    uint64_t detected_ns = 0;
+    std::vector<bool> repaired(lost.size(), false);
+    size_t remaining = lost.size();
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(2 * DFS_HEARTBEAT_TIMEOUT_SEC + 10 * lost.size());
+    while (remaining > 0 && std::chrono::steady_clock::now() < deadline) {
+        for (size_t i = 0; i < lost.size(); ++i) {
+            if (repaired[i]) continue;
+            std::vector<std::string> holders = cluster.metadata().get_chunk_holders(lost[i]);
+            if (holds(holders, victim)) continue;
+            if (!detected_ns) {
+                detected_ns = metrics_now_ns();
+            }
+            if (holders.size() >= DFS_REPLICATION_FACTOR) {
+                latency.record_since(detected_ns);
+                repaired[i] = true;
+                --remaining;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    uint64_t end_ns = metrics_now_ns();
+    
+    result.latency = latency.snapshot();
+    result.ops = result.latency.count;
+    result.errors = remaining;
+    result.seconds = detected_ns ? seconds_between(detected_ns, end_ns) : 0.0;
+    uint64_t chunk_bytes = std::min<uint64_t>(file.size(), DFS_CHUNK_SIZE_BYTES);
+    result.bytes = result.ops * chunk_bytes;
+    result.extra.push_back({"detect_seconds", detected_ns ? seconds_between(killed_ns, detected_ns)
+                                                          : seconds_between(killed_ns, end_ns)});
+    
+    std::string stats = cluster.metadata().export_metrics();
+    result.extra.push_back({"copies_failed",
+        metric_value(stats, "dfs_meta_recovery_copies_total{result=\"failed\"}")});
+    return result;
+}
+
+// ----------------------------------------------------------------------------
+// Driver
+// ----------------------------------------------------------------------------
+
+static std::vector<std::string> split(const std::string& text) {
+    std::vector<std::string> parts;
+    std::stringstream in(text);
+    std::string part;
+    while (std::getline(in, part, ',')) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+// "4096", "64k", "1m"
+static size_t parse_size(const std::string& text) {
+    size_t value = std::strtoull(text.c_str(), nullptr, 10);
+    char unit = text.empty() ? 0 : std::tolower(text.back());
+    return unit == 'k' ? value << 10 : unit == 'm' ? value << 20 : value;
+}
+
+static bool parse_options(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0) return false;
+        std::string key = arg.substr(2, equals == std::string::npos ? std::string::npos : equals - 2);
+        std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+        
+        if (key == "servers") options.servers = std::atoi(value.c_str());
+        else if (key == "processes") options.processes = true;
+        else if (key == "storage") options.storage_dir = value;
+        else if (key == "port") options.port = std::atoi(value.c_str());
+        else if (key == "workloads") options.workloads = split(value);
+        else if (key == "threads") options.threads = std::max(1, std::atoi(value.c_str()));
+        else if (key == "file-mb") options.file_mb = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "seconds") options.seconds = std::atof(value.c_str());
+        else if (key == "ops") options.ops = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "meta-files") options.meta_files = std::atoi(value.c_str());
+        else if (key == "hb-servers") options.hb_servers = std::atoi(value.c_str());
+        else if (key == "hb-chunks") options.hb_chunks = std::atoi(value.c_str());
+        else if (key == "hb-rounds") options.hb_rounds = std::atoi(value.c_str());
+        else if (key == "hb-deltas") options.hb_deltas = std::atoi(value.c_str());
+        else if (key == "io-sizes") {
+            options.io_sizes.clear();
+            for (const std::string& size : split(value)) {
+                if (parse_size(size) > 0) options.io_sizes.push_back(parse_size(size));
+            }
+        } else {
+            return false;
+        }
+    }
+    
+    for (const std::string& workload : options.workloads) {
+        if (std::find(std::begin(BENCH_WORKLOADS), std::end(BENCH_WORKLOADS), workload) ==
+            std::end(BENCH_WORKLOADS)) {
+            return false;
+        }
+    }
+    if (options.workloads.empty()) {
+        options.workloads.assign(std::begin(BENCH_WORKLOADS), std::end(BENCH_WORKLOADS));
+    }
+    return options.servers >= DFS_REPLICATION_FACTOR && options.file_mb > 0 &&
+           !options.io_sizes.empty();
+}
+
+static void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--option=value ...]" << std::endl;
+    std::cerr << "  --servers=4              chunk servers (at least " << DFS_REPLICATION_FACTOR
+              << "; recovery needs one more)" << std::endl;
+    std::cerr << "  --processes              run each chunk server in a child process" << std::endl;
+    std::cerr << "  --storage=DIR            file-backed chunk stores under DIR (default: memory)" << std::endl;
+    std::cerr << "  --port=9400              metadata server port; chunk servers use the next ones," << std::endl;
+    std::cerr << "                           then the heartbeat workload's own metadata server" << std::endl;
+    std::cerr << "  --workloads=a,b,...      seq_write rand_write seq_read rand_read meta_create" << std::endl;
+    std::cerr << "                           meta_stat heartbeat recovery (default: all, in this order)" << std::endl;
+    std::cerr << "  --io-sizes=4k,64k,1m     I/O sizes of the read and write workloads" << std::endl;
+    std::cerr << "  --threads=4              client threads" << std::endl;
+    std::cerr << "  --file-mb=256            size of the file read, written and recovered" << std::endl;
+    std::cerr << "  --seconds=5 --ops=N      limit per workload and I/O size" << std::endl;
+    std::cerr << "  --meta-files=20000       files created, then stat'ed" << std::endl;
+    std::cerr << "  --hb-servers=10 --hb-chunks=100000 --hb-rounds=20 --hb-deltas=100" << std::endl;
+    std::cerr << "                           synthetic servers, chunks each, delta heartbeats, chunks per delta" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    auto selected = [&](const std::string& workload) {
+        return std::find(options.workloads.begin(), options.workloads.end(), workload) !=
+               options.workloads.end();
+    };
+    if (selected("recovery") && options.servers <= DFS_REPLICATION_FACTOR) {
+        std::cerr << "dfs_bench: recovery needs more than " << DFS_REPLICATION_FACTOR
+                  << " servers" << std::endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    
+    std::fflush(stdout);
+    g_results = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    
+    BenchCluster cluster(options);
+    if (!cluster.start()) {
+        return 1;
+    }
+    std::cerr << "dfs_bench: " << options.servers << " chunk servers up" << std::endl;
+    
+    DataFile file(cluster, options.file_mb << 20);
+    auto data_file = [&](bool filled) {
+        if (!file.open() || (filled && !file.fill())) {
+            std::cerr << "dfs_bench: cannot set up " << DATA_FILE << std::endl;
+            return false;
+        }
+        return true;
+    };
+    
+    for (const char* workload : BENCH_WORKLOADS) {
+        std::string name = workload;
+        if (!selected(name)) continue;
+        std::cerr << "dfs_bench: " << name << std::endl;
+        
+        if (name == "seq_write" || name == "rand_write" || name == "seq_read" || name == "rand_read") {
+            bool write = name.find("write") != std::string::npos;
+            if (!data_file(!write)) return 1;
+            for (size_t io_bytes : options.io_sizes) {
+                print_result(options, run_io(options, file, write, name[0] == 'r',
+                                             std::min<size_t>(io_bytes, file.size())));
+            }
+        } else if (name == "meta_create" || name == "meta_stat") {
+            DistributedFileSystem client("127.0.0.1", cluster.metadata_port());
+            FileMetadata metadata;
+            if (!client.get_file_info(META_DIR, metadata)) {
+                client.mkdir(META_DIR);
+            }
+            // Whatever meta_create left out (or all of them, if it did not run)
+            if (name == "meta_stat") {
+                std::vector<std::string> paths;
+                for (uint32_t i = 0; i < options.meta_files; ++i) {
+                    paths.push_back(meta_path(i));
+                }
+                client.create_files(paths);
+            }
+            print_result(options, run_meta(options, cluster, name == "meta_create"));
+        } else if (name == "heartbeat") {
+            for (const BenchResult& result : run_heartbeat(options)) {
+                print_result(options, result);
+            }
+        } else if (name == "recovery") {
+            if (!data_file(true)) return 1;
+            print_result(options, run_recovery(cluster, file));
+        }
+    }
+    
+    cluster.stop();
+    return 0;
+}
+
+
+// ============================================================================
+// File: test_chained_writes.cpp - Chained Write Regression Test
+// ============================================================================
+
+#include "chunk_server.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+
+// Two chunk servers with one worker each take concurrent writes whose replica
+// chains cross (A then B, B then A). Each server forwards to the other while
+// the other forwards back; this used to stall both until the network timeout.
+
+static const uint16_t TEST_PORT = 9480;          // Chunk servers A and B
+static const uint16_t TEST_METADATA_PORT = 9489;  // Nothing listens; heartbeats just fail
+static const size_t TEST_WRITE_BYTES = 8 * 1024 * 1024;
+static const int TEST_WRITES_PER_DIRECTION = 2;
+
+struct WriteOutcome {
+    bool sent = false;
+    uint32_t replicas_written = 0;
+    double seconds = 0;
+};
+
+// One raw OP_WRITE of data to chain.front(), forwarded along the rest of chain
+static WriteOutcome write_through_chain(const std::vector<ChunkLocation>& chain, uint64_t chunk_id,
+                                        const std::vector<uint8_t>& data) {
+    WriteOutcome outcome;
+    auto start = std::chrono::steady_clock::now();
+    
+    NetworkSocket socket;
+    if (!socket.connect_to_server(chain.front().ip_address, chain.front().port)) {
+        return outcome;
+    }
+    socket.set_timeout(2 * DFS_NETWORK_TIMEOUT_MS);
+    
+    std::vector<uint8_t> chain_bytes;
+    WireWriter chain_out(chain_bytes);
+    encode_write_chain(chain_out, chain);
+    
+    WriteRequestHeader request = {chunk_id, 0, (uint32_t)data.size(), 0, (uint32_t)chain_bytes.size()};
+    struct iovec iov[3];
+    iov[0].iov_base = &request;
+    iov[0].iov_len = sizeof(WriteRequestHeader);
+    iov[1].iov_base = chain_bytes.data();
+    iov[1].iov_len = chain_bytes.size();
+    iov[2].iov_base = const_cast<uint8_t*>(data.data());
+    iov[2].iov_len = data.size();
+    
+    FrameHeader header = make_frame_header(OP_WRITE, sizeof(WriteRequestHeader) + chain_bytes.size() + data.size());
+    uint32_t crc = NetworkSocket::calculate_crc32((const uint8_t*)&request, sizeof(WriteRequestHeader));
+    crc = NetworkSocket::extend_crc32(crc, chain_bytes.data(), chain_bytes.size());
+    header.checksum = NetworkSocket::extend_crc32(crc, data.data(), data.size());
+    
+    ProtocolFrame response;
+    if (socket.send_frame(header, iov, 3) && socket.recv_frame(response) &&
+        response.payload_size >= sizeof(WriteResponseHeader)) {
+        WriteResponseHeader result;
+        std::memcpy(&result, response.payload.data(), sizeof(WriteResponseHeader));
+        outcome.sent = true;
+        outcome.replicas_written = result.replicas_written;
+    }
+    outcome.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return outcome;
+}
+
+int main() {
+    ChunkLocation a("TEST_A", "127.0.0.1", TEST_PORT, 0);
+    ChunkLocation b("TEST_B", "127.0.0.1", TEST_PORT + 1, 0);
+    
+    std::vector<std::unique_ptr<ChunkServer>> servers;
+    for (const ChunkLocation& location : {a, b}) {
+        servers.push_back(std::make_unique<ChunkServer>(location.server_id, location.ip_address, 
+                                                        location.port, "/tmp/dfs_test_chain", 1ull << 32,
+                                                        std::make_unique<MemoryChunkStore>()));
+        servers.back()->set_metadata_server("127.0.0.1", TEST_METADATA_PORT);
+        servers.back()->set_worker_threads(1);
+        if (!servers.back()->start()) {
+            std::cerr << "FAIL: could not start " << location.server_id << std::endl;
+            return 1;
+        }
+    }
+    
+    std::vector<uint8_t> data(TEST_WRITE_BYTES, 0xA5);
+    std::vector<WriteOutcome> outcomes(2 * TEST_WRITES_PER_DIRECTION);
+    std::vector<std::thread> writers;
+    for (size_t i = 0; i < outcomes.size(); ++i) {
+        writers.emplace_back([&, i] {
+            std::vector<ChunkLocation> chain = (i % 2 == 0) ? std::vector<ChunkLocation>{a, b} 
+                                                            : std::vector<ChunkLocation>{b, a};
+            outcomes[i] = write_through_chain(chain, 1000 + i, data);
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    
+    // Well under DFS_NETWORK_TIMEOUT_MS, which a stalled chain runs into
+    const double limit_seconds = DFS_NETWORK_TIMEOUT_MS / 1000.0 / 2;
+    int failures = 0;
+    for (size_t i = 0; i < outcomes.size(); ++i) {
+        const WriteOutcome& outcome = outcomes[i];
+        bool ok = outcome.sent && outcome.replicas_written == 2 && outcome.seconds < limit_seconds;
+        std::cout << (ok ? "ok" : "FAIL") << ": write " << i << (i % 2 == 0 ? " A->B" : " B->A")
+                  << " replicas_written=" << outcome.replicas_written 
+                  << " seconds=" << outcome.seconds << std::endl;
+        failures += ok ? 0 : 1;
+    }
+    
+    for (auto& server : servers) {
+        server->stop();
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+
+// ============================================================================
+// File: test_write_integrity.cpp - Damaged Write Regression Test
+// ============================================================================
+
+#include "chunk_server.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// A streamed OP_WRITE whose data fails the frame checksum must leave a
+// committed chunk exactly as it was: same bytes, same size, same version.
+// Damage on one hop of a chain must leave the replicas past it behind the
+// ones before it, so reads for the newer version are refused there.
+
+static const uint16_t TEST_PORT = 9482;           // Chunk servers A and B
+static const uint16_t TEST_PROXY_PORT = 9484;     // Damages A's forwarded writes to B
+static const uint16_t TEST_METADATA_PORT = 9489;  // Nothing listens; heartbeats just fail
+static const size_t TEST_CHUNK_BYTES = 256 * 1024;
+static const size_t TEST_DAMAGED_BYTE = 128 * 1024;  // Offset in the forwarded stream
+
+// One raw OP_WRITE to chain.front(), forwarded along the rest; damaged flips
+// the frame checksum as if a byte had changed in flight
+static bool send_write(const std::vector<ChunkLocation>& chain, uint64_t chunk_id, uint32_t offset,
+                       const std::vector<uint8_t>& data, bool damaged, WriteResponseHeader& result) {
+    NetworkSocket socket;
+    if (!socket.connect_to_server(chain.front().ip_address, chain.front().port)) {
+        return false;
+    }
+    socket.set_timeout(DFS_NETWORK_TIMEOUT_MS);
+    
+    std::vector<uint8_t> chain_bytes;
+    WireWriter chain_out(chain_bytes);
+    encode_write_chain(chain_out, chain);
+    
+    WriteRequestHeader request = {chunk_id, offset, (uint32_t)data.size(), 0, (uint32_t)chain_bytes.size()};
+    struct iovec iov[3];
+    iov[0].iov_base = &request;
+    iov[0].iov_len = sizeof(WriteRequestHeader);
+    iov[1].iov_base = chain_bytes.data();
+    iov[1].iov_len = chain_bytes.size();
+    iov[2].iov_base = const_cast<uint8_t*>(data.data());
+    iov[2].iov_len = data.size();
+    
+    FrameHeader header = make_frame_header(OP_WRITE, sizeof(WriteRequestHeader) + chain_bytes.size() + data.size());
+    uint32_t crc = NetworkSocket::calculate_crc32((const uint8_t*)&request, sizeof(WriteRequestHeader));
+    crc = NetworkSocket::extend_crc32(crc, chain_bytes.data(), chain_bytes.size());
+    header.checksum = NetworkSocket::extend_crc32(crc, data.data(), data.size()) ^ (damaged ? 1u : 0u);
+    
+    ProtocolFrame response;
+    if (!socket.send_frame(header, iov, 3) || !socket.recv_frame(response) ||
+        response.payload_size < sizeof(WriteResponseHeader)) {
+        return false;
+    }
+    std::memcpy(&result, response.payload.data(), sizeof(WriteResponseHeader));
+    return true;
+}
+
+// Whole chunk from one replica, as a client that has seen version would read it
+static bool read_chunk_at(const ChunkLocation& replica, uint64_t chunk_id, uint32_t version, 
+                          std::vector<uint8_t>& data) {
+    NetworkSocket socket;
+    if (!socket.connect_to_server(replica.ip_address, replica.port)) {
+        return false;
+    }
+    socket.set_timeout(DFS_NETWORK_TIMEOUT_MS);
+    
+    ReadRequestHeader request = {chunk_id, 0, (uint32_t)TEST_CHUNK_BYTES, version, 0};
+    ProtocolFrame frame(OP_READ);
+    frame.set_payload(&request, sizeof(ReadRequestHeader));
+    frame.checksum = NetworkSocket::calculate_crc32(frame.payload.data(), frame.payload_size);
+    
+    ProtocolFrame response;
+    ReadResponseHeader result;
+    if (!socket.send_frame(frame) || !socket.recv_frame(response) ||
+        response.payload_size < sizeof(ReadResponseHeader)) {
+        return false;
+    }
+    std::memcpy(&result, response.payload.data(), sizeof(ReadResponseHeader));
+    data.assign(response.payload.begin() + sizeof(ReadResponseHeader), response.payload.end());
+    return result.status == 0;
+}
+
+// Copies one connection to target and back, flipping the byte at
+// TEST_DAMAGED_BYTE on the way there
+class DamagingProxy {
+public:
+    bool start(uint16_t port, const ChunkLocation& target) {
+        if (!listener_.create_server_socket("127.0.0.1", port) || !listener_.listen_for_connections()) {
+            return false;
+        }
+        target_ = target;
+        accept_thread_ = std::thread([this] {
+            std::string peer_ip;
+            client_fd_ = listener_.accept_connection(peer_ip);
+            if (client_fd_ < 0 || !upstream_.connect_to_server(target_.ip_address, target_.port)) {
+                return;
+            }
+            int server_fd = upstream_.get_socket_fd();
+            back_thread_ = std::thread([this, server_fd] { pump(server_fd, client_fd_, false); });
+            pump(client_fd_, server_fd, true);
+        });
+        return true;
+    }
+    
+    void stop() {
+        listener_.close_socket();
+        if (client_fd_ >= 0) shutdown(client_fd_, SHUT_RDWR);
+        if (upstream_.is_connected()) shutdown(upstream_.get_socket_fd(), SHUT_RDWR);
+        if (accept_thread_.joinable()) accept_thread_.join();
+        if (back_thread_.joinable()) back_thread_.join();
+        if (client_fd_ >= 0) close(client_fd_);
+    }
+
+private:
+    NetworkSocket listener_;
+    NetworkSocket upstream_;
+    ChunkLocation target_;
+    int client_fd_ = -1;
+    std::thread accept_thread_;
+    std::thread back_thread_;
+    
+    static void pump(int from, int to, bool damage) {
+        std::vector<uint8_t> buffer(64 * 1024);
+        size_t copied = 0;
+        ssize_t received;
+        while ((received = recv(from, buffer.data(), buffer.size(), 0)) > 0) {
+            if (damage && copied <= TEST_DAMAGED_BYTE && TEST_DAMAGED_BYTE < copied + received) {
+                buffer[TEST_DAMAGED_BYTE - copied] ^= 0xFF;
+            }
+            copied += received;
+            for (ssize_t sent = 0; sent < received; ) {
+                ssize_t n = send(to, buffer.data() + sent, received - sent, MSG_NOSIGNAL);
+                if (n <= 0) return;
+                sent += n;
+            }
+        }
+        shutdown(to, SHUT_WR);
+    }
+};
+
+static bool check(bool ok, const std::string& what) {
+    std::cout << (ok ? "ok" : "FAIL") << ": " << what << std::endl;
+    return ok;
+}
+
+int main() {
+    ChunkLocation a("TEST_A", "127.0.0.1", TEST_PORT, 0);
+    ChunkLocation b("TEST_B", "127.0.0.1", TEST_PORT + 1, 0);
+    ChunkLocation b_via_proxy("TEST_B", "127.0.0.1", TEST_PROXY_PORT, 0);
+    
+    std::vector<std::unique_ptr<ChunkServer>> servers;
+    for (const ChunkLocation& location : {a, b}) {
+        servers.push_back(std::make_unique<ChunkServer>(location.server_id, location.ip_address, 
+                                                        location.port, "/tmp/dfs_test_integrity", 1ull << 32,
+                                                        std::make_unique<MemoryChunkStore>()));
+        servers.back()->set_metadata_server("127.0.0.1", TEST_METADATA_PORT);
+        if (!servers.back()->start()) {
+            std::cerr << "FAIL: could not start " << location.server_id << std::endl;
+            return 1;
+        }
+    }
+    DamagingProxy proxy;
+    if (!proxy.start(TEST_PROXY_PORT, b)) {
+        std::cerr << "FAIL: could not start the proxy" << std::endl;
+        return 1;
+    }
+    
+    std::vector<uint8_t> old_data(TEST_CHUNK_BYTES, 0x11);
+    std::vector<uint8_t> new_data(TEST_CHUNK_BYTES, 0x22);
+    std::vector<uint8_t> read_back;
+    WriteResponseHeader result;
+    bool passed = true;
+    
+    // Damaged writes on one server
+    passed &= check(send_write({a}, 7, 0, old_data, false, result) && result.status == 0, "initial write");
+    passed &= check(send_write({a}, 7, 0, new_data, true, result) && result.status != 0,
+                    "damaged overwrite refused");
+    passed &= check(send_write({a}, 7, TEST_CHUNK_BYTES / 2, new_data, true, result) && result.status != 0,
+                    "damaged overwrite past the end refused");
+    passed &= check(read_chunk_at(a, 7, 0, read_back) && read_back == old_data, "old data read back");
+    passed &= check(send_write({a}, 7, 0, new_data, false, result) && result.status == 0, 
+                    "intact overwrite stored");
+    passed &= check(read_chunk_at(a, 7, 0, read_back) && read_back == new_data, "new data read back");
+    
+    // A chain damaged between A and B
+    passed &= check(send_write({a, b}, 8, 0, old_data, false, result) && result.replicas_written == 2,
+                    "chained write stored on both replicas");
+    uint32_t old_version = result.version;
+    passed &= check(send_write({a, b_via_proxy}, 8, 0, new_data, false, result) && 
+                    result.replicas_written == 1 && result.version > old_version,
+                    "write damaged on the second hop stored on the first replica only");
+    uint32_t new_version = result.version;
+    passed &= check(read_chunk_at(a, 8, new_version, read_back) && read_back == new_data,
+                    "first replica serves the new version");
+    passed &= check(!read_chunk_at(b, 8, new_version, read_back), "second replica refuses the new version");
+    passed &= check(read_chunk_at(b, 8, old_version, read_back) && read_back == old_data,
+                    "second replica still holds the old version");
+    
+    proxy.stop();
+    for (auto& server : servers) {
+        server->stop();
+    }
+    return passed ? 0 : 1;
+}
+
+
+// ============================================================================
+// File: CMakeLists.txt - Build Configuration
+// ============================================================================
+
+cmake_minimum_required(VERSION 3.10)
+project(DistributedFileSystem CXX)
+
+set(CMAKE_CXX_STANDARD 17)
+set(CMAKE_CXX_STANDARD_REQUIRED ON)
+set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -O3 -Wall -Wextra")
+
+# Find required packages
+find_package(Threads REQUIRED)
+find_package(SQLite3 REQUIRED)
+
+# Header files
+set(HEADERS
+    common.h
+    metrics.h
+    thread_pool.h
+    network.h
+    client_lib.h
+    chunk_store.h
+    namespace_tree.h
+    metadata_log.h
+    chunk_placement.h
+    replication_scheduler.h
+    chunk_server.h
+)
+
+# Source files
+set(SOURCES
+    metrics.h
+    thread_pool.h
+    network.h
+    client_lib.h
+    chunk_store.h
+    namespace_tree.h
+    metadata_log.h
+    chunk_placement.h
+    replication_scheduler.h
+    chunk_server.h
+)
+
+# Include directories
+include_directories(${CMAKE_CURRENT_SOURCE_DIR})
+
+# Chunk Server executable
+add_executable(chunk_server
+    main_chunk_server.cpp
+    ${SOURCES}
+)
+target_link_libraries(chunk_server
+    Threads::Threads
+    ${SQLITE3_LIBRARIES}
+)
 
 # Client example executable
 add_executable(dfs_client
@@ -254,6 +3081,45 @@ target_link_libraries(dfs_client
     ${SQLITE3_LIBRARIES}
 )
 
+# Component microbenchmarks
+add_executable(dfs_microbench
+    main_microbench.cpp
+    ${SOURCES}
+)
+target_link_libraries(dfs_microbench
+    Threads::Threads
+)
+
+# Cluster benchmarks (in-process metadata server and chunk servers)
+add_executable(dfs_bench
+    main_bench.cpp
+    metadata_server.cpp
+    ${SOURCES}
+)
+target_link_libraries(dfs_bench
+    Threads::Threads
+)
+
+# Regression tests
+enable_testing()
+add_executable(test_chained_writes
+    test_chained_writes.cpp
+    ${SOURCES}
+)
+target_link_libraries(test_chained_writes
+    Threads::Threads
+)
+add_test(NAME chained_writes COMMAND test_chained_writes)
+
+add_executable(test_write_integrity
+    test_write_integrity.cpp
+    ${SOURCES}
+)
+target_link_libraries(test_write_integrity
+    Threads::Threads
+)
+add_test(NAME write_integrity COMMAND test_write_integrity)
+
 # Compile options
 if(UNIX)
     target_compile_options(chunk_server PRIVATE -Wl,--no-undefined)
@@ -273,12 +3139,15 @@ CXX = g++
 CXXFLAGS = -std=c++17 -O3 -Wall -Wextra -pthread
 LDFLAGS = -lsqlite3 -lpthread
 
-SOURCES = thread_pool.h network.h client_lib.h chunk_server.h
-HEADERS = common.h thread_pool.h network.h client_lib.h chunk_server.h
+SOURCES = metrics.h thread_pool.h network.h client_lib.h chunk_store.h namespace_tree.h metadata_log.h chunk_placement.h replication_scheduler.h chunk_server.h
+HEADERS = common.h metrics.h thread_pool.h network.h client_lib.h chunk_store.h namespace_tree.h metadata_log.h chunk_placement.h replication_scheduler.h chunk_server.h
 
 # Targets
 CHUNK_SERVER = chunk_server
 CLIENT_EXAMPLE = dfs_client
+MICROBENCH = dfs_microbench
+BENCH = dfs_bench
+TESTS = test_chained_writes test_write_integrity
 
 all: $(CHUNK_SERVER) $(CLIENT_EXAMPLE)
 
@@ -288,8 +3157,20 @@ $(CHUNK_SERVER): main_chunk_server.cpp $(HEADERS)
 $(CLIENT_EXAMPLE): main_client_example.cpp $(HEADERS)
 	$(CXX) $(CXXFLAGS) -o $@ $< $(LDFLAGS)
 
+$(MICROBENCH): main_microbench.cpp $(HEADERS)
+	$(CXX) $(CXXFLAGS) -o $@ $< $(LDFLAGS)
+
+$(BENCH): main_bench.cpp metadata_server.cpp metadata_server.h $(HEADERS)
+	$(CXX) $(CXXFLAGS) -o $@ main_bench.cpp metadata_server.cpp $(LDFLAGS)
+
+test_chained_writes: test_chained_writes.cpp $(HEADERS)
+	$(CXX) $(CXXFLAGS) -o $@ $< $(LDFLAGS)
+
+test_write_integrity: test_write_integrity.cpp $(HEADERS)
+	$(CXX) $(CXXFLAGS) -o $@ $< $(LDFLAGS)
+
 clean:
-	rm -f $(CHUNK_SERVER) $(CLIENT_EXAMPLE) *.o
+	rm -f $(CHUNK_SERVER) $(CLIENT_EXAMPLE) $(MICROBENCH) $(BENCH) $(TESTS) *.o
 
 run_chunk_server: $(CHUNK_SERVER)
 	./$(CHUNK_SERVER) CS_001 127.0.0.1 9001
@@ -297,4 +3178,13 @@ run_chunk_server: $(CHUNK_SERVER)
 run_client: $(CLIENT_EXAMPLE)
 	./$(CLIENT_EXAMPLE)
 
-.PHONY: all clean run_chunk_server run_client
+bench: $(MICROBENCH)
+	./$(MICROBENCH) net
+
+cluster_bench: $(BENCH)
+	./$(BENCH) --workloads=seq_write,seq_read,rand_read,meta_create,meta_stat
+
+test: $(TESTS)
+	for t in $(TESTS); do ./$$t || exit 1; done
+
+.PHONY: all clean run_chunk_server run_client bench cluster_bench test
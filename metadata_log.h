@@ -0,0 +1,647 @@
+// ============================================================================
+// DISTRIBUTED FILE SYSTEM - METADATA LOG
+// ============================================================================
+// File: metadata_log.h & metadata_log.cpp
+// Description: Write-ahead log and snapshots that keep the metadata server's
+//              namespace across restarts
+// ============================================================================
+
+#ifndef DFS_METADATA_LOG_H
+#define DFS_METADATA_LOG_H
+
+#include "common.h"
+#include "namespace_tree.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Namespace changes, appended to numbered segment files (metadata.log.<sequence>).
+// Each record is a u32 length and u32 CRC32C, then the u8 change type and the
+// encoded FileMetadata.
+//
+// append() only buffers. sync() makes everything appended so far durable, and
+// concurrent callers share the work (group commit): one that finds no flush
+// running writes out and fdatasyncs all that is buffered, the others wait for it
+// and usually find their records in that flush.
+class MetadataLog {
+public:
+    explicit MetadataLog(const std::string& directory);
+    ~MetadataLog();
+    
+    // Replay the records of segments first_sequence onward, in order, then start
+    // a new segment for appends. A torn or corrupt record ends the log: its
+    // segment is cut there.
+    bool open(uint64_t first_sequence, const std::function<void(const NamespaceChange&)>& replay);
+    
+    void append(const NamespaceChange& change);
+    
+    // False once a write or sync has failed; the log then stays failed
+    bool sync();
+    
+    // Seal the current segment, with everything in it durable, and continue in a
+    // new one. Returns the new segment's sequence, 0 if the log failed.
+    uint64_t rotate();
+    
+    // Delete the segments before sequence, once a snapshot covers them
+    void discard_before(uint64_t sequence);
+    
+    uint64_t bytes_since_rotate() const;
+    uint64_t flushes() const;  // Writes + fdatasyncs done for sync()
+
+private:
+    std::string directory_;
+    
+    mutable std::mutex mutex_;
+    std::condition_variable flushed_;
+    int fd_;
+    uint64_t sequence_;                  // Segment fd_ appends to
+    std::vector<uint8_t> pending_;       // Appended, not yet written
+    uint64_t appended_;                  // Bytes ever appended, across segments
+    uint64_t durable_;                   // Bytes ever written and synced
+    uint64_t rotated_at_;                // appended_ when the segment began
+    uint64_t flushes_;
+    bool flushing_;
+    bool failed_;
+    
+    std::string segment_path(uint64_t sequence) const;
+    bool open_segment_locked(uint64_t sequence);
+    void flush_locked(std::unique_lock<std::mutex>& lock);
+    bool replay_segment(uint64_t sequence, const std::function<void(const NamespaceChange&)>& replay);
+};
+
+// A NamespaceTree written out in fixed-size records: every entry (parents
+// first), their chunks, the chunk servers those name and a string pool, each
+// array checksummed. Loading maps the file and reads the records in place.
+class MetadataSnapshot {
+public:
+    struct Info {
+        uint64_t log_sequence;   // First log segment the snapshot does not cover
+        uint64_t next_file_id;
+        uint64_t next_chunk_id;
+        uint64_t entries;        // Filled in by write() and load()
+    };
+    
+    // Visits tree while it changes, so the log from info.log_sequence on must be
+    // replayed over it. Written to a temp file, synced, then renamed over path.
+    static bool write(const std::string& path, const NamespaceTree& tree, Info& info);
+    
+    // Into an empty tree. False if there is no valid snapshot at path.
+    static bool load(const std::string& path, NamespaceTree& tree, Info& info);
+};
+
+#endif // DFS_METADATA_LOG_H
+
+
+// ============================================================================
+// File: metadata_log.cpp
+// ============================================================================
+
+#include "metadata_log.h"
+#include "network.h"
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char* LOG_SEGMENT_PREFIX = "metadata.log.";
+static const uint32_t LOG_RECORD_HEADER_BYTES = 8;  // u32 length, u32 CRC32C of the body
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const uint8_t* ptr = static_cast<const uint8_t*>(data);
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = ::write(fd, ptr + written, size - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+// A created or renamed file survives a crash only once its directory entry does
+static bool sync_directory(const std::string& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+// MetadataLog
+// ---------------------------------------------------------------------------
+
+MetadataLog::MetadataLog(const std::string& directory)
+    : directory_(directory), fd_(-1), sequence_(0), appended_(0), durable_(0), rotated_at_(0),
+      flushes_(0), flushing_(false), failed_(false) {}
+
+MetadataLog::~MetadataLog() {
+    sync();
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+std::string MetadataLog::segment_path(uint64_t sequence) const {
+    return directory_ + "/" + LOG_SEGMENT_PREFIX + std::to_string(sequence);
+}
+
+bool MetadataLog::open(uint64_t first_sequence,
+                       const std::function<void(const NamespaceChange&)>& replay) {
+    std::vector<uint64_t> sequences;
+    if (DIR* dir = opendir(directory_.c_str())) {
+        size_t prefix = std::strlen(LOG_SEGMENT_PREFIX);
+        while (struct dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.compare(0, prefix, LOG_SEGMENT_PREFIX) == 0 && name.size() > prefix &&
+                name.find_first_not_of("0123456789", prefix) == std::string::npos) {
+                uint64_t sequence = std::stoull(name.substr(prefix));
+                if (sequence >= first_sequence) {
+                    sequences.push_back(sequence);
+                }
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(sequences.begin(), sequences.end());
+    
+    for (uint64_t sequence : sequences) {
+        if (!replay_segment(sequence, replay)) {
+            // Anything after a cut segment was never acknowledged as durable
+            break;
+        }
+    }
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t next = sequences.empty() ? first_sequence : sequences.back() + 1;
+    return open_segment_locked(std::max<uint64_t>(next, 1));
+}
+
+// mmap a segment and replay its records; false if it had to be cut short
+bool MetadataLog::replay_segment(uint64_t sequence,
+                                 const std::function<void(const NamespaceChange&)>& replay) {
+    std::string path = segment_path(sequence);
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void* mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    
+    const uint8_t* data = static_cast<const uint8_t*>(mapped);
+    size_t offset = 0;
+    while (size - offset >= LOG_RECORD_HEADER_BYTES) {
+        uint32_t length, crc;
+        std::memcpy(&length, data + offset, sizeof(length));
+        std::memcpy(&crc, data + offset + sizeof(length), sizeof(crc));
+        const uint8_t* body = data + offset + LOG_RECORD_HEADER_BYTES;
+        if (length > size - offset - LOG_RECORD_HEADER_BYTES ||
+            NetworkSocket::calculate_crc32(body, length) != crc) {
+            break;
+        }
+        
+        WireReader in(body, length);
+        uint8_t type = 0;
+        NamespaceChange change{NamespaceChange::ADD, FileMetadata()};
+        if (!in.get_u8(type) || !decode_file_metadata(in, change.entry)) {
+            break;
+        }
+        change.type = static_cast<NamespaceChange::Type>(type);
+        replay(change);
+        offset += LOG_RECORD_HEADER_BYTES + length;
+    }
+    
+    if (mapped) {
+        munmap(mapped, size);
+    }
+    bool complete = offset == size;
+    if (!complete) {
+        std::cerr << "Metadata log " << path << " cut at byte " << offset << " of " << size
+                  << " (torn or corrupt record)" << std::endl;
+        if (ftruncate(fd, offset) != 0 || fsync(fd) != 0) {
+            std::cerr << "Failed to cut metadata log " << path << std::endl;
+        }
+    }
+    close(fd);
+    return complete;
+}
+
+// Caller holds mutex_
+bool MetadataLog::open_segment_locked(uint64_t sequence) {
+    int fd = ::open(segment_path(sequence).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0 || !sync_directory(directory_)) {
+        std::cerr << "Failed to open metadata log " << segment_path(sequence) << std::endl;
+        if (fd >= 0) {
+            close(fd);
+        }
+        failed_ = true;
+        return false;
+    }
+    
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    fd_ = fd;
+    sequence_ = sequence;
+    rotated_at_ = appended_;
+    return true;
+}
+
+void MetadataLog::append(const NamespaceChange& change) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t start = pending_.size();
+    pending_.resize(start + LOG_RECORD_HEADER_BYTES);
+    WireWriter out(pending_);
+    out.put_u8(change.type);
+    encode_file_metadata(out, change.entry);
+    
+    uint32_t length = static_cast<uint32_t>(pending_.size() - start - LOG_RECORD_HEADER_BYTES);
+    uint32_t crc = NetworkSocket::calculate_crc32(pending_.data() + start + LOG_RECORD_HEADER_BYTES,
+                                                  length);
+    std::memcpy(pending_.data() + start, &length, sizeof(length));
+    std::memcpy(pending_.data() + start + sizeof(length), &crc, sizeof(crc));
+    appended_ += pending_.size() - start;
+}
+
+bool MetadataLog::sync() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t target = appended_;
+    while (durable_ < target && !failed_) {
+        if (flushing_) {
+            flushed_.wait(lock);  // Its flush may already cover target
+        } else {
+            flush_locked(lock);
+        }
+    }
+    return !failed_;
+}
+
+// Write out and sync everything pending. Entered and left with lock held, but
+// drops it for the I/O so appends carry on and gather for the next flush.
+void MetadataLog::flush_locked(std::unique_lock<std::mutex>& lock) {
+    flushing_ = true;
+    std::vector<uint8_t> batch;
+    batch.swap(pending_);
+    uint64_t end = appended_;
+    int fd = fd_;
+    
+    lock.unlock();
+    bool ok = write_all(fd, batch.data(), batch.size()) && fdatasync(fd) == 0;
+    lock.lock();
+    
+    flushing_ = false;
+    ++flushes_;
+    if (ok) {
+        durable_ = end;
+    } else {
+        std::cerr << "Failed to write metadata log " << segment_path(sequence_) << std::endl;
+        failed_ = true;
+    }
+    if (pending_.empty()) {
+        batch.clear();
+        pending_.swap(batch);  // Keep the capacity
+    }
+    flushed_.notify_all();
+}
+
+uint64_t MetadataLog::rotate() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (flushing_) {
+        flushed_.wait(lock);
+    }
+    
+    // The last of the segment is written with the lock held, so nothing more joins it
+    if (!failed_ && !pending_.empty()) {
+        if (write_all(fd_, pending_.data(), pending_.size()) && fdatasync(fd_) == 0) {
+            durable_ = appended_;
+            pending_.clear();
+        } else {
+            failed_ = true;
+        }
+    }
+    if (failed_ || !open_segment_locked(sequence_ + 1)) {
+        flushed_.notify_all();
+        return 0;
+    }
+    flushed_.notify_all();
+    return sequence_;
+}
+
+void MetadataLog::discard_before(uint64_t sequence) {
+    std::vector<std::string> doomed;
+    if (DIR* dir = opendir(directory_.c_str())) {
+        size_t prefix = std::strlen(LOG_SEGMENT_PREFIX);
+        while (struct dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.compare(0, prefix, LOG_SEGMENT_PREFIX) == 0 && name.size() > prefix &&
+                name.find_first_not_of("0123456789", prefix) == std::string::npos &&
+                std::stoull(name.substr(prefix)) < sequence) {
+                doomed.push_back(directory_ + "/" + name);
+            }
+        }
+        closedir(dir);
+    }
+    for (const std::string& path : doomed) {
+        unlink(path.c_str());
+    }
+}
+
+uint64_t MetadataLog::bytes_since_rotate() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return appended_ - rotated_at_;
+}
+
+uint64_t MetadataLog::flushes() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return flushes_;
+}
+
+// ---------------------------------------------------------------------------
+// MetadataSnapshot
+// ---------------------------------------------------------------------------
+
+// File layout: header, then entries, chunks, servers and the string pool, each
+// 8-byte aligned so the records can be read in place from the mapping
+static const uint32_t SNAPSHOT_MAGIC = 0x4E534644;  // "DFSN"
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t log_sequence;
+    uint64_t next_file_id;
+    uint64_t next_chunk_id;
+    uint64_t entry_count;
+    uint64_t chunk_count;
+    uint64_t server_count;
+    uint64_t string_bytes;           // Padded to a multiple of 8
+    uint32_t section_crcs[4];        // Entries, chunks, servers, strings
+};
+
+// A string in the pool
+struct SnapshotString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SnapshotEntry {
+    uint64_t file_id;
+    uint64_t parent_id;              // 0 for the root's children
+    uint64_t file_size;
+    uint64_t creation_time;
+    uint64_t modification_time;
+    SnapshotString name;             // Last path component
+    SnapshotString owner;
+    uint32_t permissions;
+    uint32_t chunk_count;            // Its chunks follow the previous entry's
+    uint8_t replication_factor;
+    uint8_t is_directory;
+    uint8_t reserved[6];
+};
+
+struct SnapshotChunk {
+    uint64_t chunk_id;
+    uint64_t size;
+    uint64_t creation_time;
+    uint32_t version;
+    uint16_t replicas[DFS_REPLICATION_FACTOR];  // Indices into the servers
+    uint8_t replica_count;
+    uint8_t reserved[8 - (4 + 2 * DFS_REPLICATION_FACTOR + 1) % 8];
+};
+
+struct SnapshotServer {
+    SnapshotString server_id;
+    SnapshotString ip_address;
+    uint16_t port;
+    uint8_t reserved[6];
+};
+
+bool MetadataSnapshot::write(const std::string& path, const NamespaceTree& tree, Info& info) {
+    std::vector<SnapshotEntry> entries;
+    std::vector<SnapshotChunk> chunks;
+    std::vector<SnapshotServer> servers;
+    std::string strings;
+    std::unordered_map<std::string, uint16_t> server_indices;
+    
+    auto add_string = [&strings](const std::string& value) {
+        SnapshotString ref = {static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(value.size())};
+        strings += value;
+        return ref;
+    };
+    
+    tree.visit([&](uint64_t parent_id, const FileMetadata& metadata) {
+        SnapshotEntry entry = {};
+        entry.file_id = metadata.file_id;
+        entry.parent_id = parent_id;
+        entry.file_size = metadata.file_size;
+        entry.creation_time = metadata.creation_time;
+        entry.modification_time = metadata.modification_time;
+        entry.name = add_string(metadata.path.substr(metadata.path.rfind('/') + 1));
+        entry.owner = add_string(metadata.owner);
+        entry.permissions = metadata.permissions;
+        entry.chunk_count = static_cast<uint32_t>(metadata.chunks.size());
+        entry.replication_factor = static_cast<uint8_t>(metadata.replication_factor);
+        entry.is_directory = metadata.is_directory;
+        entries.push_back(entry);
+        
+        for (const ChunkHandle& handle : metadata.chunks) {
+            SnapshotChunk chunk = {};
+            chunk.chunk_id = handle.chunk_id;
+            chunk.size = handle.size;
+            chunk.creation_time = handle.creation_time;
+            chunk.version = handle.version;
+            for (const ChunkLocation& replica : handle.replicas) {
+                if (chunk.replica_count == DFS_REPLICATION_FACTOR) {
+                    break;
+                }
+                auto it = server_indices.find(replica.server_id);
+                if (it == server_indices.end()) {
+                    SnapshotServer server = {};
+                    server.server_id = add_string(replica.server_id);
+                    server.ip_address = add_string(replica.ip_address);
+                    server.port = replica.port;
+                    it = server_indices.emplace(replica.server_id, servers.size()).first;
+                    servers.push_back(server);
+                }
+                chunk.replicas[chunk.replica_count++] = it->second;
+            }
+            chunks.push_back(chunk);
+        }
+    });
+    strings.resize((strings.size() + 7) & ~size_t(7));
+    
+    SnapshotHeader header = {};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.log_sequence = info.log_sequence;
+    header.next_file_id = info.next_file_id;
+    header.next_chunk_id = info.next_chunk_id;
+    header.entry_count = entries.size();
+    header.chunk_count = chunks.size();
+    header.server_count = servers.size();
+    header.string_bytes = strings.size();
+    
+    const std::pair<const void*, size_t> sections[4] = {
+        {entries.data(), entries.size() * sizeof(SnapshotEntry)},
+        {chunks.data(), chunks.size() * sizeof(SnapshotChunk)},
+        {servers.data(), servers.size() * sizeof(SnapshotServer)},
+        {strings.data(), strings.size()},
+    };
+    for (int i = 0; i < 4; ++i) {
+        header.section_crcs[i] = NetworkSocket::calculate_crc32(
+            static_cast<const uint8_t*>(sections[i].first), sections[i].second);
+    }
+    
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write_all(fd, &header, sizeof(header));
+    for (int i = 0; i < 4 && ok; ++i) {
+        ok = write_all(fd, sections[i].first, sections[i].second);
+    }
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    
+    std::string directory = path.substr(0, path.rfind('/') + 1);
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0 ||
+        !sync_directory(directory.empty() ? "." : directory)) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    info.entries = entries.size();
+    return true;
+}
+
+bool MetadataSnapshot::load(const std::string& path, NamespaceTree& tree, Info& info) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
+    }
+    
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+    
+    // Each count is bounded by what is left of the file before it is multiplied,
+    // so a damaged header can neither wrap the size check nor point past the mapping
+    const SnapshotHeader* header = static_cast<const SnapshotHeader*>(mapped);
+    const uint64_t counts[4] = {header->entry_count, header->chunk_count, header->server_count, 
+                                header->string_bytes};
+    const size_t item_bytes[4] = {sizeof(SnapshotEntry), sizeof(SnapshotChunk), sizeof(SnapshotServer), 1};
+    size_t section_bytes[4] = {0, 0, 0, 0};
+    size_t remaining = (size_t)st.st_size - sizeof(SnapshotHeader);
+    bool valid = header->magic == SNAPSHOT_MAGIC && header->version == SNAPSHOT_VERSION;
+    for (int i = 0; i < 4 && valid; ++i) {
+        valid = counts[i] <= remaining / item_bytes[i];
+        if (valid) {
+            section_bytes[i] = counts[i] * item_bytes[i];
+            remaining -= section_bytes[i];
+        }
+    }
+    valid = valid && remaining == 0;
+    
+    const uint8_t* sections[4];
+    const uint8_t* section = reinterpret_cast<const uint8_t*>(header + 1);
+    for (int i = 0; i < 4; ++i) {
+        sections[i] = section;
+        section += section_bytes[i];
+        valid = valid && NetworkSocket::calculate_crc32(sections[i], section_bytes[i]) == header->section_crcs[i];
+    }
+    if (!valid) {
+        std::cerr << "Ignoring invalid metadata snapshot " << path << std::endl;
+        munmap(mapped, st.st_size);
+        return false;
+    }
+    const SnapshotEntry* entries = reinterpret_cast<const SnapshotEntry*>(sections[0]);
+    const SnapshotChunk* chunks = reinterpret_cast<const SnapshotChunk*>(sections[1]);
+    const SnapshotServer* servers = reinterpret_cast<const SnapshotServer*>(sections[2]);
+    const char* strings = reinterpret_cast<const char*>(sections[3]);
+    
+    auto get_string = [&](const SnapshotString& ref) {
+        return ref.offset + (uint64_t)ref.length <= header->string_bytes
+            ? std::string(strings + ref.offset, ref.length) : std::string();
+    };
+    
+    std::vector<ChunkLocation> locations(header->server_count);
+    for (uint64_t i = 0; i < header->server_count; ++i) {
+        locations[i] = ChunkLocation(get_string(servers[i].server_id), get_string(servers[i].ip_address),
+                                     servers[i].port, 0);
+    }
+    // Parents come before their children, so each entry's parent is in by then
+    uint64_t next_chunk = 0;
+    FileMetadata metadata;
+    for (uint64_t i = 0; i < header->entry_count; ++i) {
+        const SnapshotEntry& entry = entries[i];
+        if (next_chunk + entry.chunk_count > header->chunk_count) {
+            break;
+        }
+        
+        metadata.file_id = entry.file_id;
+        metadata.file_size = entry.file_size;
+        metadata.creation_time = entry.creation_time;
+        metadata.modification_time = entry.modification_time;
+        metadata.owner = get_string(entry.owner);
+        metadata.permissions = entry.permissions;
+        metadata.replication_factor = entry.replication_factor;
+        metadata.is_directory = entry.is_directory != 0;
+        metadata.chunks.resize(entry.chunk_count);
+        for (ChunkHandle& handle : metadata.chunks) {
+            handle.replicas.clear();
+            const SnapshotChunk& chunk = chunks[next_chunk++];
+            handle.chunk_id = chunk.chunk_id;
+            handle.size = chunk.size;
+            handle.creation_time = chunk.creation_time;
+            handle.version = chunk.version;
+            for (uint8_t r = 0; r < chunk.replica_count && r < DFS_REPLICATION_FACTOR; ++r) {
+                if (chunk.replicas[r] < locations.size()) {
+                    handle.replicas.push_back(locations[chunk.replicas[r]]);
+                    handle.replicas.back().generation_number = chunk.version;
+                }
+            }
+        }
+        
+        std::string_view name;
+        if (entry.name.offset + (uint64_t)entry.name.length <= header->string_bytes) {
+            name = std::string_view(strings + entry.name.offset, entry.name.length);
+        }
+        tree.insert_child(entry.parent_id, name, metadata);
+    }
+    
+    info.log_sequence = header->log_sequence;
+    info.next_file_id = header->next_file_id;
+    info.next_chunk_id = header->next_chunk_id;
+    info.entries = header->entry_count;
+    tree.reserve_file_ids(header->next_file_id);
+    munmap(mapped, st.st_size);
+    return true;
+}
@@ -0,0 +1,446 @@
+// ============================================================================
+// DISTRIBUTED FILE SYSTEM - METRICS
+// ============================================================================
+// File: metrics.h & metrics.cpp
+// Description: Low-overhead counters and latency histograms, exported as text
+// ============================================================================
+
+#ifndef DFS_METRICS_H
+#define DFS_METRICS_H
+
+#include "common.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Counters and histograms are split into this many slots, each updated by the
+// threads that drew it, so hot paths on different cores rarely share a line
+const size_t METRICS_SLOTS = 8;
+
+// Slot of the calling thread, assigned round-robin on first use
+size_t metrics_thread_slot();
+
+// Monotonic clock in nanoseconds, the unit histograms record in
+inline uint64_t metrics_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        slots_[metrics_thread_slot()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value{0};
+    };
+    Slot slots_[METRICS_SLOTS];
+};
+
+// Merged copy of a histogram
+struct HistogramSnapshot {
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+    std::vector<uint64_t> buckets;
+    
+    // Highest value of the bucket holding quantile q (0..1), never above max_ns
+    uint64_t percentile(double q) const;
+};
+
+// HDR-style latency histogram: values below 64 ns are exact, larger ones fall
+// into 32 buckets per power of two (within 3%), up to 2^36 ns (~68 s) beyond
+// which they share the top bucket. A slot's buckets are allocated the first
+// time one of its threads records, so a histogram nothing hits costs ~100 bytes
+class LatencyHistogram {
+public:
+    static const uint32_t PRECISION_BITS = 5;
+    static const uint32_t BUCKETS = 1024;
+    
+    LatencyHistogram() {
+        for (auto& slot : slots_) slot.store(nullptr, std::memory_order_relaxed);
+    }
+    ~LatencyHistogram();
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+    
+    void record(uint64_t value_ns);
+    void record_since(uint64_t start_ns) { record(metrics_now_ns() - start_ns); }
+    HistogramSnapshot snapshot() const;
+    
+    static uint32_t bucket_of(uint64_t value_ns);
+    static uint64_t bucket_upper(uint32_t bucket);  // Highest value the bucket holds
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+        std::atomic<uint64_t> buckets[BUCKETS];
+        
+        Slot() {
+            for (auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+        }
+    };
+    std::atomic<Slot*> slots_[METRICS_SLOTS];
+    
+    Slot& slot_for_thread();
+};
+
+// Records the time from construction to destruction
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram& histogram)
+        : histogram_(histogram), start_ns_(metrics_now_ns()) {}
+    ~ScopedLatency() { histogram_.record_since(start_ns_); }
+
+private:
+    LatencyHistogram& histogram_;
+    uint64_t start_ns_;
+};
+
+// Lock guard that records how long the lock took to get into wait, and how
+// long it was held into hold. Lock is std::unique_lock or std::shared_lock
+template <typename Lock>
+class TimedLock {
+public:
+    template <typename Mutex>
+    TimedLock(Mutex& mutex, LatencyHistogram& wait, LatencyHistogram& hold) : hold_(hold) {
+        uint64_t start_ns = metrics_now_ns();
+        lock_ = Lock(mutex);
+        locked_ns_ = metrics_now_ns();
+        wait.record(locked_ns_ - start_ns);
+    }
+    ~TimedLock() {
+        if (lock_.owns_lock()) {
+            hold_.record_since(locked_ns_);
+        }
+    }
+    TimedLock(const TimedLock&) = delete;
+    TimedLock& operator=(const TimedLock&) = delete;
+    
+    void unlock() {
+        hold_.record_since(locked_ns_);
+        lock_.unlock();
+    }
+    
+    // Wait on condition (a std::condition_variable_any) with the lock released;
+    // the time spent waiting does not count as hold time
+    template <typename Condition, typename Predicate>
+    bool wait_for(Condition& condition, std::chrono::milliseconds timeout, Predicate ready) {
+        hold_.record_since(locked_ns_);
+        bool satisfied = condition.wait_for(lock_, timeout, ready);
+        locked_ns_ = metrics_now_ns();
+        return satisfied;
+    }
+
+private:
+    LatencyHistogram& hold_;
+    Lock lock_;
+    uint64_t locked_ns_;
+};
+
+// Named metrics of one server or client. Registration takes a lock and returns
+// a reference that stays valid for the registry's lifetime; updates through it
+// take none. export_text() renders the Prometheus text format: histograms as
+// summaries in seconds (quantile 1 is the maximum), counters and gauges as is.
+// labels is the inside of the braces, e.g. op="read"
+class MetricsRegistry {
+public:
+    Counter& counter(const std::string& name, const std::string& labels = "");
+    LatencyHistogram& histogram(const std::string& name, const std::string& labels = "");
+    // Sampled at export time; must stay callable for the registry's lifetime
+    void gauge(const std::string& name, const std::string& labels, std::function<double()> read);
+    
+    std::string export_text() const;
+
+private:
+    enum Kind { COUNTER, HISTOGRAM, GAUGE };
+    struct Series {
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<LatencyHistogram> histogram;
+        std::function<double()> gauge;
+    };
+    struct Family {
+        Kind kind;
+        std::map<std::string, Series> series;  // By labels
+    };
+    
+    std::map<std::string, Family> families_;
+    mutable std::mutex mutex_;
+    
+    Series& series_locked(const std::string& name, const std::string& labels, Kind kind);
+};
+
+// Per message type request latency and bytes of a server or client, registered
+// as <prefix>_request_seconds, <prefix>_received_bytes_total and
+// <prefix>_sent_bytes_total with an op label. Types not in message_types are
+// counted together as op="unknown"
+class RequestMetrics {
+public:
+    RequestMetrics(MetricsRegistry& registry, const std::string& prefix,
+                   const std::vector<uint16_t>& message_types);
+    
+    void record(uint16_t message_type, uint64_t latency_ns, uint64_t bytes_in, uint64_t bytes_out);
+
+private:
+    struct Op {
+        LatencyHistogram* latency;
+        Counter* bytes_in;
+        Counter* bytes_out;
+    };
+    
+    std::vector<Op> ops_;   // By message type up to OP_STATS; ops_[0] is "unknown"
+};
+
+// "read" for OP_READ and so on; "unknown" for types this build does not know
+const char* message_type_label(uint16_t message_type);
+
+#endif // DFS_METRICS_H
+
+
+// ============================================================================
+// File: metrics.cpp
+// ============================================================================
+
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+size_t metrics_thread_slot() {
+    static std::atomic<size_t> next_slot(0);
+    static thread_local size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % METRICS_SLOTS;
+    return slot;
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const Slot& slot : slots_) {
+        total += slot.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t HistogramSnapshot::percentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)std::ceil(std::min(1.0, std::max(0.0, q)) * count);
+    rank = std::max<uint64_t>(1, std::min(rank, count));
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < buckets.size(); ++bucket) {
+        seen += buckets[bucket];
+        if (seen >= rank) {
+            return std::min(LatencyHistogram::bucket_upper(bucket), max_ns);
+        }
+    }
+    return max_ns;
+}
+
+LatencyHistogram::~LatencyHistogram() {
+    for (auto& slot : slots_) {
+        delete slot.load(std::memory_order_relaxed);
+    }
+}
+
+uint32_t LatencyHistogram::bucket_of(uint64_t value_ns) {
+    const uint64_t exact = 1ull << (PRECISION_BITS + 1);
+    if (value_ns < exact) {
+        return (uint32_t)value_ns;
+    }
+    uint32_t shift = (63 - __builtin_clzll(value_ns)) - PRECISION_BITS;
+    uint32_t bucket = (shift << PRECISION_BITS) + (uint32_t)(value_ns >> shift);
+    return std::min(bucket, BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::bucket_upper(uint32_t bucket) {
+    const uint32_t exact = 1u << (PRECISION_BITS + 1);
+    if (bucket < exact) {
+        return bucket;
+    }
+    if (bucket >= BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    uint32_t shift = (bucket >> PRECISION_BITS) - 1;
+    uint64_t mantissa = (bucket & ((1u << PRECISION_BITS) - 1)) + (1u << PRECISION_BITS);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+LatencyHistogram::Slot& LatencyHistogram::slot_for_thread() {
+    std::atomic<Slot*>& entry = slots_[metrics_thread_slot()];
+    Slot* slot = entry.load(std::memory_order_acquire);
+    if (!slot) {
+        Slot* fresh = new Slot();
+        if (entry.compare_exchange_strong(slot, fresh, std::memory_order_acq_rel)) {
+            slot = fresh;
+        } else {
+            delete fresh;  // Another thread of this slot got there first
+        }
+    }
+    return *slot;
+}
+
+void LatencyHistogram::record(uint64_t value_ns) {
+    Slot& slot = slot_for_thread();
+    slot.buckets[bucket_of(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    slot.count.fetch_add(1, std::memory_order_relaxed);
+    slot.sum_ns.fetch_add(value_ns, std::memory_order_relaxed);
+    uint64_t max_ns = slot.max_ns.load(std::memory_order_relaxed);
+    while (value_ns > max_ns &&
+           !slot.max_ns.compare_exchange_weak(max_ns, value_ns, std::memory_order_relaxed)) {}
+}
+
+// Slots are read without stopping writers, so count and buckets may be a few
+// records apart; quantiles go by the buckets' own total
+HistogramSnapshot LatencyHistogram::snapshot() const {
+    HistogramSnapshot snapshot;
+    snapshot.buckets.assign(BUCKETS, 0);
+    for (const auto& entry : slots_) {
+        const Slot* slot = entry.load(std::memory_order_acquire);
+        if (!slot) {
+            continue;
+        }
+        snapshot.sum_ns += slot->sum_ns.load(std::memory_order_relaxed);
+        snapshot.max_ns = std::max(snapshot.max_ns, slot->max_ns.load(std::memory_order_relaxed));
+        for (uint32_t bucket = 0; bucket < BUCKETS; ++bucket) {
+            uint64_t n = slot->buckets[bucket].load(std::memory_order_relaxed);
+            snapshot.buckets[bucket] += n;
+            snapshot.count += n;
+        }
+    }
+    return snapshot;
+}
+
+MetricsRegistry::Series& MetricsRegistry::series_locked(const std::string& name,
+                                                        const std::string& labels, Kind kind) {
+    // A name keeps the kind it was first registered with
+    auto inserted = families_.emplace(name, Family{kind, {}});
+    return inserted.first->second.series[labels];
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& labels) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Series& series = series_locked(name, labels, COUNTER);
+    if (!series.counter) {
+        series.counter = std::make_unique<Counter>();
+    }
+    return *series.counter;
+}
+
+LatencyHistogram& MetricsRegistry::histogram(const std::string& name, const std::string& labels) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Series& series = series_locked(name, labels, HISTOGRAM);
+    if (!series.histogram) {
+        series.histogram = std::make_unique<LatencyHistogram>();
+    }
+    return *series.histogram;
+}
+
+void MetricsRegistry::gauge(const std::string& name, const std::string& labels,
+                            std::function<double()> read) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    series_locked(name, labels, GAUGE).gauge = std::move(read);
+}
+
+static void append_sample(std::string& out, const std::string& name, const std::string& labels,
+                          const char* extra_label, double value) {
+    out += name;
+    if (!labels.empty() || extra_label) {
+        out += '{';
+        out += labels;
+        if (extra_label) {
+            if (!labels.empty()) out += ',';
+            out += extra_label;
+        }
+        out += '}';
+    }
+    char number[32];
+    std::snprintf(number, sizeof(number), " %.9g\n", value);
+    out += number;
+}
+
+std::string MetricsRegistry::export_text() const {
+    static const std::pair<const char*, double> QUANTILES[] = {
+        {"quantile=\"0.5\"", 0.5}, {"quantile=\"0.9\"", 0.9}, {"quantile=\"0.99\"", 0.99},
+        {"quantile=\"0.999\"", 0.999}, {"quantile=\"1\"", 1.0}
+    };
+    
+    std::string out;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (const auto& family : families_) {
+        const std::string& name = family.first;
+        const Family& metrics = family.second;
+        out += "# TYPE " + name +
+               (metrics.kind == COUNTER ? " counter\n" : metrics.kind == GAUGE ? " gauge\n" : " summary\n");
+        for (const auto& entry : metrics.series) {
+            const std::string& labels = entry.first;
+            const Series& series = entry.second;
+            if (series.counter) {
+                append_sample(out, name, labels, nullptr, (double)series.counter->value());
+            } else if (series.gauge) {
+                append_sample(out, name, labels, nullptr, series.gauge());
+            } else if (series.histogram) {
+                HistogramSnapshot snapshot = series.histogram->snapshot();
+                for (const auto& quantile : QUANTILES) {
+                    append_sample(out, name, labels, quantile.first,
+                                  snapshot.percentile(quantile.second) / 1e9);
+                }
+                append_sample(out, name + "_sum", labels, nullptr, snapshot.sum_ns / 1e9);
+                append_sample(out, name + "_count", labels, nullptr, (double)snapshot.count);
+            }
+        }
+    }
+    return out;
+}
+
+const char* message_type_label(uint16_t message_type) {
+    switch (message_type) {
+        case OP_READ: return "read";
+        case OP_WRITE: return "write";
+        case OP_DELETE: return "delete";
+        case OP_REPLICATE: return "replicate";
+        case OP_HEARTBEAT: return "heartbeat";
+        case OP_METADATA_QUERY: return "metadata_query";
+        case OP_FILE_CREATE: return "file_create";
+        case OP_FILE_DELETE: return "file_delete";
+        case OP_MKDIR: return "mkdir";
+        case OP_METADATA_INVALIDATE: return "metadata_invalidate";
+        case OP_BATCH_METADATA: return "batch_metadata";
+        case OP_STATS: return "stats";
+        case OP_ACK: return "ack";
+        default: return "unknown";
+    }
+}
+
+RequestMetrics::RequestMetrics(MetricsRegistry& registry, const std::string& prefix,
+                               const std::vector<uint16_t>& message_types) {
+    auto register_op = [&](uint16_t message_type) {
+        std::string labels = std::string("op=\"") + message_type_label(message_type) + "\"";
+        return Op{&registry.histogram(prefix + "_request_seconds", labels),
+                  &registry.counter(prefix + "_received_bytes_total", labels),
+                  &registry.counter(prefix + "_sent_bytes_total", labels)};
+    };
+    ops_.assign(OP_STATS + 1, register_op(0));
+    for (uint16_t message_type : message_types) {
+        if (message_type < ops_.size()) {
+            ops_[message_type] = register_op(message_type);
+        }
+    }
+}
+
+void RequestMetrics::record(uint16_t message_type, uint64_t latency_ns, uint64_t bytes_in,
+                            uint64_t bytes_out) {
+    const Op& op = message_type < ops_.size() ? ops_[message_type] : ops_[0];
+    op.latency->record(latency_ns);
+    op.bytes_in->add(bytes_in);
+    op.bytes_out->add(bytes_out);
+}
@@ -0,0 +1,921 @@
+// ============================================================================
+// DISTRIBUTED FILE SYSTEM - METADATA NAMESPACE
+// ============================================================================
+// File: namespace_tree.h & namespace_tree.cpp
+// Description: Directory-inode tree holding the metadata server's namespace
+//              in compact per-file records
+// ============================================================================
+
+#ifndef DFS_NAMESPACE_TREE_H
+#define DFS_NAMESPACE_TREE_H
+
+#include "common.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+
+// Path component strings (and owners), each stored once for the whole
+// namespace however many entries use it, and reference counted
+class NameInterner {
+public:
+    // The stored copy of name; valid until the matching release()
+    std::string_view intern(std::string_view name);
+    void release(std::string_view name);
+    size_t size() const;
+
+private:
+    static const size_t NUM_SHARDS = 16;
+    
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, uint32_t> refs;  // Node-based: keys never move
+    };
+    
+    std::array<Shard, NUM_SHARDS> shards_;
+    
+    Shard& shard_for(std::string_view name) {
+        return shards_[std::hash<std::string_view>()(name) % NUM_SHARDS];
+    }
+};
+
+// Chunk servers named by small integers, so a stored replica is two bytes
+using ServerIndex = uint16_t;
+const ServerIndex DFS_NO_SERVER = 0xFFFF;
+
+// Id and address of every chunk server a stored replica refers to
+class ServerTable {
+public:
+    // Index naming server_id, recorded with its current address; DFS_NO_SERVER when full
+    ServerIndex intern(const std::string& server_id, const std::string& ip_address, uint16_t port);
+    ChunkLocation location(ServerIndex index) const;  // generation_number left 0
+    size_t size() const;
+
+private:
+    struct Server {
+        std::string server_id;
+        std::string ip_address;
+        uint16_t port;
+    };
+    
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, ServerIndex> indices_;
+    std::vector<Server> servers_;
+};
+
+// A ChunkHandle as stored. At most DFS_REPLICATION_FACTOR replicas are kept, inline.
+struct CompactChunk {
+    uint64_t chunk_id;
+    uint32_t version;
+    uint32_t creation_time;  // Seconds since the epoch
+    uint32_t size;           // At most DFS_CHUNK_SIZE_BYTES
+    ServerIndex replicas[DFS_REPLICATION_FACTOR];
+    uint8_t replica_count;
+};
+
+// A file's chunk list: a contiguous run inside a ChunkArena
+struct ChunkSpan {
+    CompactChunk* chunks = nullptr;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+};
+
+// Every file's chunk list, carved out of large pages so each list is one
+// contiguous run. Runs have power-of-two capacities and never move; a list
+// that outgrows its run is copied into a bigger one, and freed runs are reused.
+// Pages live as long as the arena.
+class ChunkArena {
+public:
+    ChunkSpan allocate(uint32_t capacity);
+    void release(const ChunkSpan& span);
+    size_t reserved_bytes() const;
+
+private:
+    static const uint32_t PAGE_CHUNKS = 16384;  // 512 KB pages
+    
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<CompactChunk[]>> pages_;
+    CompactChunk* next_ = nullptr;  // Uncarved part of the newest page
+    uint32_t left_ = 0;
+    size_t reserved_ = 0;
+    std::array<std::vector<CompactChunk*>, 32> free_;  // Freed runs by log2 capacity
+    
+    void free_run_locked(CompactChunk* run, uint32_t capacity);
+};
+
+// A file or directory as stored: FileMetadata without the path (the tree
+// spells it), with the owner interned and the chunks in the ChunkArena
+struct FileRecord {
+    uint64_t file_id;
+    uint64_t file_size;
+    uint32_t creation_time;
+    uint32_t modification_time;
+    uint32_t permissions;
+    uint8_t replication_factor;
+    bool is_directory;
+    std::string_view owner;  // Empty for none
+    ChunkSpan chunks;
+};
+
+// A change to a NamespaceTree, as reported to its observer and taken by apply()
+struct NamespaceChange {
+    enum Type : uint8_t {
+        ADD = 1,            // entry is the new file or directory
+        REMOVE = 2,         // entry.file_id was removed
+        APPEND_CHUNKS = 3,  // entry.chunks appended to entry.file_id at entry.modification_time
+    };
+    
+    Type type;
+    FileMetadata entry;  // entry.path is normalized
+};
+
+// The namespace as a tree of directory inodes. Each directory has its own hash
+// table of children, keyed by interned component name, and its own
+// reader/writer lock. Walks couple locks from the root down (never more than a
+// directory and its parent at once), so operations in unrelated subtrees run
+// concurrently, and a lookup costs one hash probe per path component instead
+// of O(log n) full-path compares.
+//
+// A node's record is guarded by its parent directory's lock; a directory's
+// children by its own. Missing parent directories are created on insert.
+class NamespaceTree {
+public:
+    NamespaceTree();
+    
+    // Path's metadata with its chunks, path normalized
+    bool get(const std::string& path, FileMetadata& metadata) const;
+    
+    // Add a file or directory (metadata.is_directory) at path, with any chunks
+    // in metadata. Assigns metadata.file_id unless it is already set (e.g. when
+    // replaying).
+    MetadataStatus insert(const std::string& path, FileMetadata& metadata);
+    
+    // Add name under the directory parent_id (0 for the root) without walking a
+    // path; for filling a tree nobody else uses yet, such as from a snapshot
+    MetadataStatus insert_child(uint64_t parent_id, std::string_view name, FileMetadata& metadata);
+    
+    // Remove path; a directory must be empty
+    MetadataStatus erase(const std::string& path);
+    
+    // Append to the chunks of the file at path, if it is still file_id
+    bool append_chunks(const std::string& path, uint64_t file_id, const std::vector<ChunkHandle>& chunks,
+                       uint64_t modification_time);
+    
+    // Path of the entry with file_id (0 is the root)
+    bool find_path(uint64_t file_id, std::string& path) const;
+    
+    // Names of a directory's children
+    bool list(const std::string& path, std::vector<std::string>& names) const;
+    
+    // Called for every change made by insert (parent directories included),
+    // erase and append_chunks, with the lock that orders it held: changes that
+    // conflict arrive in the order they were made. Set before the tree is
+    // shared; the observer must not block or call back into the tree.
+    using ChangeObserver = std::function<void(const NamespaceChange&)>;
+    void set_observer(ChangeObserver observer) { observer_ = std::move(observer); }
+    
+    // Redo a reported change. One already reflected here, or made to an entry
+    // that is gone since, is skipped; so replaying the changes made while a
+    // visit() ran, over what it visited, rebuilds the tree as it was after them.
+    MetadataStatus apply(const NamespaceChange& change);
+    
+    // Every entry, parents before children (each directory is held shared
+    // while its subtree is visited). entry.path is the full path.
+    using Visitor = std::function<void(uint64_t parent_id, const FileMetadata& entry)>;
+    void visit(const Visitor& visitor) const;
+    
+    uint64_t next_file_id() const { return next_file_id_.load(std::memory_order_relaxed); }
+    void reserve_file_ids(uint64_t next);  // Ids below next are never assigned
+    
+    size_t size() const { return size_.load(std::memory_order_relaxed); }  // Excluding the root
+    size_t interned_names() const { return names_.size(); }
+    size_t chunk_bytes() const { return arena_.reserved_bytes(); }
+
+private:
+    using PathParts = std::vector<std::string_view>;  // Views into the caller's path
+    
+    struct Directory;
+    
+    struct Node {
+        FileRecord record;
+        std::unique_ptr<Directory> dir;  // Set for directories
+        Node* parent = nullptr;          // Null for the root
+        std::string_view name;           // This node's key in parent
+    };
+    
+    // Nodes live in the hash nodes themselves, which never move on rehash
+    struct Directory {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string_view, Node> children;  // Keys are interned
+    };
+    
+    struct IdShard {
+        mutable std::mutex mutex;
+        std::unordered_map<uint64_t, const Node*> nodes;
+    };
+    
+    // Declared before root_: the records and keys in the tree point into these
+    NameInterner names_;
+    ServerTable servers_;
+    ChunkArena arena_;
+    
+    Node root_;
+    std::atomic<uint64_t> next_file_id_;
+    std::atomic<size_t> size_;
+    std::array<IdShard, 16> ids_;  // file_id -> node, for chunk allocation by id
+    ChangeObserver observer_;
+    
+    // Lock-coupled walk to the directory holding the last component of parts;
+    // returns its node with the directory held through shared or exclusive as
+    // asked. With create, missing directories on the way are made. Null if an
+    // ancestor is missing or a file.
+    Node* lock_parent(const PathParts& parts, bool create, bool exclusive_parent,
+                      std::shared_lock<std::shared_mutex>& shared,
+                      std::unique_lock<std::shared_mutex>& exclusive) const;
+    static Node* find_child(const Directory& dir, std::string_view name);
+    Node* add_child_locked(Node& parent, std::string_view name, FileMetadata& metadata);
+    MetadataStatus remove_child_locked(Node& parent, const PathParts& parts);
+    void visit_locked(const Node& dir_node, std::string& path, FileMetadata& entry,
+                      const Visitor& visitor) const;
+    
+    // FileMetadata <-> FileRecord; caller holds the record's directory
+    void store_record(const FileMetadata& metadata, FileRecord& record);
+    void append_chunks_locked(FileRecord& record, const std::vector<ChunkHandle>& chunks);
+    void load_record(const FileRecord& record, FileMetadata& metadata) const;
+    void drop_record(FileRecord& record);
+    
+    void index_id(const Node& node);
+    void unindex_id(uint64_t file_id);
+    static std::string path_of(const Node& node);
+    static bool split(const std::string& path, PathParts& parts);
+    static std::string join(const PathParts& parts, size_t count);
+};
+
+#endif // DFS_NAMESPACE_TREE_H
+
+
+// ============================================================================
+// File: namespace_tree.cpp
+// ============================================================================
+
+#include "namespace_tree.h"
+#include <algorithm>
+
+// ---------------------------------------------------------------------------
+// NameInterner
+// ---------------------------------------------------------------------------
+
+std::string_view NameInterner::intern(std::string_view name) {
+    Shard& shard = shard_for(name);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto it = shard.refs.emplace(std::string(name), 0).first;
+    it->second++;
+    return it->first;
+}
+
+void NameInterner::release(std::string_view name) {
+    Shard& shard = shard_for(name);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto it = shard.refs.find(std::string(name));
+    if (it != shard.refs.end() && --it->second == 0) {
+        shard.refs.erase(it);
+    }
+}
+
+size_t NameInterner::size() const {
+    size_t total = 0;
+    for (const Shard& shard : shards_) {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        total += shard.refs.size();
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------------------
+// ServerTable
+// ---------------------------------------------------------------------------
+
+ServerIndex ServerTable::intern(const std::string& server_id, const std::string& ip_address,
+                                uint16_t port) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = indices_.find(server_id);
+        if (it != indices_.end()) {
+            const Server& server = servers_[it->second];
+            if (server.ip_address == ip_address && server.port == port) {
+                return it->second;
+            }
+        }
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = indices_.find(server_id);
+    if (it != indices_.end()) {
+        // Moved: replicas follow the server to its new address
+        servers_[it->second].ip_address = ip_address;
+        servers_[it->second].port = port;
+        return it->second;
+    }
+    if (servers_.size() >= DFS_NO_SERVER) {
+        return DFS_NO_SERVER;
+    }
+    
+    ServerIndex index = static_cast<ServerIndex>(servers_.size());
+    servers_.push_back({server_id, ip_address, port});
+    indices_.emplace(server_id, index);
+    return index;
+}
+
+ChunkLocation ServerTable::location(ServerIndex index) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (index >= servers_.size()) {
+        return ChunkLocation();
+    }
+    const Server& server = servers_[index];
+    return ChunkLocation(server.server_id, server.ip_address, server.port, 0);
+}
+
+size_t ServerTable::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return servers_.size();
+}
+
+// ---------------------------------------------------------------------------
+// ChunkArena
+// ---------------------------------------------------------------------------
+
+static uint32_t log2_capacity(uint32_t capacity) {
+    uint32_t bits = 0;
+    while ((1u << bits) < capacity) {
+        ++bits;
+    }
+    return bits;
+}
+
+ChunkSpan ChunkArena::allocate(uint32_t capacity) {
+    ChunkSpan span;
+    if (capacity == 0) {
+        return span;
+    }
+    uint32_t bits = log2_capacity(capacity);
+    span.capacity = 1u << bits;
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!free_[bits].empty()) {
+        span.chunks = free_[bits].back();
+        free_[bits].pop_back();
+        return span;
+    }
+    
+    if (span.capacity > left_) {
+        // The rest of the page becomes free runs; a list bigger than a page gets its own
+        while (left_ > 0) {
+            uint32_t run = 1u << (31 - __builtin_clz(left_));
+            free_run_locked(next_, run);
+            next_ += run;
+            left_ -= run;
+        }
+        uint32_t page_chunks = std::max((uint32_t)PAGE_CHUNKS, span.capacity);
+        pages_.push_back(std::make_unique<CompactChunk[]>(page_chunks));
+        reserved_ += (size_t)page_chunks * sizeof(CompactChunk);
+        next_ = pages_.back().get();
+        left_ = page_chunks;
+    }
+    
+    span.chunks = next_;
+    next_ += span.capacity;
+    left_ -= span.capacity;
+    return span;
+}
+
+void ChunkArena::release(const ChunkSpan& span) {
+    if (span.capacity == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    free_run_locked(span.chunks, span.capacity);
+}
+
+void ChunkArena::free_run_locked(CompactChunk* run, uint32_t capacity) {
+    free_[log2_capacity(capacity)].push_back(run);
+}
+
+size_t ChunkArena::reserved_bytes() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return reserved_;
+}
+
+// ---------------------------------------------------------------------------
+// NamespaceTree
+// ---------------------------------------------------------------------------
+
+NamespaceTree::NamespaceTree() : next_file_id_(1), size_(0) {
+    FileMetadata root;
+    root.file_id = 0;
+    root.permissions = 0755;
+    root.is_directory = true;
+    store_record(root, root_.record);
+    root_.dir = std::make_unique<Directory>();
+}
+
+// Components of path; "/a//b/" -> {a, b}. "." and ".." are not resolved.
+bool NamespaceTree::split(const std::string& path, PathParts& parts) {
+    parts.clear();
+    std::string_view rest(path);
+    while (!rest.empty()) {
+        size_t end = rest.find('/');
+        std::string_view part = rest.substr(0, end);
+        if (part == "." || part == "..") {
+            return false;
+        }
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+        rest = end == std::string_view::npos ? std::string_view() : rest.substr(end + 1);
+    }
+    return true;
+}
+
+std::string NamespaceTree::join(const PathParts& parts, size_t count) {
+    std::string path;
+    for (size_t i = 0; i < count; ++i) {
+        path += '/';
+        path += parts[i];
+    }
+    return path.empty() ? "/" : path;
+}
+
+// Caller holds dir's lock
+NamespaceTree::Node* NamespaceTree::find_child(const Directory& dir, std::string_view name) {
+    auto it = dir.children.find(name);
+    return it == dir.children.end() ? nullptr : const_cast<Node*>(&it->second);
+}
+
+// Caller holds parent's directory exclusively and has checked that name is free
+NamespaceTree::Node* NamespaceTree::add_child_locked(Node& parent, std::string_view name,
+                                                     FileMetadata& metadata) {
+    if (metadata.file_id == 0) {
+        metadata.file_id = next_file_id_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        reserve_file_ids(metadata.file_id + 1);  // Replayed id: later allocations must not reuse it
+    }
+    
+    std::string_view key = names_.intern(name);
+    Node& node = parent.dir->children[key];
+    node.parent = &parent;
+    node.name = key;
+    store_record(metadata, node.record);
+    if (metadata.is_directory) {
+        node.dir = std::make_unique<Directory>();
+    }
+    
+    index_id(node);
+    size_.fetch_add(1, std::memory_order_relaxed);
+    
+    if (observer_) {
+        NamespaceChange change{NamespaceChange::ADD, metadata};
+        change.entry.path = path_of(node);
+        observer_(change);
+    }
+    return &node;
+}
+
+// Caller holds parent's directory exclusively
+MetadataStatus NamespaceTree::remove_child_locked(Node& parent, const PathParts& parts) {
+    Directory& dir = *parent.dir;
+    auto it = dir.children.find(parts.back());
+    if (it == dir.children.end()) {
+        return META_NOT_FOUND;
+    }
+    
+    Node& node = it->second;
+    if (node.dir) {
+        // Nobody can enter it while dir is held, so emptiness cannot change after this
+        std::unique_lock<std::shared_mutex> lock(node.dir->mutex);
+        if (!node.dir->children.empty()) {
+            return META_NOT_EMPTY;
+        }
+    }
+    
+    if (observer_) {
+        NamespaceChange change{NamespaceChange::REMOVE, FileMetadata()};
+        change.entry.path = join(parts, parts.size());
+        change.entry.file_id = node.record.file_id;
+        change.entry.is_directory = node.record.is_directory;
+        observer_(change);
+    }
+    
+    unindex_id(node.record.file_id);
+    drop_record(node.record);
+    std::string_view name = it->first;
+    dir.children.erase(it);
+    names_.release(name);
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return META_OK;
+}
+
+void NamespaceTree::reserve_file_ids(uint64_t next) {
+    uint64_t current = next_file_id_.load(std::memory_order_relaxed);
+    while (current < next && !next_file_id_.compare_exchange_weak(current, next)) {}
+}
+
+void NamespaceTree::store_record(const FileMetadata& metadata, FileRecord& record) {
+    record.file_id = metadata.file_id;
+    record.file_size = metadata.file_size;
+    record.creation_time = static_cast<uint32_t>(metadata.creation_time);
+    record.modification_time = static_cast<uint32_t>(metadata.modification_time);
+    record.permissions = metadata.permissions;
+    record.replication_factor = static_cast<uint8_t>(metadata.replication_factor);
+    record.is_directory = metadata.is_directory;
+    record.owner = metadata.owner.empty() ? std::string_view() : names_.intern(metadata.owner);
+    record.chunks = ChunkSpan();
+    append_chunks_locked(record, metadata.chunks);
+}
+
+void NamespaceTree::append_chunks_locked(FileRecord& record, const std::vector<ChunkHandle>& chunks) {
+    if (chunks.empty()) {
+        return;
+    }
+    
+    ChunkSpan& span = record.chunks;
+    uint32_t needed = span.count + static_cast<uint32_t>(chunks.size());
+    if (needed > span.capacity) {
+        ChunkSpan grown = arena_.allocate(needed);
+        std::copy(span.chunks, span.chunks + span.count, grown.chunks);
+        grown.count = span.count;
+        arena_.release(span);
+        span = grown;
+    }
+    
+    for (const ChunkHandle& chunk : chunks) {
+        CompactChunk& stored = span.chunks[span.count++];
+        stored.chunk_id = chunk.chunk_id;
+        stored.version = chunk.version;
+        stored.creation_time = static_cast<uint32_t>(chunk.creation_time);
+        stored.size = static_cast<uint32_t>(chunk.size);
+        stored.replica_count = 0;
+        for (const ChunkLocation& replica : chunk.replicas) {
+            if (stored.replica_count == DFS_REPLICATION_FACTOR) {
+                break;
+            }
+            ServerIndex index = servers_.intern(replica.server_id, replica.ip_address, replica.port);
+            if (index != DFS_NO_SERVER) {
+                stored.replicas[stored.replica_count++] = index;
+            }
+        }
+    }
+}
+
+// Replica generation numbers come back as the chunk version
+void NamespaceTree::load_record(const FileRecord& record, FileMetadata& metadata) const {
+    metadata.file_id = record.file_id;
+    metadata.file_size = record.file_size;
+    metadata.creation_time = record.creation_time;
+    metadata.modification_time = record.modification_time;
+    metadata.permissions = record.permissions;
+    metadata.replication_factor = record.replication_factor;
+    metadata.is_directory = record.is_directory;
+    metadata.owner.assign(record.owner.data(), record.owner.size());
+    
+    metadata.chunks.resize(record.chunks.count);
+    for (uint32_t i = 0; i < record.chunks.count; ++i) {
+        const CompactChunk& stored = record.chunks.chunks[i];
+        ChunkHandle& chunk = metadata.chunks[i];
+        chunk.chunk_id = stored.chunk_id;
+        chunk.version = stored.version;
+        chunk.creation_time = stored.creation_time;
+        chunk.size = stored.size;
+        chunk.replicas.clear();
+        for (uint8_t r = 0; r < stored.replica_count; ++r) {
+            chunk.replicas.push_back(servers_.location(stored.replicas[r]));
+            chunk.replicas.back().generation_number = stored.version;
+        }
+    }
+}
+
+void NamespaceTree::drop_record(FileRecord& record) {
+    arena_.release(record.chunks);
+    record.chunks = ChunkSpan();
+    if (!record.owner.empty()) {
+        names_.release(record.owner);
+        record.owner = std::string_view();
+    }
+}
+
+NamespaceTree::Node* NamespaceTree::lock_parent(const PathParts& parts, bool create,
+                                                bool exclusive_parent,
+                                                std::shared_lock<std::shared_mutex>& shared,
+                                                std::unique_lock<std::shared_mutex>& exclusive) const {
+    Node* dir_node = const_cast<Node*>(&root_);
+    
+    // A lock on dir_node's parent is held from here on; dir_node cannot be erased under it
+    std::shared_lock<std::shared_mutex> up;
+    std::unique_lock<std::shared_mutex> up_writer;
+    for (size_t i = 0; i + 1 < parts.size(); ++i) {
+        Directory* dir = dir_node->dir.get();
+        std::shared_lock<std::shared_mutex> reader(dir->mutex);
+        Node* child = find_child(*dir, parts[i]);
+        if (child && child->dir) {
+            up_writer = std::unique_lock<std::shared_mutex>();
+            up = std::move(reader);
+            dir_node = child;
+            continue;
+        }
+        reader.unlock();
+        if (child || !create) {
+            return nullptr;  // A file on the way, or missing
+        }
+        
+        // Create the missing directory and keep dir exclusive while stepping into it
+        std::unique_lock<std::shared_mutex> writer(dir->mutex);
+        child = find_child(*dir, parts[i]);
+        if (!child) {
+            FileMetadata metadata;
+            metadata.permissions = 0755;
+            metadata.is_directory = true;
+            // Only insert() passes create, and it is not const
+            child = const_cast<NamespaceTree*>(this)->add_child_locked(*dir_node, parts[i], metadata);
+        }
+        if (!child->dir) {
+            return nullptr;
+        }
+        up = std::shared_lock<std::shared_mutex>();
+        up_writer = std::move(writer);
+        dir_node = child;
+    }
+    
+    if (exclusive_parent) {
+        exclusive = std::unique_lock<std::shared_mutex>(dir_node->dir->mutex);
+    } else {
+        shared = std::shared_lock<std::shared_mutex>(dir_node->dir->mutex);
+    }
+    return dir_node;
+}
+
+bool NamespaceTree::get(const std::string& path, FileMetadata& metadata) const {
+    PathParts parts;
+    if (!split(path, parts)) {
+        return false;
+    }
+    
+    if (parts.empty()) {
+        std::shared_lock<std::shared_mutex> lock(root_.dir->mutex);
+        load_record(root_.record, metadata);
+    } else {
+        std::shared_lock<std::shared_mutex> shared;
+        std::unique_lock<std::shared_mutex> exclusive;
+        Node* parent = lock_parent(parts, false, false, shared, exclusive);
+        Node* node = parent ? find_child(*parent->dir, parts.back()) : nullptr;
+        if (!node) {
+            return false;
+        }
+        load_record(node->record, metadata);
+    }
+    metadata.path = join(parts, parts.size());
+    return true;
+}
+
+MetadataStatus NamespaceTree::insert(const std::string& path, FileMetadata& metadata) {
+    PathParts parts;
+    if (!split(path, parts)) {
+        return META_ERROR;
+    }
+    if (parts.empty()) {
+        return META_EXISTS;
+    }
+    
+    std::shared_lock<std::shared_mutex> shared;
+    std::unique_lock<std::shared_mutex> exclusive;
+    Node* parent = lock_parent(parts, true, true, shared, exclusive);
+    if (!parent) {
+        return META_ERROR;
+    }
+    if (find_child(*parent->dir, parts.back())) {
+        return META_EXISTS;
+    }
+    
+    add_child_locked(*parent, parts.back(), metadata);
+    return META_OK;
+}
+
+MetadataStatus NamespaceTree::insert_child(uint64_t parent_id, std::string_view name,
+                                           FileMetadata& metadata) {
+    Node* parent = &root_;
+    if (parent_id != 0) {
+        IdShard& shard = ids_[parent_id % ids_.size()];
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.nodes.find(parent_id);
+        if (it == shard.nodes.end()) {
+            return META_NOT_FOUND;
+        }
+        parent = const_cast<Node*>(it->second);
+    }
+    if (!parent->dir || name.empty() || name == "." || name == ".." ||
+        name.find('/') != std::string_view::npos) {
+        return META_ERROR;
+    }
+    
+    std::unique_lock<std::shared_mutex> lock(parent->dir->mutex);
+    if (find_child(*parent->dir, name)) {
+        return META_EXISTS;
+    }
+    add_child_locked(*parent, name, metadata);
+    return META_OK;
+}
+
+MetadataStatus NamespaceTree::erase(const std::string& path) {
+    PathParts parts;
+    if (!split(path, parts) || parts.empty()) {
+        return META_ERROR;
+    }
+    
+    std::shared_lock<std::shared_mutex> shared;
+    std::unique_lock<std::shared_mutex> exclusive;
+    Node* parent = lock_parent(parts, false, true, shared, exclusive);
+    if (!parent) {
+        return META_NOT_FOUND;
+    }
+    return remove_child_locked(*parent, parts);
+}
+
+bool NamespaceTree::append_chunks(const std::string& path, uint64_t file_id,
+                                  const std::vector<ChunkHandle>& chunks, uint64_t modification_time) {
+    PathParts parts;
+    if (!split(path, parts) || parts.empty()) {
+        return false;
+    }
+    
+    std::shared_lock<std::shared_mutex> shared;
+    std::unique_lock<std::shared_mutex> exclusive;
+    Node* parent = lock_parent(parts, false, true, shared, exclusive);
+    Node* node = parent ? find_child(*parent->dir, parts.back()) : nullptr;
+    if (!node || node->record.file_id != file_id || node->record.is_directory) {
+        return false;  // The path may have been deleted and reused
+    }
+    
+    append_chunks_locked(node->record, chunks);
+    node->record.modification_time = static_cast<uint32_t>(modification_time);
+    
+    if (observer_) {
+        NamespaceChange change{NamespaceChange::APPEND_CHUNKS, FileMetadata()};
+        change.entry.path = join(parts, parts.size());
+        change.entry.file_id = file_id;
+        change.entry.modification_time = modification_time;
+        change.entry.chunks = chunks;
+        observer_(change);
+    }
+    return true;
+}
+
+MetadataStatus NamespaceTree::apply(const NamespaceChange& change) {
+    PathParts parts;
+    if (!split(change.entry.path, parts) || parts.empty()) {
+        return META_ERROR;
+    }
+    
+    // Parents are never created here: a missing one was removed after the change
+    std::shared_lock<std::shared_mutex> shared;
+    std::unique_lock<std::shared_mutex> exclusive;
+    Node* parent = lock_parent(parts, false, true, shared, exclusive);
+    if (!parent) {
+        return META_NOT_FOUND;
+    }
+    Node* node = find_child(*parent->dir, parts.back());
+    
+    switch (change.type) {
+        case NamespaceChange::ADD: {
+            if (node) {
+                return META_EXISTS;
+            }
+            FileMetadata entry = change.entry;
+            add_child_locked(*parent, parts.back(), entry);
+            return META_OK;
+        }
+        
+        case NamespaceChange::REMOVE:
+            if (!node || node->record.file_id != change.entry.file_id) {
+                return META_NOT_FOUND;
+            }
+            return remove_child_locked(*parent, parts);
+        
+        case NamespaceChange::APPEND_CHUNKS: {
+            if (!node || node->record.file_id != change.entry.file_id || node->record.is_directory) {
+                return META_NOT_FOUND;
+            }
+            // A change's chunks go in together, so its first one tells whether it is in
+            ChunkSpan& span = node->record.chunks;
+            if (!change.entry.chunks.empty() &&
+                std::any_of(span.chunks, span.chunks + span.count, [&](const CompactChunk& chunk) {
+                    return chunk.chunk_id == change.entry.chunks.front().chunk_id;
+                })) {
+                return META_EXISTS;
+            }
+            append_chunks_locked(node->record, change.entry.chunks);
+            node->record.modification_time = static_cast<uint32_t>(change.entry.modification_time);
+            return META_OK;
+        }
+    }
+    return META_ERROR;
+}
+
+void NamespaceTree::visit(const Visitor& visitor) const {
+    std::string path;
+    FileMetadata entry;
+    visit_locked(root_, path, entry, visitor);
+}
+
+// Caller holds dir_node's parent directory, if it has one
+void NamespaceTree::visit_locked(const Node& dir_node, std::string& path, FileMetadata& entry,
+                                 const Visitor& visitor) const {
+    std::shared_lock<std::shared_mutex> lock(dir_node.dir->mutex);
+    size_t length = path.size();
+    for (const auto& child : dir_node.dir->children) {
+        path += '/';
+        path += child.first;
+        load_record(child.second.record, entry);
+        entry.path = path;
+        visitor(dir_node.record.file_id, entry);
+        if (child.second.dir) {
+            visit_locked(child.second, path, entry, visitor);
+        }
+        path.resize(length);
+    }
+}
+
+bool NamespaceTree::list(const std::string& path, std::vector<std::string>& names) const {
+    PathParts parts;
+    if (!split(path, parts)) {
+        return false;
+    }
+    
+    const Directory* target = root_.dir.get();
+    std::shared_lock<std::shared_mutex> shared;
+    std::unique_lock<std::shared_mutex> exclusive;
+    if (!parts.empty()) {
+        Node* parent = lock_parent(parts, false, false, shared, exclusive);
+        Node* node = parent ? find_child(*parent->dir, parts.back()) : nullptr;
+        if (!node || !node->dir) {
+            return false;
+        }
+        target = node->dir.get();
+    }
+    
+    // Taken while the parent is still held, as in the walk
+    std::shared_lock<std::shared_mutex> lock(target->mutex);
+    names.clear();
+    for (const auto& child : target->children) {
+        names.emplace_back(child.first);
+    }
+    return true;
+}
+
+bool NamespaceTree::find_path(uint64_t file_id, std::string& path) const {
+    if (file_id == 0) {
+        path = "/";
+        return true;
+    }
+    
+    const IdShard& shard = ids_[file_id % ids_.size()];
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto it = shard.nodes.find(file_id);
+    if (it == shard.nodes.end()) {
+        return false;
+    }
+    
+    // While indexed, the node and its ancestors stay put: erase unindexes under
+    // this lock first, and only empty directories are erased
+    path = path_of(*it->second);
+    return true;
+}
+
+// Caller keeps node from being erased. Names and parent links never change after insert.
+std::string NamespaceTree::path_of(const Node& node) {
+    std::vector<std::string_view> names;
+    for (const Node* at = &node; at->parent; at = at->parent) {
+        names.push_back(at->name);
+    }
+    std::string path;
+    for (auto name = names.rbegin(); name != names.rend(); ++name) {
+        path += '/';
+        path += *name;
+    }
+    return path.empty() ? "/" : path;
+}
+
+void NamespaceTree::index_id(const Node& node) {
+    IdShard& shard = ids_[node.record.file_id % ids_.size()];
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.nodes[node.record.file_id] = &node;
+}
+
+void NamespaceTree::unindex_id(uint64_t file_id) {
+    IdShard& shard = ids_[file_id % ids_.size()];
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.nodes.erase(file_id);
+}
@@ -12,7 +12,16 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/types.h>
 #include <netinet/in.h>
 
 class NetworkSocket {
@@ -28,19 +37,64 @@ public:
     // Client-side operations
     bool connect_to_server(const std::string& server_ip, uint16_t server_port);
     
+    // Take ownership of an already connected descriptor (e.g. from accept_connection)
+    bool attach(int connected_fd);
+    
     // Data transmission
     bool send_data(const std::vector<uint8_t>& data);
     bool recv_data(std::vector<uint8_t>& data, size_t max_size);
     bool send_frame(const ProtocolFrame& frame);
     bool recv_frame(ProtocolFrame& frame);
     
+    // Loop until exactly length bytes land in dest; false on error or peer close
+    bool recv_exact(void* dest, size_t length);
+    
+    // Streaming receive: read and validate the header, then let the caller consume
+    // the payload in bounded slices instead of buffering it whole
+    using SliceHandler = std::function<bool(const uint8_t* data, size_t length, uint64_t offset)>;
+    bool recv_frame_header(FrameHeader& header);
+    bool recv_payload(ProtocolFrame& frame);  // Payload for a header already in frame
+    bool recv_stream(size_t length, size_t slice_size, uint32_t& crc, const SliceHandler& on_slice);
+    
+    // Checks shared by blocking and event-driven receive paths
+    bool validate_frame_header(const FrameHeader& header) const;
+    static bool verify_payload_checksum(const ProtocolFrame& frame);
+    
+    // Scatter-gather send: header and payload segments go out in one sendmsg()
+    // call without being copied into a contiguous buffer
+    bool send_frame(const FrameHeader& header, const struct iovec* payload_iov, int iovcnt);
+    bool send_iov(struct iovec* iov, int iovcnt);
+    
+    // Send a frame whose payload lives in a file (e.g. an on-disk chunk) via sendfile()
+    bool send_frame_from_file(const FrameHeader& header, int file_fd, off_t offset, size_t length);
+    
     // Socket management
     void close_socket();
     bool is_connected() const { return socket_fd_ != -1; }
+    // An idle connection the peer has since closed or reset; sends on it
+    // still succeed until the reset comes back
+    bool peer_closed() const;
+    // Send and receive timeout, DFS_NETWORK_TIMEOUT_MS by default
+    bool set_timeout(int timeout_ms);
     int get_socket_fd() const { return socket_fd_; }
     
-    // Utility functions
+    // Upper bound on accepted payload_size; larger frames are rejected before allocation
+    void set_max_payload_size(uint32_t max_size) { max_payload_size_ = max_size; }
+    uint32_t get_max_payload_size() const { return max_payload_size_; }
+    
+    // Utility functions (CRC32C / Castagnoli polynomial since protocol version 2)
     static uint32_t calculate_crc32(const uint8_t* data, size_t length);
+    static uint32_t extend_crc32(uint32_t crc, const uint8_t* data, size_t length);
+    // crc32(a + b) from crc32(a), crc32(b) and b's length, without the data
+    static uint32_t combine_crc32(uint32_t crc_a, uint32_t crc_b, uint64_t length_b);
+    
+    // CRC engines; the fastest available one is picked at runtime
+    enum CrcImplementation { CRC_TABLE, CRC_SLICE_BY_8, CRC_HARDWARE };
+    static uint32_t extend_crc32(uint32_t crc, const uint8_t* data, size_t length, 
+                                 CrcImplementation impl);
+    static bool crc_implementation_available(CrcImplementation impl);
+    static CrcImplementation active_crc_implementation();
+    static const char* crc_implementation_name(CrcImplementation impl);
     static std::string get_local_ip();
 
 private:
@@ -48,31 +102,165 @@ private:
     struct sockaddr_in local_addr_;
     struct sockaddr_in peer_addr_;
     bool is_server_;
+    uint32_t max_payload_size_;
     
     bool set_socket_options();
 };
 
-// Connection pool for efficient client connections
+// Event-driven connection handling for servers: a few I/O threads multiplex
+// every accepted socket with epoll and hand complete frames to worker threads,
+// so idle keep-alive connections no longer pin a worker each
+class ConnectionReactor {
+public:
+    // Runs a task on the server's worker pool
+    using Executor = std::function<void(std::function<void()>)>;
+    
+    // Handle one fully received, checksum-verified request. connection_id names
+    // the client connection for later push() calls.
+    using RequestHandler = std::function<void(uint64_t connection_id, const ProtocolFrame& request, 
+                                              ProtocolFrame& response)>;
+    
+    // Handle a request whose payload is still on the socket (e.g. streamed chunk
+    // writes); returning false drops the connection
+    using StreamHandler = std::function<bool(NetworkSocket& socket, const FrameHeader& header,
+                                             ProtocolFrame& response)>;
+    
+    explicit ConnectionReactor(size_t num_io_threads = 1);
+    ~ConnectionReactor();
+    
+    void set_request_handler(RequestHandler handler) { request_handler_ = std::move(handler); }
+    void set_stream_handler(uint16_t message_type, StreamHandler handler) {
+        stream_handlers_[message_type] = std::move(handler);
+    }
+    void set_max_payload_size(uint32_t max_size) { max_payload_size_ = max_size; }
+    void set_max_connections(size_t max_connections) { max_connections_ = max_connections; }
+    
+    // Streamed requests run here instead of on the start() executor; set it
+    // when stream handlers block on other servers. Set before start()
+    void set_stream_executor(Executor executor) { stream_executor_ = std::move(executor); }
+    
+    // Takes over accepting on an already listening socket
+    bool start(NetworkSocket& listener, Executor executor);
+    void stop();
+    
+    size_t get_connection_count() const { return connection_count_; }
+    size_t get_num_io_threads() const { return io_threads_.size(); }
+    
+    // Send an unsolicited frame (e.g. an invalidation) on a client connection;
+    // serialized with responses. False if the connection is gone.
+    bool push(uint64_t connection_id, const ProtocolFrame& frame);
+
+private:
+    // One accepted client; its fd is armed EPOLLONESHOT. A fully received request
+    // is handed to a worker and the fd re-armed at once, so a client can pipeline
+    // up to DFS_MAX_PIPELINED_REQUESTS requests and gets each response (matched
+    // by request_id) as soon as it is ready. Streamed requests own the socket and
+    // are still handled one at a time.
+    struct Connection {
+        NetworkSocket socket;
+        std::string peer_ip;
+        uint64_t id;
+        ProtocolFrame request;
+        size_t header_received;
+        size_t payload_received;
+        std::atomic<uint32_t> in_flight;  // Requests dispatched but not yet answered
+        std::mutex send_mutex;  // Responses and pushes must not interleave
+        
+        Connection() : id(0), header_received(0), payload_received(0), in_flight(0) {}
+    };
+    
+    struct IoThread {
+        int epoll_fd;
+        int wake_fd;
+        std::thread thread;
+        std::mutex mutex;
+        std::map<int, std::shared_ptr<Connection>> connections;
+        
+        IoThread() : epoll_fd(-1), wake_fd(-1) {}
+    };
+    
+    std::vector<std::unique_ptr<IoThread>> io_threads_;
+    std::atomic<bool> running_;
+    std::atomic<size_t> connection_count_;
+    size_t next_io_thread_;
+    uint64_t next_connection_id_;
+    std::map<uint64_t, std::weak_ptr<Connection>> connections_by_id_;
+    std::mutex ids_mutex_;
+    int listen_fd_;
+    uint32_t max_payload_size_;
+    size_t max_connections_;
+    
+    Executor executor_;
+    Executor stream_executor_;
+    RequestHandler request_handler_;
+    std::map<uint16_t, StreamHandler> stream_handlers_;
+    
+    void io_loop(IoThread& io);
+    void accept_pending();
+    void on_readable(IoThread& io, const std::shared_ptr<Connection>& conn);
+    void dispatch_request(IoThread& io, std::shared_ptr<Connection> conn);
+    void dispatch_stream(IoThread& io, std::shared_ptr<Connection> conn, const StreamHandler& handler);
+    void finish_request(IoThread& io, const std::shared_ptr<Connection>& conn, bool keep_open);
+    bool arm(IoThread& io, int fd, int op);
+    void close_connection(IoThread& io, const std::shared_ptr<Connection>& conn);
+};
+
+// Connection pool for efficient client connections. Up to pool_size idle
+// connections are kept per server, most recently used first. Servers are
+// spread over independently locked shards, and once a server is known an
+// acquire takes its shard lock only to pop a connection: no allocation, and
+// connects and liveness probes happen outside the lock. At most
+// DFS_POOL_MAX_DIALS connects to one server run at once; callers beyond that
+// wait for one of them, and fail with it when the server is unreachable
 class ConnectionPool {
 public:
     explicit ConnectionPool(size_t pool_size = 10);
     ~ConnectionPool();
     
+    // A pooled connection that still looks open, else a new one; nullptr when
+    // the server cannot be reached
     std::shared_ptr<NetworkSocket> acquire(const std::string& server_ip, uint16_t port);
-    void release(const std::string& key, std::shared_ptr<NetworkSocket> socket);
+    // Only for connections whose last exchange completed
+    void release(const std::string& server_ip, uint16_t port, std::shared_ptr<NetworkSocket> socket);
+    // Close connections idle for DFS_POOL_IDLE_TIMEOUT_SEC; also done
+    // piecemeal as the pool is used
+    void evict_idle();
     void clear();
+    
+    size_t idle_count();
 
 private:
-    struct PooledConnection {
+    using Clock = std::chrono::steady_clock;
+    static const int SHARD_BITS = 4;
+    
+    struct Idle {
         std::shared_ptr<NetworkSocket> socket;
-        time_t last_used;
+        Clock::time_point since;
+    };
+    // Never erased, so a caller may wait on one without the shard pinning it
+    struct Endpoint {
+        std::string ip;
+        uint16_t port;
+        std::vector<Idle> idle;               // Oldest first, capacity reserved up front
+        uint32_t dialing;
+        uint64_t failed_dials;
+        std::condition_variable changed;      // A dial ended or a connection came back
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::unique_ptr<Endpoint>> endpoints;
+        Clock::time_point swept;
     };
     
-    std::map<std::string, std::vector<PooledConnection>> pools_;
-    std::mutex pool_mutex_;
+    Shard shards_[1 << SHARD_BITS];
     size_t max_pool_size_;
     
-    std::string make_key(const std::string& ip, uint16_t port);
+    static uint64_t endpoint_key(const std::string& ip, uint16_t port);
+    Shard& shard_for(uint64_t key);
+    // nullptr on a key collision between two hashed names; caller holds shard.mutex
+    Endpoint* find_endpoint(Shard& shard, uint64_t key, const std::string& ip, uint16_t port);
+    void evict_idle_locked(Shard& shard, Clock::time_point now, 
+                           std::vector<std::shared_ptr<NetworkSocket>>& closing);
 };
 
 #endif // DFS_NETWORK_H
@@ -86,41 +274,210 @@ private:
 #include <cstring>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <fcntl.h>
 #include <iostream>
 #include <ifaddrs.h>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <array>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
 
-// CRC32 lookup table for fast computation
-static uint32_t crc32_table[256];
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78)
+static const uint32_t CRC32C_POLY = 0x82F63B78;
 
-static void init_crc32_table() {
-    static bool initialized = false;
-    if (initialized) return;
+// Slice-by-8 tables; table[0] is the classic byte-at-a-time table
+struct Crc32cTables {
+    uint32_t table[8][256];
     
-    for (uint32_t i = 0; i < 256; ++i) {
-        uint32_t crc = i;
-        for (uint32_t j = 0; j < 8; ++j) {
-            if (crc & 1) {
-                crc = (crc >> 1) ^ 0xEDB88320;
-            } else {
-                crc >>= 1;
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (uint32_t j = 0; j < 8; ++j) {
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (uint32_t k = 1; k < 8; ++k) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
             }
         }
-        crc32_table[i] = crc;
     }
-    initialized = true;
+};
+
+static const Crc32cTables& crc32c_tables() {
+    static const Crc32cTables tables;
+    return tables;
 }
 
-uint32_t NetworkSocket::calculate_crc32(const uint8_t* data, size_t length) {
-    init_crc32_table();
-    uint32_t crc = 0xFFFFFFFF;
-    
+// Engines operate on the raw (pre-inverted) CRC register
+static uint32_t crc32c_table(uint32_t crc, const uint8_t* data, size_t length) {
+    const auto& t = crc32c_tables().table;
     for (size_t i = 0; i < length; ++i) {
-        uint8_t byte = data[i];
-        crc = (crc >> 8) ^ crc32_table[(crc ^ byte) & 0xFF];
+        crc = (crc >> 8) ^ t[0][(crc ^ data[i]) & 0xFF];
     }
+    return crc;
+}
+
+static uint32_t crc32c_slice_by_8(uint32_t crc, const uint8_t* data, size_t length) {
+    const auto& t = crc32c_tables().table;
+    while (length >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, data, 4);
+        std::memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        data += 8;
+        length -= 8;
+    }
+    return crc32c_table(crc, data, length);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t* data, size_t length) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (length > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        --length;
+    }
+    return crc;
+}
+
+static bool crc32c_hardware_supported() {
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc")))
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t* data, size_t length) {
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc = __crc32cb(crc, *data++);
+        --length;
+    }
+    return crc;
+}
+
+static bool crc32c_hardware_supported() {
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#else
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t* data, size_t length) {
+    return crc32c_slice_by_8(crc, data, length);
+}
+
+static bool crc32c_hardware_supported() {
+    return false;
+}
+#endif
+
+typedef uint32_t (*Crc32cFn)(uint32_t, const uint8_t*, size_t);
+
+static Crc32cFn crc32c_engine(NetworkSocket::CrcImplementation impl) {
+    switch (impl) {
+        case NetworkSocket::CRC_HARDWARE: return crc32c_hardware;
+        case NetworkSocket::CRC_SLICE_BY_8: return crc32c_slice_by_8;
+        default: return crc32c_table;
+    }
+}
+
+bool NetworkSocket::crc_implementation_available(CrcImplementation impl) {
+    return impl != CRC_HARDWARE || crc32c_hardware_supported();
+}
+
+NetworkSocket::CrcImplementation NetworkSocket::active_crc_implementation() {
+    static const CrcImplementation active = 
+        crc32c_hardware_supported() ? CRC_HARDWARE : CRC_SLICE_BY_8;
+    return active;
+}
+
+const char* NetworkSocket::crc_implementation_name(CrcImplementation impl) {
+    switch (impl) {
+        case CRC_HARDWARE: return "hardware";
+        case CRC_SLICE_BY_8: return "slice-by-8";
+        default: return "table";
+    }
+}
+
+uint32_t NetworkSocket::calculate_crc32(const uint8_t* data, size_t length) {
+    return extend_crc32(0, data, length);
+}
+
+// Continue a CRC over more data: extend_crc32(extend_crc32(0, a), b) == crc32(a + b)
+uint32_t NetworkSocket::extend_crc32(uint32_t crc, const uint8_t* data, size_t length) {
+    static const Crc32cFn engine = crc32c_engine(active_crc_implementation());
+    return engine(crc ^ 0xFFFFFFFF, data, length) ^ 0xFFFFFFFF;
+}
+
+// a * b modulo the CRC32C polynomial, in its reflected bit order
+static uint32_t crc32c_multiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1) {
+        if (a & bit) {
+            product ^= b;
+        }
+        b = (b & 1) ? (b >> 1) ^ 0x82F63B78 : b >> 1;
+    }
+    return product;
+}
+
+// Appending length_b bytes multiplies a's CRC by x^(8 * length_b); that power
+// is built from squares, so this is O(log length_b)
+uint32_t NetworkSocket::combine_crc32(uint32_t crc_a, uint32_t crc_b, uint64_t length_b) {
+    static const std::array<uint32_t, 64> powers = [] {
+        std::array<uint32_t, 64> table;   // table[k] = x^(2^k)
+        uint32_t power = 1u << 30;        // x^1
+        for (uint32_t& entry : table) {
+            entry = power;
+            power = crc32c_multiply(power, power);
+        }
+        return table;
+    }();
     
-    return crc ^ 0xFFFFFFFF;
+    uint32_t shift = 1u << 31;            // x^0
+    for (size_t k = 3; length_b != 0 && k < powers.size(); length_b >>= 1, ++k) {
+        if (length_b & 1) {
+            shift = crc32c_multiply(powers[k], shift);
+        }
+    }
+    return crc32c_multiply(shift, crc_a) ^ crc_b;
+}
+
+uint32_t NetworkSocket::extend_crc32(uint32_t crc, const uint8_t* data, size_t length, 
+                                     CrcImplementation impl) {
+    if (!crc_implementation_available(impl)) {
+        impl = CRC_SLICE_BY_8;
+    }
+    return crc32c_engine(impl)(crc ^ 0xFFFFFFFF, data, length) ^ 0xFFFFFFFF;
 }
 
 std::string NetworkSocket::get_local_ip() {
@@ -150,7 +507,8 @@ std::string NetworkSocket::get_local_ip() {
     return local_ip;
 }
 
-NetworkSocket::NetworkSocket() : socket_fd_(-1), is_server_(false) {
+NetworkSocket::NetworkSocket() 
+    : socket_fd_(-1), is_server_(false), max_payload_size_(DFS_MAX_FRAME_PAYLOAD_BYTES) {
     std::memset(&local_addr_, 0, sizeof(local_addr_));
     std::memset(&peer_addr_, 0, sizeof(peer_addr_));
 }
@@ -165,9 +523,19 @@ bool NetworkSocket::set_socket_options() {
         return false;
     }
     
+    // Requests, acks and pushed invalidations are small frames that must not wait
+    // behind Nagle for the peer's delayed ACK
+    if (setsockopt(socket_fd_, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) < 0) {
+        return false;
+    }
+    
+    return set_timeout(DFS_NETWORK_TIMEOUT_MS);
+}
+
+bool NetworkSocket::set_timeout(int timeout_ms) {
     struct timeval tv;
-    tv.tv_sec = DFS_NETWORK_TIMEOUT_MS / 1000;
-    tv.tv_usec = (DFS_NETWORK_TIMEOUT_MS % 1000) * 1000;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
     
     if (setsockopt(socket_fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
         return false;
@@ -245,6 +613,19 @@ bool NetworkSocket::connect_to_server(const std::string& server_ip, uint16_t ser
     return true;
 }
 
+bool NetworkSocket::attach(int connected_fd) {
+    close_socket();
+    socket_fd_ = connected_fd;
+    is_server_ = false;
+    
+    if (!set_socket_options()) {
+        close_socket();
+        return false;
+    }
+    
+    return true;
+}
+
 bool NetworkSocket::send_data(const std::vector<uint8_t>& data) {
     if (socket_fd_ < 0) return false;
     
@@ -274,54 +655,200 @@ bool NetworkSocket::recv_data(std::vector<uint8_t>& data, size_t max_size) {
     return true;
 }
 
-bool NetworkSocket::send_frame(const ProtocolFrame& frame) {
-    std::vector<uint8_t> buffer;
+bool NetworkSocket::send_iov(struct iovec* iov, int iovcnt) {
+    if (socket_fd_ < 0) return false;
     
-    // Serialize frame header
-    uint8_t* ptr = (uint8_t*)&frame;
-    size_t frame_size = sizeof(uint32_t) * 4 + sizeof(uint16_t) * 2 + frame.payload_size;
+    // Skip empty leading segments so sendmsg() always has work to do
+    while (iovcnt > 0 && iov->iov_len == 0) {
+        ++iov;
+        --iovcnt;
+    }
     
-    buffer.insert(buffer.end(), ptr, ptr + frame_size);
+    while (iovcnt > 0) {
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = std::min(iovcnt, IOV_MAX);
+        
+        ssize_t sent = sendmsg(socket_fd_, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        
+        // Advance past fully sent segments, then trim a partially sent one
+        size_t remaining = sent;
+        while (iovcnt > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t*)iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
     
-    return send_data(buffer);
+    return true;
 }
 
-bool NetworkSocket::recv_frame(ProtocolFrame& frame) {
-    std::vector<uint8_t> header_data;
+bool NetworkSocket::send_frame(const FrameHeader& header, const struct iovec* payload_iov, int iovcnt) {
+    std::vector<struct iovec> iov(iovcnt + 1);
+    iov[0].iov_base = const_cast<FrameHeader*>(&header);
+    iov[0].iov_len = DFS_FRAME_HEADER_SIZE;
     
-    // Receive header (magic + version + type + size + checksum)
-    if (!recv_data(header_data, 16)) {
+    size_t payload_bytes = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        iov[i + 1] = payload_iov[i];
+        payload_bytes += payload_iov[i].iov_len;
+    }
+    
+    if (payload_bytes != header.payload_size) {
         return false;
     }
     
-    if (header_data.size() != 16) {
+    return send_iov(iov.data(), (int)iov.size());
+}
+
+bool NetworkSocket::send_frame(const ProtocolFrame& frame) {
+    if (frame.payload_size > frame.payload.size()) {
         return false;
     }
     
-    std::memcpy(&frame, header_data.data(), 16);
+    struct iovec payload_iov;
+    payload_iov.iov_base = const_cast<uint8_t*>(frame.payload.data());
+    payload_iov.iov_len = frame.payload_size;
     
-    // Verify magic number
-    if (frame.magic != DFS_PROTOCOL_MAGIC) {
+    return send_frame(frame, &payload_iov, 1);
+}
+
+bool NetworkSocket::send_frame_from_file(const FrameHeader& header, int file_fd, 
+                                         off_t offset, size_t length) {
+    if (socket_fd_ < 0 || header.payload_size != length) return false;
+    
+    // Header first (corked with MSG_MORE so it shares a segment with the payload)
+    size_t header_sent = 0;
+    const uint8_t* header_ptr = (const uint8_t*)&header;
+    while (header_sent < DFS_FRAME_HEADER_SIZE) {
+        ssize_t sent = send(socket_fd_, header_ptr + header_sent, 
+                            DFS_FRAME_HEADER_SIZE - header_sent, MSG_MORE | MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        header_sent += sent;
+    }
+    
+    // Payload straight from the page cache, no user-space copy
+    size_t total_sent = 0;
+    while (total_sent < length) {
+        ssize_t sent = sendfile(socket_fd_, file_fd, &offset, length - total_sent);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (sent == 0) {
+            return false;  // File shorter than advertised payload
+        }
+        total_sent += sent;
+    }
+    
+    return true;
+}
+
+bool NetworkSocket::recv_exact(void* dest, size_t length) {
+    if (socket_fd_ < 0) return false;
+    
+    uint8_t* ptr = static_cast<uint8_t*>(dest);
+    size_t total_received = 0;
+    while (total_received < length) {
+        ssize_t received = recv(socket_fd_, ptr + total_received, length - total_received, 0);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (received == 0) {
+            return false;  // Peer closed mid-frame
+        }
+        total_received += received;
+    }
+    
+    return true;
+}
+
+bool NetworkSocket::recv_frame_header(FrameHeader& header) {
+    // Receive header (magic + version + type + size + checksum)
+    if (!recv_exact(&header, DFS_FRAME_HEADER_SIZE)) {
         return false;
     }
     
-    // Receive payload
-    std::vector<uint8_t> payload_data;
-    if (!recv_data(payload_data, frame.payload_size)) {
+    return validate_frame_header(header);
+}
+
+bool NetworkSocket::validate_frame_header(const FrameHeader& header) const {
+    // Verify magic number
+    if (header.magic != DFS_PROTOCOL_MAGIC) {
         return false;
     }
     
-    std::memcpy(frame.payload, payload_data.data(), frame.payload_size);
+    // Peers on another version may checksum with a different polynomial
+    if (header.version != DFS_PROTOCOL_VERSION) {
+        return false;
+    }
     
-    // Verify checksum
-    uint32_t calculated_crc = calculate_crc32(frame.payload, frame.payload_size);
-    if (calculated_crc != frame.checksum) {
+    // Refuse oversized frames before anything is allocated for the payload
+    if (header.payload_size > max_payload_size_) {
         return false;
     }
     
     return true;
 }
 
+bool NetworkSocket::recv_stream(size_t length, size_t slice_size, uint32_t& crc, 
+                                const SliceHandler& on_slice) {
+    std::vector<uint8_t> slice(std::min(length, slice_size));
+    
+    uint64_t offset = 0;
+    while (offset < length) {
+        size_t chunk = std::min(slice.size(), (size_t)(length - offset));
+        if (!recv_exact(slice.data(), chunk)) {
+            return false;
+        }
+        
+        crc = extend_crc32(crc, slice.data(), chunk);
+        if (!on_slice(slice.data(), chunk, offset)) {
+            return false;
+        }
+        offset += chunk;
+    }
+    
+    return true;
+}
+
+bool NetworkSocket::recv_frame(ProtocolFrame& frame) {
+    FrameHeader& header = frame;
+    if (!recv_frame_header(header)) {
+        return false;
+    }
+    
+    return recv_payload(frame);
+}
+
+bool NetworkSocket::recv_payload(ProtocolFrame& frame) {
+    // Receive payload straight into the frame's buffer
+    frame.payload.resize(frame.payload_size);
+    if (!recv_exact(frame.payload.data(), frame.payload_size)) {
+        return false;
+    }
+    
+    return verify_payload_checksum(frame);
+}
+
+bool NetworkSocket::verify_payload_checksum(const ProtocolFrame& frame) {
+    uint32_t calculated_crc = calculate_crc32(frame.payload.data(), frame.payload_size);
+    return calculated_crc == frame.checksum;
+}
+
 void NetworkSocket::close_socket() {
     if (socket_fd_ >= 0) {
         close(socket_fd_);
@@ -329,47 +856,531 @@ void NetworkSocket::close_socket() {
     }
 }
 
+bool NetworkSocket::peer_closed() const {
+    if (socket_fd_ < 0) {
+        return true;
+    }
+    uint8_t byte;
+    ssize_t n = recv(socket_fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
 // Connection Pool Implementation
-ConnectionPool::ConnectionPool(size_t pool_size) : max_pool_size_(pool_size) {}
+ConnectionPool::ConnectionPool(size_t pool_size) : max_pool_size_(std::max((size_t)1, pool_size)) {
+    for (Shard& shard : shards_) {
+        shard.swept = Clock::now();
+    }
+}
 
 ConnectionPool::~ConnectionPool() {
     clear();
 }
 
-std::string ConnectionPool::make_key(const std::string& ip, uint16_t port) {
-    return ip + ":" + std::to_string(port);
+// An IPv4 address and port pack exactly; anything else is hashed into keys
+// IPv4 cannot produce
+uint64_t ConnectionPool::endpoint_key(const std::string& ip, uint16_t port) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip.c_str(), &addr) == 1) {
+        return ((uint64_t)ntohl(addr.s_addr) << 16) | port;
+    }
+    return (std::hash<std::string>()(ip) * 65537 + port) | (1ull << 63);
+}
+
+ConnectionPool::Shard& ConnectionPool::shard_for(uint64_t key) {
+    return shards_[(key * 0x9E3779B97F4A7C15ull) >> (64 - SHARD_BITS)];
+}
+
+ConnectionPool::Endpoint* ConnectionPool::find_endpoint(Shard& shard, uint64_t key, 
+                                                        const std::string& ip, uint16_t port) {
+    auto it = shard.endpoints.find(key);
+    if (it == shard.endpoints.end()) {
+        std::unique_ptr<Endpoint> endpoint(new Endpoint());
+        endpoint->ip = ip;
+        endpoint->port = port;
+        endpoint->idle.reserve(max_pool_size_);
+        endpoint->dialing = 0;
+        endpoint->failed_dials = 0;
+        it = shard.endpoints.emplace(key, std::move(endpoint)).first;
+    }
+    Endpoint* endpoint = it->second.get();
+    return endpoint->port == port && endpoint->ip == ip ? endpoint : nullptr;
 }
 
 std::shared_ptr<NetworkSocket> ConnectionPool::acquire(const std::string& server_ip, uint16_t port) {
-    std::string key = make_key(server_ip, port);
+    uint64_t key = endpoint_key(server_ip, port);
+    Shard& shard = shard_for(key);
+    std::vector<std::shared_ptr<NetworkSocket>> closing;  // Closed once the lock is dropped
     
-    std::unique_lock<std::mutex> lock(pool_mutex_);
-    
-    auto it = pools_.find(key);
-    if (it != pools_.end() && !it->second.empty()) {
-        auto conn = it->second.back();
-        it->second.pop_back();
-        return conn.socket;
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    Endpoint* endpoint = find_endpoint(shard, key, server_ip, port);
+    while (endpoint) {
+        Clock::time_point now = Clock::now();
+        while (!endpoint->idle.empty()) {
+            Idle conn = std::move(endpoint->idle.back());
+            endpoint->idle.pop_back();
+            if (now - conn.since >= std::chrono::seconds(DFS_POOL_IDLE_TIMEOUT_SEC)) {
+                // The rest have been idle longer still
+                closing.push_back(std::move(conn.socket));
+                for (Idle& older : endpoint->idle) {
+                    closing.push_back(std::move(older.socket));
+                }
+                endpoint->idle.clear();
+                break;
+            }
+            
+            lock.unlock();
+            if (!conn.socket->peer_closed()) {
+                return conn.socket;
+            }
+            conn.socket.reset();
+            lock.lock();
+        }
+        if (endpoint->dialing < DFS_POOL_MAX_DIALS) {
+            break;
+        }
+        
+        uint64_t failed = endpoint->failed_dials;
+        endpoint->changed.wait_for(lock, std::chrono::milliseconds(DFS_NETWORK_TIMEOUT_MS));
+        if (endpoint->failed_dials != failed) {
+            return nullptr;  // Down for them, down for us
+        }
+    }
+    if (endpoint) {
+        ++endpoint->dialing;
     }
+    lock.unlock();
+    closing.clear();
     
-    // Create new connection
     auto socket = std::make_shared<NetworkSocket>();
-    if (socket->connect_to_server(server_ip, port)) {
-        return socket;
+    bool connected = socket->connect_to_server(server_ip, port);
+    if (endpoint) {
+        lock.lock();
+        --endpoint->dialing;
+        endpoint->failed_dials += connected ? 0 : 1;
+        endpoint->changed.notify_all();
     }
-    
-    return nullptr;
+    return connected ? socket : nullptr;
 }
 
-void ConnectionPool::release(const std::string& key, std::shared_ptr<NetworkSocket> socket) {
-    std::unique_lock<std::mutex> lock(pool_mutex_);
+void ConnectionPool::release(const std::string& server_ip, uint16_t port, 
+                             std::shared_ptr<NetworkSocket> socket) {
+    if (!socket || !socket->is_connected()) {
+        return;
+    }
+    uint64_t key = endpoint_key(server_ip, port);
+    Shard& shard = shard_for(key);
+    std::vector<std::shared_ptr<NetworkSocket>> closing;
+    Clock::time_point now = Clock::now();
     
-    if (pools_[key].size() < max_pool_size_) {
-        pools_[key].push_back({socket, std::time(nullptr)});
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    Endpoint* endpoint = find_endpoint(shard, key, server_ip, port);
+    if (endpoint && endpoint->idle.size() < max_pool_size_) {
+        endpoint->idle.push_back({std::move(socket), now});
+        endpoint->changed.notify_one();
+    }
+    if (now - shard.swept >= std::chrono::seconds(DFS_POOL_IDLE_TIMEOUT_SEC)) {
+        evict_idle_locked(shard, now, closing);
+    }
+}
+
+void ConnectionPool::evict_idle() {
+    Clock::time_point now = Clock::now();
+    for (Shard& shard : shards_) {
+        std::vector<std::shared_ptr<NetworkSocket>> closing;
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        evict_idle_locked(shard, now, closing);
+    }
+}
+
+void ConnectionPool::evict_idle_locked(Shard& shard, Clock::time_point now,
+                                       std::vector<std::shared_ptr<NetworkSocket>>& closing) {
+    shard.swept = now;
+    for (auto& entry : shard.endpoints) {
+        std::vector<Idle>& idle = entry.second->idle;
+        size_t expired = 0;
+        while (expired < idle.size() && 
+               now - idle[expired].since >= std::chrono::seconds(DFS_POOL_IDLE_TIMEOUT_SEC)) {
+            closing.push_back(std::move(idle[expired].socket));
+            ++expired;
+        }
+        idle.erase(idle.begin(), idle.begin() + expired);
     }
 }
 
 void ConnectionPool::clear() {
-    std::unique_lock<std::mutex> lock(pool_mutex_);
-    pools_.clear();
+    for (Shard& shard : shards_) {
+        std::vector<std::shared_ptr<NetworkSocket>> closing;
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        for (auto& entry : shard.endpoints) {
+            for (Idle& conn : entry.second->idle) {
+                closing.push_back(std::move(conn.socket));
+            }
+            entry.second->idle.clear();
+        }
+    }
+}
+
+size_t ConnectionPool::idle_count() {
+    size_t count = 0;
+    for (Shard& shard : shards_) {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        for (auto& entry : shard.endpoints) {
+            count += entry.second->idle.size();
+        }
+    }
+    return count;
+}
+
+// Connection Reactor Implementation
+ConnectionReactor::ConnectionReactor(size_t num_io_threads)
+    : running_(false), connection_count_(0), next_io_thread_(0), next_connection_id_(1), 
+      listen_fd_(-1), max_payload_size_(DFS_MAX_FRAME_PAYLOAD_BYTES), max_connections_(DFS_MAX_CONCURRENT_CLIENTS) {
+    for (size_t i = 0; i < std::max((size_t)1, num_io_threads); ++i) {
+        io_threads_.push_back(std::make_unique<IoThread>());
+    }
+}
+
+ConnectionReactor::~ConnectionReactor() {
+    stop();
+    
+    // Closed only here: workers finishing a request may still touch the epoll set
+    for (auto& io : io_threads_) {
+        if (io->epoll_fd >= 0) close(io->epoll_fd);
+        if (io->wake_fd >= 0) close(io->wake_fd);
+    }
+}
+
+bool ConnectionReactor::start(NetworkSocket& listener, Executor executor) {
+    if (running_ || !listener.is_connected()) {
+        return false;
+    }
+    
+    listen_fd_ = listener.get_socket_fd();
+    executor_ = std::move(executor);
+    
+    // The listener is polled, so a lost accept race must not block the I/O thread
+    int flags = fcntl(listen_fd_, F_GETFL, 0);
+    if (flags < 0 || fcntl(listen_fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return false;
+    }
+    
+    for (auto& io : io_threads_) {
+        if (io->epoll_fd < 0) {
+            io->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            io->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (io->epoll_fd < 0 || io->wake_fd < 0) {
+                return false;
+            }
+            
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = io->wake_fd;
+            if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, io->wake_fd, &ev) < 0) {
+                return false;
+            }
+        }
+    }
+    
+    // The first I/O thread accepts and spreads connections round-robin
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd_;
+    if (epoll_ctl(io_threads_[0]->epoll_fd, EPOLL_CTL_ADD, listen_fd_, &ev) < 0) {
+        return false;
+    }
+    
+    running_ = true;
+    for (auto& io : io_threads_) {
+        IoThread* thread_state = io.get();
+        io->thread = std::thread([this, thread_state] { io_loop(*thread_state); });
+    }
+    
+    return true;
+}
+
+void ConnectionReactor::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    
+    for (auto& io : io_threads_) {
+        uint64_t one = 1;
+        ssize_t ignored = write(io->wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+    for (auto& io : io_threads_) {
+        if (io->thread.joinable()) {
+            io->thread.join();
+        }
+    }
+    
+    epoll_ctl(io_threads_[0]->epoll_fd, EPOLL_CTL_DEL, listen_fd_, nullptr);
+    
+    // Unblock workers still talking to a client; the fd closes with its last reference
+    for (auto& io : io_threads_) {
+        std::unique_lock<std::mutex> lock(io->mutex);
+        for (auto& entry : io->connections) {
+            ::shutdown(entry.first, SHUT_RDWR);
+            epoll_ctl(io->epoll_fd, EPOLL_CTL_DEL, entry.first, nullptr);
+        }
+        connection_count_ -= io->connections.size();
+        io->connections.clear();
+    }
+    
+    std::unique_lock<std::mutex> lock(ids_mutex_);
+    connections_by_id_.clear();
+}
+
+void ConnectionReactor::io_loop(IoThread& io) {
+    const int max_events = 64;
+    struct epoll_event events[max_events];
+    
+    while (running_) {
+        int ready = epoll_wait(io.epoll_fd, events, max_events, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        
+        for (int i = 0; i < ready && running_; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == io.wake_fd) {
+                continue;
+            }
+            if (fd == listen_fd_) {
+                accept_pending();
+                continue;
+            }
+            
+            std::shared_ptr<Connection> conn;
+            {
+                std::unique_lock<std::mutex> lock(io.mutex);
+                auto it = io.connections.find(fd);
+                if (it == io.connections.end()) continue;
+                conn = it->second;
+            }
+            
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_connection(io, conn);
+            } else {
+                on_readable(io, conn);
+            }
+        }
+    }
+}
+
+void ConnectionReactor::accept_pending() {
+    while (true) {
+        struct sockaddr_in peer;
+        socklen_t addr_len = sizeof(peer);
+        int client_fd = accept4(listen_fd_, (struct sockaddr*)&peer, &addr_len, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            return;  // EAGAIN: backlog drained
+        }
+        
+        if (connection_count_ >= max_connections_) {
+            close(client_fd);
+            continue;
+        }
+        
+        // Sockets stay blocking for workers; the reactor itself reads with MSG_DONTWAIT
+        auto conn = std::make_shared<Connection>();
+        if (!conn->socket.attach(client_fd)) {
+            close(client_fd);
+            continue;
+        }
+        conn->socket.set_max_payload_size(max_payload_size_);
+        conn->peer_ip = inet_ntoa(peer.sin_addr);
+        {
+            std::unique_lock<std::mutex> lock(ids_mutex_);
+            conn->id = next_connection_id_++;
+            connections_by_id_[conn->id] = conn;
+        }
+        
+        IoThread& io = *io_threads_[next_io_thread_++ % io_threads_.size()];
+        {
+            std::unique_lock<std::mutex> lock(io.mutex);
+            io.connections[client_fd] = conn;
+        }
+        connection_count_++;
+        
+        if (!arm(io, client_fd, EPOLL_CTL_ADD)) {
+            close_connection(io, conn);
+        }
+    }
+}
+
+bool ConnectionReactor::arm(IoThread& io, int fd, int op) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = fd;
+    return epoll_ctl(io.epoll_fd, op, fd, &ev) == 0;
+}
+
+// Pull whatever the socket has without blocking; dispatch once a frame is complete
+void ConnectionReactor::on_readable(IoThread& io, const std::shared_ptr<Connection>& conn) {
+    int fd = conn->socket.get_socket_fd();
+    FrameHeader& header = conn->request;
+    
+    while (true) {
+        uint8_t* dest;
+        size_t wanted;
+        if (conn->header_received < DFS_FRAME_HEADER_SIZE) {
+            dest = (uint8_t*)&header + conn->header_received;
+            wanted = DFS_FRAME_HEADER_SIZE - conn->header_received;
+        } else {
+            dest = conn->request.payload.data() + conn->payload_received;
+            wanted = header.payload_size - conn->payload_received;
+        }
+        
+        if (wanted > 0) {
+            ssize_t received = recv(fd, dest, wanted, MSG_DONTWAIT);
+            if (received < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (!arm(io, fd, EPOLL_CTL_MOD)) close_connection(io, conn);
+                    return;
+                }
+                close_connection(io, conn);
+                return;
+            }
+            if (received == 0) {
+                close_connection(io, conn);
+                return;
+            }
+            
+            if (conn->header_received < DFS_FRAME_HEADER_SIZE) {
+                conn->header_received += received;
+                if (conn->header_received < DFS_FRAME_HEADER_SIZE) continue;
+                
+                if (!conn->socket.validate_frame_header(header)) {
+                    close_connection(io, conn);
+                    return;
+                }
+                
+                auto stream = stream_handlers_.find(header.message_type);
+                if (stream != stream_handlers_.end()) {
+                    dispatch_stream(io, conn, stream->second);
+                    return;
+                }
+                conn->request.payload.resize(header.payload_size);
+                continue;
+            }
+            conn->payload_received += received;
+            if (conn->payload_received < header.payload_size) continue;
+        }
+        
+        if (!NetworkSocket::verify_payload_checksum(conn->request)) {
+            close_connection(io, conn);
+            return;
+        }
+        dispatch_request(io, conn);
+        return;
+    }
+}
+
+void ConnectionReactor::dispatch_request(IoThread& io, std::shared_ptr<Connection> conn) {
+    IoThread* owner = &io;
+    auto request = std::make_shared<ProtocolFrame>(std::move(conn->request));
+    conn->request = ProtocolFrame();
+    conn->header_received = 0;
+    conn->payload_received = 0;
+    
+    // Past the pipelining limit the fd stays disarmed; the worker that brings
+    // in_flight back under it re-arms
+    bool read_next = conn->in_flight.fetch_add(1) + 1 < DFS_MAX_PIPELINED_REQUESTS;
+    try {
+        executor_([this, owner, conn, request] {
+            ProtocolFrame response(OP_ACK);
+            request_handler_(conn->id, *request, response);
+            response.request_id = request->request_id;
+            bool sent;
+            {
+                std::unique_lock<std::mutex> lock(conn->send_mutex);
+                sent = conn->socket.send_frame(response);
+            }
+            
+            if (!sent) {
+                close_connection(*owner, conn);
+            } else if (conn->in_flight.fetch_sub(1) == DFS_MAX_PIPELINED_REQUESTS && 
+                       (!running_ || !arm(*owner, conn->socket.get_socket_fd(), EPOLL_CTL_MOD))) {
+                close_connection(*owner, conn);
+            }
+        });
+    } catch (const std::exception& e) {
+        close_connection(io, conn);  // Worker pool already shut down
+        return;
+    }
+    
+    if (read_next && !arm(io, conn->socket.get_socket_fd(), EPOLL_CTL_MOD)) {
+        close_connection(io, conn);
+    }
+}
+
+void ConnectionReactor::dispatch_stream(IoThread& io, std::shared_ptr<Connection> conn, 
+                                        const StreamHandler& handler) {
+    IoThread* owner = &io;
+    const Executor& executor = stream_executor_ ? stream_executor_ : executor_;
+    try {
+        executor([this, owner, conn, &handler] {
+            ProtocolFrame response(OP_ACK);
+            bool ok = handler(conn->socket, conn->request, response);
+            response.request_id = conn->request.request_id;
+            if (ok) {
+                std::unique_lock<std::mutex> lock(conn->send_mutex);
+                ok = conn->socket.send_frame(response);
+            }
+            finish_request(*owner, conn, ok);
+        });
+    } catch (const std::exception& e) {
+        close_connection(io, conn);
+    }
+}
+
+// Reset the per-request state after a streamed request and hand the connection
+// back to its I/O thread
+void ConnectionReactor::finish_request(IoThread& io, const std::shared_ptr<Connection>& conn, 
+                                       bool keep_open) {
+    conn->request = ProtocolFrame();
+    conn->header_received = 0;
+    conn->payload_received = 0;
+    
+    if (!keep_open || !running_ || !arm(io, conn->socket.get_socket_fd(), EPOLL_CTL_MOD)) {
+        close_connection(io, conn);
+    }
+}
+
+void ConnectionReactor::close_connection(IoThread& io, const std::shared_ptr<Connection>& conn) {
+    int fd = conn->socket.get_socket_fd();
+    std::unique_lock<std::mutex> lock(io.mutex);
+    auto it = io.connections.find(fd);
+    if (it == io.connections.end() || it->second != conn) {
+        return;  // Already dropped by stop()
+    }
+    
+    epoll_ctl(io.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    io.connections.erase(it);
+    connection_count_--;
+    
+    std::unique_lock<std::mutex> ids_lock(ids_mutex_);
+    connections_by_id_.erase(conn->id);
+}
+
+bool ConnectionReactor::push(uint64_t connection_id, const ProtocolFrame& frame) {
+    std::shared_ptr<Connection> conn;
+    {
+        std::unique_lock<std::mutex> lock(ids_mutex_);
+        auto it = connections_by_id_.find(connection_id);
+        if (it != connections_by_id_.end()) {
+            conn = it->second.lock();
+        }
+    }
+    if (!conn || !running_) {
+        return false;
+    }
+    
+    std::unique_lock<std::mutex> lock(conn->send_mutex);
+    return conn->socket.send_frame(frame);
 }
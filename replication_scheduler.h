@@ -0,0 +1,232 @@
+// ============================================================================
+// DISTRIBUTED FILE SYSTEM - RE-REPLICATION SCHEDULER
+// ============================================================================
+// File: replication_scheduler.h & replication_scheduler.cpp
+// Description: Orders and paces the copies that restore lost chunk replicas
+// ============================================================================
+
+#ifndef DFS_REPLICATION_SCHEDULER_H
+#define DFS_REPLICATION_SCHEDULER_H
+
+#include "common.h"
+#include <string>
+#include <vector>
+#include <set>
+#include <chrono>
+#include <unordered_map>
+
+// Chunks with fewer than DFS_REPLICATION_FACTOR live replicas wait here, those
+// with the fewest first. A copy starts when a slot of DFS_RECOVERY_PARALLELISM
+// is free, one of the chunk's holders is not already serving
+// DFS_RECOVERY_STREAMS_PER_SERVER copies, and the byte budget allows it. Chunks
+// below DFS_MINIMUM_REPLICAS are one failure from loss and do not wait for the
+// budget. Not synchronized: MetadataServer guards it with reports_mutex_
+class ReplicationScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+    
+    struct Task {
+        uint64_t chunk_id;
+        std::string source;
+        std::string target;     // Filled in by assign()
+        bool urgent;            // Below DFS_MINIMUM_REPLICAS when started
+    };
+    
+    ReplicationScheduler(uint32_t parallelism, uint64_t bytes_per_sec, uint64_t chunk_bytes);
+    
+    // A chunk lost a replica and has live left; queued while that is short
+    // of the replication factor, dropped once none are left to copy from
+    void replica_lost(uint64_t chunk_id, uint32_t live);
+    // A replica was found; only chunks already queued are affected, since
+    // servers report what they hold a slice at a time
+    void replica_added(uint64_t chunk_id, uint32_t live);
+    
+    // Copies to begin now, each from the least busy eligible holder. They hold
+    // their slots until finish()
+    std::vector<Task> start(Clock::time_point now,
+                            const std::unordered_map<uint64_t, std::vector<std::string>>& holders);
+    void assign(uint64_t chunk_id, const std::string& target);
+    // A failed copy is retried after DFS_HEARTBEAT_INTERVAL_SEC, a successful
+    // one as soon as live replicas are still missing
+    void finish(uint64_t chunk_id, bool copied, Clock::time_point now);
+    
+    // Copies each server is serving, as source or target
+    const std::unordered_map<std::string, uint32_t>& streams() const { return streams_; }
+    
+    size_t queued() const { return chunks_.size() - running_.size(); }
+    size_t in_flight() const { return running_.size(); }
+
+private:
+    struct Chunk {
+        uint32_t live;
+        Clock::time_point not_before;
+        bool running;
+    };
+    
+    uint32_t parallelism_;
+    uint64_t bytes_per_sec_;
+    uint64_t chunk_bytes_;
+    
+    std::unordered_map<uint64_t, Chunk> chunks_;
+    std::set<std::pair<uint32_t, uint64_t>> ranked_;   // (live, chunk_id) of chunks not running
+    std::unordered_map<uint64_t, Task> running_;
+    std::unordered_map<std::string, uint32_t> streams_; // Copies per server, as source or target
+    
+    int64_t budget_bytes_;          // May dip below 0 after urgent copies
+    Clock::time_point refilled_;
+    
+    void set_live(uint64_t chunk_id, uint32_t live, bool enqueue);
+    void refill(Clock::time_point now);
+    void release(const std::string& server_id);
+};
+
+#endif // DFS_REPLICATION_SCHEDULER_H
+
+
+// ============================================================================
+// File: replication_scheduler.cpp
+// ============================================================================
+
+#include "replication_scheduler.h"
+#include <algorithm>
+
+// Queue entries looked at per start() call, so a long queue of chunks whose
+// holders are all busy costs bounded time
+static const size_t SCHEDULER_SCAN_LIMIT = 4096;
+
+ReplicationScheduler::ReplicationScheduler(uint32_t parallelism, uint64_t bytes_per_sec,
+                                           uint64_t chunk_bytes)
+    : parallelism_(parallelism), bytes_per_sec_(bytes_per_sec), chunk_bytes_(chunk_bytes),
+      budget_bytes_(0), refilled_(Clock::now()) {}
+
+void ReplicationScheduler::replica_lost(uint64_t chunk_id, uint32_t live) {
+    set_live(chunk_id, live, true);
+}
+
+void ReplicationScheduler::replica_added(uint64_t chunk_id, uint32_t live) {
+    set_live(chunk_id, live, false);
+}
+
+void ReplicationScheduler::set_live(uint64_t chunk_id, uint32_t live, bool enqueue) {
+    auto it = chunks_.find(chunk_id);
+    bool wanted = live > 0 && live < (uint32_t)DFS_REPLICATION_FACTOR;
+    if (it == chunks_.end()) {
+        if (wanted && enqueue) {
+            chunks_[chunk_id] = Chunk{live, Clock::time_point(), false};
+            ranked_.emplace(live, chunk_id);
+        }
+        return;
+    }
+    
+    // A running copy keeps its entry; finish() decides whether more are needed
+    Chunk& chunk = it->second;
+    if (!chunk.running) {
+        ranked_.erase({chunk.live, chunk_id});
+        if (!wanted) {
+            chunks_.erase(it);
+            return;
+        }
+        ranked_.emplace(live, chunk_id);
+    }
+    chunk.live = live;
+}
+
+std::vector<ReplicationScheduler::Task> ReplicationScheduler::start(
+        Clock::time_point now, const std::unordered_map<uint64_t, std::vector<std::string>>& holders) {
+    refill(now);
+    
+    std::vector<Task> tasks;
+    size_t scanned = 0;
+    for (auto it = ranked_.begin(); it != ranked_.end() && running_.size() < parallelism_ &&
+                                    scanned < SCHEDULER_SCAN_LIMIT; ++scanned) {
+        uint32_t live = it->first;
+        uint64_t chunk_id = it->second;
+        bool urgent = live < (uint32_t)DFS_MINIMUM_REPLICAS;
+        if (!urgent && budget_bytes_ < (int64_t)chunk_bytes_) {
+            break;  // Everything after this one waits for the budget too
+        }
+        Chunk& chunk = chunks_[chunk_id];
+        auto held = holders.find(chunk_id);
+        if (now < chunk.not_before || held == holders.end()) {
+            ++it;
+            continue;
+        }
+        
+        const std::string* source = nullptr;
+        uint32_t source_streams = DFS_RECOVERY_STREAMS_PER_SERVER;
+        for (const std::string& server_id : held->second) {
+            auto streams = streams_.find(server_id);
+            uint32_t count = streams != streams_.end() ? streams->second : 0;
+            if (count < source_streams) {
+                source = &server_id;
+                source_streams = count;
+            }
+        }
+        if (!source) {
+            ++it;
+            continue;
+        }
+        
+        ++streams_[*source];
+        budget_bytes_ -= chunk_bytes_;
+        chunk.running = true;
+        Task task = {chunk_id, *source, "", urgent};
+        running_[chunk_id] = task;
+        tasks.push_back(task);
+        it = ranked_.erase(it);
+    }
+    return tasks;
+}
+
+void ReplicationScheduler::assign(uint64_t chunk_id, const std::string& target) {
+    auto it = running_.find(chunk_id);
+    if (it != running_.end() && it->second.target.empty()) {
+        it->second.target = target;
+        ++streams_[target];
+    }
+}
+
+void ReplicationScheduler::finish(uint64_t chunk_id, bool copied, Clock::time_point now) {
+    auto it = running_.find(chunk_id);
+    if (it == running_.end()) {
+        return;
+    }
+    release(it->second.source);
+    if (!it->second.target.empty()) {
+        release(it->second.target);
+    }
+    running_.erase(it);
+    
+    auto entry = chunks_.find(chunk_id);
+    if (entry == chunks_.end()) {
+        return;
+    }
+    Chunk& chunk = entry->second;
+    chunk.running = false;
+    if (chunk.live == 0 || chunk.live >= (uint32_t)DFS_REPLICATION_FACTOR) {
+        chunks_.erase(entry);
+        return;
+    }
+    chunk.not_before = copied ? now : now + std::chrono::seconds(DFS_HEARTBEAT_INTERVAL_SEC);
+    ranked_.emplace(chunk.live, chunk_id);
+}
+
+// One second of budget at most builds up, so an idle spell does not turn into
+// a burst of copies
+void ReplicationScheduler::refill(Clock::time_point now) {
+    if (now <= refilled_) {
+        return;
+    }
+    uint64_t elapsed_us = std::min<uint64_t>(1000000,
+        std::chrono::duration_cast<std::chrono::microseconds>(now - refilled_).count());
+    refilled_ = now;
+    int64_t cap = (int64_t)std::max(bytes_per_sec_, chunk_bytes_);
+    budget_bytes_ = std::min(cap, budget_bytes_ + (int64_t)(bytes_per_sec_ * elapsed_us / 1000000));
+}
+
+void ReplicationScheduler::release(const std::string& server_id) {
+    auto it = streams_.find(server_id);
+    if (it != streams_.end() && --it->second == 0) {
+        streams_.erase(it);
+    }
+}
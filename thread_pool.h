@@ -9,38 +9,229 @@
 #define DFS_THREAD_POOL_H
 
 #include <thread>
-#include <queue>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
 
+class LatencyHistogram;
+
+// Move-only type-erased callable. Callables up to INLINE_BYTES (lambdas
+// capturing a few pointers, shared_ptrs or a std::function) are stored in
+// place, so scheduling them does not allocate.
+class Task {
+public:
+    static const size_t INLINE_BYTES = 48;
+    
+    Task() noexcept : ops_(nullptr) {}
+    
+    template <typename F, typename Fn = typename std::decay<F>::type,
+              typename = typename std::enable_if<!std::is_same<Fn, Task>::value>::type>
+    Task(F&& fn) : ops_(nullptr) {
+        if constexpr (sizeof(Fn) <= INLINE_BYTES && alignof(Fn) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible<Fn>::value) {
+            new (storage_) Fn(std::forward<F>(fn));
+            ops_ = &inline_ops<Fn>();
+        } else {
+            *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(fn));
+            ops_ = &heap_ops<Fn>();
+        }
+    }
+    
+    Task(Task&& other) noexcept : ops_(other.ops_) {
+        if (ops_) {
+            ops_->move(storage_, other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+    
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->move(storage_, other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+    
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    
+    ~Task() { reset(); }
+    
+    void operator()() { ops_->invoke(storage_); }
+    explicit operator bool() const { return ops_ != nullptr; }
+    
+    void reset() {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dest, void* src);  // Leaves src destroyed
+        void (*destroy)(void* storage);
+    };
+    
+    template <typename Fn>
+    static const Ops& inline_ops() {
+        static const Ops ops = {
+            [](void* s) { (*static_cast<Fn*>(s))(); },
+            [](void* d, void* s) {
+                new (d) Fn(std::move(*static_cast<Fn*>(s)));
+                static_cast<Fn*>(s)->~Fn();
+            },
+            [](void* s) { static_cast<Fn*>(s)->~Fn(); }
+        };
+        return ops;
+    }
+    
+    template <typename Fn>
+    static const Ops& heap_ops() {
+        static const Ops ops = {
+            [](void* s) { (**static_cast<Fn**>(s))(); },
+            [](void* d, void* s) { *static_cast<Fn**>(d) = *static_cast<Fn**>(s); },
+            [](void* s) { delete *static_cast<Fn**>(s); }
+        };
+        return ops;
+    }
+    
+    alignas(std::max_align_t) unsigned char storage_[INLINE_BYTES];
+    const Ops* ops_;
+};
+
+// Work-stealing pool. Each worker owns a lock-free deque (Chase-Lev): tasks a
+// worker schedules go to its own deque and are popped LIFO, idle workers steal
+// FIFO from the others. Tasks from outside the pool (e.g. reactor I/O threads)
+// go through a shared injection queue that workers drain in batches.
 class ThreadPool {
 public:
     explicit ThreadPool(size_t num_threads);
     ~ThreadPool();
     
     // Enqueue a task for execution
-    void enqueue(std::function<void()> task);
+    template <typename F>
+    void enqueue(F&& task) { submit(Task(std::forward<F>(task))); }
+    
+    // Enqueue many tasks with one lock round-trip and one wake-up pass
+    void enqueue_bulk(std::vector<Task>&& tasks);
     
     // Stop the thread pool and wait for all tasks to complete
     void shutdown();
     
     // Get number of worker threads
-    size_t get_num_threads() const { return threads_.size(); }
+    size_t get_num_threads() const { return workers_.size(); }
     
     // Get number of pending tasks
-    size_t get_pending_tasks() const;
+    size_t get_pending_tasks() const { return queued_.load(std::memory_order_relaxed); }
+    
+    // Record how long each task waits before a worker starts it; set before
+    // the first task is enqueued
+    void set_queue_wait_histogram(LatencyHistogram* histogram) { queue_wait_ = histogram; }
+
+private:
+    struct TaskNode {
+        Task task;
+        uint64_t enqueued_ns = 0;  // Only stamped when queue_wait_ is set
+    };
+    
+    // Fixed-capacity Chase-Lev deque of task pointers; push/pop by the owning
+    // worker only, steal from any thread
+    class WorkStealingDeque {
+    public:
+        static const int64_t CAPACITY = 1024;
+        
+        WorkStealingDeque() : top_(0), bottom_(0) {
+            for (auto& slot : slots_) slot.store(nullptr, std::memory_order_relaxed);
+        }
+        
+        bool push(TaskNode* node);
+        TaskNode* pop();
+        TaskNode* steal();
+    
+    private:
+        alignas(64) std::atomic<int64_t> top_;
+        alignas(64) std::atomic<int64_t> bottom_;
+        std::atomic<TaskNode*> slots_[CAPACITY];
+    };
+    
+    struct Worker {
+        WorkStealingDeque deque;
+        std::vector<TaskNode*> node_cache;  // Recycled nodes, touched by the owner only
+        std::thread thread;
+        uint64_t steal_seed;
+    };
+    
+    std::vector<std::unique_ptr<Worker>> workers_;
+    
+    // Injection queue for tasks submitted from non-worker threads
+    std::deque<TaskNode> injected_;
+    std::mutex queue_mutex_;
+    
+    // Idle workers park here; producers only touch the mutex when someone sleeps
+    std::mutex sleep_mutex_;
+    std::condition_variable cv_;
+    std::atomic<size_t> sleepers_;
+    std::atomic<size_t> queued_;
+    std::atomic<bool> stop_;
+    LatencyHistogram* queue_wait_;
+    
+    void submit(Task&& task);
+    void wake_workers(size_t count);
+    Worker* local_worker() const;
+    
+    void worker_thread(Worker& worker);
+    bool take_injected(Worker& worker);
+    TaskNode* steal_task(Worker& worker);
+    void run_node(Worker& worker, TaskNode* node);
+    TaskNode* acquire_node(Worker& worker);
+    void release_node(Worker& worker, TaskNode* node);
+};
+
+// Runs each task on a thread of its own, for tasks that block on other servers
+// (a chained write waiting for its downstream replica). A pool worker blocked
+// that way can deadlock two servers whose requests wait on each other; here a
+// task never waits for a free thread. Threads that finish stay for the next
+// task; past max_threads busy ones enqueue throws.
+class ElasticThreads {
+public:
+    explicit ElasticThreads(size_t max_threads);
+    ~ElasticThreads();
+    
+    template <typename F>
+    void enqueue(F&& task) { submit(Task(std::forward<F>(task))); }
+    
+    // Wait for running tasks and stop every thread
+    void shutdown();
+    
+    size_t get_busy_threads() const;
 
 private:
     std::vector<std::thread> threads_;
-    std::queue<std::function<void()>> tasks_;
-    mutable std::mutex queue_mutex_;
+    std::deque<Task> pending_;
+    mutable std::mutex mutex_;
     std::condition_variable cv_;
+    size_t idle_;
+    size_t busy_;
+    size_t max_threads_;
     bool stop_;
     
-    void worker_thread();
+    void submit(Task&& task);
+    void thread_loop();
 };
 
 #endif // DFS_THREAD_POOL_H
@@ -51,11 +242,83 @@ private:
 // ============================================================================
 
 #include "thread_pool.h"
+#include "metrics.h"
 #include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+// Pool and worker the calling thread belongs to (null for non-worker threads)
+static thread_local const void* tls_pool = nullptr;
+static thread_local void* tls_worker = nullptr;
+
+static const size_t NODE_CACHE_LIMIT = 256;
+static const size_t INJECTED_BATCH_LIMIT = 32;
+
+bool ThreadPool::WorkStealingDeque::push(TaskNode* node) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    if (b - t >= CAPACITY) {
+        return false;
+    }
+    
+    // Release on bottom_ publishes the node (and its task) to thieves
+    slots_[b & (CAPACITY - 1)].store(node, std::memory_order_relaxed);
+    bottom_.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+ThreadPool::TaskNode* ThreadPool::WorkStealingDeque::pop() {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    
+    if (t > b) {
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    
+    TaskNode* node = slots_[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+    if (t == b) {
+        // Last element: race thieves for it
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            node = nullptr;
+        }
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return node;
+}
 
-ThreadPool::ThreadPool(size_t num_threads) : stop_(false) {
+ThreadPool::TaskNode* ThreadPool::WorkStealingDeque::steal() {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    
+    if (t >= b) {
+        return nullptr;
+    }
+    
+    TaskNode* node = slots_[t & (CAPACITY - 1)].load(std::memory_order_acquire);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+        return nullptr;  // Lost to the owner or another thief
+    }
+    return node;
+}
+
+ThreadPool::ThreadPool(size_t num_threads)
+    : sleepers_(0), queued_(0), stop_(false), queue_wait_(nullptr) {
+    num_threads = std::max((size_t)1, num_threads);
     for (size_t i = 0; i < num_threads; ++i) {
-        threads_.emplace_back([this] { worker_thread(); });
+        workers_.push_back(std::make_unique<Worker>());
+        workers_.back()->steal_seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+    
+    // Start threads only once every deque exists, since workers steal from each other
+    for (auto& worker : workers_) {
+        Worker* state = worker.get();
+        worker->thread = std::thread([this, state] { worker_thread(*state); });
     }
 }
 
@@ -63,58 +326,299 @@ ThreadPool::~ThreadPool() {
     shutdown();
 }
 
-void ThreadPool::worker_thread() {
-    while (true) {
-        std::function<void()> task;
+ThreadPool::Worker* ThreadPool::local_worker() const {
+    return tls_pool == this ? static_cast<Worker*>(tls_worker) : nullptr;
+}
+
+ThreadPool::TaskNode* ThreadPool::acquire_node(Worker& worker) {
+    if (worker.node_cache.empty()) {
+        return new TaskNode();
+    }
+    TaskNode* node = worker.node_cache.back();
+    worker.node_cache.pop_back();
+    return node;
+}
+
+void ThreadPool::release_node(Worker& worker, TaskNode* node) {
+    if (worker.node_cache.size() < NODE_CACHE_LIMIT) {
+        worker.node_cache.push_back(node);
+    } else {
+        delete node;
+    }
+}
+
+void ThreadPool::submit(Task&& task) {
+    if (stop_.load(std::memory_order_acquire)) {
+        throw std::runtime_error("ThreadPool is stopped");
+    }
+    
+    // Counted before the push: a worker that sees queued_ == 0 may sleep
+    queued_.fetch_add(1, std::memory_order_seq_cst);
+    uint64_t enqueued_ns = queue_wait_ ? metrics_now_ns() : 0;
+    
+    Worker* worker = local_worker();
+    bool pushed = false;
+    if (worker) {
+        TaskNode* node = acquire_node(*worker);
+        node->task = std::move(task);
+        node->enqueued_ns = enqueued_ns;
+        pushed = worker->deque.push(node);
+        if (!pushed) {
+            task = std::move(node->task);
+            release_node(*worker, node);
+        }
+    }
+    
+    if (!pushed) {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        injected_.push_back(TaskNode{std::move(task), enqueued_ns});
+    }
+    
+    wake_workers(1);
+}
+
+void ThreadPool::enqueue_bulk(std::vector<Task>&& tasks) {
+    if (tasks.empty()) {
+        return;
+    }
+    if (stop_.load(std::memory_order_acquire)) {
+        throw std::runtime_error("ThreadPool is stopped");
+    }
+    
+    queued_.fetch_add(tasks.size(), std::memory_order_seq_cst);
+    uint64_t enqueued_ns = queue_wait_ ? metrics_now_ns() : 0;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        for (auto& task : tasks) {
+            injected_.push_back(TaskNode{std::move(task), enqueued_ns});
+        }
+    }
+    
+    wake_workers(tasks.size());
+    tasks.clear();
+}
+
+void ThreadPool::wake_workers(size_t count) {
+    size_t sleeping = sleepers_.load(std::memory_order_seq_cst);
+    if (sleeping == 0) {
+        return;
+    }
+    
+    // Pairs with the predicate check under sleep_mutex_ in worker_thread()
+    { std::unique_lock<std::mutex> lock(sleep_mutex_); }
+    if (count >= sleeping) {
+        cv_.notify_all();
+    } else {
+        for (size_t i = 0; i < count; ++i) cv_.notify_one();
+    }
+}
+
+// Move a batch from the injection queue into the local deque and run the first
+bool ThreadPool::take_injected(Worker& worker) {
+    std::vector<TaskNode> batch;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        if (injected_.empty()) {
+            return false;
+        }
         
-        {
+        size_t share = injected_.size() / workers_.size() + 1;
+        size_t count = std::min(std::min(share, INJECTED_BATCH_LIMIT), injected_.size());
+        batch.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            batch.push_back(std::move(injected_.front()));
+            injected_.pop_front();
+        }
+    }
+    
+    // The rest of the batch stays stealable by idle workers
+    for (size_t i = 1; i < batch.size(); ++i) {
+        TaskNode* node = acquire_node(worker);
+        *node = std::move(batch[i]);
+        if (!worker.deque.push(node)) {
+            batch[i] = std::move(*node);
+            release_node(worker, node);
             std::unique_lock<std::mutex> lock(queue_mutex_);
-            cv_.wait(lock, [this] { return !tasks_.empty() || stop_; });
-            
-            if (stop_ && tasks_.empty()) {
-                return;
-            }
-            
-            if (tasks_.empty()) {
-                continue;
+            for (size_t j = i; j < batch.size(); ++j) {
+                injected_.push_back(std::move(batch[j]));
             }
-            
-            task = std::move(tasks_.front());
-            tasks_.pop();
+            break;
+        }
+    }
+    if (batch.size() > 1) {
+        wake_workers(batch.size() - 1);
+    }
+    
+    TaskNode* first = acquire_node(worker);
+    *first = std::move(batch[0]);
+    run_node(worker, first);
+    return true;
+}
+
+ThreadPool::TaskNode* ThreadPool::steal_task(Worker& worker) {
+    size_t count = workers_.size();
+    if (count < 2) {
+        return nullptr;
+    }
+    
+    // xorshift64 picks the first victim so thieves don't all hit worker 0
+    worker.steal_seed ^= worker.steal_seed << 13;
+    worker.steal_seed ^= worker.steal_seed >> 7;
+    worker.steal_seed ^= worker.steal_seed << 17;
+    size_t start = worker.steal_seed % count;
+    
+    for (size_t i = 0; i < count; ++i) {
+        Worker& victim = *workers_[(start + i) % count];
+        if (&victim == &worker) continue;
+        if (TaskNode* node = victim.deque.steal()) {
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+void ThreadPool::run_node(Worker& worker, TaskNode* node) {
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    if (queue_wait_ && node->enqueued_ns) {
+        queue_wait_->record_since(node->enqueued_ns);
+    }
+    
+    try {
+        node->task();
+    } catch (const std::exception& e) {
+        std::cerr << "Thread pool task error: " << e.what() << std::endl;
+    }
+    
+    node->task.reset();
+    release_node(worker, node);
+}
+
+void ThreadPool::worker_thread(Worker& worker) {
+    tls_pool = this;
+    tls_worker = &worker;
+    
+    while (true) {
+        if (TaskNode* node = worker.deque.pop()) {
+            run_node(worker, node);
+            continue;
+        }
+        if (take_injected(worker)) {
+            continue;
+        }
+        if (TaskNode* node = steal_task(worker)) {
+            run_node(worker, node);
+            continue;
         }
         
-        try {
-            task();
-        } catch (const std::exception& e) {
-            std::cerr << "Thread pool task error: " << e.what() << std::endl;
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        if (queued_.load(std::memory_order_seq_cst) > 0) {
+            // Someone is mid-push or a steal raced; look again
+            lock.unlock();
+            std::this_thread::yield();
+            continue;
+        }
+        if (stop_.load(std::memory_order_acquire)) {
+            break;
         }
+        
+        sleepers_.fetch_add(1, std::memory_order_seq_cst);
+        cv_.wait(lock, [this] {
+            return queued_.load(std::memory_order_seq_cst) > 0 || stop_.load(std::memory_order_acquire);
+        });
+        sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+    
+    for (TaskNode* node : worker.node_cache) {
+        delete node;
     }
+    worker.node_cache.clear();
+    tls_pool = nullptr;
+    tls_worker = nullptr;
 }
 
-void ThreadPool::enqueue(std::function<void()> task) {
+void ThreadPool::shutdown() {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        if (stop_) {
-            throw std::runtime_error("ThreadPool is stopped");
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
         }
-        tasks_.emplace(std::move(task));
     }
-    cv_.notify_one();
 }
 
-size_t ThreadPool::get_pending_tasks() const {
-    std::unique_lock<std::mutex> lock(queue_mutex_);
-    return tasks_.size();
+
+ElasticThreads::ElasticThreads(size_t max_threads)
+    : idle_(0), busy_(0), max_threads_(std::max((size_t)1, max_threads)), stop_(false) {}
+
+ElasticThreads::~ElasticThreads() {
+    shutdown();
 }
 
-void ThreadPool::shutdown() {
+size_t ElasticThreads::get_busy_threads() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return busy_;
+}
+
+void ElasticThreads::submit(Task&& task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stop_) {
+        throw std::runtime_error("ElasticThreads is stopped");
+    }
+    
+    // Every queued task has an idle thread on its way, or gets a new one
+    if (pending_.size() < idle_) {
+        pending_.push_back(std::move(task));
+        cv_.notify_one();
+        return;
+    }
+    if (threads_.size() >= max_threads_) {
+        throw std::runtime_error("ElasticThreads: all threads busy");
+    }
+    pending_.push_back(std::move(task));
+    threads_.emplace_back([this] { thread_loop(); });
+}
+
+void ElasticThreads::thread_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        if (!pending_.empty()) {
+            Task task = std::move(pending_.front());
+            pending_.pop_front();
+            busy_++;
+            lock.unlock();
+            try {
+                task();
+            } catch (const std::exception& e) {
+                std::cerr << "Elastic thread task error: " << e.what() << std::endl;
+            }
+            task.reset();
+            lock.lock();
+            busy_--;
+            continue;
+        }
+        if (stop_) {
+            return;
+        }
+        idle_++;
+        cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+        idle_--;
+    }
+}
+
+void ElasticThreads::shutdown() {
+    std::vector<std::thread> threads;
     {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
+        std::unique_lock<std::mutex> lock(mutex_);
         stop_ = true;
+        threads.swap(threads_);
     }
     cv_.notify_all();
     
-    for (auto& thread : threads_) {
+    for (auto& thread : threads) {
         if (thread.joinable()) {
             thread.join();
         }